@@ -115,6 +115,21 @@ Array::update_length(int)
     set_length(length);
 }
 
+// Round the block down to a whole number of 'rows' made of the trailing
+// dimensions, using as many of those dimensions as fit in the block.
+int64_t
+Array::m_block_length(int64_t max_elements)
+{
+    int64_t row = 1;
+    for (std::vector<dimension>::reverse_iterator i = _shape.rbegin(); i != _shape.rend(); ++i) {
+        if (row * (*i).c_size > max_elements)
+            break;
+        row *= (*i).c_size;
+    }
+
+    return row > 0 ? (max_elements / row) * row : max_elements;
+}
+
 // Construct an instance of Array. The (BaseType *) is assumed to be
 // allocated using new - The dtor for Vector will delete this object.
 
@@ -187,6 +187,8 @@ protected:
     unsigned int print_array(ostream &out, unsigned int index,
                              unsigned int dims, unsigned int shape[]);
 
+    virtual int64_t m_block_length(int64_t max_elements);
+
 public:
     /** A constant iterator used to access the various dimensions of an
         Array.
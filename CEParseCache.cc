@@ -0,0 +1,300 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "CEParseCache.h"
+#include "BaseType.h"
+#include "Constructor.h"
+#ifdef DAP4
+#include "D4Group.h"
+#endif
+
+#include "InternalErr.h"
+#include "debug.h"
+
+using namespace std;
+
+namespace libdap {
+
+// Lock d_mutex for the life of a method
+class CEParseCacheGuard {
+    pthread_mutex_t &d_mutex;
+public:
+    CEParseCacheGuard(pthread_mutex_t &m) : d_mutex(m) { pthread_mutex_lock(&d_mutex); }
+    ~CEParseCacheGuard() { pthread_mutex_unlock(&d_mutex); }
+};
+
+/**
+ * Find the path to a variable.
+ *
+ * Within a Constructor, a variable's position is its index in the list of
+ * variables; a D4Group held by a D4Group is at -(i + 1) where i is its
+ * index in the list of groups. The template variable of an Array is at 0.
+ *
+ * @param var The variable
+ * @param path Value-result parameter; the positions of the variables from
+ * the top-level variable, not included, down to \c var.
+ * @return The top-level variable, the one with no parent; \c var if it
+ * has no parent.
+ */
+BaseType *CEParsePlan::find_path(BaseType *var, vector<int> &path)
+{
+    path.clear();
+
+    BaseType *child = var;
+    for (BaseType *parent = child->get_parent(); parent; child = parent, parent = parent->get_parent()) {
+        int position = 0;
+        bool found = false;
+#ifdef DAP4
+        if (parent->type() == dods_group_c && child->type() == dods_group_c) {
+            D4Group *g = static_cast<D4Group*>(parent);
+            D4Group::groupsIter i = find(g->grp_begin(), g->grp_end(), child);
+            found = i != g->grp_end();
+            position = -(i - g->grp_begin()) - 1;
+        }
+        else
+#endif
+        if (parent->is_constructor_type()) {
+            Constructor *c = static_cast<Constructor*>(parent);
+            Constructor::Vars_iter i = find(c->var_begin(), c->var_end(), child);
+            found = i != c->var_end();
+            position = i - c->var_begin();
+        }
+        else if (parent->is_vector_type()) {
+            found = parent->var() == child;
+        }
+
+        if (!found)
+            throw InternalErr(__FILE__, __LINE__, "The variable '" + var->name() + "' is not held by its parent.");
+
+        path.push_back(position);
+    }
+
+    reverse(path.begin(), path.end());
+    return child;
+}
+
+/**
+ * Find a variable using its path.
+ *
+ * @param top The top-level variable
+ * @param path A path returned by find_path()
+ * @param first Start with this element of \c path
+ * @return The variable or null if the path does not match the variables
+ * held by \c top.
+ */
+BaseType *CEParsePlan::follow_path(BaseType *top, const vector<int> &path, vector<int>::size_type first)
+{
+    BaseType *var = top;
+    for (vector<int>::size_type i = first; var && i < path.size(); ++i) {
+        int position = path[i];
+        if (position < 0) {
+#ifdef DAP4
+            if (var->type() != dods_group_c)
+                return 0;
+            D4Group *g = static_cast<D4Group*>(var);
+            unsigned int index = -position - 1;
+            var = (index < (unsigned int) (g->grp_end() - g->grp_begin())) ? *(g->grp_begin() + index) : 0;
+#else
+            return 0;
+#endif
+        }
+        else if (var->is_constructor_type()) {
+            Constructor *c = static_cast<Constructor*>(var);
+            var = (position < c->var_end() - c->var_begin()) ? *(c->var_begin() + position) : 0;
+        }
+        else if (var->is_vector_type() && position == 0) {
+            var = var->var();
+        }
+        else {
+            return 0;
+        }
+    }
+
+    return var;
+}
+
+/**
+ * Make an empty cache.
+ * @param max_entries Hold no more than this many expressions.
+ */
+CEParseCache::CEParseCache(unsigned int max_entries) :
+    d_max_entries(max_entries), d_hits(0), d_misses(0)
+{
+    if (pthread_mutex_init(&d_mutex, 0) != 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not initialize the constraint expression cache lock.");
+}
+
+CEParseCache::~CEParseCache()
+{
+    m_evict(0);
+    pthread_mutex_destroy(&d_mutex);
+}
+
+// Discard the least recently used entries until no more than max_entries
+// remain. The caller must hold the lock.
+void CEParseCache::m_evict(unsigned int max_entries)
+{
+    while (d_entries.size() > max_entries) {
+        DBG(cerr << "Discarding the parsed expression: " << d_entries.back().first << endl);
+        d_index.erase(d_entries.back().first);
+        m_discard(d_entries.back().second);
+        d_entries.pop_back();
+    }
+}
+
+// Delete a plan that is no longer in the cache, unless an evaluator is
+// using it; release() deletes it then. The caller must hold the lock.
+void CEParseCache::m_discard(CEParsePlan *plan)
+{
+    if (plan->d_refs > 0)
+        plan->d_cached = false;
+    else
+        delete plan;
+}
+
+/**
+ * Find the plan for an expression and make it the most recently used one.
+ * The plan is not deleted, even if the cache discards it, until the caller
+ * passes it to release().
+ *
+ * @param key Identifies the dataset and the expression.
+ * @return The plan or null if the expression is not in the cache.
+ */
+CEParsePlan *CEParseCache::find(const string &key)
+{
+    CEParseCacheGuard guard(d_mutex);
+
+    map<string, Entries::iterator>::iterator i = d_index.find(key);
+    if (i == d_index.end()) {
+        ++d_misses;
+        return 0;
+    }
+
+    d_entries.splice(d_entries.begin(), d_entries, i->second);
+    CEParsePlan *plan = d_entries.front().second;
+    ++plan->d_refs;
+    return plan;
+}
+
+/**
+ * Stop using a plan returned by find().
+ *
+ * @param plan The plan
+ * @param used True if the plan was applied, which counts as a hit; false if
+ * it did not match the dataset and the expression had to be parsed.
+ */
+void CEParseCache::release(CEParsePlan *plan, bool used)
+{
+    CEParseCacheGuard guard(d_mutex);
+
+    if (used)
+        ++d_hits;
+    else
+        ++d_misses;
+
+    if (--plan->d_refs == 0 && !plan->d_cached)
+        delete plan;
+}
+
+/**
+ * Add the plan for an expression, replacing any plan already held for it.
+ * This may discard the least recently used expression.
+ *
+ * @param key Identifies the dataset and the expression.
+ * @param plan The cache deletes the plan when it is discarded.
+ */
+void CEParseCache::insert(const string &key, CEParsePlan *plan)
+{
+    CEParseCacheGuard guard(d_mutex);
+
+    map<string, Entries::iterator>::iterator i = d_index.find(key);
+    if (i != d_index.end()) {
+        m_discard(i->second->second);
+        d_entries.erase(i->second);
+        d_index.erase(i);
+    }
+
+    if (d_max_entries == 0) {
+        delete plan;
+        return;
+    }
+
+    m_evict(d_max_entries - 1);
+
+    d_entries.push_front(make_pair(key, plan));
+    d_index[key] = d_entries.begin();
+}
+
+unsigned int CEParseCache::get_max_entries()
+{
+    CEParseCacheGuard guard(d_mutex);
+    return d_max_entries;
+}
+
+/**
+ * Change the number of expressions the cache can hold. If it holds more,
+ * the least recently used ones are discarded.
+ */
+void CEParseCache::set_max_entries(unsigned int max_entries)
+{
+    CEParseCacheGuard guard(d_mutex);
+    d_max_entries = max_entries;
+    m_evict(d_max_entries);
+}
+
+/// The number of expressions in the cache
+unsigned int CEParseCache::size()
+{
+    CEParseCacheGuard guard(d_mutex);
+    return d_entries.size();
+}
+
+/// Discard every expression. The hit and miss counts are not changed.
+void CEParseCache::clear()
+{
+    CEParseCacheGuard guard(d_mutex);
+    m_evict(0);
+}
+
+unsigned long CEParseCache::get_hits()
+{
+    CEParseCacheGuard guard(d_mutex);
+    return d_hits;
+}
+
+unsigned long CEParseCache::get_misses()
+{
+    CEParseCacheGuard guard(d_mutex);
+    return d_misses;
+}
+
+} // namespace libdap
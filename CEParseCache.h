@@ -0,0 +1,129 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _ce_parse_cache_h
+#define _ce_parse_cache_h 1
+
+#include <pthread.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace libdap
+{
+
+class BaseType;
+
+/**
+ * The result of parsing a constraint expression, recorded so that it can
+ * be applied to another copy of the dataset's DDS or DMR without parsing
+ * the expression again. ConstraintEvaluator and D4ConstraintEvaluator each
+ * define their own kind of plan.
+ *
+ * Plans refer to variables using their path from the top of the dataset:
+ * the position of each variable within its parent, starting with the
+ * top-level variable. A variable found using a path is checked against the
+ * name recorded with it.
+ */
+class CEParsePlan
+{
+private:
+    friend class CEParseCache;
+
+    unsigned int d_refs;    // Evaluators using the plan (see CEParseCache::find())
+    bool d_cached;          // False once the cache has discarded the plan
+
+public:
+    CEParsePlan() : d_refs(0), d_cached(true) { }
+    virtual ~CEParsePlan() { }
+
+protected:
+    static BaseType *find_path(BaseType *var, std::vector<int> &path);
+    static BaseType *follow_path(BaseType *top, const std::vector<int> &path, std::vector<int>::size_type first = 0);
+};
+
+/**
+ * @brief A cache of parsed constraint expressions
+ *
+ * Servers often see the same few constraints, over and over, for the same
+ * dataset. When a ConstraintEvaluator or D4ConstraintEvaluator is given a
+ * cache (set_parse_cache()), the result of each expression it parses is
+ * saved, keyed by the dataset and the expression. When the expression is
+ * used again with a new copy of the dataset's DDS or DMR, the saved result
+ * is applied to it and the expression is not parsed.
+ *
+ * The cache holds at most get_max_entries() expressions and discards the
+ * least recently used one to make room for a new one. It may be shared by
+ * many evaluators, in several threads. The evaluators do not own the cache.
+ *
+ * A plan returned by find() is kept until it is passed to release(), even
+ * if the cache discards it in the meantime, so it can be applied without
+ * holding the cache's lock.
+ */
+class CEParseCache
+{
+private:
+    typedef std::list<std::pair<std::string, CEParsePlan*> > Entries;
+
+    Entries d_entries;  // Most recently used first
+    std::map<std::string, Entries::iterator> d_index;
+
+    unsigned int d_max_entries;
+
+    unsigned long d_hits;
+    unsigned long d_misses;
+
+    pthread_mutex_t d_mutex;
+
+    CEParseCache(const CEParseCache &);
+    CEParseCache &operator=(const CEParseCache &);
+
+    void m_evict(unsigned int max_entries);
+    void m_discard(CEParsePlan *plan);
+
+public:
+    CEParseCache(unsigned int max_entries = 100);
+    virtual ~CEParseCache();
+
+    CEParsePlan *find(const std::string &key);
+    void release(CEParsePlan *plan, bool used);
+    void insert(const std::string &key, CEParsePlan *plan);
+
+    unsigned int get_max_entries();
+    void set_max_entries(unsigned int max_entries);
+
+    unsigned int size();
+    void clear();
+
+    /// The number of times a plan returned by find() was used
+    unsigned long get_hits();
+    /// The number of times an expression was not found or its plan not used
+    unsigned long get_misses();
+};
+
+} // namespace libdap
+
+#endif // _ce_parse_cache_h
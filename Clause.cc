@@ -43,11 +43,13 @@
 #include "UInt16.h"
 #include "Int32.h"
 #include "UInt32.h"
+#include "Vector.h"
 #include "DDS.h"
 #include "Clause.h"
 
 using std::cerr;
 using std::endl;
+using std::vector;
 
 namespace libdap {
 
@@ -190,6 +192,57 @@ Clause::value(DDS &dds)
     }
 }
 
+/** @brief Evaluate a relational clause for each element of an array
+
+    When the first operand of a relational clause is an array of numbers,
+    find whether the clause is true for each of its elements. The elements
+    are compared using Vector::element_ops(). As for value(), the list of
+    second operands is an implicit logical OR. If the first operand is not
+    an array, the clause's value is the only entry in the mask.
+
+    @param dds Use variables from this DDS when evaluating the
+    expression
+    @param mask Set to one entry for each element of the first operand;
+    non-zero where the clause is true.
+    @return True if the clause is true for any element.
+    @exception InternalErr if called for a clause that is not a relational
+    expression. */
+bool
+Clause::element_value(DDS &dds, vector<unsigned char> &mask)
+{
+    assert(OK());
+
+    if (!_op)
+        throw InternalErr(__FILE__, __LINE__,
+                          "Only a relational clause can be evaluated for the elements of an array.");
+
+    BaseType *btp = _arg1->bvalue(dds);
+    Vector *vec = dynamic_cast<Vector*>(btp);
+    if (!vec) {
+        bool result = false;
+        for (rvalue_list_iter i = _args->begin(); i != _args->end() && !result; i++)
+            result = btp->ops((*i)->bvalue(dds), _op);
+
+        mask.assign(1, result);
+        return result;
+    }
+
+    mask.clear();
+    vector<unsigned char> rvalue_mask;
+    for (rvalue_list_iter i = _args->begin(); i != _args->end(); i++) {
+        vec->element_ops((*i)->bvalue(dds), _op, rvalue_mask);
+        if (i == _args->begin()) {
+            mask.swap(rvalue_mask);
+        }
+        else {
+            for (vector<unsigned char>::size_type j = 0; j < mask.size(); ++j)
+                mask[j] |= rvalue_mask[j];
+        }
+    }
+
+    return std::find(mask.begin(), mask.end(), 1) != mask.end();
+}
+
 /** @brief Evaluate a clause that returns a value via a BaseType
     pointer.
     This method should be called only for those clauses that return values.
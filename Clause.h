@@ -107,6 +107,8 @@ private:
     Clause(const Clause &);
     Clause &operator=(const Clause &);
 
+    friend class ConstraintPlan;
+
 public:
     Clause(const int oper, rvalue *a1, rvalue_list *rv);
     Clause(bool_func func, rvalue_list *rv);
@@ -123,6 +125,8 @@ public:
 
     bool value(DDS &dds);
 
+    bool element_value(DDS &dds, std::vector<unsigned char> &mask);
+
     bool value(DDS &dds, BaseType **value);
 };
 
@@ -26,10 +26,17 @@
 
 //#define DODS_DEBUG
 
+#include <map>
+#include <set>
+
 #include "ServerFunctionsList.h"
 #include "ConstraintEvaluator.h"
+#include "CEParseCache.h"
 #include "Clause.h"
 #include "DataDDS.h"
+#include "Array.h"
+#include "Sequence.h"
+#include "util.h"
 
 #include "ce_parser.h"
 #include "debug.h"
@@ -38,18 +45,20 @@
 
 struct yy_buffer_state;
 
-int ce_exprparse(libdap::ce_parser_arg *arg);
+int ce_exprparse(libdap::ce_parser_arg *arg, void *scanner);
 
-// Glue routines declared in expr.lex
-void ce_expr_switch_to_buffer(void *new_buffer);
-void ce_expr_delete_buffer(void * buffer);
-void *ce_expr_string(const char *yy_str);
+// The reentrant scanner and its glue routines; see ce_expr.lex
+int ce_exprlex_init(void **scanner);
+int ce_exprlex_destroy(void *scanner);
+void ce_expr_switch_to_buffer(void *new_buffer, void *scanner);
+void ce_expr_delete_buffer(void * buffer, void *scanner);
+void *ce_expr_string(const char *yy_str, void *scanner);
 
-extern int ce_exprdebug;
+using namespace std;
 
 namespace libdap {
 
-ConstraintEvaluator::ConstraintEvaluator()
+ConstraintEvaluator::ConstraintEvaluator() : d_parse_cache(0), d_cacheable(true)
 {
     // Functions are now held in BES modules. jhrg 1/30/13
 
@@ -352,37 +361,438 @@ bool ConstraintEvaluator::eval_selection(DDS &dds, const string &)
     return result;
 }
 
+/**
+ * The result of parsing a DAP2 constraint expression: the changes the parser
+ * made to the variables of the DDS and the clauses it added to the
+ * evaluator. Variables are identified by their position in a pre-order
+ * walk of the DDS (see get_vars()) and checked by name and type before the
+ * plan is used.
+ */
+class ConstraintPlan : public CEParsePlan
+{
+public:
+    typedef vector<BaseType*> Vars;
+
+    // The values the parser sets for one variable
+    struct State {
+        bool send_p;
+        bool in_selection;
+        vector<int> dims;   // start, stride and stop of each dimension of an Array
+        int row_start, row_stride, row_stop;    // Sequence row number constraint
+
+        State(BaseType *var);
+
+        bool operator==(const State &rhs) const {
+            return send_p == rhs.send_p && in_selection == rhs.in_selection && dims == rhs.dims
+                && row_start == rhs.row_start && row_stride == rhs.row_stride && row_stop == rhs.row_stop;
+        }
+        bool operator!=(const State &rhs) const { return !(*this == rhs); }
+
+        void apply(BaseType *var) const;
+    };
+
+    static void get_vars(DDS &dds, Vars &vars);
+
+    ConstraintPlan() : d_num_vars(0) { }
+    virtual ~ConstraintPlan();
+
+    bool record(const Vars &vars, const vector<State> &before, ConstraintEvaluator &eval,
+        vector<Clause*>::size_type first);
+    bool replay(DDS &dds, ConstraintEvaluator &eval) const;
+
+private:
+    struct Ref {
+        unsigned int index;
+        string name;
+        Type type;
+    };
+
+    struct Change {
+        Ref var;
+        State before;
+        State after;
+
+        Change(const Ref &r, const State &b, const State &a) : var(r), before(b), after(a) { }
+    };
+
+    // An rvalue: a variable, a constant or a function and its arguments
+    struct Value {
+        int var;                // Index of a variable in the Vars or -1
+        BaseType *constant;     // Weak pointer to one of d_constants
+        btp_func func;
+        bool has_args;
+        vector<Value> args;
+
+        Value() : var(-1), constant(0), func(0), has_args(false) { }
+    };
+
+    struct Term {
+        int op;
+        bool_func b_func;
+        btp_func bt_func;
+        bool has_arg1;
+        Value arg1;
+        bool has_args;
+        vector<Value> args;
+    };
+
+    typedef map<BaseType*, unsigned int> VarIndex;
+
+    unsigned int d_num_vars;
+    vector<Ref> d_refs;         // Variables used by the clauses
+    vector<Change> d_changes;
+    vector<Term> d_clauses;
+    vector<BaseType*> d_constants;
+
+    ConstraintPlan(const ConstraintPlan &);
+    ConstraintPlan &operator=(const ConstraintPlan &);
+
+    static void m_add_vars(BaseType *var, Vars &vars);
+    static Ref m_ref(BaseType *var, unsigned int index);
+    static bool m_check(const Vars &vars, const Ref &ref);
+
+    bool m_record(rvalue *rv, const VarIndex &index, const set<BaseType*> &constants, Value &value);
+    bool m_record(rvalue_list *rvs, const VarIndex &index, const set<BaseType*> &constants, vector<Value> &values);
+
+    rvalue *m_build(const Value &value, const Vars &vars, ConstraintEvaluator &eval) const;
+    rvalue_list *m_build(const vector<Value> &values, const Vars &vars, ConstraintEvaluator &eval) const;
+};
+
+ConstraintPlan::State::State(BaseType *var) :
+    send_p(var->send_p()), in_selection(var->is_in_selection()), row_start(-1), row_stride(1), row_stop(-1)
+{
+    if (var->type() == dods_array_c) {
+        Array *a = static_cast<Array*>(var);
+        for (Array::Dim_iter d = a->dim_begin(), e = a->dim_end(); d != e; ++d) {
+            dims.push_back(d->start);
+            dims.push_back(d->stride);
+            dims.push_back(d->stop);
+        }
+    }
+    else if (var->type() == dods_sequence_c) {
+        Sequence *s = static_cast<Sequence*>(var);
+        row_start = s->get_starting_row_number();
+        row_stride = s->get_row_stride();
+        row_stop = s->get_ending_row_number();
+    }
+}
+
+// Every variable whose state changed is recorded, so this sets only 'var'
+// and does not use the versions of set_send_p() and set_in_selection() that
+// change the variable's parent or children.
+void ConstraintPlan::State::apply(BaseType *var) const
+{
+    var->BaseType::set_send_p(send_p);
+    var->BaseType::set_in_selection(in_selection);
+
+    if (var->type() == dods_array_c) {
+        Array *a = static_cast<Array*>(var);
+        vector<int>::const_iterator v = dims.begin();
+        for (Array::Dim_iter d = a->dim_begin(), e = a->dim_end(); d != e && v != dims.end(); ++d, v += 3) {
+            if (d->start != v[0] || d->stride != v[1] || d->stop != v[2])
+                a->add_constraint(d, v[0], v[1], v[2]);
+        }
+    }
+    else if (var->type() == dods_sequence_c && row_stop >= row_start) {
+        static_cast<Sequence*>(var)->set_row_number_constraint(row_start, row_stop, row_stride);
+    }
+}
+
+ConstraintPlan::~ConstraintPlan()
+{
+    for (vector<BaseType*>::iterator i = d_constants.begin(), e = d_constants.end(); i != e; ++i)
+        delete *i;
+}
+
+void ConstraintPlan::m_add_vars(BaseType *var, Vars &vars)
+{
+    vars.push_back(var);
+
+    if (var->is_constructor_type()) {
+        Constructor *c = static_cast<Constructor*>(var);
+        for (Constructor::Vars_iter i = c->var_begin(), e = c->var_end(); i != e; ++i)
+            m_add_vars(*i, vars);
+    }
+    else if (var->is_vector_type() && var->var()) {
+        m_add_vars(var->var(), vars);
+    }
+}
+
+/** All of the variables in a DDS, in pre-order. */
+void ConstraintPlan::get_vars(DDS &dds, Vars &vars)
+{
+    vars.clear();
+    for (DDS::Vars_iter i = dds.var_begin(), e = dds.var_end(); i != e; ++i)
+        m_add_vars(*i, vars);
+}
+
+ConstraintPlan::Ref ConstraintPlan::m_ref(BaseType *var, unsigned int index)
+{
+    Ref ref;
+    ref.index = index;
+    ref.name = var->name();
+    ref.type = var->type();
+    return ref;
+}
+
+bool ConstraintPlan::m_check(const Vars &vars, const Ref &ref)
+{
+    return ref.index < vars.size() && vars[ref.index]->type() == ref.type && vars[ref.index]->name() == ref.name;
+}
+
+bool ConstraintPlan::m_record(rvalue *rv, const VarIndex &index, const set<BaseType*> &constants, Value &value)
+{
+    if (rv->d_func) {
+        value.func = rv->d_func;
+        value.has_args = rv->d_args != 0;
+        return !rv->d_args || m_record(rv->d_args, index, constants, value.args);
+    }
+
+    if (!rv->d_value)
+        return true;
+
+    VarIndex::const_iterator i = index.find(rv->d_value);
+    if (i != index.end()) {
+        value.var = i->second;
+        d_refs.push_back(m_ref(rv->d_value, i->second));
+        return true;
+    }
+
+    // Only the constants held by the evaluator are known to belong to the
+    // expression; anything else was made by the parser in some other way.
+    if (constants.find(rv->d_value) == constants.end())
+        return false;
+
+    value.constant = rv->d_value->ptr_duplicate();
+    d_constants.push_back(value.constant);
+    return true;
+}
+
+bool ConstraintPlan::m_record(rvalue_list *rvs, const VarIndex &index, const set<BaseType*> &constants,
+    vector<Value> &values)
+{
+    values.resize(rvs->size());
+    for (rvalue_list::size_type i = 0; i < rvs->size(); ++i) {
+        if (!m_record((*rvs)[i], index, constants, values[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Record the result of a parse.
+ *
+ * @param vars The variables of the DDS, from get_vars(), before the parse
+ * @param before Their states before the parse
+ * @param eval The evaluator used for the parse
+ * @param first The index of the first clause added by the parse
+ * @return False if the result cannot be recorded.
+ */
+bool ConstraintPlan::record(const Vars &vars, const vector<State> &before, ConstraintEvaluator &eval,
+    vector<Clause*>::size_type first)
+{
+    d_num_vars = vars.size();
+
+    VarIndex index;
+    for (Vars::size_type i = 0; i < vars.size(); ++i) {
+        index[vars[i]] = i;
+
+        State after(vars[i]);
+        if (after != before[i])
+            d_changes.push_back(Change(m_ref(vars[i], i), before[i], after));
+    }
+
+    set<BaseType*> constants(eval.constants.begin(), eval.constants.end());
+
+    d_clauses.resize(eval.expr.size() - first);
+    for (vector<Clause*>::size_type i = first; i < eval.expr.size(); ++i) {
+        Clause *c = eval.expr[i];
+        Term &t = d_clauses[i - first];
+
+        t.op = c->_op;
+        t.b_func = c->_b_func;
+        t.bt_func = c->_bt_func;
+
+        t.has_arg1 = c->_arg1 != 0;
+        if (c->_arg1 && !m_record(c->_arg1, index, constants, t.arg1))
+            return false;
+
+        t.has_args = c->_args != 0;
+        if (c->_args && !m_record(c->_args, index, constants, t.args))
+            return false;
+    }
+
+    return true;
+}
+
+rvalue *ConstraintPlan::m_build(const Value &value, const Vars &vars, ConstraintEvaluator &eval) const
+{
+    if (value.func)
+        return new rvalue(value.func, value.has_args ? m_build(value.args, vars, eval) : 0);
+
+    if (value.var != -1)
+        return new rvalue(vars[value.var]);
+
+    if (value.constant) {
+        BaseType *constant = value.constant->ptr_duplicate();
+        eval.append_constant(constant);
+        return new rvalue(constant);
+    }
+
+    return new rvalue;
+}
+
+rvalue_list *ConstraintPlan::m_build(const vector<Value> &values, const Vars &vars, ConstraintEvaluator &eval) const
+{
+    rvalue_list *rvs = new rvalue_list;
+    try {
+        for (vector<Value>::const_iterator i = values.begin(), e = values.end(); i != e; ++i)
+            rvs->push_back(m_build(*i, vars, eval));
+    }
+    catch (...) {
+        for (rvalue_list_iter i = rvs->begin(), e = rvs->end(); i != e; ++i)
+            delete *i;
+        delete rvs;
+        throw;
+    }
+
+    return rvs;
+}
+
+/**
+ * Apply the result of a parse to a DDS.
+ *
+ * @return False, and the DDS and evaluator are not changed, if the DDS does
+ * not match the one used for the parse or its variables are not in the
+ * same state.
+ */
+bool ConstraintPlan::replay(DDS &dds, ConstraintEvaluator &eval) const
+{
+    Vars vars;
+    get_vars(dds, vars);
+    if (vars.size() != d_num_vars)
+        return false;
+
+    for (vector<Ref>::const_iterator i = d_refs.begin(), e = d_refs.end(); i != e; ++i) {
+        if (!m_check(vars, *i))
+            return false;
+    }
+
+    for (vector<Change>::const_iterator i = d_changes.begin(), e = d_changes.end(); i != e; ++i) {
+        if (!m_check(vars, i->var) || State(vars[i->var.index]) != i->before)
+            return false;
+    }
+
+    for (vector<Change>::const_iterator i = d_changes.begin(), e = d_changes.end(); i != e; ++i)
+        i->after.apply(vars[i->var.index]);
+
+    for (vector<Term>::const_iterator i = d_clauses.begin(), e = d_clauses.end(); i != e; ++i) {
+        rvalue *arg1 = i->has_arg1 ? m_build(i->arg1, vars, eval) : 0;
+        rvalue_list *args = i->has_args ? m_build(i->args, vars, eval) : 0;
+
+        if (i->op)
+            eval.append_clause(i->op, arg1, args);
+        else if (i->b_func)
+            eval.append_clause(i->b_func, args);
+        else
+            eval.append_clause(i->bt_func, args);
+    }
+
+    return true;
+}
+
 /** @brief Parse the constraint expression given the current DDS.
 
  Evaluate the constraint expression; return the value of the expression.
  As a side effect, mark the DDS so that BaseType's mfuncs can be used to
  correctly read the variable's value and send it to the client.
 
+ If the evaluator has a parse cache (see set_parse_cache()) and the
+ expression was parsed before for the same dataset, the saved result is
+ applied to \c dds and the expression is not parsed again.
+
  @param constraint A string containing the constraint expression.
  @param dds The DDS that provides the environment within which the
  constraint is evaluated.
  @exception Throws Error if the constraint does not parse. */
 void ConstraintEvaluator::parse_constraint(const string &constraint, DDS &dds)
 {
-    void *buffer = ce_expr_string(constraint.c_str());
+    string key;
+    ConstraintPlan::Vars vars;
+    vector<ConstraintPlan::State> before;
+    vector<Clause*>::size_type first = expr.size();
+
+    if (d_parse_cache) {
+        key = "dap2\n" + dds.filename() + "\n" + dds.get_dataset_name() + "\n" + long_to_string(dds.num_var())
+            + "\n" + constraint;
+
+        CEParsePlan *plan = d_parse_cache->find(key);
+        if (plan) {
+            ConstraintPlan *dap2_plan = dynamic_cast<ConstraintPlan*>(plan);
+            bool replayed;
+            try {
+                replayed = dap2_plan && dap2_plan->replay(dds, *this);
+            }
+            catch (...) {
+                d_parse_cache->release(plan, false);
+                throw;
+            }
+
+            d_parse_cache->release(plan, replayed);
+            if (replayed)
+                return;
+        }
+
+        ConstraintPlan::get_vars(dds, vars);
+        before.reserve(vars.size());
+        for (ConstraintPlan::Vars::iterator i = vars.begin(), e = vars.end(); i != e; ++i)
+            before.push_back(ConstraintPlan::State(*i));
+    }
 
-    // Toggle this to debug the parser. A last resort...
-    ce_exprdebug = false;
+    d_cacheable = true;
 
-    ce_expr_switch_to_buffer(buffer);
+    // Each expression is parsed using a scanner and parser state of its own,
+    // so several may be parsed at once by different threads.
+    void *scanner;
+    if (ce_exprlex_init(&scanner) != 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not make the constraint expression scanner.");
+
+    void *buffer = ce_expr_string(constraint.c_str(), scanner);
+
+    ce_expr_switch_to_buffer(buffer, scanner);
 
     ce_parser_arg arg(this, &dds);
 
     // For all errors, exprparse will throw Error.
     try {
-    	ce_exprparse(&arg);
-    	ce_expr_delete_buffer(buffer);
+    	ce_exprparse(&arg, scanner);
+    	ce_expr_delete_buffer(buffer, scanner);
+    	ce_exprlex_destroy(scanner);
     }
     catch (...) {
     	// Make sure to remove the buffer when there's an error
-    	ce_expr_delete_buffer(buffer);
+    	ce_expr_delete_buffer(buffer, scanner);
+    	ce_exprlex_destroy(scanner);
     	throw;
     }
+
+    if (d_parse_cache && d_cacheable) {
+        ConstraintPlan *plan = new ConstraintPlan;
+        bool recorded;
+        try {
+            recorded = plan->record(vars, before, *this, first);
+        }
+        catch (...) {
+            delete plan;
+            throw;
+        }
+
+        if (recorded)
+            d_parse_cache->insert(key, plan);
+        else
+            delete plan;
+    }
 }
 
 } // namespace libdap
@@ -37,6 +37,8 @@ class DDS;
 class DataDDS;
 struct Clause;
 class ServerFunctionsList;
+class CEParseCache;
+class ConstraintPlan;
 
 /** @brief Evaluate a constraint expression */
 class ConstraintEvaluator
@@ -49,6 +51,9 @@ private:
     ServerFunctionsList *d_functions_list;  // Known external functions from
                                             // modules
 
+    CEParseCache *d_parse_cache;    // Weak pointer; may be null
+    bool d_cacheable;               // False if the last parse cannot be replayed
+
     // The default versions of these methods will break this class. Because
     // Clause does not support deep copies, that class will need to be modified
     // before these can be properly implemented. jhrg 4/3/06
@@ -56,6 +61,7 @@ private:
     ConstraintEvaluator &operator=(const ConstraintEvaluator &);
 
     friend class func_name_is;
+    friend class ConstraintPlan;
 
 public:
     typedef std::vector<Clause *>::const_iterator Clause_citer ;
@@ -93,6 +99,15 @@ public:
     void parse_constraint(const std::string &constraint, DDS &dds);
     void append_constant(BaseType *btp);
 
+    /// Save parsed expressions in this cache; null (the default) for none
+    void set_parse_cache(CEParseCache *cache) { d_parse_cache = cache; }
+    CEParseCache *get_parse_cache() const { return d_parse_cache; }
+
+    /** The parser calls this with false when it evaluates something, such as a
+        projection function, whose effect on the DDS the parse cache cannot
+        record. */
+    void set_cacheable(bool state) { d_cacheable = state; }
+
 };
 
 } // namespace libdap
@@ -43,6 +43,7 @@
 
 #include "D4Connect.h"
 #include "HTTPConnect.h"
+#include "HTTPStreamResponse.h"
 #include "Response.h"
 #include "DMR.h"
 #include "D4Group.h"
@@ -160,6 +161,7 @@ void D4Connect::process_data(DMR &data, Response &rs)
 #else
         chunked_istream cis(*(rs.get_cpp_stream()), CHUNK_SIZE);
 #endif
+        cis.set_read_ahead(d_read_ahead);
         // parse the DMR, stopping when the boundary is found.
         try {
             // force chunk read
@@ -198,6 +200,7 @@ void D4Connect::process_data(DMR &data, Response &rs)
 #else
         D4StreamUnMarshaller um(cis, cis.twiddle_bytes());
 #endif
+        um.set_vector_filter(data.vector_filter());
         data.root()->deserialize(um, data);
 
         return;
@@ -265,7 +268,9 @@ void D4Connect::parse_mime(Response &rs)
  @param password Password to use for authentication. Null by default.
  @brief Create an instance of Connect. */
 D4Connect::D4Connect(const string &url, string uname, string password) :
-    d_http(0), d_local(false), d_URL(""), d_UrlQueryString(""), d_server("unknown"), d_protocol("4.0")
+    d_http(0), d_local(false), d_URL(""), d_UrlQueryString(""), d_server("unknown"), d_protocol("4.0"),
+    d_parallel_ranges(1), d_range_size(8 * 1024 * 1024), d_streaming(false),
+    d_read_ahead(false)
 {
     string name = prune_spaces(url);
 
@@ -386,7 +391,14 @@ void D4Connect::request_dap4_data(DMR &dmr, const string expr)
 
     Response *rs = 0;
     try {
-        rs = d_http->fetch_url(url);
+        // When streaming, the chunked_istream's read-ahead thread reads the
+        // network while this thread decodes
+        if (d_streaming)
+            rs = d_http->fetch_url_stream(url);
+        else if (d_parallel_ranges > 1)
+            rs = d_http->fetch_url_ranges(url, d_parallel_ranges, d_range_size);
+        else
+            rs = d_http->fetch_url(url);
 
         d_server = rs->get_version();
         d_protocol = rs->get_protocol();
@@ -409,6 +421,7 @@ void D4Connect::request_dap4_data(DMR &dmr, const string expr)
 #else
             chunked_istream cis(*(rs->get_cpp_stream()), CHUNK_SIZE);
 #endif
+            cis.set_read_ahead(d_read_ahead);
 
             // parse the DMR, stopping when the boundary is found.
 
@@ -434,6 +447,7 @@ void D4Connect::request_dap4_data(DMR &dmr, const string expr)
 #else
             D4StreamUnMarshaller um(cis, cis.twiddle_bytes());
 #endif
+            um.set_vector_filter(dmr.vector_filter());
             dmr.root()->deserialize(um, dmr);
 
             break;
@@ -454,7 +468,12 @@ void D4Connect::request_dap4_data(DMR &dmr, const string expr)
         }
     }
     catch (...) {
+        // If the transfer failed part way through, that is the real problem
+        HTTPStreamResponse *srs = dynamic_cast<HTTPStreamResponse*>(rs);
+        string transfer_error = srs ? srs->get_transfer_error() : "";
         delete rs;
+        if (!transfer_error.empty())
+            throw Error("Error while reading the URL: " + url + ".\n" + transfer_error);
         throw;
     }
 
@@ -545,6 +564,21 @@ void D4Connect::set_cache_enabled(bool cache)
     if (d_http) d_http->set_cache_enabled(cache);
 }
 
+/** Read large data responses using several connections at once. The
+ response is read as byte ranges from servers that support them; see
+ HTTPConnect::fetch_url_ranges(). The HTTP cache is not used for data
+ responses read this way.
+
+ @param num_ranges The number of connections to use. One (the default)
+ reads responses using a single request.
+ @param range_size The smallest byte range to ask for. Responses no larger
+ than this are read using a single request. */
+void D4Connect::set_parallel_fetch(unsigned int num_ranges, unsigned long range_size)
+{
+    d_parallel_ranges = num_ranges;
+    d_range_size = range_size;
+}
+
 bool D4Connect::is_cache_enabled()
 {
     if (d_http)
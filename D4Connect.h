@@ -49,6 +49,11 @@ private:
     std::string d_server; // Server implementation information (the XDAP-Server header)
     std::string d_protocol; // DAP protocol from the server (XDAP)
 
+    unsigned int d_parallel_ranges; // Read data responses using this many connections
+    unsigned long d_range_size;     // The smallest byte range to read
+    bool d_streaming;               // Decode data responses as they are read
+    bool d_read_ahead;              // Read the next chunk while one is decoded
+
     void process_data(DMR &data, Response &rs);
     void process_dmr(DMR &data, Response &rs);
 
@@ -82,6 +87,29 @@ public:
 
     void set_xdap_accept(int major, int minor);
 
+    void set_parallel_fetch(unsigned int num_ranges, unsigned long range_size = 8 * 1024 * 1024);
+    /// The number of connections used to read a data response
+    unsigned int get_parallel_fetch() const { return d_parallel_ranges; }
+
+    /** Decode data responses while they are being read, instead of first
+        reading the whole response into memory or a temporary file. This
+        takes precedence over set_parallel_fetch(). The HTTP cache is not
+        used for data responses read this way.
+        @param state True to decode responses as they are read. */
+    void set_streaming_fetch(bool state) { d_streaming = state; }
+    bool get_streaming_fetch() const { return d_streaming; }
+
+    /** Read the next chunk of a data response on a second thread while the
+        current one is decoded. This helps when decoding, not the network,
+        limits how fast large responses are read. Off by default: a chunk
+        that is being read ahead must be read in full before the response
+        can be discarded, so a stalled server can hold up the end of a
+        request.
+        @param state True to read chunks ahead.
+        @see chunked_istream::set_read_ahead() */
+    void set_read_ahead(bool state) { d_read_ahead = state; }
+    bool get_read_ahead() const { return d_read_ahead; }
+
     /** Return the protocol/implementation version of the most recent
     response. This is a poorly designed method, but it returns
     information that is useful when used correctly. Before a response is
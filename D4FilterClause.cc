@@ -34,13 +34,63 @@
 
 #include "config.h"
 
+#include <string>
+#include <vector>
+
+#include "Byte.h"
+#include "Int8.h"
+#include "Int16.h"
+#include "UInt16.h"
+#include "Int32.h"
+#include "UInt32.h"
+#include "Int64.h"
+#include "UInt64.h"
+#include "Float32.h"
+#include "Float64.h"
+#include "Str.h"
+
 #include "D4RValue.h"
 #include "D4FilterClause.h"
+#include "D4SeqBatch.h"
+
+#include "Error.h"
+#include "InternalErr.h"
+#include "debug.h"
+#include "Operators.h"
 
 using namespace std;
 
 namespace libdap {
 
+/**
+ * A filter clause compiled for the types of its operands, a variable and a
+ * constant. 'eval' is specialized for the variable's type, the constant's
+ * type, the operator and the order of the operands.
+ */
+struct D4FilterPredicate {
+    bool (*eval)(const D4FilterPredicate &p);
+
+    BaseType *var;          // Weak pointer to the variable
+    bool variable_first;    // True if the variable is the left-hand operand
+
+    // The constant's value; constant_type tells which field holds it
+    Type constant_type;
+    dods_int64 i64;
+    dods_uint64 ui64;
+    dods_float64 f64;
+    string str;
+
+    Regex *regex;           // For the match operator
+
+    D4FilterPredicate() :
+        eval(0), var(0), variable_first(true), constant_type(dods_null_c), i64(0), ui64(0), f64(0), regex(0) { }
+    ~D4FilterPredicate() { delete regex; }
+
+private:
+    D4FilterPredicate(const D4FilterPredicate &);
+    D4FilterPredicate &operator=(const D4FilterPredicate &);
+};
+
 void
 D4FilterClauseList::m_duplicate(const D4FilterClauseList &src)
 {
@@ -102,12 +152,32 @@ D4FilterClauseList::value()
     return true;
 }
 
+/**
+ * @brief Evaluate the list of clauses for a batch of rows
+ *
+ * Each clause clears the entries of the batch's selection for the rows
+ * where it is false. A row is kept when all of the clauses are true.
+ *
+ * @param batch The rows; its selection is modified.
+ * @see D4FilterClause::value(D4SeqBatch &)
+ */
+void
+D4FilterClauseList::value(D4SeqBatch &batch)
+{
+    for (D4FilterClauseList::iter i = d_clauses.begin(), e = d_clauses.end(); i != e; ++i) {
+        (*i)->value(batch);
+    }
+}
+
 void D4FilterClause::m_duplicate(const D4FilterClause &rhs) {
     d_op = rhs.d_op;
 
     d_arg1 = new D4RValue(*rhs.d_arg1);
     d_arg2 = new D4RValue(*rhs.d_arg2);
 
+    d_predicate = 0;
+    compile();
+
 #if 0
     // Copy the D4RValue pointer if the 'value_kind' is a basetype,
     // but build a new D4RValue if it is a constant (because the
@@ -136,6 +206,16 @@ void D4FilterClause::m_duplicate(const D4FilterClause &rhs) {
 #endif
 }
 
+void D4FilterClause::m_clear()
+{
+    delete d_arg1;
+    d_arg1 = 0;
+    delete d_arg2;
+    d_arg2 = 0;
+    delete d_predicate;
+    d_predicate = 0;
+}
+
 /**
  * @brief Get the value of this relational expression.
  * This version of value() works for function clauses, although that's
@@ -156,6 +236,9 @@ bool D4FilterClause::value(DMR &dmr)
 	case equal:
 	case not_equal:
 	case match:
+		if (d_predicate)
+			return d_predicate->eval(*d_predicate);
+
 		return cmp(d_op, d_arg1->value(dmr), d_arg2->value(dmr));
 
 	case ND:
@@ -187,6 +270,9 @@ bool D4FilterClause::value()
     case equal:
     case not_equal:
     case match:
+        if (d_predicate)
+            return d_predicate->eval(*d_predicate);
+
         return cmp(d_op, d_arg1->value(), d_arg2->value());
 
     case ND:
@@ -209,4 +295,341 @@ bool D4FilterClause::cmp(ops op, BaseType *arg1, BaseType *arg2)
     return arg1->d4_ops(arg2, op);
 }
 
+// As D4RValue::value() does, read the variable before using its value
+static inline BaseType *read_variable(const D4FilterPredicate &p)
+{
+    if (!p.var->read_p()) {
+        p.var->read();
+        p.var->set_read_p(true);
+    }
+
+    return p.var;
+}
+
+static inline dods_int64 constant_value(const D4FilterPredicate &p, dods_int64) { return p.i64; }
+static inline dods_uint64 constant_value(const D4FilterPredicate &p, dods_uint64) { return p.ui64; }
+static inline dods_float64 constant_value(const D4FilterPredicate &p, dods_float64) { return p.f64; }
+
+template<class DT, typename T, typename C, int op, bool variable_first>
+static bool number_predicate(const D4FilterPredicate &p)
+{
+    T v = static_cast<DT*>(read_variable(p))->value();
+    C c = constant_value(p, C());
+    return variable_first ? NumCmp<T, C>::cmp(op, v, c) : NumCmp<C, T>::cmp(op, c, v);
+}
+
+template<int op, bool variable_first>
+static bool string_predicate(const D4FilterPredicate &p)
+{
+    string v = static_cast<Str*>(read_variable(p))->value();
+    return variable_first ? StrCmp<string, string>(op, v, p.str) : StrCmp<string, string>(op, p.str, v);
+}
+
+static bool regex_predicate(const D4FilterPredicate &p)
+{
+    string v = static_cast<Str*>(read_variable(p))->value();
+    return p.regex->match(v.c_str(), v.length()) > 0;
+}
+
+typedef bool (*predicate_fn)(const D4FilterPredicate &p);
+
+#define NUMBER_PREDICATE(op) \
+    case op: \
+        return variable_first ? &number_predicate<DT, T, C, op, true> : &number_predicate<DT, T, C, op, false>
+
+template<class DT, typename T, typename C>
+static predicate_fn number_predicate_op(int op, bool variable_first)
+{
+    switch (op) {
+    NUMBER_PREDICATE(SCAN_EQUAL);
+    NUMBER_PREDICATE(SCAN_NOT_EQUAL);
+    NUMBER_PREDICATE(SCAN_GREATER);
+    NUMBER_PREDICATE(SCAN_GREATER_EQL);
+    NUMBER_PREDICATE(SCAN_LESS);
+    NUMBER_PREDICATE(SCAN_LESS_EQL);
+    default:
+        return 0;
+    }
+}
+
+#undef NUMBER_PREDICATE
+
+// Returns null if the variable is not a number or the operator does not
+// apply to numbers
+template<typename C>
+static predicate_fn number_predicate_type(Type t, int op, bool variable_first)
+{
+    switch (t) {
+    case dods_byte_c:
+        return number_predicate_op<Byte, dods_byte, C>(op, variable_first);
+    case dods_int8_c:
+        return number_predicate_op<Int8, dods_int8, C>(op, variable_first);
+    case dods_int16_c:
+        return number_predicate_op<Int16, dods_int16, C>(op, variable_first);
+    case dods_uint16_c:
+        return number_predicate_op<UInt16, dods_uint16, C>(op, variable_first);
+    case dods_int32_c:
+        return number_predicate_op<Int32, dods_int32, C>(op, variable_first);
+    case dods_uint32_c:
+        return number_predicate_op<UInt32, dods_uint32, C>(op, variable_first);
+    case dods_int64_c:
+        return number_predicate_op<Int64, dods_int64, C>(op, variable_first);
+    case dods_uint64_c:
+        return number_predicate_op<UInt64, dods_uint64, C>(op, variable_first);
+    case dods_float32_c:
+        return number_predicate_op<Float32, dods_float32, C>(op, variable_first);
+    case dods_float64_c:
+        return number_predicate_op<Float64, dods_float64, C>(op, variable_first);
+    default:
+        return 0;
+    }
+}
+
+#define STRING_PREDICATE(op) \
+    case op: \
+        return variable_first ? &string_predicate<op, true> : &string_predicate<op, false>
+
+// Returns null if the variable is not a string or the operator is 'match'
+static predicate_fn string_predicate_type(Type t, int op, bool variable_first)
+{
+    if (t != dods_str_c && t != dods_url_c)
+        return 0;
+
+    switch (op) {
+    STRING_PREDICATE(SCAN_EQUAL);
+    STRING_PREDICATE(SCAN_NOT_EQUAL);
+    STRING_PREDICATE(SCAN_GREATER);
+    STRING_PREDICATE(SCAN_GREATER_EQL);
+    STRING_PREDICATE(SCAN_LESS);
+    STRING_PREDICATE(SCAN_LESS_EQL);
+    default:
+        return 0;
+    }
+}
+
+#undef STRING_PREDICATE
+
+/**
+ * Compile a clause that compares a variable with a constant. The
+ * constant's value is extracted and a comparison for the variable's type,
+ * the constant's type and the operator is chosen, so that evaluating the
+ * clause does not look up types or build objects. Clauses that cannot be
+ * compiled, including those that d4_ops() rejects, are left to cmp().
+ */
+void D4FilterClause::compile()
+{
+    D4RValue *variable_arg, *constant_arg;
+    bool variable_first;
+    if (d_arg1->get_kind() == D4RValue::basetype && d_arg2->get_kind() == D4RValue::constant) {
+        variable_arg = d_arg1;
+        constant_arg = d_arg2;
+        variable_first = true;
+    }
+    else if (d_arg1->get_kind() == D4RValue::constant && d_arg2->get_kind() == D4RValue::basetype) {
+        variable_arg = d_arg2;
+        constant_arg = d_arg1;
+        variable_first = false;
+    }
+    else {
+        return;
+    }
+
+    if (!variable_arg->get_variable())
+        return;
+
+    D4FilterPredicate *p = new D4FilterPredicate;
+    p->var = variable_arg->get_variable();
+    p->variable_first = variable_first;
+
+    // The constants built by the parser are all Int64, UInt64, Float64 or Str
+    BaseType *c = constant_arg->value();
+    p->constant_type = c->type();
+
+    Type t = p->var->type();
+    switch (p->constant_type) {
+    case dods_int64_c:
+        p->i64 = static_cast<Int64*>(c)->value();
+        p->eval = number_predicate_type<dods_int64>(t, d_op, variable_first);
+        break;
+    case dods_uint64_c:
+        p->ui64 = static_cast<UInt64*>(c)->value();
+        p->eval = number_predicate_type<dods_uint64>(t, d_op, variable_first);
+        break;
+    case dods_float64_c:
+        p->f64 = static_cast<Float64*>(c)->value();
+        p->eval = number_predicate_type<dods_float64>(t, d_op, variable_first);
+        break;
+    case dods_str_c:
+        p->str = static_cast<Str*>(c)->value();
+        if (d_op != match) {
+            p->eval = string_predicate_type(t, d_op, variable_first);
+        }
+        else if (variable_first && (t == dods_str_c || t == dods_url_c)) {
+            // The pattern is the second operand; compile it once. A bad
+            // pattern is reported when the clause is evaluated, as before.
+            try {
+                p->regex = new Regex(p->str.c_str());
+                p->eval = &regex_predicate;
+            }
+            catch (Error &e) {
+                DBG(cerr << "Not compiling the filter clause: " << e.get_error_message() << endl);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (p->eval)
+        d_predicate = p;
+    else
+        delete p;
+}
+
+template<typename T, typename C>
+static bool select_rows(int op, bool column_first, const T *col, C c, unsigned int n, unsigned char *selection)
+{
+    return column_first ? vector_cmp(op, col, c, n, selection) : constant_vector_cmp(op, c, col, n, selection);
+}
+
+// Returns false if the column does not hold numbers
+template<typename C>
+static bool select_numbers(int op, bool column_first, D4SeqBatch &batch, unsigned int column, C c)
+{
+    unsigned int n = batch.size();
+    unsigned char *selection = &batch.selection()[0];
+
+    switch (batch.get_var(column)->type()) {
+    case dods_byte_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_byte*>(batch.get_buf(column)), c, n, selection);
+    case dods_int8_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_int8*>(batch.get_buf(column)), c, n, selection);
+    case dods_int16_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_int16*>(batch.get_buf(column)), c, n, selection);
+    case dods_uint16_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_uint16*>(batch.get_buf(column)), c, n, selection);
+    case dods_int32_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_int32*>(batch.get_buf(column)), c, n, selection);
+    case dods_uint32_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_uint32*>(batch.get_buf(column)), c, n, selection);
+    case dods_int64_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_int64*>(batch.get_buf(column)), c, n, selection);
+    case dods_uint64_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_uint64*>(batch.get_buf(column)), c, n, selection);
+    case dods_float32_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_float32*>(batch.get_buf(column)), c, n, selection);
+    case dods_float64_c:
+        return select_rows(op, column_first, reinterpret_cast<dods_float64*>(batch.get_buf(column)), c, n, selection);
+    default:
+        return false;
+    }
+}
+
+// Returns false if the column does not hold strings
+static bool select_strings(const D4FilterPredicate &p, int op, D4SeqBatch &batch, unsigned int column)
+{
+    Type t = batch.get_var(column)->type();
+    if (t != dods_str_c && t != dods_url_c)
+        return false;
+
+    const vector<string> &col = batch.get_str(column);
+    vector<unsigned char> &selection = batch.selection();
+
+    if (op == SCAN_REGEXP) {
+        for (unsigned int i = 0; i < batch.size(); ++i) {
+            if (selection[i])
+                selection[i] = p.regex->match(col[i].c_str(), col[i].length()) > 0;
+        }
+
+        return true;
+    }
+
+    for (unsigned int i = 0; i < batch.size(); ++i) {
+        if (selection[i])
+            selection[i] = p.variable_first ? StrCmp<string, string>(op, col[i], p.str) : StrCmp<string, string>(op, p.str, col[i]);
+    }
+
+    return true;
+}
+
+/**
+ * Compare a column of the batch with a constant without building a
+ * BaseType for each row.
+ *
+ * @return False if this clause was not compiled or its variable is not one
+ * of the batch's columns.
+ */
+bool D4FilterClause::column_cmp(D4SeqBatch &batch)
+{
+    if (!d_predicate)
+        return false;
+
+    int column = batch.get_column(d_predicate->var);
+    if (column < 0)
+        return false;
+
+    const D4FilterPredicate &p = *d_predicate;
+    switch (p.constant_type) {
+    case dods_int64_c:
+        return select_numbers(d_op, p.variable_first, batch, column, p.i64);
+    case dods_uint64_c:
+        return select_numbers(d_op, p.variable_first, batch, column, p.ui64);
+    case dods_float64_c:
+        return select_numbers(d_op, p.variable_first, batch, column, p.f64);
+    case dods_str_c:
+        return select_strings(p, d_op, batch, column);
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Evaluate this clause for each row of a batch
+ *
+ * Clear the batch's selection for each row where the clause is false.
+ * When the clause compares one of the batch's columns with a constant, the
+ * whole column is compared at once. Otherwise each selected row is loaded
+ * into the sequence's variables and value() is used; when this returns the
+ * variables hold the values of the batch's last row.
+ *
+ * @param batch The rows; its selection is modified.
+ */
+void D4FilterClause::value(D4SeqBatch &batch)
+{
+    switch (d_op) {
+    case null:
+        throw InternalErr(__FILE__, __LINE__, "While evaluating a constraint filter clause: Found a null operator");
+
+    case less:
+    case greater:
+    case less_equal:
+    case greater_equal:
+    case equal:
+    case not_equal:
+    case match:
+        break;
+
+    case ND:
+    case map:
+        throw InternalErr(__FILE__, __LINE__, "While evaluating a constraint filter clause: Filter operator not implemented");
+
+    default:
+        throw InternalErr(__FILE__, __LINE__, "While evaluating a constraint filter clause: Unrecognized operator");
+    }
+
+    if (batch.size() == 0 || column_cmp(batch))
+        return;
+
+    vector<unsigned char> &selection = batch.selection();
+    for (unsigned int i = 0; i < batch.size(); ++i) {
+        if (selection[i]) {
+            batch.load_row(i);
+            selection[i] = value();
+        }
+    }
+
+    // Leave the variables holding the last row read, as read() does
+    batch.load_row(batch.size() - 1);
+}
+
 } // namespace libdap
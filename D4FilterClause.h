@@ -36,6 +36,8 @@ namespace libdap
 
 class D4Rvalue;
 class D4FilterClause;
+class D4SeqBatch;
+struct D4FilterPredicate;
 
 /**
  * @brief List of DAP4 Filter Clauses
@@ -85,6 +87,9 @@ public:
     bool value(DMR &dmr);
 
     bool value();
+
+    // evaluate the clauses for each row of a batch
+    void value(D4SeqBatch &batch);
 };
 
 /**
@@ -104,10 +109,8 @@ public:
  * Sequences fields. The method 'value()' is effectively the evaluator for
  * the clause and nominally reads values from the rvalue objects.
  *
- * @note Potential optimization: Because Sequences might have an optimized
- * representation as a STL vector of some built in types, there could be a
- * value() method that takes a value and compares it to the clause's constant
- * value using the supplied op.
+ * When a Sequence is read in batches (see D4SeqBatch), value(D4SeqBatch&)
+ * compares a whole column of values to the clause's constant at once.
  *
  * @note The 'ND' and 'map' ops are 'still just an idea' parts.
  */
@@ -137,15 +140,23 @@ private:
 
     D4RValue *d_arg1, *d_arg2;
 
-    D4FilterClause() : d_op(null), d_arg1(0), d_arg2(0) { }
+    // The clause compiled for its operand types; null if it was not compiled
+    D4FilterPredicate *d_predicate;
+
+    D4FilterClause() : d_op(null), d_arg1(0), d_arg2(0), d_predicate(0) { }
 
     void m_duplicate(const D4FilterClause &rhs);
+    void m_clear();
+
+    void compile();
 
     // These methods factor out first the first argument and then the
     // second. I could write one really large cmp() for all of this...
     //template<typename T> bool cmp(ops op, BaseType *arg1, T arg2);
     bool cmp(ops op, BaseType *arg1, BaseType *arg2);
 
+    bool column_cmp(D4SeqBatch &batch);
+
     friend class D4FilterClauseList;
 
 public:
@@ -153,27 +164,26 @@ public:
      * Build a D4FilterClause. The clause will take ownership of
      * the two pointer arguments and delete them.
      *
-     * @note When comparing an unsigned variable (UInt16) with a constant,
-     * at parse time (i.e., when the D4FilterClause is made) check that the
-     * constant is >= 0 and store it in an unsigned value at that time. This
-     * will avoid having to make the test repeatedly during filter evaluation.
-     *
-     * @note When parsing a constant, extract the value from the BaseType and
-     * store it in a local field, to avoid the overhead of extracting the
-     * value and looking up its type over an over.
+     * When one operand is a variable and the other a constant, the clause
+     * is compiled here: the constant's value is extracted and a comparison
+     * specialized for the variable's type, the constant's type and the
+     * operator is chosen. A regular expression is compiled once. Other
+     * clauses are evaluated using BaseType::d4_ops().
      *
      * @param op The operator
      * @param arg1 The left-hand operand
      * @param arg2 The right-hand operand
      */
     D4FilterClause(const ops op, D4RValue *arg1, D4RValue *arg2) :
-    	d_op(op), d_arg1(arg1), d_arg2(arg2) {
+    	d_op(op), d_arg1(arg1), d_arg2(arg2), d_predicate(0) {
     	assert(op != null && "null operator");
     	assert(arg1 && "null arg1");
     	assert(arg2 && "null arg2");
+
+    	compile();
     }
 
-    D4FilterClause(const D4FilterClause &src) {
+    D4FilterClause(const D4FilterClause &src) : d_predicate(0) {
         m_duplicate(src);
     }
 
@@ -181,20 +191,22 @@ public:
         if (this == &rhs)
             return *this;
 
+        m_clear();
         m_duplicate(rhs);
 
         return *this;
     }
 
     virtual ~D4FilterClause() {
-    	delete d_arg1;
-    	delete d_arg2;
+        m_clear();
     }
 
     // get the clause value; this version supports functional clauses
     bool value(DMR &dmr);
 
     bool value();
+
+    void value(D4SeqBatch &batch);
 };
 
 } // namespace libdap
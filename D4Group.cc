@@ -31,6 +31,12 @@
 
 #include <stdint.h>
 
+#include <vector>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
 #include "crc.h"
 
 #include "BaseType.h"
@@ -44,7 +50,9 @@
 
 #include "D4StreamMarshaller.h"
 #include "D4StreamUnMarshaller.h"
+#include "DMR.h"
 
+#include "InternalErr.h"
 #include "debug.h"
 
 /**
@@ -56,6 +64,182 @@
 
 namespace libdap {
 
+#ifdef USE_POSIX_THREADS
+/**
+ * Read variables using a pool of threads. Variables are read in order,
+ * and no more than 'num_threads' past the one the caller is waiting for,
+ * which limits how many variables are held in memory at once. Errors
+ * thrown by read() are held until the caller asks for that variable.
+ */
+class VariableReader {
+private:
+    std::vector<BaseType*> d_vars;
+    std::vector<bool> d_done;
+    std::vector<Error*> d_errors;
+
+    std::vector<pthread_t> d_threads;
+    pthread_mutex_t d_mutex;
+    pthread_cond_t d_cond;
+
+    unsigned int d_next;        // the next variable to read
+    unsigned int d_current;     // the variable the caller is waiting for
+    unsigned int d_window;
+    bool d_shutdown;
+    bool d_started;
+
+    VariableReader(const VariableReader &);
+    VariableReader &operator=(const VariableReader &);
+
+    void m_read_loop();
+
+    static void *reader_thread(void *arg)
+    {
+        static_cast<VariableReader*>(arg)->m_read_loop();
+        return 0;
+    }
+
+    void m_stop();
+
+public:
+    VariableReader() : d_next(0), d_current(0), d_window(0), d_shutdown(false), d_started(false) { }
+    ~VariableReader();
+
+    void start(const std::vector<BaseType*> &vars, unsigned int num_threads);
+    bool started() const { return d_started; }
+    void wait_for(unsigned int i);
+};
+
+/**
+ * Start reading 'vars' using 'num_threads' threads.
+ */
+void VariableReader::start(const std::vector<BaseType*> &vars, unsigned int num_threads)
+{
+    d_vars = vars;
+    d_done.assign(vars.size(), false);
+    d_errors.assign(vars.size(), (Error*)0);
+    d_window = num_threads;
+
+    if (pthread_mutex_init(&d_mutex, 0) != 0) throw InternalErr(__FILE__, __LINE__, "Could not initialize mutex");
+    if (pthread_cond_init(&d_cond, 0) != 0) {
+        pthread_mutex_destroy(&d_mutex);
+        throw InternalErr(__FILE__, __LINE__, "Could not initialize cond");
+    }
+    d_started = true;
+
+    for (unsigned int i = 0; i < num_threads && i < vars.size(); ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, reader_thread, this) != 0) {
+            m_stop();
+            throw InternalErr(__FILE__, __LINE__, "Could not start a thread to read variables");
+        }
+        d_threads.push_back(thread);
+    }
+}
+
+VariableReader::~VariableReader()
+{
+    if (d_started)
+        m_stop();
+
+    for (std::vector<Error*>::iterator i = d_errors.begin(); i != d_errors.end(); ++i)
+        delete *i;
+}
+
+/**
+ * Stop handing out variables and wait for the reads in progress to finish.
+ */
+void VariableReader::m_stop()
+{
+    pthread_mutex_lock(&d_mutex);
+    d_shutdown = true;
+    pthread_cond_broadcast(&d_cond);
+    pthread_mutex_unlock(&d_mutex);
+
+    for (std::vector<pthread_t>::iterator i = d_threads.begin(); i != d_threads.end(); ++i)
+        pthread_join(*i, 0);
+    d_threads.clear();
+
+    pthread_cond_destroy(&d_cond);
+    pthread_mutex_destroy(&d_mutex);
+    d_started = false;
+}
+
+void VariableReader::m_read_loop()
+{
+    while (true) {
+        pthread_mutex_lock(&d_mutex);
+        while (!d_shutdown && d_next < d_vars.size() && d_next > d_current + d_window)
+            pthread_cond_wait(&d_cond, &d_mutex);
+
+        if (d_shutdown || d_next >= d_vars.size()) {
+            pthread_mutex_unlock(&d_mutex);
+            return;
+        }
+
+        unsigned int i = d_next++;
+        pthread_mutex_unlock(&d_mutex);
+
+        Error *error = 0;
+        try {
+            if (!d_vars[i]->read_p())
+                d_vars[i]->read();
+        }
+        // Keep the type of the exception; InternalErr is the only subclass
+        // of Error that can come from read().
+        catch (InternalErr &e) {
+            error = new InternalErr(e);
+        }
+        catch (Error &e) {
+            error = new Error(e);
+        }
+        catch (std::exception &e) {
+            error = new InternalErr(__FILE__, __LINE__, string("Could not read '") + d_vars[i]->name() + "': " + e.what());
+        }
+        catch (...) {
+            error = new InternalErr(__FILE__, __LINE__, "Could not read '" + d_vars[i]->name() + "'.");
+        }
+
+        pthread_mutex_lock(&d_mutex);
+        d_done[i] = true;
+        d_errors[i] = error;
+        pthread_cond_broadcast(&d_cond);
+        pthread_mutex_unlock(&d_mutex);
+    }
+}
+
+/**
+ * Wait until variable 'i' has been read. This also lets the threads read
+ * up to 'num_threads' variables past 'i'. Variables must be waited for in
+ * order.
+ * @exception Error if read() threw an exception for variable 'i'; an
+ * InternalErr thrown by read() is rethrown as an InternalErr
+ */
+void VariableReader::wait_for(unsigned int i)
+{
+    pthread_mutex_lock(&d_mutex);
+    d_current = i;
+    pthread_cond_broadcast(&d_cond);
+    while (!d_done[i])
+        pthread_cond_wait(&d_cond, &d_mutex);
+    Error *error = d_errors[i];
+    d_errors[i] = 0;
+    pthread_mutex_unlock(&d_mutex);
+
+    if (error) {
+        InternalErr *ie = dynamic_cast<InternalErr*>(error);
+        if (ie) {
+            InternalErr e(*ie);
+            delete error;
+            throw e;
+        }
+
+        Error e(*error);
+        delete error;
+        throw e;
+    }
+}
+#endif
+
 void D4Group::m_duplicate(const D4Group &g)
 {
 	DBG(cerr << "In D4Group::m_duplicate for " << g.name() << endl);
@@ -483,13 +667,30 @@ D4Group::intern_data(/*Crc32 &checksum, DMR &dmr, ConstraintEvaluator &eval*/)
 	}
 }
 
+/**
+ * Can this variable be read before it is serialized, on a different thread
+ * than the one that serializes it?
+ */
+bool
+D4Group::m_read_ahead_p(BaseType *var)
+{
+    return var->is_simple_type() || (var->is_vector_type() && var->var() && var->var()->is_simple_type());
+}
+
 /**
  * @brief Serialize a Group
  * @param m The DAP4 Stream Marshaller. This object serializes the data values and
  * writes checksums (using CRC32) for the top level variables in every Group for which
  * one or more variables are sent. The DAP4 Marshaller object can be made so that only
  * the checksums are written.
- * @param dmr Unused
+ *
+ * If DMR::read_threads() is not zero, the scalars and arrays of scalars in
+ * each Group are read using that many threads, so that read() for the
+ * variables that follow runs while the current variable is written. The
+ * variables are still written in order, with the same checksums. Variables
+ * read this way are read all at once (Vector::set_block_size() is not used
+ * for them).
+ * @param dmr Used for DMR::read_threads()
  * @param eval Unused
  * @param filter Unused
  * @exception Error is thrown if the value needs to be read and that operation fails.
@@ -520,9 +721,31 @@ D4Group::serialize(D4StreamMarshaller &m, DMR &dmr, /*ConstraintEvaluator &eval,
     // to sort out which variables are the 'real' top-level variables and instead
     // simply computes the CRC for whatever appears as a variable in the root
     // group.
+#ifdef USE_POSIX_THREADS
+    // Read the variables that will be sent while the current one is written.
+    // Only scalars and arrays of scalars are read this way; reading other
+    // types can depend on the order in which they are serialized (e.g.,
+    // Sequences).
+    std::vector<BaseType*> read_vars;
+    VariableReader reader;
+    if (dmr.read_threads() > 0) {
+        for (Vars_iter i = d_vars.begin(); i != d_vars.end(); i++)
+            if ((*i)->send_p() && m_read_ahead_p(*i))
+                read_vars.push_back(*i);
+
+        if (read_vars.size() > 1)
+            reader.start(read_vars, dmr.read_threads());
+    }
+    unsigned int next_read_var = 0;
+#endif
+
 	for (Vars_iter i = d_vars.begin(); i != d_vars.end(); i++) {
 		// Only send the stuff in the current subset.
 		if ((*i)->send_p()) {
+#ifdef USE_POSIX_THREADS
+			if (reader.started() && next_read_var < read_vars.size() && read_vars[next_read_var] == *i)
+				reader.wait_for(next_read_var++);
+#endif
 			m.reset_checksum();
 
 	        DBG(cerr << "Serializing variable " << (*i)->type_name() << " " << (*i)->name() << endl);
@@ -60,6 +60,8 @@ private:
 
     BaseType *m_find_map_source_helper(const string &name);
 
+    static bool m_read_ahead_p(BaseType *var);
+
 protected:
     void m_duplicate(const D4Group &g);
 
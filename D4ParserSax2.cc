@@ -47,6 +47,7 @@
 #include "D4BaseTypeFactory.h"
 
 #include "D4ParserSax2.h"
+#include "vector_filter.h"
 
 #include "util.h"
 #include "debug.h"
@@ -650,6 +651,15 @@ void D4ParserSax2::dmr_start_element(void *p, const xmlChar *l, const xmlChar *p
             if (parser->check_attribute("dmrVersion"))
                 parser->dmr()->set_dmr_version(parser->xml_attrs["dmrVersion"].value);
 
+            if (parser->check_attribute("vectorFilter")) {
+                try {
+                    parser->dmr()->set_vector_filter(vector_filter_flags(parser->xml_attrs["vectorFilter"].value));
+                }
+                catch (Error &e) {
+                    D4ParserSax2::dmr_error(parser, e.get_error_message().c_str());
+                }
+            }
+
             if (parser->check_attribute("base"))
                 parser->dmr()->set_request_xml_base(parser->xml_attrs["base"].value);
 
@@ -143,6 +143,13 @@ public:
      */
     value_kind get_kind() const { return d_value_kind; }
 
+    /**
+     * @brief The variable this rvalue references
+     * Unlike value(), this does not read the variable.
+     * @return The variable, or null if this is not a 'basetype' rvalue.
+     */
+    BaseType *get_variable() const { return d_variable; }
+
     // This is the call that will be used to return the value of a function.
     // jhrg 3/10/14
     virtual BaseType *value(DMR &dmr);
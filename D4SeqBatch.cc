@@ -0,0 +1,306 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "D4SeqBatch.h"
+#include "D4Sequence.h"
+
+#include "Byte.h"
+#include "Int8.h"
+#include "Int16.h"
+#include "UInt16.h"
+#include "Int32.h"
+#include "UInt32.h"
+#include "Int64.h"
+#include "UInt64.h"
+#include "Float32.h"
+#include "Float64.h"
+#include "Str.h"
+
+#include "InternalErr.h"
+
+using namespace std;
+
+namespace libdap {
+
+// The number of bytes used to hold one value of type 't' in a column; zero
+// for strings and URLs, which are held in a vector<string>.
+static unsigned int column_width(Type t)
+{
+    switch (t) {
+    case dods_byte_c:
+    case dods_int8_c:
+        return 1;
+    case dods_int16_c:
+    case dods_uint16_c:
+        return 2;
+    case dods_int32_c:
+    case dods_uint32_c:
+    case dods_float32_c:
+        return 4;
+    case dods_int64_c:
+    case dods_uint64_c:
+    case dods_float64_c:
+        return 8;
+    case dods_str_c:
+    case dods_url_c:
+        return 0;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "A sequence read in batches can hold only numbers, strings and URLs.");
+    }
+}
+
+template<typename T, class DT>
+static inline void store_value(BaseType *var, vector<char> &buf, unsigned int row)
+{
+    reinterpret_cast<T*>(&buf[0])[row] = static_cast<DT*>(var)->value();
+}
+
+template<typename T, class DT>
+static inline void load_value(BaseType *var, const vector<char> &buf, unsigned int row)
+{
+    static_cast<DT*>(var)->set_value(reinterpret_cast<const T*>(&buf[0])[row]);
+}
+
+// Set 'var' to the value of 'row' in a column; set its read_p property
+static void set_var_value(BaseType *var, const vector<char> &buf, const vector<string> &str, unsigned int row)
+{
+    switch (var->type()) {
+    case dods_byte_c: load_value<dods_byte, Byte>(var, buf, row); break;
+    case dods_int8_c: load_value<dods_int8, Int8>(var, buf, row); break;
+    case dods_int16_c: load_value<dods_int16, Int16>(var, buf, row); break;
+    case dods_uint16_c: load_value<dods_uint16, UInt16>(var, buf, row); break;
+    case dods_int32_c: load_value<dods_int32, Int32>(var, buf, row); break;
+    case dods_uint32_c: load_value<dods_uint32, UInt32>(var, buf, row); break;
+    case dods_int64_c: load_value<dods_int64, Int64>(var, buf, row); break;
+    case dods_uint64_c: load_value<dods_uint64, UInt64>(var, buf, row); break;
+    case dods_float32_c: load_value<dods_float32, Float32>(var, buf, row); break;
+    case dods_float64_c: load_value<dods_float64, Float64>(var, buf, row); break;
+    case dods_str_c:
+    case dods_url_c:
+        static_cast<Str*>(var)->set_value(str[row]);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unexpected type in a sequence batch.");
+    }
+
+    var->set_read_p(true);
+}
+
+/**
+ * Build a batch for the variables of a sequence.
+ *
+ * @param seq The D4Sequence; the batch references its variables.
+ * @param capacity The batch can hold this many rows.
+ * @exception InternalErr if the sequence holds something other than
+ * scalar numbers, strings and URLs.
+ */
+D4SeqBatch::D4SeqBatch(D4Sequence &seq, unsigned int capacity) :
+    d_capacity(capacity), d_size(0)
+{
+    if (capacity == 0)
+        throw InternalErr(__FILE__, __LINE__, "A sequence batch must hold at least one row.");
+
+    d_columns.resize(seq.element_count());
+
+    vector<Column>::iterator c = d_columns.begin();
+    for (Constructor::Vars_iter i = seq.var_begin(), e = seq.var_end(); i != e; ++i, ++c) {
+        c->var = *i;
+        unsigned int width = column_width((*i)->type());
+        if (width)
+            c->buf.resize(width * capacity);
+        else
+            c->str.resize(capacity);
+    }
+
+    d_selection.reserve(capacity);
+}
+
+/**
+ * Can the values of this sequence be read in batches?
+ * @return True if every variable of the sequence is a scalar number,
+ * string or URL.
+ */
+bool D4SeqBatch::supported(D4Sequence &seq)
+{
+    for (Constructor::Vars_iter i = seq.var_begin(), e = seq.var_end(); i != e; ++i) {
+        switch ((*i)->type()) {
+        case dods_byte_c:
+        case dods_int8_c:
+        case dods_int16_c:
+        case dods_uint16_c:
+        case dods_int32_c:
+        case dods_uint32_c:
+        case dods_int64_c:
+        case dods_uint64_c:
+        case dods_float32_c:
+        case dods_float64_c:
+        case dods_str_c:
+        case dods_url_c:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Record how many rows were read into the batch and select all of them.
+ * @param rows The number of rows; no more than capacity().
+ */
+void D4SeqBatch::set_size(unsigned int rows)
+{
+    if (rows > d_capacity)
+        throw InternalErr(__FILE__, __LINE__, "More rows than a sequence batch can hold.");
+
+    d_size = rows;
+    d_selection.assign(rows, 1);
+}
+
+/**
+ * Find the column that holds the values of a variable.
+ * @param var One of the sequence's variables
+ * @return The column number or -1 if the variable is not one of the
+ * sequence's.
+ */
+int D4SeqBatch::get_column(const BaseType *var) const
+{
+    for (vector<Column>::size_type i = 0; i < d_columns.size(); ++i) {
+        if (d_columns[i].var == var)
+            return i;
+    }
+
+    return -1;
+}
+
+/**
+ * The storage for a column of numbers.
+ * @param i The column
+ * @return A pointer to capacity() values of the column's type
+ * @exception InternalErr if the column holds strings or URLs.
+ */
+char *D4SeqBatch::get_buf(unsigned int i)
+{
+    Column &c = d_columns.at(i);
+    if (c.buf.empty())
+        throw InternalErr(__FILE__, __LINE__, "The variable '" + c.var->name() + "' is not a number.");
+
+    return &c.buf[0];
+}
+
+/**
+ * The storage for a column of strings or URLs.
+ * @param i The column
+ * @return A vector of capacity() strings
+ * @exception InternalErr if the column holds numbers.
+ */
+vector<string> &D4SeqBatch::get_str(unsigned int i)
+{
+    Column &c = d_columns.at(i);
+    if (c.str.empty())
+        throw InternalErr(__FILE__, __LINE__, "The variable '" + c.var->name() + "' is not a string.");
+
+    return c.str;
+}
+
+/**
+ * Copy the values held by the sequence's variables to a row of the batch.
+ * This is how D4Sequence::read_batch() fills a batch using read().
+ * @param row The row number
+ */
+void D4SeqBatch::store_row(unsigned int row)
+{
+    if (row >= d_capacity)
+        throw InternalErr(__FILE__, __LINE__, "Row number out of range in a sequence batch.");
+
+    for (vector<Column>::iterator c = d_columns.begin(), e = d_columns.end(); c != e; ++c) {
+        switch (c->var->type()) {
+        case dods_byte_c: store_value<dods_byte, Byte>(c->var, c->buf, row); break;
+        case dods_int8_c: store_value<dods_int8, Int8>(c->var, c->buf, row); break;
+        case dods_int16_c: store_value<dods_int16, Int16>(c->var, c->buf, row); break;
+        case dods_uint16_c: store_value<dods_uint16, UInt16>(c->var, c->buf, row); break;
+        case dods_int32_c: store_value<dods_int32, Int32>(c->var, c->buf, row); break;
+        case dods_uint32_c: store_value<dods_uint32, UInt32>(c->var, c->buf, row); break;
+        case dods_int64_c: store_value<dods_int64, Int64>(c->var, c->buf, row); break;
+        case dods_uint64_c: store_value<dods_uint64, UInt64>(c->var, c->buf, row); break;
+        case dods_float32_c: store_value<dods_float32, Float32>(c->var, c->buf, row); break;
+        case dods_float64_c: store_value<dods_float64, Float64>(c->var, c->buf, row); break;
+        case dods_str_c:
+        case dods_url_c:
+            c->str[row] = static_cast<Str*>(c->var)->value();
+            break;
+        default:
+            throw InternalErr(__FILE__, __LINE__, "Unexpected type in a sequence batch.");
+        }
+    }
+}
+
+/**
+ * Set the values of the sequence's variables to those in a row of the
+ * batch. The variables' read_p property is set.
+ * @param row The row number
+ */
+void D4SeqBatch::load_row(unsigned int row)
+{
+    if (row >= d_size)
+        throw InternalErr(__FILE__, __LINE__, "Row number out of range in a sequence batch.");
+
+    for (vector<Column>::iterator c = d_columns.begin(), e = d_columns.end(); c != e; ++c) {
+        set_var_value(c->var, c->buf, c->str, row);
+    }
+}
+
+/**
+ * Get the value in one row of a column. The sequence's variables are not
+ * changed.
+ * @param i The column
+ * @param row The row number
+ * @return A copy of the column's variable that holds the value. The caller
+ * must delete it.
+ */
+BaseType *D4SeqBatch::get_value(unsigned int i, unsigned int row)
+{
+    if (row >= d_size)
+        throw InternalErr(__FILE__, __LINE__, "Row number out of range in a sequence batch.");
+
+    Column &c = d_columns.at(i);
+    BaseType *value = c.var->ptr_duplicate();
+    try {
+        set_var_value(value, c.buf, c.str, row);
+    }
+    catch (...) {
+        delete value;
+        throw;
+    }
+
+    return value;
+}
+
+} // namespace libdap
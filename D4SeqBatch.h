@@ -0,0 +1,106 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef _d4seqbatch_h
+#define _d4seqbatch_h 1
+
+#include <string>
+#include <vector>
+
+namespace libdap
+{
+
+class BaseType;
+class D4Sequence;
+
+/**
+ * @brief Values for a block of a D4Sequence's rows, held by column
+ *
+ * A batch has one column for each of the sequence's variables, in the
+ * order they were added to the sequence. Every variable must be a scalar
+ * number, String or URL; use supported() to test a sequence. Handlers that
+ * can read many rows at once fill a batch in D4Sequence::read_batch() and
+ * the sequence's filter is then evaluated for the whole block using
+ * D4FilterClauseList::value(D4SeqBatch &).
+ *
+ * Numbers are stored in the buffer returned by get_buf(), which holds
+ * capacity() values of the column's type (e.g., dods_int32 for an Int32
+ * variable). Strings and URLs are stored in get_str().
+ *
+ * The selection holds one byte, not one bit, per row so that the filter
+ * predicates are simple loops the compiler can vectorize.
+ */
+class D4SeqBatch
+{
+private:
+    struct Column {
+        BaseType *var;                  // Weak pointer to the sequence's variable
+        std::vector<char> buf;
+        std::vector<std::string> str;
+    };
+
+    std::vector<Column> d_columns;
+
+    unsigned int d_capacity;
+    unsigned int d_size;
+
+    std::vector<unsigned char> d_selection;
+
+    D4SeqBatch(const D4SeqBatch &);
+    D4SeqBatch &operator=(const D4SeqBatch &);
+
+public:
+    D4SeqBatch(D4Sequence &seq, unsigned int capacity);
+    virtual ~D4SeqBatch() { }
+
+    static bool supported(D4Sequence &seq);
+
+    /// The most rows the batch can hold
+    unsigned int capacity() const { return d_capacity; }
+    /// The number of rows read into the batch
+    unsigned int size() const { return d_size; }
+    void set_size(unsigned int rows);
+
+    unsigned int num_columns() const { return d_columns.size(); }
+    BaseType *get_var(unsigned int i) const { return d_columns.at(i).var; }
+    int get_column(const BaseType *var) const;
+
+    char *get_buf(unsigned int i);
+    std::vector<std::string> &get_str(unsigned int i);
+
+    /**
+     * One entry for each of the size() rows; non-zero if the row should be
+     * kept. set_size() selects every row.
+     */
+    std::vector<unsigned char> &selection() { return d_selection; }
+
+    void store_row(unsigned int row);
+    void load_row(unsigned int row);
+
+    BaseType *get_value(unsigned int i, unsigned int row);
+};
+
+} // namespace libdap
+
+#endif // _d4seqbatch_h
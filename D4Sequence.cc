@@ -31,6 +31,7 @@
 #include <sstream>
 
 #include "D4Sequence.h"
+#include "D4SeqBatch.h"
 
 #include "D4StreamMarshaller.h"
 #include "D4StreamUnMarshaller.h"
@@ -119,6 +120,7 @@ void D4Sequence::m_duplicate(const D4Sequence &s)
     }
 
     d_copy_clauses = s.d_copy_clauses;
+    d_batch_size = s.d_batch_size;
     d_clauses = (s.d_clauses != 0) ? new D4FilterClauseList(*s.d_clauses) : 0;    // deep copy if != 0
 }
 
@@ -133,7 +135,7 @@ void D4Sequence::m_duplicate(const D4Sequence &s)
 
  @brief The Sequence constructor. */
 D4Sequence::D4Sequence(const string &n) :
-        Constructor(n, dods_sequence_c, true /* is dap4 */), d_clauses(0), d_copy_clauses(true), d_length(0)
+        Constructor(n, dods_sequence_c, true /* is dap4 */), d_clauses(0), d_copy_clauses(true), d_batch_size(0), d_length(0)
 {
 }
 
@@ -148,7 +150,7 @@ D4Sequence::D4Sequence(const string &n) :
 
  @brief The Sequence server-side constructor. */
 D4Sequence::D4Sequence(const string &n, const string &d) :
-        Constructor(n, d, dods_sequence_c, true /* is dap4 */), d_clauses(0), d_copy_clauses(true), d_length(0)
+        Constructor(n, d, dods_sequence_c, true /* is dap4 */), d_clauses(0), d_copy_clauses(true), d_batch_size(0), d_length(0)
 {
 }
 
@@ -256,6 +258,37 @@ bool D4Sequence::read_next_instance(bool filter)
     return !eof;
 }
 
+/**
+ * @brief Read the next block of rows of the sequence
+ * Handlers that can read many rows at once should specialize this method
+ * and use set_batch_size() to enable it. Store the values of up to
+ * batch.capacity() rows in the batch's columns and call batch.set_size()
+ * with the number of rows read. The filter is not evaluated here; the
+ * caller evaluates it for the whole batch.
+ *
+ * This implementation fills the batch using read(), one row at a time.
+ *
+ * @param batch Store the values here. The batch's columns match the
+ * variables of this sequence.
+ * @return The number of rows read; zero when there are no more rows.
+ */
+unsigned int D4Sequence::read_batch(D4SeqBatch &batch)
+{
+    unsigned int rows = 0;
+    bool eof = false;
+    while (!eof && rows < batch.capacity()) {
+        eof = read();
+        if (!eof)
+            batch.store_row(rows++);
+
+        // Set up the next call to get another row's worth of data
+        set_read_p(false);
+    }
+
+    batch.set_size(rows);
+    return rows;
+}
+
 void D4Sequence::intern_data()
 {
     read_sequence_values(true);
@@ -308,6 +341,11 @@ void D4Sequence::read_sequence_values(bool filter)
 
     if (read_p()) return;
 
+    if (d_batch_size > 0 && D4SeqBatch::supported(*this)) {
+        read_sequence_batches(filter);
+        return;
+    }
+
     // Read the data values, then serialize. NB: read_next_instance sets d_length
     // evaluates the filter expression
     while (read_next_instance(filter)) {
@@ -346,6 +384,46 @@ void D4Sequence::read_sequence_values(bool filter)
     DBGN(cerr << __PRETTY_FUNCTION__ << " END added " << d_values.size() << endl);
 }
 
+/**
+ * @brief Read a Sequence's values into memory, a batch at a time
+ *
+ * The batched version of read_sequence_values(). Values are read using
+ * read_batch() and the filter is evaluated for each batch; only the rows
+ * that pass the filter are copied into the sequence's values.
+ *
+ * @param filter True if the filter expression bound to this sequence
+ * should be evaluated.
+ */
+void D4Sequence::read_sequence_batches(bool filter)
+{
+    D4SeqBatch batch(*this, d_batch_size);
+
+    while (read_batch(batch) > 0) {
+        if (filter && d_clauses)
+            d_clauses->value(batch);
+
+        vector<unsigned char> &selection = batch.selection();
+        for (unsigned int r = 0; r < batch.size(); ++r) {
+            if (!selection[r])
+                continue;
+
+            D4SeqRow* row = new D4SeqRow;
+            for (unsigned int c = 0; c < batch.num_columns(); ++c) {
+                if (batch.get_var(c)->send_p())
+                    row->push_back(batch.get_value(c, r));
+            }
+
+            d_values.push_back(row);
+        }
+    }
+
+    set_read_p(false);
+
+    set_length(d_values.size());
+
+    DBGN(cerr << __PRETTY_FUNCTION__ << " END added " << d_values.size() << endl);
+}
+
 /**
  * @brief Serialize the values of a D4Sequence
  * This method assumes that the underlying data store cannot/does not return a count
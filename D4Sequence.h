@@ -37,6 +37,7 @@ namespace libdap
 {
 class BaseType;
 class D4FilterClauseList;
+class D4SeqBatch;
 
 /** The type BaseTypeRow is used to store single rows of values in an
     instance of D4Sequence. Values are stored in instances of BaseType. */
@@ -144,6 +145,10 @@ private:
     // that. ...purely an optimization.
     bool d_copy_clauses;
 
+    // Read this many rows at a time using read_batch(); zero to read one
+    // row at a time using read().
+    unsigned int d_batch_size;
+
 protected:
     // This holds the values of the sequence. Values are stored in
     // instances of BaseTypeRow objects which hold instances of BaseType.
@@ -164,6 +169,7 @@ protected:
     // Specialize this if you have a data source that requires read()
     // recursively call itself for child sequences.
     void read_sequence_values(bool filter);
+    void read_sequence_batches(bool filter);
 
     friend class D4SequenceTest;
 
@@ -200,6 +206,20 @@ public:
 
     virtual bool read_next_instance(bool filter);
 
+    virtual unsigned int read_batch(D4SeqBatch &batch);
+
+    /**
+     * @brief Read this sequence's values in batches
+     * When the batch size is not zero and all of the sequence's variables
+     * are scalar numbers, strings or URLs, intern_data() and serialize()
+     * read the values using read_batch() and evaluate the filter for a
+     * whole batch at a time.
+     * @param rows The number of rows in each batch; zero (the default)
+     * reads one row at a time using read().
+     */
+    virtual void set_batch_size(unsigned int rows) { d_batch_size = rows; }
+    virtual unsigned int get_batch_size() const { return d_batch_size; }
+
     virtual void intern_data(ConstraintEvaluator &, DDS &) {
     	throw InternalErr(__FILE__, __LINE__, "Not implemented for DAP4");
     }
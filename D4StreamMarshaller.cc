@@ -34,6 +34,7 @@
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <vector>
 
 //#define DODS_DEBUG 1
 
@@ -45,10 +46,12 @@
 #ifdef USE_POSIX_THREADS
 #include "MarshallerThread.h"
 #endif
+#include "vector_filter.h"
 
 #if USE_XDR_FOR_IEEE754_ENCODING
 #include "XDRUtils.h"
 #include "util.h"
+#include "vector_swap.h"
 #endif
 
 #include "debug.h"
@@ -151,30 +154,15 @@ void D4StreamMarshaller::m_serialize_reals(char *val, unsigned int num, int widt
 
         // If this is a little-endian host, twiddle the bytes
         static bool twiddle_bytes = !is_host_big_endian();
-        if (twiddle_bytes) {
-            if (width == 4) {
-                dods_float32 *lbuf = reinterpret_cast<dods_float32*>(&buf[0]);
-                while (num--) {
-                    dods_int32 *i = reinterpret_cast<dods_int32*>(lbuf++);
-                    *i = bswap_32(*i);
-                }
-            }
-            else { // width == 8
-                dods_float64 *lbuf = reinterpret_cast<dods_float64*>(&buf[0]);
-                while (num--) {
-                    dods_int64 *i = reinterpret_cast<dods_int64*>(lbuf++);
-                    *i = bswap_64(*i);
-                }
-            }
-        }
+        if (twiddle_bytes)
+            swap_vector_elements(buf, num, width);
 #ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, size);
+        char *tbuf = tm->get_buffer(size);
+        memcpy(tbuf, buf, size);
+        tm->write(d_out, tbuf, size);
 
-        // The child thread will delete buf when it's done
         xdr_destroy(&xdr);
+        delete [] buf;
 #else
         d_out.write(&buf[0], size);
         xdr_destroy(&xdr);
@@ -190,6 +178,57 @@ void D4StreamMarshaller::m_serialize_reals(char *val, unsigned int num, int widt
 }
 #endif
 
+#ifdef USE_POSIX_THREADS
+/**
+ * Queue 'bytes' bytes from 'val' for the writer thread. The data are copied
+ * to one of the thread's buffers first; this blocks only if all of those
+ * buffers are waiting to be sent.
+ */
+void D4StreamMarshaller::m_queue_vector(const char *val, int64_t bytes)
+{
+    char *buf = tm->get_buffer(bytes);
+    memcpy(buf, val, bytes);
+
+    tm->write(d_out, buf, bytes);
+}
+#endif
+
+/**
+ * Write 'num' elements, each 'width' bytes, from 'val', applying 'filters'
+ * on the way (see vector_filter.h). The filtered values are built in a
+ * separate buffer so the caller's values are not changed.
+ */
+void D4StreamMarshaller::m_write_vector(const char *val, int64_t num, int width, unsigned int filters)
+{
+    int64_t bytes = num * width;
+
+    if (filters == vector_filter_none || num == 0) {
+#ifdef USE_POSIX_THREADS
+        m_queue_vector(val, bytes);
+#else
+        d_out.write(val, bytes);
+#endif
+    }
+    else {
+#ifdef USE_POSIX_THREADS
+        char *buf = tm->get_buffer(bytes);
+        try {
+            filter_vector(val, buf, num, width, filters);
+        }
+        catch (...) {
+            tm->release_buffer(buf);
+            throw;
+        }
+
+        tm->write(d_out, buf, bytes);
+#else
+        vector<char> buf(bytes);
+        filter_vector(val, &buf[0], num, width, filters);
+        d_out.write(&buf[0], bytes);
+#endif
+    }
+}
+
 /** Build an instance of D4StreamMarshaller. Bind the C++ stream out to this
  * instance. If the write_data parameter is true, write the data in addition
  * to computing and sending the checksum.
@@ -198,7 +237,7 @@ void D4StreamMarshaller::m_serialize_reals(char *val, unsigned int num, int widt
  * @param write_data If true, write data values. True by default
  */
 D4StreamMarshaller::D4StreamMarshaller(ostream &out, bool write_data) :
-        d_out(out), d_write_data(write_data), tm(0)
+        d_out(out), d_write_data(write_data), d_vector_filter(vector_filter_none), tm(0)
 {
 	assert(sizeof(std::streamsize) >= sizeof(int64_t));
 
@@ -521,15 +560,12 @@ void D4StreamMarshaller::put_opaque_dap4(const char *val, int64_t len)
 
     if (d_write_data) {
 #ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
+        // Queue the length prefix and the data as a single write
+        char *byte_buf = tm->get_buffer(len + sizeof(int64_t));
+        memcpy(byte_buf, &len, sizeof(int64_t));
+        memcpy(byte_buf + sizeof(int64_t), val, len);
 
-        d_out.write(reinterpret_cast<const char*>(&len), sizeof(int64_t));
-
-        char *byte_buf = new char[len];
-        memcpy(byte_buf, val, len);
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, byte_buf, len);
+        tm->write(d_out, byte_buf, len + sizeof(int64_t));
 #else
         d_out.write(reinterpret_cast<const char*>(&len), sizeof(int64_t));
         d_out.write(val, len);
@@ -549,19 +585,8 @@ void D4StreamMarshaller::put_vector(char *val, int64_t num_bytes)
 
     checksum_update(val, num_bytes);
 
-    if (d_write_data) {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[num_bytes];
-        memcpy(buf, val, num_bytes);
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, num_bytes);
-#else
-        d_out.write(val, num_bytes);
-#endif
-    }
+    if (d_write_data)
+        m_write_vector(val, num_bytes, 1, d_vector_filter & vector_filter_delta);
 }
 
 void D4StreamMarshaller::put_vector(char *val, int64_t num_elem, int elem_size)
@@ -597,19 +622,8 @@ void D4StreamMarshaller::put_vector(char *val, int64_t num_elem, int elem_size)
 
     checksum_update(val, bytes);
 
-    if (d_write_data) {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[bytes];
-        memcpy(buf, val, bytes);
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, bytes);
-#else
-        d_out.write(val, bytes);
-#endif
-    }
+    if (d_write_data)
+        m_write_vector(val, num_elem, elem_size, d_vector_filter);
 }
 
 /**
@@ -634,23 +648,13 @@ void D4StreamMarshaller::put_vector_float32(char *val, int64_t num_elem)
 	// to test that num can be multiplied by 4. A
 	assert(!(num_elem & 0xe000000000000000));
 
-	num_elem = num_elem << 2;	// num_elem is now the number of bytes
-
-    checksum_update(val, num_elem);
+	int64_t bytes = num_elem << 2;
 
-    if (d_write_data) {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[num_elem];
-        memcpy(buf, val, num_elem);
+    checksum_update(val, bytes);
 
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, num_elem);
-#else
-    	d_out.write(val, num_elem);
-#endif
-    }
+    // Delta encoding is for integers only
+    if (d_write_data)
+        m_write_vector(val, num_elem, 4, d_vector_filter & vector_filter_shuffle);
 
 #else
 	assert(val);
@@ -671,17 +675,7 @@ void D4StreamMarshaller::put_vector_float32(char *val, int64_t num_elem)
             m_serialize_reals(val, num_elem, 4, type);
         }
         else {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[bytes];
-        memcpy(buf, val, bytes);
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, bytes);
-#else
-        d_out.write(val, bytes);
-#endif
+            m_write_vector(val, num_elem, 4, d_vector_filter & vector_filter_shuffle);
         }
     }
 #endif
@@ -705,23 +699,12 @@ void D4StreamMarshaller::put_vector_float64(char *val, int64_t num_elem)
 	// See comment above
 	assert(!(num_elem & 0xf000000000000000));
 
-	num_elem = num_elem << 3;	// num_elem is now the number of bytes
-
-    checksum_update(val, num_elem);
+	int64_t bytes = num_elem << 3;
 
-    if (d_write_data) {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[num_elem];
-        memcpy(buf, val, num_elem);
+    checksum_update(val, bytes);
 
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, num_elem);
-#else
-        d_out.write(val, num_elem);
-#endif
-    }
+    if (d_write_data)
+        m_write_vector(val, num_elem, 8, d_vector_filter & vector_filter_shuffle);
 #else
 	assert(val);
 	assert(num_elem >= 0);
@@ -741,17 +724,7 @@ void D4StreamMarshaller::put_vector_float64(char *val, int64_t num_elem)
             m_serialize_reals(val, num_elem, 8, type);
         }
         else {
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-
-        char *buf = new char[bytes];
-        memcpy(buf, val, bytes);
-
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, buf, bytes);
-#else
-        d_out.write(val, bytes);
-#endif
+            m_write_vector(val, num_elem, 8, d_vector_filter & vector_filter_shuffle);
         }
     }
 #endif
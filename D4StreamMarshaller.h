@@ -79,6 +79,8 @@ private:
     ostream &d_out;
     bool d_write_data; // jhrg 1/27/12
 
+    unsigned int d_vector_filter;
+
     Crc32 d_checksum;
 
     MarshallerThread *tm;
@@ -91,11 +93,22 @@ private:
 #if USE_XDR_FOR_IEEE754_ENCODING
     void m_serialize_reals(char *val, int64_t num, int width, Type type);
 #endif
+    void m_queue_vector(const char *val, int64_t bytes);
+    void m_write_vector(const char *val, int64_t num, int width, unsigned int filters);
 
 public:
     D4StreamMarshaller(std::ostream &out, bool write_data = true);
     virtual ~D4StreamMarshaller();
 
+    /**
+     * Filter the values of vectors before they are written; 'filters' is
+     * a combination of the vector_filter values (see vector_filter.h). The
+     * receiver must be told to undo them; servers do that using the DMR
+     * (see DMR::set_vector_filter()).
+     */
+    void set_vector_filter(unsigned int filters) { d_vector_filter = filters; }
+    unsigned int get_vector_filter() const { return d_vector_filter; }
+
     virtual void reset_checksum();
     virtual string get_checksum();
     virtual void checksum_update(const void *data, unsigned long len);
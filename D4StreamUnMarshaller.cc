@@ -34,6 +34,7 @@
 #include <limits>
 #include <string>
 #include <sstream>
+#include <vector>
 
 //#define DODS_DEBUG2 1
 //#define DODS_DEBUG 1
@@ -42,6 +43,8 @@
 //#include "XDRUtils.h"
 #include "InternalErr.h"
 #include "D4StreamUnMarshaller.h"
+#include "vector_swap.h"
+#include "vector_filter.h"
 #include "debug.h"
 
 namespace libdap {
@@ -56,7 +59,8 @@ namespace libdap {
  * @param in Read from this input stream
  * @param is_stream_bigendian The byte order of the data in the stream
  */
-D4StreamUnMarshaller::D4StreamUnMarshaller(istream &in, bool twiddle_bytes) : d_in( in ), d_twiddle_bytes(twiddle_bytes)
+D4StreamUnMarshaller::D4StreamUnMarshaller(istream &in, bool twiddle_bytes) : d_in( in ), d_twiddle_bytes(twiddle_bytes),
+    d_vector_filter(vector_filter_none)
 {
 	assert(sizeof(std::streamsize) >= sizeof(int64_t));
 
@@ -77,7 +81,8 @@ D4StreamUnMarshaller::D4StreamUnMarshaller(istream &in, bool twiddle_bytes) : d_
  *
  * @param in
  */
-D4StreamUnMarshaller::D4StreamUnMarshaller(istream &in) : d_in( in ), d_twiddle_bytes(false)
+D4StreamUnMarshaller::D4StreamUnMarshaller(istream &in) : d_in( in ), d_twiddle_bytes(false),
+    d_vector_filter(vector_filter_none)
 {
 	assert(sizeof(std::streamsize) >= sizeof(int64_t));
 
@@ -299,7 +304,7 @@ D4StreamUnMarshaller::get_opaque_dap4( vector<uint8_t> &val )
 void
 D4StreamUnMarshaller::get_vector( char *val, int64_t bytes )
 {
-    d_in.read(val, bytes);
+    m_read_vector(val, bytes, 1, d_vector_filter & vector_filter_delta);
 }
 
 #if USE_XDR_FOR_IEEE754_ENCODING
@@ -328,36 +333,39 @@ void D4StreamUnMarshaller::m_deserialize_reals(char *val, int64_t num, int width
 }
 #endif
 
+/**
+ * Swap the bytes of the elements of a vector. This uses the vectorized
+ * kernels in vector_swap.cc since, when the server and client differ in
+ * byte order, this dominates the time to read large arrays.
+ */
 void D4StreamUnMarshaller::m_twidle_vector_elements(char *vals, int64_t num, int width)
 {
-    switch (width) {
-        case 2: {
-            dods_int16 *local = reinterpret_cast<dods_int16*>(vals);
-            while (num--) {
-                *local = bswap_16(*local);
-                local++;
-            }
-            break;
-        }
-        case 4: {
-            dods_int32 *local = reinterpret_cast<dods_int32*>(vals);;
-            while (num--) {
-                *local = bswap_32(*local);
-                local++;
-            }
-            break;
-        }
-        case 8: {
-            dods_int64 *local = reinterpret_cast<dods_int64*>(vals);;
-            while (num--) {
-                *local = bswap_64(*local);
-                local++;
-            }
-            break;
-        }
-        default:
-            throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    swap_vector_elements(vals, num, width);
+}
+
+/**
+ * Read 'num' elements, each 'width' bytes, into 'val' and undo 'filters'.
+ * The bytes are put back in order first, then swapped if needed, so that
+ * the deltas are summed in this host's byte order.
+ */
+void D4StreamUnMarshaller::m_read_vector(char *val, int64_t num, int width, unsigned int filters)
+{
+    int64_t bytes = num * width;
+
+    if ((filters & vector_filter_shuffle) && width > 1 && num > 0) {
+        vector<char> buf(bytes);
+        d_in.read(&buf[0], bytes);
+        unshuffle_vector(&buf[0], val, num, width);
+    }
+    else {
+        d_in.read(val, bytes);
     }
+
+    if (d_twiddle_bytes && width > 1)
+        m_twidle_vector_elements(val, num, width);
+
+    if (filters & vector_filter_delta)
+        undelta_vector(val, num, width);
 }
 
 void
@@ -369,35 +377,25 @@ D4StreamUnMarshaller::get_vector(char *val, int64_t num_elem, int elem_size)
 	assert(num_elem >= 0);
 	assert(elem_size > 0);
 
-	int64_t bytes;
-
 	switch (elem_size) {
 	case 1:
 		assert(!"Don't call this method for bytes, use put_vector(val, bytes) instead");
-		bytes = num_elem;
 		break;
 	case 2:
 		// Don't bother testing the sign bit
 		assert(!(num_elem & 0x4000000000000000)); // 0x 40 00 --> 0100 0000
-		bytes = num_elem << 1;
 		break;
 	case 4:
 		assert(!(num_elem & 0x6000000000000000)); // 0x 60 00 --> 0110 0000
-		bytes = num_elem << 2;
 		break;
 	case 8:
 		assert(!(num_elem & 0x7000000000000000)); // 0111 0000
-		bytes = num_elem << 3;
 		break;
 	default:
-		bytes = num_elem * elem_size;
 		break;
 	}
 
-    d_in.read(val, bytes);
-
-    if (d_twiddle_bytes)
-        m_twidle_vector_elements(val, num_elem, elem_size);
+    m_read_vector(val, num_elem, elem_size, d_vector_filter);
 }
 
 void
@@ -409,12 +407,7 @@ D4StreamUnMarshaller::get_vector_float32(char *val, int64_t num_elem)
 	assert(num_elem >= 0);
 	assert(!(num_elem & 0x6000000000000000)); // 0x 60 00 --> 0110 0000
 
-	int64_t bytes = num_elem << 2;
-
-    d_in.read(val, bytes);
-
-    if (d_twiddle_bytes)
-        m_twidle_vector_elements(val, num_elem, sizeof(dods_float32));
+    m_read_vector(val, num_elem, sizeof(dods_float32), d_vector_filter & vector_filter_shuffle);
 
 #else
     if (type == dods_float32_c && !std::numeric_limits<float>::is_iec559) {
@@ -441,12 +434,7 @@ D4StreamUnMarshaller::get_vector_float64(char *val, int64_t num_elem)
 	assert(num_elem >= 0);
 	assert(!(num_elem & 0x7000000000000000)); // 0x 70 00 --> 0111 0000
 
-	int64_t bytes = num_elem << 3;
-
-    d_in.read(val, bytes);
-
-    if (d_twiddle_bytes)
-        m_twidle_vector_elements(val, num_elem, sizeof(dods_float64));
+    m_read_vector(val, num_elem, sizeof(dods_float64), d_vector_filter & vector_filter_shuffle);
 
 #else
     if (type == dods_float32_c && !std::numeric_limits<float>::is_iec559) {
@@ -70,6 +70,8 @@ private:
     istream &d_in;
     bool d_twiddle_bytes;
 
+    unsigned int d_vector_filter;
+
 #if USE_XDR_FOR_IEEE754_ENCODING
     // These are used for reals that need to be converted from IEEE 754
     XDR d_source;
@@ -83,6 +85,7 @@ private:
     void m_deserialize_reals(char *val, int64_t num, int width, Type type);
 #endif
     void m_twidle_vector_elements(char *vals, int64_t num, int width);
+    void m_read_vector(char *val, int64_t num, int width, unsigned int filters);
 
 public:
     D4StreamUnMarshaller(istream &in, bool twiddle_bytes);
@@ -91,6 +94,14 @@ public:
 
     void set_twiddle_bytes(bool twiddle) { d_twiddle_bytes = twiddle; }
 
+    /**
+     * Undo these filters when reading vectors; this must match the value
+     * passed to D4StreamMarshaller::set_vector_filter() by the sender, which
+     * is found in the DMR (see DMR::vector_filter()).
+     */
+    void set_vector_filter(unsigned int filters) { d_vector_filter = filters; }
+    unsigned int get_vector_filter() const { return d_vector_filter; }
+
     /**
      * @brief Is the data source we are reading from a big-endian machine?
      * We need this because the value of the CRC32 checksum is dependent on
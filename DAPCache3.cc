@@ -29,6 +29,7 @@
 #include "config.h"
 
 #include <sys/file.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -38,11 +39,15 @@
 #include <stdlib.h>
 #endif
 
+#include <stdint.h>
+
 #include <string>
 #include <sstream>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <cerrno>
+#include <ctime>
 
 #include "DAPCache3.h"
 
@@ -72,6 +77,14 @@ static const unsigned long long BYTES_PER_MEG = 1048576ULL;
 // 2^64 / 2^20 == 2^44
 static const unsigned long long MAX_CACHE_SIZE_IN_MEGABYTES = (1ULL << 44);
 
+// Rewrite the index journal when it holds more than this many records that
+// are no longer needed
+static const unsigned long INDEX_SLACK = 1024;
+
+// The number of shards the cache is divided into. All of the processes that
+// share a cache must use the same value.
+static const unsigned int DAP_CACHE_SHARDS = 16;
+
 DAPCache3 *DAPCache3::d_instance = 0;
 
 
@@ -439,26 +452,374 @@ void DAPCache3::m_initialize_cache_info()
 
     m_check_ctor_params(); // Throws InternalErr on error.
 
-    d_cache_info = d_cache_dir + "/dap.cache.info";
+    d_shards.resize(DAP_CACHE_SHARDS);
+    for (unsigned int i = 0; i < DAP_CACHE_SHARDS; ++i) {
+        cache_shard &shard = d_shards[i];
+
+        ostringstream oss;
+        oss << i;
+        shard.info = d_cache_dir + "/dap.cache.info." + oss.str();
+        shard.index = d_cache_dir + "/dap.cache.index." + oss.str();
+        shard.index_fd = -1;
+        shard.lock_type = F_UNLCK;
+
+        // See if we can create it. If so, that means it doesn't exist. So make it and
+        // set the shard's initial size to zero.
+        if (createLockedFile(shard.info, shard.info_fd)) {
+            // initialize the shard size to zero
+            unsigned long long size = 0;
+            if (write(shard.info_fd, &size, sizeof(unsigned long long)) != sizeof(unsigned long long))
+                throw InternalErr(__FILE__, __LINE__, "Could not write size info to the cache info file in startup!");
 
-    // See if we can create it. If so, that means it doesn't exist. So make it and
-    // set the cache initial size to zero.
-    if (createLockedFile(d_cache_info, d_cache_info_fd)) {
-		// initialize the cache size to zero
-		unsigned long long size = 0;
-		if (write(d_cache_info_fd, &size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-			throw InternalErr(__FILE__, __LINE__, "Could not write size info to the cache info file in startup!");
+            // This leaves the info_fd file descriptor open
+            m_unlock_shard(shard);
+        }
+        else {
+            if ((shard.info_fd = open(shard.info.c_str(), O_RDWR)) == -1) {
+                throw InternalErr(__FILE__, __LINE__, get_errno());
+            }
+        }
 
-		// This leaves the d_cache_info_fd file descriptor open
-		unlock_cache();
-	}
-	else {
-		if ((d_cache_info_fd = open(d_cache_info.c_str(), O_RDWR)) == -1) {
-			throw InternalErr(__FILE__, __LINE__, get_errno());
-		}
-	}
+        DBG(cerr << "shard " << i << " info_fd: " << shard.info_fd << endl);
+    }
+
+    // If there's no index, or it is corrupt, build one from the files already
+    // in the cache. The directory is read once for all of the shards that need it.
+    try {
+        lock_cache_write();
+
+        bool rebuild = false;
+        for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i) {
+            m_open_index(*i);
+            m_read_index(*i);   // sets index_rebuild if the journal is corrupt
+            rebuild = rebuild || i->index_rebuild;
+        }
+
+        if (rebuild) {
+            CacheFiles contents;
+            m_collect_cache_dir_info(contents);
+            for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+                if (i->index_rebuild)
+                    m_rebuild_index(*i, contents);
+        }
+
+        // A journal left long by processes that only read from the cache
+        for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+            if (m_index_is_stale(*i))
+                m_compact_index(*i);
+
+        unlock_cache();
+    }
+    catch (...) {
+        unlock_cache();
+        throw;
+    }
+}
+
+/*
+  Shards. Every operation that changes the cache used to lock one file,
+  so every process adding to the cache waited for all the others. The
+  files are now divided into DAP_CACHE_SHARDS shards using a hash of their
+  names and each shard has its own info file, which holds the total size
+  of the files in the shard and is locked to control access to them, and
+  its own index. Processes working with files in different shards do not
+  wait for each other.
+
+  The size limit is applied to the cache as a whole: get_cache_size()
+  adds up the sizes of the shards (without locking all of them, so the
+  total is approximate) and update_and_purge() purges every shard that is
+  larger than its share of the target size.
+ */
+
+// FNV-1a
+static unsigned int shard_hash(const string &file)
+{
+    uint32_t hash = 2166136261U;
+    for (string::const_iterator i = file.begin(); i != file.end(); ++i) {
+        hash ^= static_cast<unsigned char>(*i);
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/** Private. The shard that holds 'file'. */
+DAPCache3::cache_shard &DAPCache3::m_shard(const string &file)
+{
+    return d_shards[shard_hash(file) % d_shards.size()];
+}
+
+/** Private. Lock a shard's info file; 'type' is F_RDLCK or F_WRLCK. */
+void DAPCache3::m_lock_shard(cache_shard &shard, int type)
+{
+    DBG(cerr << "lock_shard - info_fd: " << shard.info_fd << endl);
+
+    if (fcntl(shard.info_fd, F_SETLKW, lock(type)) == -1) {
+        throw InternalErr(__FILE__, __LINE__, "An error occurred trying to lock the cache-control file" + get_errno());
+    }
+
+    shard.lock_type = type;
+}
+
+/** Private. Unlock a shard's info file. */
+void DAPCache3::m_unlock_shard(cache_shard &shard)
+{
+    DBG(cerr << "DAP Cache: unlock: shard info (fd: " << shard.info_fd << ")" << endl);
+
+    if (fcntl(shard.info_fd, F_SETLK, lock(F_UNLCK)) == -1) {
+        throw InternalErr(__FILE__, __LINE__, "An error occurred trying to unlock the cache-control file" + get_errno());
+    }
+
+    shard.lock_type = F_UNLCK;
+}
+
+/** Private. Read the size from a shard's info file. */
+unsigned long long DAPCache3::m_read_shard_size(cache_shard &shard)
+{
+    unsigned long long size;
+    if (pread(shard.info_fd, &size, sizeof(unsigned long long), 0) != sizeof(unsigned long long))
+        throw InternalErr(__FILE__, __LINE__, "Could not get read size info from the cache info file!");
+
+    return size;
+}
+
+/** Private. Write the size to a shard's info file. The shard must be
+ * write-locked. */
+void DAPCache3::m_write_shard_size(cache_shard &shard, unsigned long long size)
+{
+    if (pwrite(shard.info_fd, &size, sizeof(unsigned long long), 0) != sizeof(unsigned long long))
+        throw InternalErr(__FILE__, __LINE__, "Could not write size info to the cache info file!");
+}
+
+/*
+  The cache index. Purging the cache used to mean reading the cache
+  directory, calling stat(2) for every file in it and sorting the result,
+  all with the cache locked. Now each process keeps an index of the files
+  in each shard (name, size and last use time) ordered by last use, so the
+  files to remove are simply taken from the front.
+
+  The index is shared using a journal file (dap.cache.index.<shard>). Every
+  change is appended to the journal as a record, using one write(2) to a
+  file opened with O_APPEND, and always while holding a lock on the shard's
+  info file. Before using its index, a process reads the records added
+  since it last looked. When the journal holds many more records than
+  there are files in the shard, it is rewritten (with the shard
+  write-locked) and renamed into place; other processes see the new inode
+  and reread it. That is checked whenever a record is added with the shard
+  write-locked, after a cache hit and when the cache is opened, so the
+  journal of a cache that is never purged does not grow without bound.
+
+  The journal starts with INDEX_MAGIC. Each record is an index_record
+  followed by name_len bytes of file name, all in the host's byte order.
+ */
+
+enum index_op {
+    index_add = 1,      // add a file or set its size; also sets the time
+    index_touch = 2,    // the file was used
+    index_remove = 3    // the file was removed
+};
+
+static const char INDEX_MAGIC[8] = { 'D', 'A', 'P', 'I', 'D', 'X', '0', '1' };
+
+typedef struct {
+    uint32_t op;
+    uint32_t name_len;
+    uint64_t size;
+    int64_t time;
+} index_record;
+
+static void append_index_record(vector<char> &data, int op, const string &file, unsigned long long size, time_t time)
+{
+    index_record r;
+    r.op = op;
+    r.name_len = file.length();
+    r.size = size;
+    r.time = time;
+
+    data.insert(data.end(), reinterpret_cast<char*>(&r), reinterpret_cast<char*>(&r) + sizeof(index_record));
+    data.insert(data.end(), file.begin(), file.end());
+}
+
+/** Private. Open a shard's index journal and forget what was read from the
+ * old one. If the journal is new, set index_rebuild. */
+void DAPCache3::m_open_index(cache_shard &shard)
+{
+    if (shard.index_fd != -1)
+        close(shard.index_fd);
+
+    if ((shard.index_fd = open(shard.index.c_str(), O_RDWR | O_APPEND | O_CREAT, 0666)) == -1)
+        throw InternalErr(__FILE__, __LINE__, "Could not open the cache index " + shard.index + ": " + get_errno());
+
+    struct stat buf;
+    if (fstat(shard.index_fd, &buf) != 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not stat the cache index: " + get_errno());
+
+    shard.index_ino = buf.st_ino;
+    shard.index_offset = 0;
+    shard.index_records = 0;
+    shard.index_rebuild = buf.st_size == 0;
+
+    shard.files.clear();
+    shard.lru.clear();
+    shard.index_size = 0;
+}
+
+/** Private. Read the records added to a shard's index journal since it was
+ * last read. The shard must be locked. */
+void DAPCache3::m_read_index(cache_shard &shard)
+{
+    struct stat buf;
+    if (stat(shard.index.c_str(), &buf) != 0 || (unsigned long long) buf.st_ino != shard.index_ino) {
+        // The journal was rewritten (or removed) by another process
+        m_open_index(shard);
+        if (fstat(shard.index_fd, &buf) != 0)
+            throw InternalErr(__FILE__, __LINE__, "Could not stat the cache index: " + get_errno());
+    }
 
-    DBG(cerr << "d_cache_info_fd: " << d_cache_info_fd << endl);
+    if (shard.index_rebuild || (unsigned long long) buf.st_size <= shard.index_offset)
+        return;
+
+    vector<char> data(buf.st_size - shard.index_offset);
+    ssize_t num = pread(shard.index_fd, &data[0], data.size(), shard.index_offset);
+    if (num < 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not read the cache index: " + get_errno());
+
+    size_t pos = 0;
+    if (shard.index_offset == 0) {
+        if ((size_t) num < sizeof(INDEX_MAGIC) || memcmp(&data[0], INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+            DBG(cerr << "DAP Cache: the index " << shard.index << " is corrupt; it will be rebuilt" << endl);
+            m_open_index(shard);
+            shard.index_rebuild = true;
+            return;
+        }
+        pos = sizeof(INDEX_MAGIC);
+    }
+
+    // Only whole records are used; a record being written by another
+    // process is read next time.
+    while (pos + sizeof(index_record) <= (size_t) num) {
+        index_record r;
+        memcpy(&r, &data[pos], sizeof(index_record));
+        if (pos + sizeof(index_record) + r.name_len > (size_t) num)
+            break;
+
+        m_apply_index_record(shard, r.op, string(&data[pos + sizeof(index_record)], r.name_len), r.size, r.time);
+        pos += sizeof(index_record) + r.name_len;
+        ++shard.index_records;
+    }
+
+    shard.index_offset += pos;
+}
+
+/** Private. Update a shard's in-memory index. */
+void DAPCache3::m_apply_index_record(cache_shard &shard, int op, const string &file, unsigned long long size, time_t time)
+{
+    CacheIndex::iterator i = shard.files.find(file);
+
+    switch (op) {
+    case index_add:
+        if (i != shard.files.end()) {
+            shard.lru.erase(make_pair(i->second.time, file));
+            shard.index_size -= i->second.size;
+        }
+        else {
+            i = shard.files.insert(make_pair(file, index_entry())).first;
+        }
+        i->second.size = size;
+        i->second.time = time;
+        shard.index_size += size;
+        shard.lru.insert(make_pair(time, file));
+        break;
+
+    case index_touch:
+        if (i != shard.files.end() && time > i->second.time) {
+            shard.lru.erase(make_pair(i->second.time, file));
+            i->second.time = time;
+            shard.lru.insert(make_pair(time, file));
+        }
+        break;
+
+    case index_remove:
+        if (i != shard.files.end()) {
+            shard.lru.erase(make_pair(i->second.time, file));
+            shard.index_size -= i->second.size;
+            shard.files.erase(i);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/** Private. Add a record to a shard's index journal and update the in-memory
+ * index. The shard must be locked. If the index is waiting to be rebuilt,
+ * the change will be picked up from the cache directory. */
+void DAPCache3::m_write_index_record(cache_shard &shard, int op, const string &file, unsigned long long size, time_t time)
+{
+    m_read_index(shard);
+
+    if (shard.index_rebuild)
+        return;
+
+    vector<char> data;
+    append_index_record(data, op, file, size, time);
+
+    if (write(shard.index_fd, &data[0], data.size()) != (ssize_t) data.size())
+        throw InternalErr(__FILE__, __LINE__, "Could not write to the cache index: " + get_errno());
+
+    m_read_index(shard);
+
+    // Compacting needs the write lock; see get_read_lock() for the other case
+    if (shard.lock_type == F_WRLCK && m_index_is_stale(shard))
+        m_compact_index(shard);
+}
+
+/** Private. Does a shard's index journal hold so many more records than there
+ * are files in the shard that it should be compacted? */
+bool DAPCache3::m_index_is_stale(const cache_shard &shard)
+{
+    return !shard.index_rebuild && shard.index_records > 2 * shard.files.size() + INDEX_SLACK;
+}
+
+/** Private. Rewrite a shard's index journal so that it holds one record for
+ * each file in the index. The shard must be write-locked. */
+void DAPCache3::m_compact_index(cache_shard &shard)
+{
+    DBG(cerr << "DAP Cache: compacting " << shard.index << " (" << shard.index_records << " records, " << shard.files.size() << " files)" << endl);
+
+    vector<char> data(INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+    for (CacheLRU::iterator i = shard.lru.begin(); i != shard.lru.end(); ++i)
+        append_index_record(data, index_add, i->second, shard.files[i->second].size, i->first);
+
+    string tmp = shard.index + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+        throw InternalErr(__FILE__, __LINE__, "Could not open " + tmp + ": " + get_errno());
+
+    bool ok = write(fd, &data[0], data.size()) == (ssize_t) data.size();
+    if (close(fd) != 0) ok = false;
+    if (!ok || rename(tmp.c_str(), shard.index.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw InternalErr(__FILE__, __LINE__, "Could not write the cache index: " + get_errno());
+    }
+
+    m_open_index(shard);
+    m_read_index(shard);
+}
+
+/** Private. Build a shard's index from the files in the cache directory
+ * ('contents') that belong to it. The shard must be write-locked. */
+void DAPCache3::m_rebuild_index(cache_shard &shard, const CacheFiles &contents)
+{
+    shard.files.clear();
+    shard.lru.clear();
+    shard.index_size = 0;
+    for (CacheFiles::const_iterator i = contents.begin(); i != contents.end(); ++i)
+        if (&m_shard(i->name) == &shard)
+            m_apply_index_record(shard, index_add, i->name, i->size, i->time);
+
+    m_compact_index(shard);
 }
 
 #if 0
@@ -561,18 +922,47 @@ string DAPCache3::get_cache_file_name(const string &src, bool mangle)
  */
 bool DAPCache3::get_read_lock(const string &target, int &fd)
 {
-	lock_cache_read();
+	cache_shard &shard = m_shard(target);
+	m_lock_shard(shard, F_RDLCK);
 
-    bool status = getSharedLock(target, fd);
+	bool status;
+	try {
+	    status = getSharedLock(target, fd);
+
+	    DBG(cerr << "DAP Cache: read_lock: " << target << "(" << status << ")" << endl);
 
-    DBG(cerr << "DAP Cache: read_lock: " << target << "(" << status << ")" << endl);
+	    if (status) {
+	    	m_record_descriptor(target, fd);
+	    	// Note the use so the least recently used files are purged first
+	    	m_write_index_record(shard, index_touch, target, 0, time(0));
+	    }
 
-    if (status)
-    	m_record_descriptor(target, fd);
+	    m_unlock_shard(shard);
+	}
+	catch (...) {
+		m_unlock_shard(shard);
+		throw;
+	}
 
-    unlock_cache();
+	// Hits only add records, so a cache that is never purged would keep
+	// growing its journal. The shard is only read-locked above; take the
+	// write lock to compact the journal, and check again since another
+	// process may have done it in the meantime.
+	if (status && m_index_is_stale(shard)) {
+	    m_lock_shard(shard, F_WRLCK);
+	    try {
+	        m_read_index(shard);
+	        if (m_index_is_stale(shard))
+	            m_compact_index(shard);
+	        m_unlock_shard(shard);
+	    }
+	    catch (...) {
+	        m_unlock_shard(shard);
+	        throw;
+	    }
+	}
 
-    return status;
+	return status;
 }
 
 /** @brief Create a file in the cache and lock it for write access.
@@ -589,19 +979,28 @@ bool DAPCache3::get_read_lock(const string &target, int &fd)
  * if fcntl(2) returns an error. */
 bool DAPCache3::create_and_lock(const string &target, int &fd)
 {
-	lock_cache_write();
-
-    bool status = createLockedFile(target, fd);
+	cache_shard &shard = m_shard(target);
+	m_lock_shard(shard, F_WRLCK);
 
-    DBG(cerr << "DAP Cache: create_and_lock: " << target << "(" << status << ")" << endl);
+	try {
+	    bool status = createLockedFile(target, fd);
 
-    if (status)
-    	m_record_descriptor(target, fd);
+	    DBG(cerr << "DAP Cache: create_and_lock: " << target << "(" << status << ")" << endl);
 
-    unlock_cache();
+	    if (status) {
+	    	m_record_descriptor(target, fd);
+	    	// The size is recorded by update_cache_info()
+	    	m_write_index_record(shard, index_add, target, 0, time(0));
+	    }
 
-    return status;
+	    m_unlock_shard(shard);
 
+	    return status;
+	}
+	catch (...) {
+		m_unlock_shard(shard);
+		throw;
+	}
 }
 
 /** @brief Transfer from an exclusive lock to a shared lock.
@@ -631,47 +1030,37 @@ void DAPCache3::exclusive_to_shared_lock(int fd)
     }
 }
 
-/** Get an exclusive lock on the 'cache info' file. The 'cache info' file
- * is used to control certain cache actions, ensuring that they are atomic.
- * These include making sure that the create_and_lock() and read_and_lock()
- * operations are atomic as well as the purge and related operations.
+/** Get an exclusive lock on the whole cache by locking the info files of all
+ * of its shards. The methods of this class lock only the shard that holds
+ * the file they work on, so this is not needed to make them atomic.
  *
  * @note This is intended to be used internally only but might be useful in
  * some settings.
  */
 void DAPCache3::lock_cache_write()
 {
-    DBG(cerr << "lock_cache - d_cache_info_fd: " << d_cache_info_fd << endl);
-
-    if (fcntl(d_cache_info_fd, F_SETLKW, lock(F_WRLCK)) == -1) {
-        throw InternalErr(__FILE__, __LINE__, "An error occurred trying to lock the cache-control file" + get_errno());
-    }
+    for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+        m_lock_shard(*i, F_WRLCK);
 }
 
-/** Get a shared lock on the 'cache info' file.
+/** Get a shared lock on the whole cache (all of the shards' info files).
  *
  */
 void DAPCache3::lock_cache_read()
 {
-    DBG(cerr << "lock_cache - d_cache_info_fd: " << d_cache_info_fd << endl);
-
-    if (fcntl(d_cache_info_fd, F_SETLKW, lock(F_RDLCK)) == -1) {
-        throw InternalErr(__FILE__, __LINE__, "An error occurred trying to lock the cache-control file" + get_errno());
-    }
+    for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+        m_lock_shard(*i, F_RDLCK);
 }
 
-/** Unlock the cache info file.
+/** Unlock the info files of all of the shards.
  *
  * @note This is intended to be used internally only bt might be useful in
  * some settings.
  */
 void DAPCache3::unlock_cache()
 {
-    DBG(cerr << "DAP Cache: unlock: cache_info (fd: " << d_cache_info_fd << ")" << endl);
-
-    if (fcntl(d_cache_info_fd, F_SETLK, lock(F_UNLCK)) == -1) {
-        throw InternalErr(__FILE__, __LINE__, "An error occurred trying to unlock the cache-control file" + get_errno());
-    }
+    for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+        m_unlock_shard(*i);
 }
 
 /** Unlock the named file. This does not do any name mangling; it
@@ -708,26 +1097,23 @@ void DAPCache3::unlock_and_close(int fd)
 
 /** @brief Update the cache info file to include 'target'
  *
- * Add the size of the named file to the total cache size recorded in the
- * cache info file. The cache info file is exclusively locked by this
- * method for its duration. This updates the cache info file and returns
- * the new size.
+ * Add the size of the named file to the size recorded in the info file of
+ * the shard that holds it. That info file is exclusively locked by this
+ * method for its duration. This updates the info file and returns the new
+ * size of the cache.
  *
  * @param target The name of the file
  * @return The new size of the cache
  */
 unsigned long long DAPCache3::update_cache_info(const string &target)
 {
-	try {
-		lock_cache_write();
+	cache_shard &shard = m_shard(target);
 
-		if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-			throw InternalErr(__FILE__, __LINE__, "Could not rewind to front of cache info file.");
+	try {
+		m_lock_shard(shard, F_WRLCK);
 
 		// read the size from the cache info file
-		unsigned long long current_size;
-		if (read(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-			throw InternalErr(__FILE__, __LINE__, "Could not get read size info from the cache info file!");
+		unsigned long long current_size = m_read_shard_size(shard);
 
 		struct stat buf;
 		int statret = stat(target.c_str(), &buf);
@@ -736,21 +1122,20 @@ unsigned long long DAPCache3::update_cache_info(const string &target)
 		else
 			throw InternalErr(__FILE__, __LINE__, "Could not read the size of the new file: " + target + " : " + get_errno());
 
-		DBG(cerr << "DAP Cache: cache size updated to: " << current_size << endl);
+		m_write_index_record(shard, index_add, target, buf.st_size, time(0));
 
-		if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-			throw InternalErr(__FILE__, __LINE__, "Could not rewind to front of cache info file.");
+		DBG(cerr << "DAP Cache: shard size updated to: " << current_size << endl);
 
-		if(write(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-			throw InternalErr(__FILE__, __LINE__, "Could not write size info from the cache info file!");
+		m_write_shard_size(shard, current_size);
 
-		unlock_cache();
-		return current_size;
+		m_unlock_shard(shard);
 	}
 	catch (...) {
-		unlock_cache();
+		m_unlock_shard(shard);
 		throw;
 	}
+
+	return get_cache_size();
 }
 
 /** @brief look at the cache size; is it too large?
@@ -763,33 +1148,29 @@ bool DAPCache3::cache_too_big(unsigned long long current_size) const
 }
 
 /** @brief Get the cache size.
- * Read the size information from the cache info file and return it.
- * This methods locks the cache.
- *
+ * Read the size information from the shards' info files and return their
+ * sum. Each shard is read-locked while its size is read, but the shards
+ * are not all locked at once, so the result can be slightly out of date.
  *
  * @return The size of the cache.
  */
 unsigned long long DAPCache3::get_cache_size()
 {
-	try {
-		lock_cache_read();
-
-		if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-	        throw InternalErr(__FILE__, __LINE__, "Could not rewind to front of cache info file.");
-		// read the size from the cache info file
-		unsigned long long current_size;
-		if(read(d_cache_info_fd, &current_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-		    throw InternalErr(__FILE__, __LINE__, "Could not get read size info from the cache info file!");
-
-		unlock_cache();
-	    return current_size;
-	}
-	catch(...) {
-		unlock_cache();
-		throw;
+	unsigned long long current_size = 0;
+	for (vector<cache_shard>::iterator i = d_shards.begin(); i != d_shards.end(); ++i) {
+		try {
+			m_lock_shard(*i, F_RDLCK);
+			current_size += m_read_shard_size(*i);
+			m_unlock_shard(*i);
+		}
+		catch(...) {
+			m_unlock_shard(*i);
+			throw;
+		}
 	}
-}
 
+	return current_size;
+}
 
 static bool entry_op(cache_entry &e1, cache_entry &e2)
 {
@@ -840,11 +1221,71 @@ unsigned long long DAPCache3::m_collect_cache_dir_info(CacheFiles &contents)
     return current_size;
 }
 
+/** Private. Purge files from one shard, least to most recently used, until
+ * its size is no more than 'target_size'. The shard must be write-locked.
+ * @see update_and_purge() */
+void DAPCache3::m_purge_shard(cache_shard &shard, const string &new_file, unsigned long long target_size)
+{
+    m_read_index(shard);
+    if (shard.index_rebuild) {
+        CacheFiles contents;
+        m_collect_cache_dir_info(contents);
+        m_rebuild_index(shard, contents);
+    }
+
+    DBG(cerr << "purge - shard and target size (in MB) " << shard.index_size/BYTES_PER_MEG  << ", " << target_size/BYTES_PER_MEG << endl );
+
+    // Start with the least recently used. Work from a copy of the LRU list:
+    // writing a record may compact the journal, which reloads the index.
+    vector<string> lru;
+    for (CacheLRU::iterator i = shard.lru.begin(); i != shard.lru.end(); ++i)
+        lru.push_back(i->second);
+
+    for (vector<string>::iterator i = lru.begin(); i != lru.end() && shard.index_size > target_size; ++i) {
+        const string &file = *i;
+
+        // Grab an exclusive lock but do not block - if another process has the file locked
+        // just move on to the next file. Also test to see if the current file is the file
+        // this process just added to the cache - don't purge that!
+        int cfile_fd;
+        if (file != new_file && getExclusiveLockNB(file, cfile_fd)) {
+            DBG(cerr << "purge: " << file << " removed." << endl );
+
+            if (unlink(file.c_str()) != 0)
+                throw InternalErr(__FILE__, __LINE__, "Unable to purge the file " + file + " from the cache: " + get_errno());
+
+            unlock(cfile_fd);
+            m_write_index_record(shard, index_remove, file, 0, 0);
+        }
+        else if (access(file.c_str(), F_OK) != 0 && errno == ENOENT) {
+            // Removed by something other than the cache
+            m_write_index_record(shard, index_remove, file, 0, 0);
+        }
+    }
+
+    m_write_shard_size(shard, shard.index_size);
+
+    if (m_index_is_stale(shard))
+        m_compact_index(shard);
+}
+
+static bool shard_size_op(const pair<unsigned long long, unsigned int> &s1,
+    const pair<unsigned long long, unsigned int> &s2)
+{
+    return s1.first > s2.first;
+}
+
 /** @brief Purge files from the cache
  *
- * Purge files, oldest to newest, if the current size of the cache exceeds the
- * size of the cache specified in the constructor. This method uses an exclusive
- * lock on the cache for the duration of the purge process.
+ * Purge files, least to most recently used, if the current size of the cache
+ * exceeds the size of the cache specified in the constructor. Shards are
+ * purged largest first, each no further than its share of the target size,
+ * until the cache is no larger than the target size. A shard is exclusively
+ * locked while it is purged; the others are not locked. The files and their
+ * sizes come from the cache index, so the cache directory is not read.
+ *
+ * @note Files are removed in least recently used order within a shard, but
+ * not across the whole cache.
  *
  * @param new_file The name of a file this process just added to the cache. Using
  * fcntl(2) locking there is no way this process can detect its own lock, so the
@@ -855,78 +1296,40 @@ void DAPCache3::update_and_purge(const string &new_file)
 {
     DBG(cerr << "purge - starting the purge" << endl);
 
-    try {
-        lock_cache_write();
+    // The sizes are read without locking the shards; they are only used to
+    // choose which shards to purge.
+    vector<pair<unsigned long long, unsigned int> > sizes;
+    unsigned long long computed_size = 0;
+    for (unsigned int i = 0; i < d_shards.size(); ++i) {
+        sizes.push_back(make_pair(m_read_shard_size(d_shards[i]), i));
+        computed_size += sizes.back().first;
+    }
 
-        CacheFiles contents;
-        unsigned long long computed_size = m_collect_cache_dir_info(contents);
-#if 0
-        if (BESISDEBUG( "cache_contents" )) {
-            DBG(endl << "BEFORE Purge " << computed_size/BYTES_PER_MEG << endl );
-            CacheFiles::iterator ti = contents.begin();
-            CacheFiles::iterator te = contents.end();
-            for (; ti != te; ti++) {
-                DBG((*ti).time << ": " << (*ti).name << ": size " << (*ti).size/BYTES_PER_MEG << endl );
-            }
-        }
-#endif
-        DBG(cerr << "purge - current and target size (in MB) " << computed_size/BYTES_PER_MEG  << ", " << d_target_size/BYTES_PER_MEG << endl );
-
-        // This deletes files and updates computed_size
-        if (cache_too_big(computed_size)) {
-
-            // d_target_size is 80% of the maximum cache size.
-            // Grab the first which is the oldest in terms of access time.
-            CacheFiles::iterator i = contents.begin();
-            while (i != contents.end() && computed_size > d_target_size) {
-                // Grab an exclusive lock but do not block - if another process has the file locked
-                // just move on to the next file. Also test to see if the current file is the file
-                // this process just added to the cache - don't purge that!
-                int cfile_fd;
-                if (i->name != new_file && getExclusiveLockNB(i->name, cfile_fd)) {
-                    DBG(cerr << "purge: " << i->name << " removed." << endl );
-
-                    if (unlink(i->name.c_str()) != 0)
-                        throw InternalErr(__FILE__, __LINE__, "Unable to purge the file " + i->name + " from the cache: " + get_errno());
-
-                    unlock(cfile_fd);
-                    computed_size -= i->size;
-                }
-#if 0
-                else {
-                    // This information is useful when debugging... Might comment out for production
-                    DBG(cerr << "purge: " << i->name << " is in use." << endl );
-                }
-#endif
-                ++i;
+    sort(sizes.begin(), sizes.end(), shard_size_op);
 
-                DBG(cerr << "purge - current and target size (in MB) " << computed_size/BYTES_PER_MEG << ", " << d_target_size/BYTES_PER_MEG << endl );
-            }
+    DBG(cerr << "purge - current and target size (in MB) " << computed_size/BYTES_PER_MEG  << ", " << d_target_size/BYTES_PER_MEG << endl );
 
-        }
+    unsigned long long shard_target_size = d_target_size / d_shards.size();
 
-        if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-            throw InternalErr(__FILE__, __LINE__, "Could not rewind to front of cache info file.");
+    for (vector<pair<unsigned long long, unsigned int> >::iterator s = sizes.begin();
+            s != sizes.end() && computed_size > d_target_size && s->first > shard_target_size; ++s) {
+        cache_shard &shard = d_shards[s->second];
+        unsigned long long excess = computed_size - d_target_size;
+        try {
+            m_lock_shard(shard, F_WRLCK);
 
-        if(write(d_cache_info_fd, &computed_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-            throw InternalErr(__FILE__, __LINE__, "Could not write size info to the cache info file!");
-#if 0
-        if (BESISDEBUG( "cache_contents" )) {
-            contents.clear();
-            computed_size = m_collect_cache_dir_info(contents);
-            DBG(endl << "AFTER Purge " << computed_size/BYTES_PER_MEG << endl );
-            CacheFiles::iterator ti = contents.begin();
-            CacheFiles::iterator te = contents.end();
-            for (; ti != te; ti++) {
-                DBG((*ti).time << ": " << (*ti).name << ": size " << (*ti).size/BYTES_PER_MEG << endl );
-            }
+            unsigned long long size = m_read_shard_size(shard);
+            m_purge_shard(shard, new_file, max(shard_target_size, size > excess ? size - excess : 0));
+            computed_size -= min(computed_size, size - min(size, shard.index_size));
+
+            m_unlock_shard(shard);
         }
-#endif
-        unlock_cache();
-    }
-    catch(...) {
-        unlock_cache();
-        throw;
+        catch(...) {
+            m_unlock_shard(shard);
+            throw;
+        }
+
+        DBG(cerr << "purge - current and target size (in MB) " << computed_size/BYTES_PER_MEG << ", " << d_target_size/BYTES_PER_MEG << endl );
     }
 }
 
@@ -945,8 +1348,10 @@ void DAPCache3::purge_file(const string &file)
 {
     DBG(cerr << "purge_file - starting the purge" << endl);
 
+    cache_shard &shard = m_shard(file);
+
     try {
-        lock_cache_write();
+        m_lock_shard(shard, F_WRLCK);
 
         // Grab an exclusive lock on the file
         int cfile_fd;
@@ -966,19 +1371,16 @@ void DAPCache3::purge_file(const string &file)
 
             unlock(cfile_fd);
 
-            unsigned long long cache_size = get_cache_size() - size;
+            m_write_index_record(shard, index_remove, file, 0, 0);
 
-            if (lseek(d_cache_info_fd, 0, SEEK_SET) == -1)
-                throw InternalErr(__FILE__, __LINE__, "Could not rewind to front of cache info file.");
-
-            if (write(d_cache_info_fd, &cache_size, sizeof(unsigned long long)) != sizeof(unsigned long long))
-                throw InternalErr(__FILE__, __LINE__, "Could not write size info to the cache info file!");
+            unsigned long long shard_size = m_read_shard_size(shard);
+            m_write_shard_size(shard, shard_size > size ? shard_size - size : 0);
         }
 
-        unlock_cache();
+        m_unlock_shard(shard);
     }
     catch (...) {
-        unlock_cache();
+        m_unlock_shard(shard);
         throw;
     }
 }
@@ -997,6 +1399,11 @@ void DAPCache3::dump(ostream &strm) const
     strm << DapIndent::LMarg << "cache dir: " << d_cache_dir << endl;
     strm << DapIndent::LMarg << "prefix: " << d_prefix << endl;
     strm << DapIndent::LMarg << "size (bytes): " << d_max_cache_size_in_bytes << endl;
+    unsigned long files = 0;
+    for (vector<cache_shard>::const_iterator i = d_shards.begin(); i != d_shards.end(); ++i)
+        files += i->files.size();
+    strm << DapIndent::LMarg << "shards: " << d_shards.size() << endl;
+    strm << DapIndent::LMarg << "files in the index: " << files << endl;
     DapIndent::UnIndent();
 }
 
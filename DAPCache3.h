@@ -31,8 +31,10 @@
 
 // #include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <list>
+#include <vector>
 // #include <sstream>
 
 #include "DapObj.h"
@@ -64,12 +66,14 @@ typedef std::list<cache_entry> CacheFiles;
  * can be added and the cache can be purged, without disrupting the existing
  * read operations.
  *
- * How it works. When a file is added to the cache, the cache is locked - no
- * other processes can add, read or remove files. Once a file has been added,
- * the cache size is examined and, if needed, the cache is purged so that its
- * size is 80% of the maximum size. Then the cache is unlocked. When a process
- * looks to see if a file is already in the cache, the entire cache is locked.
- * If the file is present, a shared read lock is obtained and the cache is unlocked.
+ * How it works. The files in the cache are divided into shards using a hash
+ * of their names, and each shard has its own lock. When a file is added to the
+ * cache, its shard is locked - no other processes can add, read or remove files
+ * in that shard. Once a file has been added, the cache size is examined and, if
+ * needed, the cache is purged so that its size is 80% of the maximum size; each
+ * shard is locked while it is purged. When a process looks to see if a file is
+ * already in the cache, the file's shard is locked. If the file is present, a
+ * shared read lock is obtained and the shard is unlocked.
  *
  * Methods: create_and_lock() and get_read_lock() open and lock files; the former
  * creates the file and locks it exclusively iff it does not exist, while the
@@ -81,6 +85,8 @@ typedef std::list<cache_entry> CacheFiles;
  */
 class DAPCache3: public libdap::DapObj {
 
+    friend class DAPCache3Test; // Unit tests
+
 private:
     static DAPCache3 * d_instance;
 
@@ -110,9 +116,57 @@ private:
 
     unsigned long long m_collect_cache_dir_info(CacheFiles &contents);
 
-    /// Name of the file that tracks the size of the cache
-    string d_cache_info;
-    int d_cache_info_fd;
+    // The index of the files in the cache, ordered by last use. It is kept
+    // in a journal file shared by all the processes using the cache; each
+    // process reads the records other processes have added since it last
+    // looked. See DAPCache3.cc.
+    typedef struct {
+        unsigned long long size;
+        time_t time;
+    } index_entry;
+
+    typedef std::map<string, index_entry> CacheIndex;
+    typedef std::set<std::pair<time_t, string> > CacheLRU;
+
+    // The files in the cache are divided into shards using a hash of their
+    // names. Each shard has its own info file, which holds the shard's size
+    // and is locked to control access to it, and its own index.
+    typedef struct {
+        /// Name of the file that tracks the size of the shard
+        string info;
+        int info_fd;
+        int lock_type;                      // F_RDLCK, F_WRLCK or F_UNLCK
+
+        /// Name of the file that holds the index journal
+        string index;
+        int index_fd;
+        unsigned long long index_ino;       // detects when the journal is rewritten
+        unsigned long long index_offset;    // how much of the journal has been read
+        unsigned long index_records;        // records in the journal
+        bool index_rebuild;                 // journal is new; scan the directory
+
+        CacheIndex files;
+        CacheLRU lru;
+        unsigned long long index_size;      // sum of the sizes in 'files'
+    } cache_shard;
+
+    std::vector<cache_shard> d_shards;
+
+    cache_shard &m_shard(const string &file);
+
+    void m_lock_shard(cache_shard &shard, int type);
+    void m_unlock_shard(cache_shard &shard);
+    unsigned long long m_read_shard_size(cache_shard &shard);
+    void m_write_shard_size(cache_shard &shard, unsigned long long size);
+    void m_purge_shard(cache_shard &shard, const string &new_file, unsigned long long target_size);
+
+    void m_open_index(cache_shard &shard);
+    void m_read_index(cache_shard &shard);
+    void m_rebuild_index(cache_shard &shard, const CacheFiles &contents);
+    void m_compact_index(cache_shard &shard);
+    bool m_index_is_stale(const cache_shard &shard);
+    void m_apply_index_record(cache_shard &shard, int op, const string &file, unsigned long long size, time_t time);
+    void m_write_index_record(cache_shard &shard, int op, const string &file, unsigned long long size, time_t time);
 
     void m_record_descriptor(const string &file, int fd);
     int m_get_descriptor(const string &file);
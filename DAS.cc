@@ -60,14 +60,8 @@
 using std::cerr;
 using std::endl;
 
-// Glue routines declared in das.lex
-extern void das_switch_to_buffer(void *new_buffer);
-extern void das_delete_buffer(void * buffer);
-extern void *das_buffer(FILE *fp);
-
-//extern void dasrestart(FILE *yyin);
-//extern int dasparse(void *arg); // defined in das.tab.c
-extern int dasparse(libdap::parser_arg *arg); // defined in das.tab.c
+// Parse a DAS using a scanner and parser of its own; defined in das.yy
+extern int das_parse_file(FILE *in, libdap::parser_arg *arg);
 
 namespace libdap {
 
@@ -283,9 +277,10 @@ DAS::parse(int fd)
 
 /** @brief Reads a DAS from an open file descriptor.
 
-    Read attributes from in (which defaults to stdin). If
-    dasrestart() fails, return false, otherwise return the status
-    of dasparse().
+    Read attributes from in (which defaults to stdin). The parser is
+    reentrant, so several DASs may be parsed at once, by different threads.
+
+    @exception Error if the DAS cannot be parsed.
 */
 void
 DAS::parse(FILE *in)
@@ -294,15 +289,9 @@ DAS::parse(FILE *in)
         throw InternalErr(__FILE__, __LINE__, "Null input stream.");
     }
 
-    void *buffer = das_buffer(in);
-    das_switch_to_buffer(buffer);
-
     parser_arg arg(this);
 
-    //bool status = dasparse((void *) & arg) == 0;
-    bool status = dasparse(&arg) == 0;
-
-    das_delete_buffer(buffer);
+    bool status = das_parse_file(in, &arg) == 0;
 
     //  STATUS is the result of the parser function; if a recoverable error
     //  was found it will be true but arg.status() will be false.
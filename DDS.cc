@@ -120,12 +120,8 @@ const string c_dap_40_n_sl = c_dap40_namespace + " " + c_default_dap40_schema_lo
 
 using namespace std;
 
-int ddsparse(libdap::parser_arg *arg);
-
-// Glue for the DDS parser defined in dds.lex
-void dds_switch_to_buffer(void *new_buffer);
-void dds_delete_buffer(void * buffer);
-void *dds_buffer(FILE *fp);
+// Parse a DDS using a scanner and parser of its own; defined in dds.yy
+int dds_parse_file(FILE *in, libdap::parser_arg *arg);
 
 namespace libdap {
 
@@ -1005,14 +1001,11 @@ DDS::parse(FILE *in)
         throw InternalErr(__FILE__, __LINE__, "Null input stream.");
     }
 
-    void *buffer = dds_buffer(in);
-    dds_switch_to_buffer(buffer);
-
     parser_arg arg(this);
 
-    bool status = ddsparse(&arg) == 0;
-
-    dds_delete_buffer(buffer);
+    // The parser and scanner are reentrant, so several DDSs may be parsed
+    // at once, by different threads.
+    bool status = dds_parse_file(in, &arg) == 0;
 
     DBG2(cout << "Status from parser: " << status << endl);
 
@@ -48,6 +48,7 @@
 #include "XMLWriter.h"
 #include "D4BaseTypeFactory.h"
 #include "D4Attributes.h"
+#include "vector_filter.h"
 
 #include "DDS.h"	// Included so DMRs can be built using a DDS for 'legacy' handlers
 
@@ -88,6 +89,9 @@ DMR::m_duplicate(const DMR &dmr)
 
     d_dmr_version = dmr.d_dmr_version;
 
+    d_vector_filter = dmr.d_vector_filter;
+    d_read_threads = dmr.d_read_threads;
+
     d_request_xml_base = dmr.d_request_xml_base;
 
     d_namespace = dmr.d_namespace;
@@ -117,7 +121,7 @@ DMR::m_duplicate(const DMR &dmr)
 DMR::DMR(D4BaseTypeFactory *factory, const string &name)
         : d_factory(factory), d_name(name), d_filename(""),
           d_dap_major(4), d_dap_minor(0),
-          d_dmr_version("1.0"), d_request_xml_base(""),
+          d_dmr_version("1.0"), d_vector_filter(0), d_read_threads(0), d_request_xml_base(""),
           d_namespace(c_dap40_namespace), d_max_response_size(0), d_root(0)
 {
     // sets d_dap_version string and the two integer fields too
@@ -147,7 +151,7 @@ DMR::DMR(D4BaseTypeFactory *factory, const string &name)
 DMR::DMR(D4BaseTypeFactory *factory, DDS &dds)
         : d_factory(factory), d_name(dds.get_dataset_name()),
           d_filename(dds.filename()), d_dap_major(4), d_dap_minor(0),
-          d_dmr_version("1.0"), d_request_xml_base(""),
+          d_dmr_version("1.0"), d_vector_filter(0), d_read_threads(0), d_request_xml_base(""),
           d_namespace(c_dap40_namespace), d_max_response_size(0), d_root(0)
 {
     // sets d_dap_version string and the two integer fields too
@@ -178,7 +182,7 @@ DMR::DMR(D4BaseTypeFactory *factory, DDS &dds)
  */
 DMR::DMR()
         : d_factory(0), d_name(""), d_filename(""), d_dap_major(4), d_dap_minor(0),
-          d_dap_version("4.0"), d_dmr_version("1.0"), d_request_xml_base(""),
+          d_dap_version("4.0"), d_dmr_version("1.0"), d_vector_filter(0), d_read_threads(0), d_request_xml_base(""),
           d_namespace(c_dap40_namespace), d_max_response_size(0), d_root(0)
 {
     // sets d_dap_version string and the two integer fields too
@@ -345,6 +349,12 @@ DMR::print_dap4(XMLWriter &xml, bool constrained)
     if (xmlTextWriterWriteAttribute(xml.get_writer(), (const xmlChar*) "dmrVersion", (const xmlChar*)dmr_version().c_str()) < 0)
         throw InternalErr(__FILE__, __LINE__, "Could not write attribute for dapVersion");
 
+    if (vector_filter() != 0) {
+        if (xmlTextWriterWriteAttribute(xml.get_writer(), (const xmlChar*) "vectorFilter",
+                (const xmlChar*)vector_filter_names(vector_filter()).c_str()) < 0)
+            throw InternalErr(__FILE__, __LINE__, "Could not write attribute for vectorFilter");
+    }
+
     if (xmlTextWriterWriteAttribute(xml.get_writer(), (const xmlChar*) "name", (const xmlChar*)name().c_str()) < 0)
         throw InternalErr(__FILE__, __LINE__, "Could not write attribute for name");
 
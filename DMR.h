@@ -72,6 +72,12 @@ private:
     /// The version of the DMR document
     string d_dmr_version;
 
+    /// Filters applied to the values of vectors in the data response
+    unsigned int d_vector_filter;
+
+    /// Threads used to read variables ahead of the one being serialized
+    unsigned int d_read_threads;
+
     /// The URL for the request base
     string d_request_xml_base;
 
@@ -145,6 +151,28 @@ public:
     string dmr_version() const { return d_dmr_version; }
     void set_dmr_version(const string &v) { d_dmr_version = v; }
 
+    /** Get/set the filters used for the values of vectors in a data
+     * response built using this DMR. This is a combination of the
+     * vector_filter values (see vector_filter.h) and is sent as the Dataset
+     * element's vectorFilter attribute so clients can undo the filters.
+     * @see D4StreamMarshaller::set_vector_filter()
+     */
+    //@{
+    unsigned int vector_filter() const { return d_vector_filter; }
+    void set_vector_filter(unsigned int filters) { d_vector_filter = filters; }
+    //@}
+
+    /** Get/set the number of threads D4Group::serialize() uses to read the
+     * variables that follow the one being written. Zero, the default, reads
+     * each variable when it is serialized. Only use this if the handler's
+     * read() methods can be called for different variables at the same time.
+     * @see D4Group::serialize()
+     */
+    //@{
+    unsigned int read_threads() const { return d_read_threads; }
+    void set_read_threads(unsigned int num_threads) { d_read_threads = num_threads; }
+    //@}
+
     /// Get the URL that will return this DMR/DDX/DataThing
     string request_xml_base() const { return d_request_xml_base; }
 
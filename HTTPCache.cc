@@ -34,6 +34,7 @@
 #include <unistd.h>   // for stat
 #include <sys/types.h>  // for stat and mkdir
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #include <cstring>
 #include <cerrno>
@@ -78,12 +79,13 @@ static pthread_once_t once_block = PTHREAD_ONCE_INIT;
 
 #define NO_LM_EXPIRATION 24*3600 // 24 hours
 
-#define DUMP_FREQUENCY 10 // Dump index every x loads
+#define DUMP_FREQUENCY 10 // Check the index for compaction every x loads
 
 #define MEGA 0x100000L
 #define CACHE_TOTAL_SIZE 20 // Default cache size is 20M
 #define CACHE_FOLDER_PCT 10 // 10% of cache size for metainfo etc.
 #define CACHE_GC_PCT 10  // 10% of cache size free after GC
+#define CACHE_FILL_MASK 0xFFFFF // The number of cache fill locks, less one
 #define MIN_CACHE_TOTAL_SIZE 5 // 5M Min cache size
 #define MAX_CACHE_ENTRY_SIZE 3 // 3M Max size of single cached entry
 
@@ -122,11 +124,15 @@ once_init_routine()
     false. Use this only if you're sure no one else is using the same cache
     root! This is included so that programs may use a cache that was
     left in an inconsistent state.
+    @param shared If true, several processes may use the persistent store at
+    the same time. By default false. The value of \c force is ignored when
+    this is true. The first call to instance() determines whether the cache
+    is shared.
     @return A pointer to the HTTPCache object.
     @exception Error thrown if the cache root cannot set. */
 
 HTTPCache *
-HTTPCache::instance(const string &cache_root, bool force)
+HTTPCache::instance(const string &cache_root, bool force, bool shared)
 {
     int status = pthread_once(&once_block, once_init_routine);
     if (status != 0)
@@ -138,7 +144,7 @@ HTTPCache::instance(const string &cache_root, bool force)
 
     try {
         if (!_instance) {
-            _instance = new HTTPCache(cache_root, force);
+            _instance = new HTTPCache(cache_root, force, shared);
 
             DBG(cerr << "New instance: " << _instance << ", cache root: "
                 << _instance->d_cache_root << endl);
@@ -221,12 +227,16 @@ HTTPCache::delete_instance()
     @param cache_root The fully qualified pathname of the directory which
     will hold the cache data.
     @param force Force access to the persistent store!
+    @param shared Share the persistent store with other processes. When true
+    the single user lock is not used.
     @exception Error Thrown if the single user/process lock for the
     persistent store cannot be obtained.
     @see cache_index_read */
 
-HTTPCache::HTTPCache(string cache_root, bool force) :
+HTTPCache::HTTPCache(string cache_root, bool force, bool shared) :
         d_locked_open_file(0),
+        d_cache_shared(shared),
+        d_fill_fd(-1),
         d_cache_enabled(false),
         d_cache_protected(false),
 
@@ -265,7 +275,15 @@ HTTPCache::HTTPCache(string cache_root, bool force) :
 	set_cache_root(cache_root);
 	int block_size;
 
-	if (!get_single_user_lock(force))
+	if (d_cache_shared) {
+	    create_cache_root(d_cache_root);
+
+	    string fill = d_cache_root + CACHE_FILL;
+	    d_fill_fd = open(fill.c_str(), O_RDWR | O_CREAT, 0600);
+	    if (d_fill_fd < 0)
+	        throw Error(internal_error, "Could not open the cache fill lock file: " + fill);
+	}
+	else if (!get_single_user_lock(force))
 	    throw Error(internal_error, "Could not get single user lock for the cache");
 
 #ifdef WIN32
@@ -281,7 +299,7 @@ HTTPCache::HTTPCache(string cache_root, bool force) :
 	else
 		throw Error(internal_error, "Could not set file system block size.");
 #endif
-	d_http_cache_table = new HTTPCacheTable(d_cache_root, block_size);
+	d_http_cache_table = new HTTPCacheTable(d_cache_root, block_size, d_cache_shared);
 	d_cache_enabled = true;
 
 	DBGN(cerr << "exiting" << endl);
@@ -319,7 +337,13 @@ HTTPCache::~HTTPCache()
 
     delete d_http_cache_table;
 
-    release_single_user_lock();
+    if (d_cache_shared) {
+        if (d_fill_fd >= 0)
+            close(d_fill_fd);
+    }
+    else {
+        release_single_user_lock();
+    }
 
     DBGN(cerr << "exiting destructor." << endl);
     DESTROY(&d_cache_mutex);
@@ -518,6 +542,16 @@ HTTPCache::get_cache_root() const
     return d_cache_root;
 }
 
+/** Is the persistent store shared with other processes? This is set when
+    the cache is created; see instance().
+    @return True if the cache is shared. */
+
+bool
+HTTPCache::is_cache_shared() const
+{
+    return d_cache_shared;
+}
+
 
 /** Create the cache's root directory. This is the persistent store used by
     the cache. Paths must always end in DIR_SEPARATOR_CHAR.
@@ -735,7 +769,7 @@ HTTPCache::set_max_size(unsigned long size)
 
         if (new_size < old_size && startGC()) {
             perform_garbage_collection();
-            d_http_cache_table->cache_index_write();
+            d_http_cache_table->cache_index_compact();
         }
     }
     catch (...) {
@@ -780,7 +814,7 @@ HTTPCache::set_max_entry_size(unsigned long size)
             d_max_entry_size = new_size;
             if (new_size < old_size && startGC()) {
                 perform_garbage_collection();
-                d_http_cache_table->cache_index_write();
+                d_http_cache_table->cache_index_compact();
             }
         }
     }
@@ -1127,6 +1161,39 @@ HTTPCache::open_body(const string &cachename)
     return src;
 }
 
+/** Open the body of a response in a shared cache and read-lock it. The lock
+    is released when the file is closed.
+
+    A private method.
+
+    @param cachename The name of the file that holds the response body.
+    @return The open, locked, file or null if another process has removed the
+    response. */
+
+FILE *
+HTTPCache::open_shared_body(const string &cachename)
+{
+    FILE *src = fopen(cachename.c_str(), "rb");
+    if (!src)
+        return 0;
+
+    struct flock lock;
+    lock.l_type = F_RDLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+
+    // The file may have been unlinked between the time it was opened and
+    // the time it was locked.
+    struct stat buf;
+    if (fcntl(fileno(src), F_SETLK, &lock) == -1 || fstat(fileno(src), &buf) != 0 || buf.st_nlink == 0) {
+        fclose(src);
+        return 0;
+    }
+
+    return src;
+}
+
 /** Add a new response to the cache, or replace an existing cached response
     with new data. This method returns True if the information for \c url was
     added to the cache. A response might not be cache-able; in that case this
@@ -1214,7 +1281,7 @@ HTTPCache::cache_response(const string &url, time_t request_time,
             if (startGC())
                 perform_garbage_collection();
 
-            d_http_cache_table->cache_index_write(); // resets new_entries
+            d_http_cache_table->cache_index_compact(); // resets new_entries
         }
     }
     catch (...) {
@@ -1334,6 +1401,7 @@ HTTPCache::update_response(const string &url, time_t request_time,
 
         // Update corrected_initial_age, freshness_lifetime, response_time.
         d_http_cache_table->calculate_time(entry, d_default_expiration, request_time);
+        d_http_cache_table->cache_index_append(entry);
 
         // Merge the new headers with those in the persistent store. How:
         // Load the new headers into a set, then merge the old headers. Since
@@ -1470,6 +1538,12 @@ HTTPCache::is_url_valid(const string &url)
     response without having to first dump it all to a separate file and then
     copy it into the cache (using cache_response()).
 
+    If the cache is shared, the changes other processes made to the cache
+    index are read first and the response body is read-locked (using
+    fcntl(2)) so that the garbage collection done by other processes leaves
+    it alone until it is closed. A response another process has removed is
+    treated as a miss.
+
     @param url Get response information for this URL.
     @param headers Return the response headers in this parameter
     @param cacheName A value-result parameter; the name of the cache file
@@ -1487,19 +1561,29 @@ FILE * HTTPCache::get_cached_response(const string &url,
     DBG(cerr << "Getting the cached response for " << url << endl);
 
     try {
+        d_http_cache_table->cache_index_sync();
+
         entry = d_http_cache_table->get_locked_entry_from_cache_table(url);
         if (!entry) {
         	unlock_cache_interface();
         	return 0;
         }
 
+        if (d_cache_shared && !(body = open_shared_body(entry->get_cachename()))) {
+            DBG(cerr << "The response for " << url << " was removed by another process." << endl);
+            entry->unlock_read_response();
+            unlock_cache_interface();
+            return 0;
+        }
+
         cacheName = entry->get_cachename();
         read_metadata(entry->get_cachename(), headers);
 
         DBG(cerr << "Headers just read from cache: " << endl);
         DBGN(copy(headers.begin(), headers.end(), ostream_iterator<string>(cerr, "\n")));
 
-        body = open_body(entry->get_cachename());
+        if (!body)
+            body = open_body(entry->get_cachename());
 
         DBG(cerr << "Returning: " << url << " from the cache." << endl);
 
@@ -1584,6 +1668,59 @@ HTTPCache::release_cached_response(FILE *body)
     unlock_cache_interface();
 }
 
+/** Lock the fill of a cache entry. Processes sharing a cache call this
+    before fetching a response they did not find in the cache, check the
+    cache again and then fetch and cache the response only if it is still
+    missing. The other processes wait for the first to finish so the
+    response is only fetched once. Does nothing unless the cache is shared.
+
+    The locks are byte-range locks on the \c .fill file in the cache root;
+    URLs that hash to the same byte share a lock. Like all fcntl(2) locks
+    these are held by the process, so they do not keep threads in the same
+    process from fetching the same URL.
+
+    This method does \e not lock the interface; do not call it while holding
+    that lock.
+
+    @param url The URL that will be fetched.
+    @exception Error Thrown if the lock cannot be obtained. */
+
+void
+HTTPCache::lock_cache_fill(const string &url)
+{
+    if (!d_cache_shared || d_fill_fd < 0)
+        return;
+
+    struct flock lock;
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = get_url_hash(url) & CACHE_FILL_MASK;
+    lock.l_len = 1;
+
+    while (fcntl(d_fill_fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR)
+            throw Error(internal_error, string("Could not lock the cache fill: ") + strerror(errno));
+    }
+}
+
+/** Release the lock obtained by lock_cache_fill().
+    @param url The URL that was fetched. */
+
+void
+HTTPCache::unlock_cache_fill(const string &url)
+{
+    if (!d_cache_shared || d_fill_fd < 0)
+        return;
+
+    struct flock lock;
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = get_url_hash(url) & CACHE_FILL_MASK;
+    lock.l_len = 1;
+
+    fcntl(d_fill_fd, F_SETLK, &lock);
+}
+
 /** Purge both the in-memory cache table and the contents of the cache on
     disk. This method deletes every entry in the persistent store but leaves
     the structure intact. The client of HTTPCache is responsible for making
@@ -105,6 +105,8 @@ class HTTPCache
 private:
     string d_cache_root;
     FILE *d_locked_open_file; // Lock for single process use.
+    bool d_cache_shared; // Other processes may use the cache, too.
+    int d_fill_fd; // Holds the cache fill locks of a shared cache.
 
     bool d_cache_enabled;
     bool d_cache_protected;
@@ -147,7 +149,7 @@ private:
     HTTPCache();
     HTTPCache &operator=(const HTTPCache &);
 
-    HTTPCache(string cache_root, bool force);
+    HTTPCache(string cache_root, bool force, bool shared = false);
 
     static void delete_instance(); // Run by atexit (hence static)
     
@@ -166,6 +168,7 @@ private:
     void read_metadata(const string &cachename, vector<string> &headers);
     int write_body(const string &cachename, const FILE *src);
     FILE *open_body(const string &cachename);
+    FILE *open_shared_body(const string &cachename);
 
     bool stopGC() const;
     bool startGC() const;
@@ -176,10 +179,11 @@ private:
     void hits_gc();
 
 public:
-    static HTTPCache *instance(const string &cache_root, bool force = false);
+    static HTTPCache *instance(const string &cache_root, bool force = false, bool shared = false);
     virtual ~HTTPCache();
 
     string get_cache_root() const;
+    bool is_cache_shared() const;
 
     void set_cache_enabled(bool mode);
     bool is_cache_enabled() const;
@@ -236,6 +240,10 @@ public:
 
     void release_cached_response(FILE *response);
 
+    // Don't lock the interface while holding one of these
+    void lock_cache_fill(const string &url);
+    void unlock_cache_fill(const string &url);
+
     void purge_cache();
 };
 
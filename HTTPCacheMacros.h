@@ -64,6 +64,7 @@
 
 #define CACHE_INDEX ".index"
 #define CACHE_LOCK ".lock"
+#define CACHE_FILL ".fill"
 #define CACHE_META ".meta"
 #define CACHE_EMPTY_ETAG "@cache@"
 
@@ -34,6 +34,8 @@
 #include <unistd.h>   // for stat
 #include <sys/types.h>  // for stat and mkdir
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include <cstring>
 #include <cerrno>
@@ -92,6 +94,12 @@
 
 const int CACHE_TABLE_SIZE = 1499;
 
+// The initial number of slots in the cache table's index; must be a power of
+// two. The index is doubled whenever it becomes more than CACHE_INDEX_LOAD
+// percent full.
+const size_t CACHE_INDEX_SIZE = 2048;
+const size_t CACHE_INDEX_LOAD = 70;
+
 using namespace std;
 
 namespace libdap {
@@ -110,20 +118,61 @@ get_hash(const string &url)
     return hash;
 }
 
-HTTPCacheTable::HTTPCacheTable(const string &cache_root, int block_size) :
-    d_cache_root(cache_root), d_block_size(block_size), d_current_size(0), d_new_entries(0)
+/** Compute the 64-bit hash value used to find a URL in the cache table. This
+    is FNV-1a followed by a final mixing step so that the low order bits,
+    which select the slot in the table's index, depend on the whole URL.
+    @param url
+    @return The hash code. */
+uint64_t
+get_url_hash(const string &url)
 {
-    d_cache_index = cache_root + CACHE_INDEX;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const char *ptr = url.c_str(); *ptr; ptr++) {
+        hash ^= *(unsigned char *)ptr;
+        hash *= 1099511628211ULL;
+    }
 
-    d_cache_table = new CacheEntries*[CACHE_TABLE_SIZE];
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/** Make a new cache table and read the cache index.
+
+    @param cache_root The cache's root directory.
+    @param block_size The file system's block size.
+    @param shared If true, other processes may use the cache at the same time;
+    the index is locked while it is changed and the changes other processes
+    make are read by cache_index_sync(). */
+HTTPCacheTable::HTTPCacheTable(const string &cache_root, int block_size, bool shared) :
+    d_cache_root(cache_root), d_block_size(block_size), d_current_size(0), d_new_entries(0),
+    d_journal_fd(-1), d_journal_records(0), d_shared(shared), d_lock_fd(-1), d_journal_offset(0),
+    d_journal_ino(0), d_update_depth(0)
+{
+    d_cache_index = cache_root + CACHE_INDEX;
 
-    // Initialize the cache table.
-    for (int i = 0; i < CACHE_TABLE_SIZE; ++i)
-	d_cache_table[i] = 0;
+    m_rebuild_index(CACHE_INDEX_SIZE);
 
     cache_index_read();
 }
 
+/** compute real disk space for an entry. */
+static inline int
+entry_disk_space(int size, unsigned int block_size)
+{
+    unsigned int num_of_blocks = (size + block_size) / block_size;
+    
+    DBG(cerr << "size: " << size << ", block_size: " << block_size
+        << ", num_of_blocks: " << num_of_blocks << endl);
+
+    return num_of_blocks * block_size;
+}
+
 /** Called by for_each inside ~HTTPCache().
     @param e The cache entry to delete. */
 
@@ -136,21 +185,135 @@ delete_cache_entry(HTTPCacheTable::CacheEntry *e)
 
 HTTPCacheTable::~HTTPCacheTable()
 {
-    for (int i = 0; i < CACHE_TABLE_SIZE; ++i) {
-        HTTPCacheTable::CacheEntries *cp = get_cache_table()[i];
-        if (cp) {
-            // delete each entry
-            for_each(cp->begin(), cp->end(), delete_cache_entry);
+    m_close_journal();
+    if (d_lock_fd >= 0)
+        close(d_lock_fd);
+
+    for_each(d_entries.begin(), d_entries.end(), delete_cache_entry);
+}
+
+/** @name Cache table index
+
+    These private methods maintain the open-addressing index of d_entries. */
+
+//@{
+
+/** Find the slot in the index for an entry.
+
+    @param hash The hash code for \c url (see get_url_hash()).
+    @param url Look for this URL.
+    @return The slot that holds the entry or -1 if \c url is not in the
+    table. */
+int
+HTTPCacheTable::m_find_slot(uint64_t hash, const string &url) const
+{
+    size_t mask = d_index.size() - 1;
+    for (size_t i = hash & mask; d_index[i].index; i = (i + 1) & mask) {
+        const CacheSlot &slot = d_index[i];
+        // Must test the entry because a garbage collection walk may have
+        // removed it; the CacheEntry will then be null.
+        if (slot.hash == hash && d_entries[slot.index - 1] && d_entries[slot.index - 1]->url == url)
+            return i;
+    }
+
+    return -1;
+}
+
+/** Add an index slot for the entry at position \c index in d_entries. The
+    caller must make sure the index has room for it. */
+void
+HTTPCacheTable::m_insert_slot(uint64_t hash, uint32_t index)
+{
+    size_t mask = d_index.size() - 1;
+    size_t i = hash & mask;
+    while (d_index[i].index)
+        i = (i + 1) & mask;
+
+    d_index[i].hash = hash;
+    d_index[i].index = index + 1;
+}
+
+/** Empty a slot in the index. Later slots in the same run of the probe
+    sequence are shifted back so that no lookup stops early at the hole
+    (i.e., no tombstones are needed). */
+void
+HTTPCacheTable::m_erase_slot(int slot)
+{
+    size_t mask = d_index.size() - 1;
+    size_t hole = slot;
+    for (size_t i = (hole + 1) & mask; d_index[i].index; i = (i + 1) & mask) {
+        // Move the entry back if its home slot is not in (hole, i]
+        size_t home = d_index[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            d_index[hole] = d_index[i];
+            hole = i;
+        }
+    }
+
+    d_index[hole].index = 0;
+}
+
+/** Rebuild the index from d_entries and d_entry_hashes.
+    @param capacity The new number of slots; a power of two. */
+void
+HTTPCacheTable::m_rebuild_index(size_t capacity)
+{
+    CacheSlot empty = { 0, 0 };
+    d_index.assign(capacity, empty);
+
+    for (uint32_t i = 0; i < d_entries.size(); ++i)
+        m_insert_slot(d_entry_hashes[i], i);
+}
 
-            // now delete the vector that held the entries
-            delete get_cache_table()[i];
-            get_cache_table()[i] = 0;
+/** Remove an entry from the table, but do not delete it. The last entry in
+    d_entries is moved into its place so the entries stay contiguous.
+    @param slot The entry's slot in the index. */
+void
+HTTPCacheTable::m_erase_entry(int slot)
+{
+    uint32_t index = d_index[slot].index - 1;
+    m_erase_slot(slot);
+
+    uint32_t last = d_entries.size() - 1;
+    if (index != last) {
+        // Point the last entry's slot at its new position
+        size_t mask = d_index.size() - 1;
+        size_t i = d_entry_hashes[last] & mask;
+        while (d_index[i].index != last + 1)
+            i = (i + 1) & mask;
+        d_index[i].index = index + 1;
+
+        d_entries[index] = d_entries[last];
+        d_entry_hashes[index] = d_entry_hashes[last];
+    }
+
+    d_entries.pop_back();
+    d_entry_hashes.pop_back();
+}
+
+/** Remove the entries that were deleted (and nulled) by one of the garbage
+    collection walks and rebuild the index if any were found. */
+void
+HTTPCacheTable::m_remove_deleted_entries()
+{
+    size_t j = 0;
+    for (size_t i = 0; i < d_entries.size(); ++i) {
+        if (d_entries[i]) {
+            d_entries[j] = d_entries[i];
+            d_entry_hashes[j] = d_entry_hashes[i];
+            ++j;
         }
     }
 
-    delete[] d_cache_table;
+    if (j != d_entries.size()) {
+        d_entries.resize(j);
+        d_entry_hashes.resize(j);
+        m_rebuild_index(d_index.size());
+    }
 }
 
+//@} End of the cache table index methods.
+
 /** Functor which deletes and nulls a single CacheEntry if it has expired.
     This functor is called by expired_gc which then uses the
     erase(remove(...) ...) idiom to really remove all the vector entries that
@@ -170,7 +333,7 @@ public:
 	} 
 
 	void operator()(HTTPCacheTable::CacheEntry *&e) {
-		if (e && !e->readers && (e->freshness_lifetime
+		if (e && !d_table.is_entry_in_use(e) && (e->freshness_lifetime
 				< (e->corrected_initial_age + (d_time - e->response_time)))) {
 			DBG(cerr << "Deleting expired cache entry: " << e->url << endl);
 			d_table.remove_cache_entry(e);
@@ -182,14 +345,16 @@ public:
 // @param time base deletes againt this time, defaults to 0 (now)
 void HTTPCacheTable::delete_expired_entries(time_t time) {
 	// Walk through and delete all the expired entries.
-	for (int cnt = 0; cnt < CACHE_TABLE_SIZE; cnt++) {
-		HTTPCacheTable::CacheEntries *slot = get_cache_table()[cnt];
-		if (slot) {
-			for_each(slot->begin(), slot->end(), DeleteExpired(*this, time));
-			slot->erase(remove(slot->begin(), slot->end(),
-					static_cast<HTTPCacheTable::CacheEntry *>(0)), slot->end());
-		}
+	m_begin_update();
+	try {
+		for_each(d_entries.begin(), d_entries.end(), DeleteExpired(*this, time));
+		m_remove_deleted_entries();
+	}
+	catch (...) {
+		m_end_update();
+		throw;
 	}
+	m_end_update();
 }
 
 /** Functor which deletes and nulls a single CacheEntry which has less than
@@ -208,7 +373,7 @@ public:
 	}
 
 	void operator()(HTTPCacheTable::CacheEntry *&e) {
-		if (e && !e->readers && e->hits <= d_hits) {
+		if (e && !d_table.is_entry_in_use(e) && e->hits <= d_hits) {
 			DBG(cerr << "Deleting cache entry: " << e->url << endl);
 			d_table.remove_cache_entry(e);
 			delete e; e = 0;
@@ -218,16 +383,16 @@ public:
 
 void 
 HTTPCacheTable::delete_by_hits(int hits) {
-    for (int cnt = 0; cnt < CACHE_TABLE_SIZE; cnt++) {
-        if (get_cache_table()[cnt]) {
-            HTTPCacheTable::CacheEntries *slot = get_cache_table()[cnt];
-            for_each(slot->begin(), slot->end(), DeleteByHits(*this, hits));
-            slot->erase(remove(slot->begin(), slot->end(),
-                               static_cast<HTTPCacheTable::CacheEntry*>(0)),
-                        slot->end());
-
-        }
+    m_begin_update();
+    try {
+        for_each(d_entries.begin(), d_entries.end(), DeleteByHits(*this, hits));
+        m_remove_deleted_entries();
     }
+    catch (...) {
+        m_end_update();
+        throw;
+    }
+    m_end_update();
 }
 
 /** Functor which deletes and nulls a single CacheEntry which is larger than 
@@ -244,7 +409,7 @@ public:
 	}
 
 	void operator()(HTTPCacheTable::CacheEntry *&e) {
-		if (e && !e->readers && e->size > d_size) {
+		if (e && !d_table.is_entry_in_use(e) && e->size > d_size) {
 			DBG(cerr << "Deleting cache entry: " << e->url << endl);
 			d_table.remove_cache_entry(e);
 			delete e; e = 0;
@@ -253,26 +418,312 @@ public:
 };
 
 void HTTPCacheTable::delete_by_size(unsigned int size) {
-    for (int cnt = 0; cnt < CACHE_TABLE_SIZE; cnt++) {
-        if (get_cache_table()[cnt]) {
-            HTTPCacheTable::CacheEntries *slot = get_cache_table()[cnt];
-            for_each(slot->begin(), slot->end(), DeleteBySize(*this, size));
-            slot->erase(remove(slot->begin(), slot->end(),
-                               static_cast<HTTPCacheTable::CacheEntry*>(0)),
-                        slot->end());
-
-        }
+    m_begin_update();
+    try {
+        for_each(d_entries.begin(), d_entries.end(), DeleteBySize(*this, size));
+        m_remove_deleted_entries();
     }
+    catch (...) {
+        m_end_update();
+        throw;
+    }
+    m_end_update();
 }
 
 /** @name Cache Index
 
-    These methods manage the cache's index file. Each cache holds an index
-    file named \c .index which stores the cache's state information. */
+    These methods manage the cache's index. The index is a binary journal
+    named \c .index.journal: an eight byte magic string followed by records,
+    each a CacheJournalHeader and \c length bytes of data. An \c add record
+    holds a CacheEntry (see WriteOneCacheEntry) and replaces any earlier
+    entry for the same URL; a \c remove record holds just the URL. Records
+    are appended as entries are added, updated and removed, so an index
+    survives a crash. The journal is compacted, by writing one \c add record
+    per entry to a new file, when the HTTPCache is deleted and when it holds
+    many more records than there are entries.
+
+    The journal is written in the host's byte order; it is not meant to be
+    shared between machines. Hit counts are only saved when the journal is
+    compacted.
+
+    Older versions of the library used a text index file named \c .index.
+    If there is no journal that file is read and replaced by a journal. */
 
 //@{
 
-/** Remove the cache index file.
+#define CACHE_JOURNAL ".journal"
+#define CACHE_JOURNAL_MAGIC "DAPCJ001"
+#define CACHE_JOURNAL_MAGIC_LEN 8
+
+// Compact the journal when it has more than twice as many records as there
+// are entries in the table, plus this many.
+#define CACHE_JOURNAL_SLACK 1024
+
+enum CacheJournalOp {
+    journal_add = 1,
+    journal_remove = 2
+};
+
+struct CacheJournalHeader {
+    uint32_t op;
+    uint32_t length;
+};
+
+// The fixed size part of an add record; the url, cachename and etag follow.
+struct CacheJournalEntry {
+    int64_t lm;
+    int64_t expires;
+    int64_t size;
+    int64_t freshness_lifetime;
+    int64_t response_time;
+    int64_t corrected_initial_age;
+    int32_t hash;
+    int32_t hits;
+    uint32_t flags; // range, must_revalidate
+    uint32_t url_len;
+    uint32_t cachename_len;
+    uint32_t etag_len;
+};
+
+#define JOURNAL_RANGE 0x01
+#define JOURNAL_MUST_REVALIDATE 0x02
+
+/** Build a journal record. */
+static void
+build_journal_record(vector<char> &record, CacheJournalOp op, const char *data, uint32_t length)
+{
+    CacheJournalHeader header;
+    header.op = op;
+    header.length = length;
+
+    record.resize(sizeof(CacheJournalHeader) + length);
+    memcpy(&record[0], &header, sizeof(CacheJournalHeader));
+    if (length)
+        memcpy(&record[sizeof(CacheJournalHeader)], data, length);
+}
+
+/** Functor which builds the journal's \c add record for a single CacheEntry
+    and, if given a FILE pointer, writes it to that file. */
+
+class WriteOneCacheEntry :
+	public unary_function<HTTPCacheTable::CacheEntry *, void>
+{
+
+    FILE *d_fp;
+    vector<char> d_data;
+
+public:
+    vector<char> d_record;
+
+    WriteOneCacheEntry(FILE *fp = 0) : d_fp(fp)
+    {}
+
+    void operator()(HTTPCacheTable::CacheEntry *e)
+    {
+        if (!e)
+            return;
+
+        CacheJournalEntry je;
+        je.lm = e->lm;
+        je.expires = e->expires;
+        je.size = e->size;
+        je.freshness_lifetime = e->freshness_lifetime;
+        je.response_time = e->response_time;
+        je.corrected_initial_age = e->corrected_initial_age;
+        je.hash = e->hash;
+        je.hits = e->hits;
+        je.flags = (e->range ? JOURNAL_RANGE : 0) | (e->must_revalidate ? JOURNAL_MUST_REVALIDATE : 0);
+        je.url_len = e->url.size();
+        je.cachename_len = e->cachename.size();
+        je.etag_len = e->etag.size();
+
+        d_data.resize(sizeof(CacheJournalEntry) + je.url_len + je.cachename_len + je.etag_len);
+        char *data = &d_data[0];
+        memcpy(data, &je, sizeof(CacheJournalEntry));
+        data += sizeof(CacheJournalEntry);
+        memcpy(data, e->url.data(), je.url_len);
+        data += je.url_len;
+        memcpy(data, e->cachename.data(), je.cachename_len);
+        data += je.cachename_len;
+        memcpy(data, e->etag.data(), je.etag_len);
+
+        build_journal_record(d_record, journal_add, &d_data[0], d_data.size());
+
+        if (d_fp && fwrite(&d_record[0], d_record.size(), 1, d_fp) != 1)
+            throw Error(internal_error, "Cache Index. Error writing cache index\n");
+    }
+};
+
+/** Functor which builds a new CacheEntry from the data of an \c add record. */
+
+class ReadOneCacheEntry {
+public:
+    HTTPCacheTable::CacheEntry *operator()(const char *data, uint32_t length)
+    {
+        CacheJournalEntry je;
+        if (length < sizeof(CacheJournalEntry))
+            return 0;
+        memcpy(&je, data, sizeof(CacheJournalEntry));
+        if ((uint64_t)je.url_len + je.cachename_len + je.etag_len != length - sizeof(CacheJournalEntry))
+            return 0;
+
+        HTTPCacheTable::CacheEntry *e = new HTTPCacheTable::CacheEntry;
+        e->lm = je.lm;
+        e->expires = je.expires;
+        e->size = je.size;
+        e->freshness_lifetime = je.freshness_lifetime;
+        e->response_time = je.response_time;
+        e->corrected_initial_age = je.corrected_initial_age;
+        e->hash = je.hash;
+        e->hits = je.hits;
+        e->range = je.flags & JOURNAL_RANGE;
+        e->must_revalidate = je.flags & JOURNAL_MUST_REVALIDATE;
+
+        data += sizeof(CacheJournalEntry);
+        e->url.assign(data, je.url_len);
+        data += je.url_len;
+        e->cachename.assign(data, je.cachename_len);
+        data += je.cachename_len;
+        e->etag.assign(data, je.etag_len);
+
+        return e;
+    }
+};
+
+/** The name of the journal that holds the cache index. */
+string
+HTTPCacheTable::m_journal_name() const
+{
+    return d_cache_index + CACHE_JOURNAL;
+}
+
+/** Open the journal for appending, creating it if needed. In shared mode the
+    caller must hold the index lock. */
+void
+HTTPCacheTable::m_open_journal()
+{
+    m_close_journal();
+
+    string journal = m_journal_name();
+    d_journal_fd = open(journal.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (d_journal_fd < 0)
+        throw Error(internal_error, "Cache Index. Can't open `" + journal + "' for writing");
+
+    struct stat buf;
+    if (fstat(d_journal_fd, &buf) == 0 && buf.st_size == 0) {
+        if (write(d_journal_fd, CACHE_JOURNAL_MAGIC, CACHE_JOURNAL_MAGIC_LEN) != CACHE_JOURNAL_MAGIC_LEN) {
+            m_close_journal();
+            throw Error(internal_error, "Cache Index. Error writing `" + journal + "'");
+        }
+
+        // A new, empty journal
+        d_journal_ino = buf.st_ino;
+        d_journal_offset = CACHE_JOURNAL_MAGIC_LEN;
+    }
+}
+
+void
+HTTPCacheTable::m_close_journal()
+{
+    if (d_journal_fd >= 0)
+        close(d_journal_fd);
+    d_journal_fd = -1;
+}
+
+/** Lock the index of a shared cache. The lock is held on a separate file
+    (\c .index.lock) because the journal is replaced when it is compacted.
+    Does nothing unless the cache is shared.
+    @param type F_RDLCK or F_WRLCK */
+void
+HTTPCacheTable::m_lock_index(short type)
+{
+    if (!d_shared)
+        return;
+
+    if (d_lock_fd < 0) {
+        string lock = d_cache_index + CACHE_LOCK;
+        d_lock_fd = open(lock.c_str(), O_RDWR | O_CREAT, 0600);
+        if (d_lock_fd < 0)
+            throw Error(internal_error, "Cache Index. Can't open `" + lock + "'");
+    }
+
+    struct flock lock;
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+
+    while (fcntl(d_lock_fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR)
+            throw Error(internal_error, string("Cache Index. Could not lock the index: ") + strerror(errno));
+    }
+}
+
+void
+HTTPCacheTable::m_unlock_index()
+{
+    if (!d_shared || d_lock_fd < 0)
+        return;
+
+    struct flock lock;
+    lock.l_type = F_UNLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+
+    fcntl(d_lock_fd, F_SETLK, &lock);
+}
+
+/** Start a change to the cache index. For a shared cache, lock the index
+    and apply the changes other processes have made to it. Changes may be
+    nested; only the outermost locks and unlocks the index. Does nothing
+    while the journal is being read. */
+void
+HTTPCacheTable::m_begin_update()
+{
+    if (!d_shared || d_journal_fd < 0 || d_update_depth++ > 0)
+        return;
+
+    m_lock_index(F_WRLCK);
+    try {
+        // The journal was removed by another process; start a new one
+        if (!m_sync_journal(true))
+            m_open_journal();
+    }
+    catch (...) {
+        --d_update_depth;
+        m_unlock_index();
+        throw;
+    }
+}
+
+void
+HTTPCacheTable::m_end_update()
+{
+    if (!d_shared || d_update_depth == 0 || --d_update_depth > 0)
+        return;
+
+    m_unlock_index();
+}
+
+/** Append a record to the journal. Does nothing if the journal is not open,
+    which is the case while it is being read. In shared mode this must be
+    called between m_begin_update() and m_end_update().
+    @exception Error Thrown if the record cannot be written. */
+void
+HTTPCacheTable::m_journal_append(const vector<char> &record)
+{
+    if (d_journal_fd < 0)
+        return;
+
+    if (write(d_journal_fd, &record[0], record.size()) != (ssize_t)record.size())
+        throw Error(internal_error, "Cache Index. Error writing `" + m_journal_name() + "'");
+
+    d_journal_offset += record.size();
+    ++d_journal_records;
+}
+
+/** Remove the cache index.
 
     A private method.
 
@@ -282,13 +733,36 @@ bool
 HTTPCacheTable::cache_index_delete()
 {
 	d_new_entries = 0;
-	
-    return (REMOVE_BOOL(d_cache_index.c_str()) == 0);
+	d_journal_records = 0;
+
+	m_lock_index(F_WRLCK);
+
+	m_close_journal();
+	bool status = (REMOVE_BOOL(m_journal_name().c_str()) == 0);
+	// An old text index, if there is one
+	status = (REMOVE_BOOL(d_cache_index.c_str()) == 0) || status;
+
+	try {
+	    m_open_journal();
+	}
+	catch (...) {
+	    m_unlock_index();
+	    throw;
+	}
+
+	m_unlock_index();
+
+	return status;
 }
 
-/** Read the saved set of cached entries from disk. Consistency between the
-    in-memory cache and the index is maintained by only reading the index
-    file when the HTTPCache object is created!
+/** Read the saved set of cached entries from disk. Unless the cache is
+    shared, consistency between the in-memory cache and the index is
+    maintained by only reading the index when the HTTPCache object is
+    created! A shared cache calls cache_index_sync() to read the changes made
+    by other processes.
+
+    If there is no journal, but there is a text index file, read that and
+    write the entries to a new journal.
 
     A private method.
 
@@ -296,6 +770,239 @@ HTTPCacheTable::cache_index_delete()
 
 bool
 HTTPCacheTable::cache_index_read()
+{
+    m_close_journal();
+    d_journal_records = 0;
+    d_journal_offset = 0;
+    d_journal_ino = 0;
+
+    bool status;
+    m_lock_index(F_WRLCK);
+    try {
+        status = m_sync_journal(true);
+        if (!status && m_read_text_index()) {
+            m_write_journal(); // Replace the text index with a journal
+            status = true;
+        }
+
+        m_open_journal();
+    }
+    catch (...) {
+        m_unlock_index();
+        throw;
+    }
+    m_unlock_index();
+
+    d_new_entries = 0;
+
+    return status;
+}
+
+/** Apply the changes other processes have made to the index of a shared
+    cache. Does nothing unless the cache is shared.
+
+    @exception Error Thrown if the index cannot be locked. */
+void
+HTTPCacheTable::cache_index_sync()
+{
+    if (!d_shared || d_update_depth > 0)
+        return;
+
+    m_lock_index(F_RDLCK);
+    try {
+        m_sync_journal(false);
+    }
+    catch (...) {
+        m_unlock_index();
+        throw;
+    }
+    m_unlock_index();
+}
+
+/** Apply an \c add record to the table. If there is already an entry for
+    the URL, update it (the record was written by another process, or this
+    one, after that entry was added). */
+void
+HTTPCacheTable::m_merge_entry(CacheEntry *e)
+{
+    int slot = m_find_slot(get_url_hash(e->url), e->url);
+    if (slot < 0) {
+        m_add_entry(e);
+        return;
+    }
+
+    CacheEntry *entry = d_entries[d_index[slot].index - 1];
+
+    unsigned long eds = entry_disk_space(entry->size, d_block_size);
+    d_current_size = (eds > d_current_size) ? 0 : d_current_size - eds;
+    d_current_size += entry_disk_space(e->size, d_block_size);
+
+    entry->cachename = e->cachename;
+    entry->etag = e->etag;
+    entry->lm = e->lm;
+    entry->expires = e->expires;
+    entry->size = e->size;
+    entry->range = e->range;
+    entry->hash = e->hash;
+    entry->freshness_lifetime = e->freshness_lifetime;
+    entry->response_time = e->response_time;
+    entry->corrected_initial_age = e->corrected_initial_age;
+    entry->must_revalidate = e->must_revalidate;
+    entry->hits = max(entry->hits, e->hits);
+
+    delete e;
+}
+
+/** Remove an entry from the table because a \c remove record was read. The
+    entry's files have already been removed. An entry in use by this process
+    is left in place. */
+void
+HTTPCacheTable::m_forget_entry(const string &url)
+{
+    int slot = m_find_slot(get_url_hash(url), url);
+    if (slot < 0)
+        return;
+
+    CacheEntry *entry = d_entries[d_index[slot].index - 1];
+    if (entry->readers)
+        return;
+
+    unsigned long eds = entry_disk_space(entry->size, d_block_size);
+    d_current_size = (eds > d_current_size) ? 0 : d_current_size - eds;
+
+    m_erase_entry(slot);
+    delete entry;
+}
+
+/** Apply the records in the journal, starting at d_journal_offset, to the
+    table. The journal is mapped into memory. When the journal was replaced
+    (compacted) by another process, or is read for the first time, all of it
+    is read and entries that are no longer in it are removed from the table.
+
+    A partial record at the end of the journal (the result of a crash while it
+    was being written) is discarded. If \c truncate is true the journal is
+    truncated so that new records follow the last good one; in shared mode
+    that is only safe while holding the write lock on the index.
+
+    A private method.
+
+    @param truncate Truncate the journal after the last good record.
+    @return True when the journal was found and read, false otherwise. */
+
+bool
+HTTPCacheTable::m_sync_journal(bool truncate)
+{
+    int fd = open(m_journal_name().c_str(), O_RDWR);
+    // If the journal can't be opened that's OK; start with an empty cache.
+    if (fd < 0)
+        return false;
+
+    struct stat buf;
+    if (fstat(fd, &buf) != 0 || buf.st_size < CACHE_JOURNAL_MAGIC_LEN) {
+        close(fd);
+        return false;
+    }
+
+    bool reload = buf.st_ino != d_journal_ino || buf.st_size < d_journal_offset;
+    size_t size = buf.st_size;
+    size_t offset = reload ? 0 : d_journal_offset;
+    if (offset == size) {
+        close(fd);
+        return true;
+    }
+
+    void *mem = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    const char *data = static_cast<const char *>(mem);
+    if (reload) {
+        if (memcmp(data, CACHE_JOURNAL_MAGIC, CACHE_JOURNAL_MAGIC_LEN) != 0) {
+            munmap(mem, size);
+            close(fd);
+            return false;
+        }
+        offset = CACHE_JOURNAL_MAGIC_LEN;
+        d_journal_records = 0;
+    }
+
+    set<string> urls;
+    ReadOneCacheEntry read_entry;
+    while (offset + sizeof(CacheJournalHeader) <= size) {
+        CacheJournalHeader header;
+        memcpy(&header, data + offset, sizeof(CacheJournalHeader));
+        if (header.length > size - offset - sizeof(CacheJournalHeader))
+            break;
+
+        const char *record = data + offset + sizeof(CacheJournalHeader);
+        if (header.op == journal_add) {
+            CacheEntry *e = read_entry(record, header.length);
+            if (!e)
+                break;
+            if (reload)
+                urls.insert(e->url);
+            m_merge_entry(e);
+        }
+        else if (header.op == journal_remove) {
+            string url(record, header.length);
+            if (reload)
+                urls.erase(url);
+            m_forget_entry(url);
+        }
+        else {
+            break;
+        }
+
+        offset += sizeof(CacheJournalHeader) + header.length;
+        ++d_journal_records;
+    }
+
+    munmap(mem, size);
+
+    if (offset != size && truncate) {
+        DBG(cerr << "HTTPCache::m_sync_journal - Discarding " << size - offset << " bytes at the end of the journal" << endl);
+        if (ftruncate(fd, offset) != 0) {
+            DBG(cerr << "HTTPCache::m_sync_journal - Failed to truncate the journal" << endl);
+        }
+    }
+
+    close(fd);
+
+    if (reload) {
+        // Remove the entries that are no longer in the journal
+        for (CacheEntriesIter i = d_entries.begin(); i != d_entries.end(); ++i) {
+            if (!(*i)->readers && urls.find((*i)->url) == urls.end()) {
+                unsigned long eds = entry_disk_space((*i)->size, d_block_size);
+                d_current_size = (eds > d_current_size) ? 0 : d_current_size - eds;
+                delete *i;
+                *i = 0;
+            }
+        }
+        m_remove_deleted_entries();
+
+        // Append to the new journal
+        if (d_journal_fd >= 0) {
+            m_open_journal();
+        }
+    }
+
+    d_journal_ino = buf.st_ino;
+    d_journal_offset = offset;
+
+    return true;
+}
+
+/** Read a text index file, the format used by older versions of the
+    library.
+
+    A private method.
+
+    @return True when a cache index was found and read, false otherwise. */
+
+bool
+HTTPCacheTable::m_read_text_index()
 {
     FILE *fp = fopen(d_cache_index.c_str(), "r");
     // If the cache index can't be opened that's OK; start with an empty
@@ -306,7 +1013,7 @@ HTTPCacheTable::cache_index_read()
 
     char line[1024];
     while (!feof(fp) && fgets(line, 1024, fp)) {
-    	add_entry_to_cache_table(cache_index_parse_line(line));
+    	m_add_entry(cache_index_parse_line(line));
         DBG2(cerr << line << endl);
     }
 
@@ -315,12 +1022,10 @@ HTTPCacheTable::cache_index_read()
         DBG(cerr << "HTTPCache::cache_index_read - Failed to close " << (void *)fp << endl);
     }
 
-    d_new_entries = 0;
-    
     return true;
 }
 
-/** Parse one line of the index file.
+/** Parse one line of a text index file.
 
     A private method.
 
@@ -356,79 +1061,130 @@ HTTPCacheTable::cache_index_parse_line(const char *line)
     return entry;
 }
 
-/** Functor which writes a single CacheEntry to the \c .index file. */
-
-class WriteOneCacheEntry :
-	public unary_function<HTTPCacheTable::CacheEntry *, void>
+/** Write a new, compacted, journal holding an \c add record for each entry
+    and replace the current journal with it. In shared mode the caller must
+    hold the index lock. */
+void
+HTTPCacheTable::m_write_journal()
 {
+    string journal = m_journal_name();
+    string tmp = journal + ".tmp";
 
-    FILE *d_fp;
+    DBG(cerr << "Cache Index. Writing index " << journal << endl);
 
-public:
-    WriteOneCacheEntry(FILE *fp) : d_fp(fp)
-    {}
+    // Open the file for writing.
+    FILE * fp = NULL;
+    if ((fp = fopen(tmp.c_str(), "wb")) == NULL) {
+        throw Error(string("Cache Index. Can't open `") + tmp
+                    + string("' for writing"));
+    }
 
-    void operator()(HTTPCacheTable::CacheEntry *e)
-    {
-        if (e && fprintf(d_fp,
-                         "%s %s %s %ld %ld %ld %c %d %d %ld %ld %ld %c\r\n",
-                         e->url.c_str(),
-                         e->cachename.c_str(),
-                         e->etag == "" ? CACHE_EMPTY_ETAG : e->etag.c_str(),
-                         (long)(e->lm),
-                         (long)(e->expires),
-                         e->size,
-                         e->range ? '1' : '0', // not used. 10/02/02 jhrg
-                         e->hash,
-                         e->hits,
-                         (long)(e->freshness_lifetime),
-                         (long)(e->response_time),
-                         (long)(e->corrected_initial_age),
-                         e->must_revalidate ? '1' : '0') < 0)
+    // Write an add record for every entry, then move the new journal into
+    // place so that a crash leaves either the old or the new journal.
+    long size;
+    struct stat buf;
+    try {
+        if (fwrite(CACHE_JOURNAL_MAGIC, CACHE_JOURNAL_MAGIC_LEN, 1, fp) != 1)
+            throw Error(internal_error, "Cache Index. Error writing cache index\n");
+
+        for_each(d_entries.begin(), d_entries.end(), WriteOneCacheEntry(fp));
+
+        if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fstat(fileno(fp), &buf) != 0)
             throw Error(internal_error, "Cache Index. Error writing cache index\n");
+
+        size = ftell(fp);
+    }
+    catch (...) {
+        fclose(fp);
+        REMOVE_BOOL(tmp.c_str());
+        throw;
+    }
+
+    /* Done writing */
+    int res = fclose(fp);
+    if (res) {
+        DBG(cerr << "HTTPCache::cache_index_write - Failed to close "
+            << (void *)fp << endl);
     }
-};
 
-/** Walk through the list of cached objects and write the cache index file to
-    disk. If the file does not exist, it is created. If the file does exist,
-    it is overwritten. As a side effect, zero the new_entries counter.
+    if (rename(tmp.c_str(), journal.c_str()) != 0) {
+        REMOVE_BOOL(tmp.c_str());
+        throw Error(internal_error, "Cache Index. Could not replace `" + journal + "'");
+    }
+
+    REMOVE_BOOL(d_cache_index.c_str());
+
+    d_journal_records = d_entries.size();
+    d_journal_ino = buf.st_ino;
+    d_journal_offset = size;
+
+    // Reopen the journal unless it is being read
+    if (d_journal_fd >= 0)
+        m_open_journal();
+}
+
+/** Walk through the list of cached objects and write a new, compacted,
+    journal to disk, replacing the current one. If the index was read from an
+    old text index file, that file is removed. As a side effect, zero the
+    new_entries counter.
 
     A private method.
 
-    @exception Error Thrown if the index file cannot be opened for writing.
+    @exception Error Thrown if the journal cannot be opened for writing.
     @note The HTTPCache destructor calls this method and silently ignores
     this exception. */
 void
 HTTPCacheTable::cache_index_write()
 {
-    DBG(cerr << "Cache Index. Writing index " << d_cache_index << endl);
-
-    // Open the file for writing.
-    FILE * fp = NULL;
-    if ((fp = fopen(d_cache_index.c_str(), "wb")) == NULL) {
-        throw Error(string("Cache Index. Can't open `") + d_cache_index
-                    + string("' for writing"));
+    m_begin_update();
+    try {
+        m_write_journal();
+    }
+    catch (...) {
+        m_end_update();
+        throw;
     }
+    m_end_update();
 
-    // Walk through the list and write it out. The format is really
-    // simple as we keep it all in ASCII.
+    d_new_entries = 0;
+}
 
-    for (int cnt = 0; cnt < CACHE_TABLE_SIZE; cnt++) {
-        HTTPCacheTable::CacheEntries *cp = get_cache_table()[cnt];
-        if (cp)
-            for_each(cp->begin(), cp->end(), WriteOneCacheEntry(fp));
-    }
+/** Compact the journal if it holds many more records than there are entries
+    in the table. As a side effect, zero the new_entries counter.
 
-    /* Done writing */
-    int res = fclose(fp);
-    if (res) {
-        DBG(cerr << "HTTPCache::cache_index_write - Failed to close "
-            << (void *)fp << endl);
-    }
+    @exception Error Thrown if the journal cannot be written. */
+void
+HTTPCacheTable::cache_index_compact()
+{
+    if (d_journal_records > 2 * d_entries.size() + CACHE_JOURNAL_SLACK)
+        cache_index_write();
 
     d_new_entries = 0;
 }
 
+/** Record the current state of \c entry in the journal. Use this after
+    changing an entry that is already in the table; adding and removing
+    entries updates the journal.
+
+    @param entry The CacheEntry.
+    @exception Error Thrown if the journal cannot be written. */
+void
+HTTPCacheTable::cache_index_append(HTTPCacheTable::CacheEntry *entry)
+{
+    WriteOneCacheEntry write_entry;
+    write_entry(entry);
+
+    m_begin_update();
+    try {
+        m_journal_append(write_entry.d_record);
+    }
+    catch (...) {
+        m_end_update();
+        throw;
+    }
+    m_end_update();
+}
+
 //@} End of the cache index methods.
 /** Create the directory path for cache file. The cache uses a set of
     directories within d_cache_root to store individual responses. The name
@@ -537,38 +1293,63 @@ HTTPCacheTable::create_location(HTTPCacheTable::CacheEntry *entry)
 }
 
 
-/** compute real disk space for an entry. */
-static inline int
-entry_disk_space(int size, unsigned int block_size)
-{
-    unsigned int num_of_blocks = (size + block_size) / block_size;
-    
-    DBG(cerr << "size: " << size << ", block_size: " << block_size
-        << ", num_of_blocks: " << num_of_blocks << endl);
-
-    return num_of_blocks * block_size;
-}
-
 /** @name Methods to manipulate instances of CacheEntry. */
 
 //@{
 
+/** Add a CacheEntry to the cache table and record it in the cache index
+    journal. If the cache is shared, an entry another process added for the
+    same URL is replaced (and its files removed).
+
+    @param entry The CacheEntry instance to add. */
+void
+HTTPCacheTable::add_entry_to_cache_table(CacheEntry *entry)
+{
+    WriteOneCacheEntry write_entry;
+    write_entry(entry);
+
+    m_begin_update();
+    try {
+        if (d_shared && d_update_depth > 0) {
+            uint64_t hash = get_url_hash(entry->url);
+            int slot = m_find_slot(hash, entry->url);
+            if (slot >= 0 && !d_entries[d_index[slot].index - 1]->readers) {
+                CacheEntry *e = d_entries[d_index[slot].index - 1];
+                REMOVE(e->cachename.c_str());
+                REMOVE(string(e->cachename + CACHE_META).c_str());
+                m_forget_entry(e->url);
+            }
+        }
+
+        m_add_entry(entry);
+        m_journal_append(write_entry.d_record);
+    }
+    catch (...) {
+        m_end_update();
+        throw;
+    }
+    m_end_update();
+}
+
 /** Add a CacheEntry to the cache table. As each entry is read, load it into
     the in-memory cache table and update the HTTPCache's current_size. The
     later is used by the garbage collection method.
 
     @param entry The CacheEntry instance to add. */
 void
-HTTPCacheTable::add_entry_to_cache_table(CacheEntry *entry)
+HTTPCacheTable::m_add_entry(CacheEntry *entry)
 {
     int hash = entry->hash;
     if (hash > CACHE_TABLE_SIZE-1 || hash < 0)
         throw InternalErr(__FILE__, __LINE__, "Hash value too large!");
 
-    if (!d_cache_table[hash])
-        d_cache_table[hash] = new CacheEntries;
+    if ((d_entries.size() + 1) * 100 > d_index.size() * CACHE_INDEX_LOAD)
+        m_rebuild_index(d_index.size() * 2);
 
-    d_cache_table[hash]->push_back(entry);
+    uint64_t url_hash = get_url_hash(entry->url);
+    m_insert_slot(url_hash, d_entries.size());
+    d_entries.push_back(entry);
+    d_entry_hashes.push_back(url_hash);
     
     DBG(cerr << "add_entry_to_cache_table, current_size: " << d_current_size
         << ", entry->size: " << entry->size << ", block size: " << d_block_size 
@@ -587,34 +1368,27 @@ HTTPCacheTable::add_entry_to_cache_table(CacheEntry *entry)
 HTTPCacheTable::CacheEntry *
 HTTPCacheTable::get_locked_entry_from_cache_table(const string &url) /*const*/
 {
-    return get_locked_entry_from_cache_table(get_hash(url), url);
+    return get_locked_entry_from_cache_table(get_url_hash(url), url);
 }
 
 /** Get a pointer to a CacheEntry from the cache table. Providing a way to
     pass the hash code into this method makes it easier to test for correct
     behavior when two entries collide. 10/07/02 jhrg
 
-    @param hash The hash code for \c url.
+    @param hash The hash code for \c url (see get_url_hash()).
     @param url Look for this URL.
     @return The matching CacheEntry instance or NULL if none was found. */
 HTTPCacheTable::CacheEntry *
-HTTPCacheTable::get_locked_entry_from_cache_table(int hash, const string &url) /*const*/
+HTTPCacheTable::get_locked_entry_from_cache_table(uint64_t hash, const string &url) /*const*/
 {
     DBG(cerr << "url: " << url << "; hash: " << hash << endl);
-    DBG(cerr << "d_cache_table: " << hex << d_cache_table << dec << endl);
-    if (d_cache_table[hash]) {
-	CacheEntries *cp = d_cache_table[hash];
-	for (CacheEntriesIter i = cp->begin(); i != cp->end(); ++i) {
-	    // Must test *i because perform_garbage_collection may have
-	    // removed this entry; the CacheEntry will then be null.
-	    if ((*i) && (*i)->url == url) {
-		(*i)->lock_read_response(); // Lock the response
-		return *i;
-	    }
-	}
-    }
+    int slot = m_find_slot(hash, url);
+    if (slot < 0)
+        return 0;
 
-    return 0;
+    CacheEntry *entry = d_entries[d_index[slot].index - 1];
+    entry->lock_read_response(); // Lock the response
+    return entry;
 }
 
 /** Get a pointer to a CacheEntry from the cache table. Providing a way to
@@ -626,26 +1400,19 @@ HTTPCacheTable::get_locked_entry_from_cache_table(int hash, const string &url) /
 HTTPCacheTable::CacheEntry *
 HTTPCacheTable::get_write_locked_entry_from_cache_table(const string &url)
 {
-	int hash = get_hash(url);
-    if (d_cache_table[hash]) {
-        CacheEntries *cp = d_cache_table[hash];
-        for (CacheEntriesIter i = cp->begin(); i != cp->end(); ++i) {
-            // Must test *i because perform_garbage_collection may have
-            // removed this entry; the CacheEntry will then be null.
-            if ((*i) && (*i)->url == url) {
-            	(*i)->lock_write_response();	// Lock the response
-            	return *i;
-            }
-        }
-    }
+    int slot = m_find_slot(get_url_hash(url), url);
+    if (slot < 0)
+        return 0;
 
-    return 0;
+    CacheEntry *entry = d_entries[d_index[slot].index - 1];
+    entry->lock_write_response(); // Lock the response
+    return entry;
 }
 
 /** Remove a CacheEntry. This means delete the entry's files on disk and free
     the CacheEntry object. The caller should null the entry's pointer in the
     cache_table. The total size of the cache is decremented once the entry is
-    deleted.
+    deleted and the removal is recorded in the cache index journal.
 
     @param entry The CacheEntry to delete.
     @exception InternalErr Thrown if \c entry is in use. */
@@ -666,33 +1433,57 @@ HTTPCacheTable::remove_cache_entry(HTTPCacheTable::CacheEntry *entry)
     set_current_size((eds > get_current_size()) ? 0 : get_current_size() - eds);
     
     DBG(cerr << "remove_cache_entry, current_size: " << get_current_size() << endl);
+
+    vector<char> record;
+    build_journal_record(record, journal_remove, entry->url.data(), entry->url.size());
+
+    m_begin_update();
+    try {
+        m_journal_append(record);
+    }
+    catch (...) {
+        m_end_update();
+        throw;
+    }
+    m_end_update();
 }
 
-/** Functor which deletes and nulls a CacheEntry if the given entry matches
-    the url. */
-class DeleteCacheEntry: public unary_function<HTTPCacheTable::CacheEntry *&, void>
+/** Is an entry in use? An entry is in use if this process is reading it or,
+    when the cache is shared, another process holds a lock on its body (see
+    HTTPCache::get_cached_response()). Entries in use are not removed by the
+    garbage collection methods.
+
+    @param entry The CacheEntry.
+    @return True if the entry is in use. */
+bool
+HTTPCacheTable::is_entry_in_use(HTTPCacheTable::CacheEntry *entry)
 {
-    string d_url;
-    HTTPCacheTable *d_cache_table;
+    if (entry->readers)
+        return true;
 
-public:
-    DeleteCacheEntry(HTTPCacheTable *c, const string &url)
-            : d_url(url), d_cache_table(c)
-    {}
+    if (!d_shared)
+        return false;
 
-    void operator()(HTTPCacheTable::CacheEntry *&e)
-    {
-        if (e && e->url == d_url) {
-        	e->lock_write_response();
-            d_cache_table->remove_cache_entry(e);
-        	e->unlock_write_response();
-            delete e; e = 0;
-        }
-    }
-};
+    // This process holds no locks on the body (it has no readers), so opening
+    // and closing it here cannot release one.
+    int fd = open(entry->cachename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct flock lock;
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = 0;
+    lock.l_len = 0;
+
+    bool in_use = fcntl(fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK;
+    close(fd);
+
+    return in_use;
+}
 
 /** Find the CacheEntry for the given url and remove both its information in
-    the persistent store and the entry in d_cache_table. If \c url is not in
+    the persistent store and the entry in the cache table. If \c url is not in
     the cache, this method does nothing.
 
     @param url Remove this URL's entry.
@@ -700,13 +1491,26 @@ public:
 void
 HTTPCacheTable::remove_entry_from_cache_table(const string &url)
 {
-    int hash = get_hash(url);
-    if (d_cache_table[hash]) {
-        CacheEntries *cp = d_cache_table[hash];
-        for_each(cp->begin(), cp->end(), DeleteCacheEntry(this, url));
-        cp->erase(remove(cp->begin(), cp->end(), static_cast<HTTPCacheTable::CacheEntry*>(0)),
-                  cp->end());
+    uint64_t hash = get_url_hash(url);
+
+    m_begin_update();
+    try {
+        for (int slot = m_find_slot(hash, url); slot >= 0; slot = m_find_slot(hash, url)) {
+            CacheEntry *e = d_entries[d_index[slot].index - 1];
+
+            e->lock_write_response();
+            remove_cache_entry(e);
+            e->unlock_write_response();
+
+            m_erase_entry(slot);
+            delete e;
+        }
+    }
+    catch (...) {
+        m_end_update();
+        throw;
     }
+    m_end_update();
 }
 
 /** Functor to delete and null all unlocked HTTPCacheTable::CacheEntry objects. */
@@ -733,13 +1537,16 @@ void HTTPCacheTable::delete_all_entries()
 {
     // Walk through the cache table and, for every entry in the cache, delete
     // it on disk and in the cache table.
-    for (int cnt = 0; cnt < CACHE_TABLE_SIZE; cnt++) {
-	HTTPCacheTable::CacheEntries *slot = get_cache_table()[cnt];
-	if (slot) {
-	    for_each(slot->begin(), slot->end(), DeleteUnlockedCacheEntry(*this));
-	    slot->erase(remove(slot->begin(), slot->end(), static_cast<HTTPCacheTable::CacheEntry *> (0)), slot->end());
-	}
+    m_begin_update();
+    try {
+        for_each(d_entries.begin(), d_entries.end(), DeleteUnlockedCacheEntry(*this));
+        m_remove_deleted_entries();
+    }
+    catch (...) {
+        m_end_update();
+        throw;
     }
+    m_end_update();
 
     cache_index_delete();
 }
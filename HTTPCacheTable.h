@@ -33,6 +33,9 @@
 #include <io.h>   // stat for win32? 09/05/02 jhrg
 #endif
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include <cstring>
 
 #include <string>
@@ -82,10 +85,14 @@
 namespace libdap {
 
 int get_hash(const string &url);
+uint64_t get_url_hash(const string &url);
 
 /** The table of entries in the client-side cache. This class maintains a table
  of CacheEntries, where one instance of CacheEntry is made for
- each item in the cache. When an item is accessed it is either
+ each item in the cache. The entries are held in one contiguous vector and
+ found using an open-addressing (linear probing) index keyed by a 64-bit
+ hash of the URL; the index grows with the number of entries. When an item
+ is accessed it is either
  locked for reading or writing. When locked for reading the entry is
  recorded on a list of read-locked entries. The caller must explicitly
  free the entry for it to be removed from this list (which is the only
@@ -144,8 +151,8 @@ public:
         friend class HTTPCacheTest;
 
         // Allow access by the functors used in HTTPCacheTable
-        friend class DeleteCacheEntry;
         friend class WriteOneCacheEntry;
+        friend class ReadOneCacheEntry;
         friend class DeleteExpired;
         friend class DeleteByHits;
         friend class DeleteBySize;
@@ -258,20 +265,28 @@ public:
         }
     };
 
-    // Typedefs for CacheTable. A CacheTable is a vector of vectors of
-    // CacheEntries. The outer vector is accessed using the hash value.
-    // Entries with matching hashes occupy successive positions in the inner
-    // vector (that's how hash collisions are resolved). Search the inner
-    // vector for a specific match.
+    // Typedefs for the cache table. The CacheEntries are stored, in no particular
+    // order, in one vector; d_entry_hashes holds the 64-bit hash of each
+    // entry's URL at the same position. The index is an open-addressing table
+    // of slots, each holding a URL hash and the position of its entry plus
+    // one (zero marks an empty slot). Collisions are resolved by linear
+    // probing, so a lookup compares the URLs only when the full hashes match.
     typedef vector<CacheEntry *> CacheEntries;
     typedef CacheEntries::iterator CacheEntriesIter;
 
-    typedef CacheEntries **CacheTable;    // Array of pointers to CacheEntries
+    struct CacheSlot {
+        uint64_t hash;
+        uint32_t index;
+    };
+
+    typedef vector<CacheSlot> CacheIndex;
 
     friend class HTTPCacheTest;
 
 private:
-    CacheTable d_cache_table;
+    CacheEntries d_entries;
+    vector<uint64_t> d_entry_hashes;
+    CacheIndex d_index;
 
     string d_cache_root;
     unsigned int d_block_size; // File block size.
@@ -280,6 +295,15 @@ private:
     string d_cache_index;
     int d_new_entries;
 
+    int d_journal_fd;               // The cache index journal, open for appending
+    unsigned int d_journal_records; // Number of records in the journal
+
+    bool d_shared;                  // Is the cache shared with other processes?
+    int d_lock_fd;                  // The index lock file (shared caches only)
+    off_t d_journal_offset;         // The end of the records read or written
+    ino_t d_journal_ino;            // The inode of the journal d_journal_offset refers to
+    int d_update_depth;             // Nesting of m_begin_update() calls
+
     map<FILE *, HTTPCacheTable::CacheEntry *> d_locked_entries;
 
     // Make these private to prevent use
@@ -287,18 +311,43 @@ private:
     HTTPCacheTable &operator=(const HTTPCacheTable &);
     HTTPCacheTable();
 
-    CacheTable &get_cache_table()
-    {
-        return d_cache_table;
-    }
+    int m_find_slot(uint64_t hash, const string &url) const;
+    void m_insert_slot(uint64_t hash, uint32_t index);
+    void m_erase_slot(int slot);
+    void m_rebuild_index(size_t capacity);
+    void m_erase_entry(int slot);
+    void m_remove_deleted_entries();
+
+    string m_journal_name() const;
+    void m_open_journal();
+    void m_close_journal();
+    void m_journal_append(const vector<char> &record);
+    void m_write_journal();
+    bool m_sync_journal(bool truncate);
+    bool m_read_text_index();
 
-    CacheEntry *get_locked_entry_from_cache_table(int hash, const string &url); /*const*/
+    void m_lock_index(short type);
+    void m_unlock_index();
+    void m_begin_update();
+    void m_end_update();
+
+    void m_add_entry(CacheEntry *entry);
+    void m_merge_entry(CacheEntry *entry);
+    void m_forget_entry(const string &url);
+
+    CacheEntry *get_locked_entry_from_cache_table(uint64_t hash, const string &url); /*const*/
 
 public:
-    HTTPCacheTable(const string &cache_root, int block_size);
+    HTTPCacheTable(const string &cache_root, int block_size, bool shared = false);
     ~HTTPCacheTable();
 
     //@{ @name Accessors/Mutators
+    /// The number of entries in the table
+    unsigned int get_num_entries() const
+    {
+        return d_entries.size();
+    }
+
     unsigned long get_current_size() const
     {
         return d_current_size;
@@ -330,6 +379,11 @@ public:
     {
         return d_cache_root;
     }
+    /// Is the cache shared with other processes?
+    bool is_shared() const
+    {
+        return d_shared;
+    }
     void set_cache_root(const string &cr)
     {
         d_cache_root = cr;
@@ -345,6 +399,9 @@ public:
     bool cache_index_read();
     CacheEntry *cache_index_parse_line(const char *line);
     void cache_index_write();
+    void cache_index_compact();
+    void cache_index_append(CacheEntry *entry);
+    void cache_index_sync();
 
     string create_hash_directory(int hash);
     void create_location(CacheEntry *entry);
@@ -352,6 +409,7 @@ public:
     void add_entry_to_cache_table(CacheEntry *entry);
     void remove_cache_entry(HTTPCacheTable::CacheEntry *entry);
 
+    bool is_entry_in_use(CacheEntry *entry);
     void remove_entry_from_cache_table(const string &url);
     CacheEntry *get_locked_entry_from_cache_table(const string &url);
     CacheEntry *get_write_locked_entry_from_cache_table(const string &url);
@@ -31,6 +31,7 @@
 #endif
 
 #include <sys/stat.h>
+#include <pthread.h>
 
 #ifdef WIN32
 #include <io.h>
@@ -38,6 +39,7 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <functional>
 #include <algorithm>
 #include <sstream>
@@ -63,6 +65,7 @@
 #include "RCReader.h"
 #include "HTTPResponse.h"
 #include "HTTPCacheResponse.h"
+#include "HTTPStreamResponse.h"
 
 using namespace std;
 
@@ -307,8 +310,63 @@ curl_debug(CURL *, curl_infotype info, char *msg, size_t size, void  *)
     return 0;
 }
 
+/** @name Connection sharing
+
+    All of the libcurl handles made by HTTPConnect use one share object so
+    that an open (keep-alive) connection, a DNS lookup or an SSL session made
+    for one HTTPConnect instance can be reused by the others. Connections are
+    only shared with libcurl 7.57 and later. */
+//@{
+
+static pthread_once_t connection_share_once = PTHREAD_ONCE_INIT;
+static CURLSH *connection_share = 0;
+static pthread_mutex_t connection_share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+lock_connection_share(CURL *, curl_lock_data data, curl_lock_access, void *)
+{
+    pthread_mutex_lock(&connection_share_locks[data]);
+}
+
+static void
+unlock_connection_share(CURL *, curl_lock_data data, void *)
+{
+    pthread_mutex_unlock(&connection_share_locks[data]);
+}
+
+static void
+init_connection_share()
+{
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i)
+        pthread_mutex_init(&connection_share_locks[i], 0);
+
+    connection_share = curl_share_init();
+    if (!connection_share)
+        return;
+
+    curl_share_setopt(connection_share, CURLSHOPT_LOCKFUNC, lock_connection_share);
+    curl_share_setopt(connection_share, CURLSHOPT_UNLOCKFUNC, unlock_connection_share);
+    curl_share_setopt(connection_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(connection_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(connection_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+/** Get the libcurl share object used by all HTTPConnect instances.
+    @return The share object or null if it could not be made. */
+static CURLSH *
+get_connection_share()
+{
+    pthread_once(&connection_share_once, init_connection_share);
+    return connection_share;
+}
+
+//@}
+
 /** Initialize libcurl. Create a libcurl handle that can be used for all of
-    the HTTP requests made through this instance. */
+    the HTTP requests made through this instance. The handle shares its
+    connections with the other instances (see get_connection_share()). */
 
 void
 HTTPConnect::www_lib_init()
@@ -365,6 +423,14 @@ HTTPConnect::www_lib_init()
     curl_easy_setopt(d_curl, CURLOPT_FOLLOWLOCATION, 1);
     curl_easy_setopt(d_curl, CURLOPT_MAXREDIRS, 5);
 
+    // Reuse connections made by other instances and keep them open
+    CURLSH *share = get_connection_share();
+    if (share)
+        curl_easy_setopt(d_curl, CURLOPT_SHARE, share);
+#if LIBCURL_VERSION_NUM >= 0x071900
+    curl_easy_setopt(d_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+#endif
+
     // If the user turns off SSL validation...
     if (d_rcr->get_validate_ssl() == 0) {
         curl_easy_setopt(d_curl, CURLOPT_SSL_VERIFYPEER, 0);
@@ -429,21 +495,28 @@ public:
 long
 HTTPConnect::read_url(const string &url, FILE *stream, vector<string> *resp_hdrs, const vector<string> *headers)
 {
-    curl_easy_setopt(d_curl, CURLOPT_URL, url.c_str());
-
-#ifdef WIN32
     //  See the curl documentation for CURLOPT_FILE (aka CURLOPT_WRITEDATA)
     //  and the CURLOPT_WRITEFUNCTION option.  Quote: "If you are using libcurl as
     //  a win32 DLL, you MUST use the CURLOPT_WRITEFUNCTION option if you set the
     //  CURLOPT_WRITEDATA option or you will experience crashes".  At the root of
     //  this issue is that one should not pass a FILE * to a windows DLL.  Close
     //  inspection of libcurl yields that their default write function when using
-    //  the CURLOPT_WRITEDATA is just "fwrite".
+    //  the CURLOPT_WRITEDATA is just "fwrite". Always set it, since the other
+    //  read_url() replaces it.
     curl_easy_setopt(d_curl, CURLOPT_WRITEDATA, stream);
     curl_easy_setopt(d_curl, CURLOPT_WRITEFUNCTION, &fwrite);
-#else
-    curl_easy_setopt(d_curl, CURLOPT_WRITEDATA, stream);
-#endif
+
+    return perform_request(url, resp_hdrs, headers);
+}
+
+/** Make the request for \c url using d_curl, once the destination for the
+    body has been set. See read_url() for information about the parameters.
+
+    A private method. */
+long
+HTTPConnect::perform_request(const string &url, vector<string> *resp_hdrs, const vector<string> *headers)
+{
+    curl_easy_setopt(d_curl, CURLOPT_URL, url.c_str());
 
     DBG(copy(d_request_headers.begin(), d_request_headers.end(),
              ostream_iterator<string>(cerr, "\n")));
@@ -544,12 +617,16 @@ HTTPConnect::url_uses_no_proxy_for(const string &url) throw()
     file information to be used by this virtual connection. */
 
 HTTPConnect::HTTPConnect(RCReader *rcr, bool use_cpp) : d_username(""), d_password(""), d_cookie_jar(""),
-		d_dap_client_protocol_major(2),	d_dap_client_protocol_minor(0), d_use_cpp_streams(use_cpp)
+		d_dap_client_protocol_major(2),	d_dap_client_protocol_minor(0), d_use_cpp_streams(use_cpp),
+		d_multi(0), d_next_request(0)
 
 {
     d_accept_deflate = rcr->get_deflate();
     d_rcr = rcr;
 
+    // MAX_MEMORY_RESPONSE is given in kilobytes
+    d_max_memory_response = (rcr->get_max_memory_response() > 0) ? rcr->get_max_memory_response() * 1024UL : 0;
+
     // Load in the default headers to send with a request. The empty Pragma
     // headers overrides libcurl's default Pragma: no-cache header (which
     // will disable caching by Squid, et c.). The User-Agent header helps
@@ -563,7 +640,7 @@ HTTPConnect::HTTPConnect(RCReader *rcr, bool use_cpp) : d_username(""), d_passwo
 
     // HTTPCache::instance returns a valid ptr or 0.
     if (d_rcr->get_use_cache())
-        d_http_cache = HTTPCache::instance(d_rcr->get_dods_cache_root(),true);
+        d_http_cache = HTTPCache::instance(d_rcr->get_dods_cache_root(), true, d_rcr->get_shared_cache());
     else
         d_http_cache = 0;
 
@@ -588,6 +665,10 @@ HTTPConnect::~HTTPConnect()
 {
     DBG2(cerr << "Entering the HTTPConnect dtor" << endl);
 
+    cancel_fetches();
+    if (d_multi)
+        curl_multi_cleanup(d_multi);
+
     curl_easy_cleanup(d_curl);
 
     DBG2(cerr << "Leaving the HTTPConnect dtor" << endl);
@@ -638,39 +719,55 @@ HTTPConnect::fetch_url(const string &url)
 	cout << ss.str();
 #endif
 
+    string location = set_response_info(stream, d_content_type);
+
+#ifdef HTTP_TRACE
+    cout << endl << endl;
+#endif
+
+    // handle redirection case (2007-04-27, gaffigan@sfos.uaf.edu)
+    if (location != "" &&
+	    url.substr(0,url.find("?",0)).compare(location.substr(0,url.find("?",0))) != 0) {
+    	delete stream;
+        return fetch_url(location);
+    }
+
+    if (d_use_cpp_streams) {
+    	stream->transform_to_cpp();
+    }
+
+    return stream;
+}
+
+/** Set the type, server version and protocol of a response using its
+    headers.
+
+    A private method.
+
+    @param stream The response.
+    @param content_type The Content-Type libcurl read for the response.
+    @return The value of the response's Location header, or "". */
+string
+HTTPConnect::set_response_info(HTTPResponse *stream, const string &content_type)
+{
     ParseHeader parser;
 
     // An apparent quirk of libcurl is that it does not pass the Content-type
     // header to the callback used to save them, but check and add it from the
     // saved state variable only if it's not there (without this a test failed
     // in HTTPCacheTest). jhrg 11/12/13
-    if (!d_content_type.empty() && find_if(stream->get_headers()->begin(), stream->get_headers()->end(),
+    if (!content_type.empty() && find_if(stream->get_headers()->begin(), stream->get_headers()->end(),
     									   HeaderMatch("Content-Type:")) == stream->get_headers()->end())
-        stream->get_headers()->push_back("Content-Type: " + d_content_type);
+        stream->get_headers()->push_back("Content-Type: " + content_type);
 
     parser = for_each(stream->get_headers()->begin(), stream->get_headers()->end(), ParseHeader());
 
-#ifdef HTTP_TRACE
-    cout << endl << endl;
-#endif
-
-    // handle redirection case (2007-04-27, gaffigan@sfos.uaf.edu)
-    if (parser.get_location() != "" &&
-	    url.substr(0,url.find("?",0)).compare(parser.get_location().substr(0,url.find("?",0))) != 0) {
-    	delete stream;
-        return fetch_url(parser.get_location());
-    }
-
     stream->set_type(parser.get_object_type()); // uses the value of content-description
 
     stream->set_version(parser.get_server());
     stream->set_protocol(parser.get_protocol());
 
-    if (d_use_cpp_streams) {
-    	stream->transform_to_cpp();
-    }
-
-    return stream;
+    return parser.get_location();
 }
 
 // Look around for a reasonable place to put a temporary file. Check first
@@ -817,6 +914,420 @@ close_temp(FILE *s, const string &name)
     	throw InternalErr(__FILE__, __LINE__, "!FAIL! " + long_to_string(res));
 }
 
+/** @name In-memory responses
+
+    A response body is read into memory and then read from there using
+    fmemopen(). Only when it grows larger than the limit set with
+    set_max_memory_response() is it moved to a temporary file, with the rest
+    of the body written there. Small responses such as a DAS or DDS never
+    touch the disk. */
+//@{
+
+/** The destination of a response body while it is read. */
+struct HTTPConnect::ResponseBody {
+    unsigned long limit;    // Largest body to hold in memory
+    vector<char> *buffer;   // The body, while it is held in memory
+    FILE *stream;           // Set by open() or spill()
+    string temp_file;       // Set by spill()
+
+    ResponseBody(unsigned long l) : limit(l), buffer(new vector<char>), stream(0) { }
+
+    ~ResponseBody()
+    {
+        if (stream) {
+            fclose(stream);
+            if (!temp_file.empty())
+                unlink(temp_file.c_str());
+        }
+        delete buffer;
+    }
+
+    /** Move the body to a temporary file; what is read from now on is
+        written there. */
+    void spill()
+    {
+        temp_file = get_temp_file(stream);
+        if (!buffer->empty() && fwrite(&(*buffer)[0], 1, buffer->size(), stream) != buffer->size())
+            throw Error("Could not write the response to " + temp_file + ": " + strerror(errno));
+
+        delete buffer;
+        buffer = 0;
+    }
+
+    /** Discard what has been read so the body can be read again. */
+    void clear()
+    {
+        if (stream) {
+            fclose(stream);
+            stream = 0;
+            if (!temp_file.empty())
+                unlink(temp_file.c_str());
+            temp_file = "";
+        }
+
+        if (buffer)
+            buffer->clear();
+        else
+            buffer = new vector<char>;
+    }
+
+    /** Open the complete body for reading. */
+    void open()
+    {
+        if (buffer) {
+#ifdef HAVE_FMEMOPEN
+            static char empty;
+            stream = fmemopen(buffer->empty() ? &empty : &(*buffer)[0], buffer->size(), "r");
+            if (stream)
+                return;
+#endif
+            spill();
+        }
+
+        rewind(stream);
+    }
+
+    /** Pass the open body to a new HTTPResponse. */
+    HTTPResponse *make_response(int status, vector<string> *headers)
+    {
+        HTTPResponse *rs;
+        if (buffer)
+            rs = new HTTPResponse(stream, status, headers, buffer);
+        else
+            rs = new HTTPResponse(stream, status, headers, temp_file);
+
+        stream = 0;
+        buffer = 0;
+        temp_file = "";
+        return rs;
+    }
+
+    /** The libcurl write function; \c data is the ResponseBody. */
+    static size_t write(void *ptr, size_t size, size_t nmemb, void *data)
+    {
+        ResponseBody *body = static_cast<ResponseBody *>(data);
+        size_t bytes = size * nmemb;
+
+        if (body->buffer && body->buffer->size() + bytes > body->limit) {
+            try {
+                body->spill();
+            }
+            catch (Error &e) {
+                DBG(cerr << "Could not save the response: " << e.get_error_message() << endl);
+                return 0;   // libcurl stops the transfer
+            }
+        }
+
+        if (body->buffer) {
+            body->buffer->insert(body->buffer->end(), static_cast<char *>(ptr), static_cast<char *>(ptr) + bytes);
+            return bytes;
+        }
+
+        return fwrite(ptr, 1, bytes, body->stream);
+    }
+};
+
+/** Use libcurl to dereference a URL, reading the body into \c body. See
+    the other read_url() for information about the other parameters.
+
+    @param body The destination for the body. Use ResponseBody::open() to
+    read it. */
+long
+HTTPConnect::read_url(const string &url, ResponseBody &body, vector<string> *resp_hdrs, const vector<string> *headers)
+{
+    curl_easy_setopt(d_curl, CURLOPT_WRITEDATA, &body);
+    curl_easy_setopt(d_curl, CURLOPT_WRITEFUNCTION, &ResponseBody::write);
+
+    return perform_request(url, resp_hdrs, headers);
+}
+
+//@}
+
+/** @name Request coalescing
+
+    When several threads request the same URL at the same time, only the
+    first makes the request; the others wait for it to finish and then read
+    the same response. Each waiting thread gets its own copy of a body held
+    in memory, or a hard link to the temporary file that holds a larger
+    one, so each response can be read and deleted independently. Requests are the same if they have the same URL,
+    request headers, credentials and cookie jar and either both or neither
+    use the HTTP cache. */
+//@{
+
+/** A transfer made by one thread for itself and any threads that asked for
+    the same URL while it was in progress. */
+struct SharedFetch {
+    pthread_cond_t d_done_cond;
+    bool d_done;
+    int d_waiters;          // Threads waiting for this transfer
+
+    long d_status;
+    vector<string> d_headers;
+    string d_content_type;
+    bool d_in_memory;       // True if the body is in d_body, not in d_files
+    vector<char> d_body;
+    vector<string> d_files; // One link to the body for each waiting thread
+
+    bool d_failed;
+    Error *d_error;         // An Error or InternalErr; null unless d_failed
+
+    SharedFetch() : d_done(false), d_waiters(0), d_status(0), d_in_memory(false), d_failed(false), d_error(0)
+    {
+        pthread_cond_init(&d_done_cond, 0);
+    }
+
+    ~SharedFetch()
+    {
+        delete d_error;
+        pthread_cond_destroy(&d_done_cond);
+    }
+};
+
+// Transfers in progress, indexed by the request key (see fetch_key()).
+static pthread_mutex_t shared_fetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<string, SharedFetch *> shared_fetches;
+
+static void
+lock_shared_fetches()
+{
+    int status = pthread_mutex_lock(&shared_fetch_mutex);
+    if (status != 0)
+        throw InternalErr(__FILE__, __LINE__, string("Mutex lock: ") + strerror(status));
+}
+
+static void
+unlock_shared_fetches()
+{
+    int status = pthread_mutex_unlock(&shared_fetch_mutex);
+    if (status != 0)
+        throw InternalErr(__FILE__, __LINE__, string("Mutex unlock: ") + strerror(status));
+}
+
+/** Build the key that identifies a request: the URL followed by everything
+    else that can change the response. */
+static string
+fetch_key(const string &url, const string &credentials, const string &cookie_jar, bool cached,
+          const vector<string> &request_headers, const vector<string> *headers)
+{
+    string key = url + '\n' + credentials + '\n' + cookie_jar + (cached ? "\ncached" : "\nnot cached");
+    for (vector<string>::const_iterator i = request_headers.begin(); i != request_headers.end(); ++i)
+        key += '\n' + *i;
+    if (headers) {
+        for (vector<string>::const_iterator i = headers->begin(); i != headers->end(); ++i)
+            key += '\n' + *i;
+    }
+
+    return key;
+}
+
+/** Hand the result of a transfer to the threads waiting for it, wake them
+    and stop sharing the transfer. On success each waiting thread can copy
+    the body from memory or gets its own link to the file that holds it; a
+    thread that does not get either makes the request itself.
+
+    @param key The request key.
+    @param fetch The shared transfer.
+    @param body The response body, if it is held in memory.
+    @param temp_file The file that holds the response body otherwise. */
+static void
+finish_shared_fetch(const string &key, SharedFetch *fetch, const vector<char> *body, const string &temp_file)
+{
+    lock_shared_fetches();
+
+    shared_fetches.erase(key);
+
+    if (!fetch->d_failed && body && fetch->d_waiters > 0) {
+        fetch->d_in_memory = true;
+        fetch->d_body = *body;
+    }
+#ifndef WIN32
+    else if (!fetch->d_failed) {
+        for (int i = 0; i < fetch->d_waiters; ++i) {
+            string file = temp_file + "-" + long_to_string(i);
+            if (link(temp_file.c_str(), file.c_str()) == 0)
+                fetch->d_files.push_back(file);
+        }
+    }
+#endif
+
+    fetch->d_done = true;
+    pthread_cond_broadcast(&fetch->d_done_cond);
+
+    bool unused = fetch->d_waiters == 0;
+
+    unlock_shared_fetches();
+
+    if (unused)
+        delete fetch;
+}
+
+/** Dereference a URL and load its body into a new temporary file, sharing
+    the transfer with any other threads that make the same request at the
+    same time. See read_url() for information about the parameters.
+
+    A private method.
+
+    @param url The URL to dereference.
+    @param body Value-result parameter; the response body, open for
+    reading.
+    @param resp_hdrs Value-result parameter; the response headers.
+    @param headers Additional request headers.
+    @param shared Value-result parameter; true if the response was read by
+    another thread. Such a response should not be cached again.
+    @return The HTTP status code.
+    @exception Error Thrown if the URL could not be dereferenced, either by
+    this thread or by the thread that made the request. An InternalErr
+    thrown while the other thread made the request is rethrown as an
+    InternalErr. */
+long
+HTTPConnect::coalesced_read_url(const string &url, ResponseBody &body,
+                                vector<string> *resp_hdrs, const vector<string> *headers, bool &shared)
+{
+    string key = fetch_key(url, d_upstring, d_cookie_jar, is_cache_enabled(), d_request_headers, headers);
+    SharedFetch *fetch = 0;
+    shared = false;
+
+    lock_shared_fetches();
+
+    map<string, SharedFetch *>::iterator i = shared_fetches.find(key);
+    if (i == shared_fetches.end()) {
+        fetch = new SharedFetch;
+        shared_fetches[key] = fetch;
+        unlock_shared_fetches();
+    }
+    else {
+        // Wait for the thread making this request
+        SharedFetch *other = i->second;
+        ++other->d_waiters;
+        while (!other->d_done)
+            pthread_cond_wait(&other->d_done_cond, &shared_fetch_mutex);
+
+        string file;
+        if (!other->d_files.empty()) {
+            file = other->d_files.back();
+            other->d_files.pop_back();
+        }
+
+        bool in_memory = other->d_in_memory;
+        if (in_memory)
+            body.buffer->assign(other->d_body.begin(), other->d_body.end());
+
+        long status = other->d_status;
+        vector<string> other_headers = other->d_headers;
+        string content_type = other->d_content_type;
+        bool failed = other->d_failed;
+        // Copy the error with its own type so an InternalErr is not sliced
+        Error *error = 0;
+        if (failed) {
+            InternalErr *ie = dynamic_cast<InternalErr*>(other->d_error);
+            error = ie ? new InternalErr(*ie) : new Error(*other->d_error);
+        }
+
+        bool last = --other->d_waiters == 0;
+
+        unlock_shared_fetches();
+
+        if (last)
+            delete other;
+
+        if (error) {
+            InternalErr *ie = dynamic_cast<InternalErr*>(error);
+            if (ie) {
+                InternalErr e(*ie);
+                delete error;
+                throw e;
+            }
+
+            Error e(*error);
+            delete error;
+            throw e;
+        }
+
+        if (!file.empty()) {
+            body.stream = fopen(file.c_str(), "r+b");
+            if (body.stream) {
+                delete body.buffer;
+                body.buffer = 0;
+                body.temp_file = file;
+            }
+            else {
+                unlink(file.c_str());
+            }
+        }
+
+        if (in_memory || body.stream) {
+            DBG(cerr << "Using the response read by another thread for " << url << endl);
+            if (in_memory)
+                body.open();
+            resp_hdrs->insert(resp_hdrs->end(), other_headers.begin(), other_headers.end());
+            d_content_type = content_type;
+            shared = true;
+            return status;
+        }
+
+        // Make the request without sharing it
+    }
+
+    long status;
+    try {
+        status = read_url(url, body, resp_hdrs, headers);
+        body.open();
+    }
+    catch (InternalErr &e) {
+        if (fetch) {
+            fetch->d_failed = true;
+            fetch->d_error = new InternalErr(e);
+            finish_shared_fetch(key, fetch, 0, "");
+        }
+        throw;
+    }
+    catch (Error &e) {
+        if (fetch) {
+            fetch->d_failed = true;
+            fetch->d_error = new Error(e);
+            finish_shared_fetch(key, fetch, 0, "");
+        }
+        throw;
+    }
+    catch (...) {
+        if (fetch) {
+            fetch->d_failed = true;
+            fetch->d_error = new InternalErr(__FILE__, __LINE__, "Unexpected exception while reading " + url);
+            finish_shared_fetch(key, fetch, 0, "");
+        }
+        throw;
+    }
+
+    if (fetch) {
+        fetch->d_status = status;
+        fetch->d_headers = *resp_hdrs;
+        fetch->d_content_type = d_content_type;
+        finish_shared_fetch(key, fetch, body.buffer, body.temp_file);
+    }
+
+    return status;
+}
+
+/** How many threads are waiting for a transfer made by another thread? Used
+    by the unit tests.
+
+    A private method. */
+int
+HTTPConnect::get_num_shared_fetch_waiters()
+{
+    lock_shared_fetches();
+
+    int waiters = 0;
+    for (map<string, SharedFetch *>::iterator i = shared_fetches.begin(); i != shared_fetches.end(); ++i)
+        waiters += i->second->d_waiters;
+
+    unlock_shared_fetches();
+
+    return waiters;
+}
+
+//@}
+
 /** Dereference a URL. This method looks first in the HTTP cache to see if a
     cached response may be used. It may get the response from the cache, it
     may validate a response in the cache and/or update the response from the
@@ -829,6 +1340,11 @@ close_temp(FILE *s, const string &name)
     version and type fields. Thus this method and plain_fetch_url() only have
     to get the stream pointer set, the resources to release and d_headers.
 
+    When the cache is shared with other processes, a response that is not in
+    the cache is fetched while holding the cache fill lock for the URL, and
+    the cache is checked again once that lock is obtained. If several
+    processes miss on the same URL at once, only the first fetches it.
+
     A private method.
 
     @note This method assumes that d_http_cache is not null!
@@ -846,13 +1362,41 @@ HTTPConnect::caching_fetch_url(const string &url)
     vector<string> *headers = new vector<string>;
     string file_name;
     FILE *s = d_http_cache->get_cached_response(url, *headers, file_name);
+    if (!s && d_http_cache->is_cache_shared()) {
+        // Another process may be fetching this URL; wait for it, then look
+        // again.
+        d_http_cache->lock_cache_fill(url);
+        try {
+            s = d_http_cache->get_cached_response(url, *headers, file_name);
+        }
+        catch (...) {
+            d_http_cache->unlock_cache_fill(url);
+            delete headers;
+            throw;
+        }
+        if (s)
+            d_http_cache->unlock_cache_fill(url);
+    }
+
     if (!s) {
         // url not in cache; get it and cache it
         DBGN(cerr << "no; getting response and caching." << endl);
         delete headers; headers = 0;
         time_t now = time(0);
-        HTTPResponse *rs = plain_fetch_url(url);
-        d_http_cache->cache_response(url, now, *(rs->get_headers()), rs->get_stream());
+        HTTPResponse *rs = 0;
+        try {
+            // If another thread read the response, it has cached it
+            bool shared;
+            rs = plain_fetch_url(url, &shared);
+            if (!shared)
+                d_http_cache->cache_response(url, now, *(rs->get_headers()), rs->get_stream());
+        }
+        catch (...) {
+            d_http_cache->unlock_cache_fill(url);
+            delete rs;
+            throw;
+        }
+        d_http_cache->unlock_cache_fill(url);
 
         return rs;
     }
@@ -870,17 +1414,15 @@ HTTPConnect::caching_fetch_url(const string &url)
             d_http_cache->release_cached_response(s); // This closes 's'
             headers->clear();
             vector<string> cond_hdrs = d_http_cache->get_conditional_request_headers(url);
-            FILE *body = 0;
-            string dods_temp = get_temp_file(body);
+            ResponseBody body(d_max_memory_response);
             time_t now = time(0); // When was the request made (now).
             long http_status;
+            bool shared; // If true, another thread updated the cache
 
             try {
-                http_status = read_url(url, body, /*resp_hdrs*/headers, &cond_hdrs);
-                rewind(body);
+                http_status = coalesced_read_url(url, body, /*resp_hdrs*/headers, &cond_hdrs, shared);
             }
             catch (Error &e) {
-                close_temp(body, dods_temp);
                 delete headers;
                 throw ;
             }
@@ -889,17 +1431,17 @@ HTTPConnect::caching_fetch_url(const string &url)
                 case 200: { // New headers and new body
                     DBGN(cerr << "read a new response; caching." << endl);
 
-                    d_http_cache->cache_response(url, now, /* *resp_hdrs*/*headers, body);
-                    HTTPResponse *rs = new HTTPResponse(body, http_status, /*resp_hdrs*/headers, dods_temp);
+                    if (!shared)
+                        d_http_cache->cache_response(url, now, /* *resp_hdrs*/*headers, body.stream);
 
-                    return rs;
+                    return body.make_response(http_status, /*resp_hdrs*/headers);
                 }
 
                 case 304: { // Just new headers, use cached body
                     DBGN(cerr << "cached response valid; updating." << endl);
 
-                    close_temp(body, dods_temp);
-                    d_http_cache->update_response(url, now, /* *resp_hdrs*/ *headers);
+                    if (!shared)
+                        d_http_cache->update_response(url, now, /* *resp_hdrs*/ *headers);
                     string file_name;
                     FILE *hs = d_http_cache->get_cached_response(url, *headers, file_name);
                     HTTPCacheResponse *crs = new HTTPCacheResponse(hs, 304, headers, file_name, d_http_cache);
@@ -907,7 +1449,6 @@ HTTPConnect::caching_fetch_url(const string &url)
                 }
 
                 default: { // Oops.
-                    close_temp(body, dods_temp);
                     if (http_status >= 400) {
                 	delete headers; headers = 0;
                         string msg = "Error while reading the URL: ";
@@ -930,28 +1471,34 @@ HTTPConnect::caching_fetch_url(const string &url)
     throw InternalErr(__FILE__, __LINE__, "Should never get here");
 }
 
-/** Dereference a URL and load its body into a temporary file. This
-    method ignores the HTTP cache.
+/** Dereference a URL and load its body into memory or, if it is large, a
+    temporary file (see set_max_memory_response()). This method ignores the
+    HTTP cache. If other threads request the same URL at
+    the same time, only one request is made (see coalesced_read_url()).
 
     A private method.
 
     @param url The URL to dereference.
+    @param shared If not null, set to true if the response was read by
+    another thread.
     @return A pointer to the open stream.
     @exception Error Thrown if the URL could not be dereferenced.
     @exception InternalErr Thrown if a temporary file to hold the response
     could not be opened. */
 
 HTTPResponse *
-HTTPConnect::plain_fetch_url(const string &url)
+HTTPConnect::plain_fetch_url(const string &url, bool *shared)
 {
 	DBG(cerr << "Getting URL: " << url << endl);
-	FILE *stream = 0;
-	string dods_temp = get_temp_file(stream);
+	ResponseBody body(d_max_memory_response);
 	vector<string> *resp_hdrs = new vector<string>;
 
 	int status = -1;
 	try {
-		status = read_url(url, stream, resp_hdrs); // Throws Error.
+		bool read_by_other;
+		status = coalesced_read_url(url, body, resp_hdrs, 0, read_by_other); // Throws Error.
+		if (shared)
+			*shared = read_by_other;
 		if (status >= 400) {
 			// delete resp_hdrs; resp_hdrs = 0;
 			string msg = "Error while reading the URL: ";
@@ -964,7 +1511,6 @@ HTTPConnect::plain_fetch_url(const string &url)
 
 	catch (Error &e) {
 		delete resp_hdrs;
-		close_temp(stream, dods_temp);
 		throw;
 	}
 
@@ -976,13 +1522,654 @@ HTTPConnect::plain_fetch_url(const string &url)
 	}
 	else {
 #endif
-	rewind(stream);
-	return new HTTPResponse(stream, status, resp_hdrs, dods_temp);
+	return body.make_response(status, resp_hdrs);
 #if 0
 }
 #endif
 }
 
+/** Make a copy of d_curl, which has all of the options set in
+    www_lib_init(), set up to request \c url. The copy does not share the
+    write function or the response header vector with d_curl; set those.
+
+    A private method.
+
+    @param url The URL to dereference.
+    @param request_headers Value-result parameter; the request headers used
+    by the copy. The caller must free them (curl_slist_free_all()) after
+    cleaning up the copy.
+    @return The new libcurl handle.
+    @exception InternalErr Thrown if the handle could not be copied. */
+CURL *
+HTTPConnect::copy_handle(const string &url, struct curl_slist *&request_headers)
+{
+    CURL *curl = curl_easy_duphandle(d_curl);
+    if (!curl)
+        throw InternalErr(__FILE__, __LINE__, "Could not initialize libcurl.");
+
+    BuildHeaders req_hdrs;
+    req_hdrs = for_each(d_request_headers.begin(), d_request_headers.end(), req_hdrs);
+    request_headers = req_hdrs.get_headers();
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request_headers);
+
+    if (url_uses_no_proxy_for(url))
+        curl_easy_setopt(curl, CURLOPT_PROXY, 0);
+
+    // See read_url()
+    string::size_type at_sign = url.find('@');
+    string upstring = (at_sign != url.npos) ? url.substr(7, at_sign - 7) : d_upstring;
+    if (!upstring.empty())
+        curl_easy_setopt(curl, CURLOPT_USERPWD, upstring.c_str());
+
+    return curl;
+}
+
+/** Dereference a URL without waiting for the response body. The response
+    headers have been read when this returns; the body is read from the
+    network as the caller reads it from the response's C++ stream. Nothing
+    is written to a temporary file and the HTTP cache is not used.
+
+    @param url The URL to dereference.
+    @return The response; read the body using get_cpp_stream().
+    @exception Error Thrown if the URL could not be dereferenced. */
+HTTPStreamResponse *
+HTTPConnect::fetch_url_stream(const string &url)
+{
+    struct curl_slist *request_headers = 0;
+    CURL *curl = copy_handle(url, request_headers);
+
+    // Takes ownership of curl and request_headers
+    HTTPStreamResponse *rs = new HTTPStreamResponse(curl, request_headers, new vector<string>);
+    try {
+        rs->start();
+
+        if (rs->get_status() >= 400)
+            throw Error("Error while reading the URL: " + url
+                        + ".\nThe OPeNDAP server returned the following message:\n"
+                        + http_status_to_string(rs->get_status()));
+
+        set_response_info(rs, rs->get_content_type());
+    }
+    catch (...) {
+        delete rs;
+        throw;
+    }
+
+    return rs;
+}
+
+/** @name Asynchronous requests
+
+    These methods make several requests at once using a libcurl multi handle
+    and return the responses as they complete. Start each request with
+    start_fetch_url() and then call get_next_response() until it returns
+    null. A response that is in the HTTP cache and valid is returned from the
+    cache; other responses are read from the network (a cached response that
+    is not valid is fetched again, not validated) and then cached. */
+//@{
+
+/** A request started by start_fetch_url(). */
+struct HTTPConnect::PendingFetch {
+    int request;
+    string url;
+    time_t request_time;
+    CURL *curl;
+    struct curl_slist *request_headers;
+    ResponseBody body;
+    vector<string> *headers;
+    char error_buffer[CURL_ERROR_SIZE];
+
+    PendingFetch(int r, const string &u, unsigned long max_memory_response) :
+        request(r), url(u), request_time(time(0)), curl(0), request_headers(0), body(max_memory_response), headers(0)
+    {
+        error_buffer[0] = '\0';
+    }
+};
+
+/** Free a request's libcurl handle, headers and body.
+    @param fetch The request; it is deleted. */
+void
+HTTPConnect::free_fetch(PendingFetch *fetch)
+{
+    if (fetch->curl)
+        curl_easy_cleanup(fetch->curl);
+    if (fetch->request_headers)
+        curl_slist_free_all(fetch->request_headers);
+    delete fetch->headers;
+    delete fetch;
+}
+
+/** Abandon all of the asynchronous requests and free their responses. */
+void
+HTTPConnect::cancel_fetches()
+{
+    for (vector<PendingFetch *>::iterator i = d_pending.begin(); i != d_pending.end(); ++i) {
+        curl_multi_remove_handle(d_multi, (*i)->curl);
+        free_fetch(*i);
+    }
+    d_pending.clear();
+
+    for (CompletedFetches::iterator i = d_completed.begin(); i != d_completed.end(); ++i)
+        delete i->second;
+    d_completed.clear();
+}
+
+/** Start a request for a URL. The request is made while the caller does
+    other things, including starting more requests; use get_next_response()
+    to get the response.
+
+    @param url The URL to dereference.
+    @return A number that identifies the request. get_next_response()
+    returns it along with the response.
+    @exception Error Thrown if the request could not be started. */
+int
+HTTPConnect::start_fetch_url(const string &url)
+{
+    int request = ++d_next_request;
+
+    // Use a valid response from the cache
+    if (is_cache_enabled()) {
+        vector<string> *headers = new vector<string>;
+        string file_name;
+        FILE *s = d_http_cache->get_cached_response(url, *headers, file_name);
+        if (s && d_http_cache->is_url_valid(url)) {
+            DBG(cerr << "Using the cached response for " << url << endl);
+            HTTPResponse *rs = new HTTPCacheResponse(s, 200, headers, file_name, d_http_cache);
+            set_response_info(rs, "");
+            if (d_use_cpp_streams)
+                rs->transform_to_cpp();
+            d_completed.push_back(make_pair(request, rs));
+            return request;
+        }
+
+        if (s)
+            d_http_cache->release_cached_response(s);
+        delete headers;
+    }
+
+    if (!d_multi) {
+        d_multi = curl_multi_init();
+        if (!d_multi)
+            throw InternalErr(__FILE__, __LINE__, "Could not initialize libcurl.");
+    }
+
+    PendingFetch *fetch = new PendingFetch(request, url, d_max_memory_response);
+    try {
+        fetch->curl = copy_handle(url, fetch->request_headers);
+        fetch->headers = new vector<string>;
+
+        curl_easy_setopt(fetch->curl, CURLOPT_WRITEDATA, &fetch->body);
+        curl_easy_setopt(fetch->curl, CURLOPT_WRITEFUNCTION, &ResponseBody::write);
+        curl_easy_setopt(fetch->curl, CURLOPT_WRITEHEADER, fetch->headers);
+        curl_easy_setopt(fetch->curl, CURLOPT_ERRORBUFFER, fetch->error_buffer);
+        curl_easy_setopt(fetch->curl, CURLOPT_PRIVATE, fetch);
+
+        if (curl_multi_add_handle(d_multi, fetch->curl) != CURLM_OK)
+            throw InternalErr(__FILE__, __LINE__, "Could not start the request for " + url);
+    }
+    catch (...) {
+        free_fetch(fetch);
+        throw;
+    }
+
+    d_pending.push_back(fetch);
+
+    // Start the transfer
+    int running;
+    curl_multi_perform(d_multi, &running);
+
+    return request;
+}
+
+/** Get the response to a request made using start_fetch_url(), waiting for
+    one to complete if needed. Responses are returned in the order in which
+    they complete, not the order in which they were requested.
+
+    @param request Value-result parameter; the number start_fetch_url()
+    returned for the request. Set even when an Error is thrown.
+    @return The response or null if there are no requests left. The caller
+    must delete the response.
+    @exception Error Thrown if the request failed or the server returned an
+    error. Other requests are not affected. */
+HTTPResponse *
+HTTPConnect::get_next_response(int &request)
+{
+    if (!d_completed.empty()) {
+        request = d_completed.front().first;
+        HTTPResponse *rs = d_completed.front().second;
+        d_completed.pop_front();
+        return rs;
+    }
+
+    while (!d_pending.empty()) {
+        int running;
+        while (curl_multi_perform(d_multi, &running) == CURLM_CALL_MULTI_PERFORM)
+            ;
+
+        int queued;
+        CURLMsg *msg;
+        while ((msg = curl_multi_info_read(d_multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            PendingFetch *fetch = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&fetch);
+            CURLcode result = msg->data.result;
+
+            curl_multi_remove_handle(d_multi, fetch->curl);
+            d_pending.erase(find(d_pending.begin(), d_pending.end(), fetch));
+
+            request = fetch->request;
+            return finish_fetch(fetch, result);
+        }
+
+#if LIBCURL_VERSION_NUM >= 0x071c00
+        curl_multi_wait(d_multi, 0, 0, 1000, 0);
+#else
+        usleep(1000);
+#endif
+    }
+
+    return 0;
+}
+
+/** Build the response for a completed request and cache it.
+
+    A private method.
+
+    @param fetch The request; it is deleted.
+    @param result The libcurl result code for the request.
+    @return The response.
+    @exception Error Thrown if the request failed. */
+HTTPResponse *
+HTTPConnect::finish_fetch(PendingFetch *fetch, CURLcode result)
+{
+    long status = 0;
+    char *ct_ptr = 0;
+    if (result == CURLE_OK)
+        result = curl_easy_getinfo(fetch->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (result == CURLE_OK)
+        result = curl_easy_getinfo(fetch->curl, CURLINFO_CONTENT_TYPE, &ct_ptr);
+
+    if (result != CURLE_OK) {
+        string msg = fetch->error_buffer[0] ? fetch->error_buffer : curl_easy_strerror(result);
+        free_fetch(fetch);
+        throw Error(msg);
+    }
+
+    if (status >= 400) {
+        string msg = "Error while reading the URL: " + fetch->url
+                     + ".\nThe OPeNDAP server returned the following message:\n" + http_status_to_string(status);
+        free_fetch(fetch);
+        throw Error(msg);
+    }
+
+    string content_type = ct_ptr ? ct_ptr : "";
+
+    HTTPResponse *rs;
+    try {
+        fetch->body.open();
+        rs = fetch->body.make_response(status, fetch->headers);
+    }
+    catch (...) {
+        free_fetch(fetch);
+        throw;
+    }
+    fetch->headers = 0;
+    string url = fetch->url;
+    time_t request_time = fetch->request_time;
+    free_fetch(fetch);
+
+    try {
+        if (is_cache_enabled())
+            d_http_cache->cache_response(url, request_time, *(rs->get_headers()), rs->get_stream());
+
+        set_response_info(rs, content_type);
+        if (d_use_cpp_streams)
+            rs->transform_to_cpp();
+    }
+    catch (...) {
+        delete rs;
+        throw;
+    }
+
+    return rs;
+}
+
+//@}
+
+/** @name Parallel byte-range requests
+
+    A large response can be read faster using several connections at once.
+    fetch_url_ranges() asks for the first part of the response and, if the
+    server supports byte ranges and there is more, reads the rest as
+    several ranges at the same time. Each range is written to its place in
+    a buffer or temporary file sized to hold the complete response. */
+//@{
+
+/** One of the byte ranges read by read_ranges(). */
+struct RangeFetch {
+    CURL *curl;
+    vector<char> *buffer;   // Write here if the body is held in memory,
+    FILE *stream;           // otherwise here
+    off_t start;            // The first byte of the range
+    off_t offset;           // Where the next byte goes
+    off_t end;              // One past the last byte of the range
+    vector<string> headers;
+    CURLcode result;
+    char error_buffer[CURL_ERROR_SIZE];
+
+    RangeFetch(vector<char> *b, FILE *s, off_t o, off_t e) :
+        curl(0), buffer(b), stream(s), start(o), offset(o), end(e), result(CURLE_OK)
+    {
+        error_buffer[0] = '\0';
+    }
+
+    /** The libcurl write function; \c data is the RangeFetch. */
+    static size_t write(void *ptr, size_t size, size_t nmemb, void *data)
+    {
+        RangeFetch *range = static_cast<RangeFetch *>(data);
+        size_t bytes = size * nmemb;
+
+        // Anything but a 206 is not the range; stop before it overwrites
+        // the other ranges.
+        long status = 0;
+        curl_easy_getinfo(range->curl, CURLINFO_RESPONSE_CODE, &status);
+        if (status != 206)
+            return 0;
+
+        // More than was asked for; the server ignored the range
+        if (range->offset + static_cast<off_t>(bytes) > range->end)
+            return 0;
+
+        if (range->buffer)
+            memcpy(&(*range->buffer)[range->offset], ptr, bytes);
+        else if (fseeko(range->stream, range->offset, SEEK_SET) != 0
+                 || fwrite(ptr, 1, bytes, range->stream) != bytes)
+            return 0;
+
+        range->offset += bytes;
+        return bytes;
+    }
+};
+
+/** Get the values of the last Content-Range header.
+    @return True if the header was found and holds a byte range of a
+    response of known size. */
+static bool
+get_content_range(const vector<string> &headers, off_t &first, off_t &last, off_t &total)
+{
+    for (vector<string>::const_reverse_iterator i = headers.rbegin(); i != headers.rend(); ++i) {
+        string name, value;
+        parse_mime_header(*i, name, value);
+        if (name == "content-range") {
+            long long f, l, t;
+            if (sscanf(value.c_str(), "bytes %lld-%lld/%lld", &f, &l, &t) != 3)
+                return false;
+            first = f;
+            last = l;
+            total = t;
+            return l >= f && t > l;
+        }
+    }
+
+    return false;
+}
+
+/** Get the value to send in an If-Range header so that the other ranges
+    come from the same response as the first one: its ETag, unless that is
+    a weak one, or else its Last-Modified time.
+    @return The value, or an empty string if there is neither. */
+static string
+get_range_validator(const vector<string> &headers)
+{
+    string last_modified;
+    for (vector<string>::const_iterator i = headers.begin(); i != headers.end(); ++i) {
+        string name, value;
+        parse_mime_header(*i, name, value);
+        if (name == "etag" && value.find("W/") != 0)
+            return value;
+        if (name == "last-modified")
+            last_modified = value;
+    }
+
+    return last_modified;
+}
+
+/** Read bytes \c offset to \c total - 1 of a response into \c body, which
+    already holds the bytes before \c offset. The bytes are read as up to \c
+    num_ranges ranges of at least \c range_size bytes, all at the same time.
+
+    Each request carries an If-Range header with \c validator, if it is not
+    empty, so a server whose response has changed since the first range was
+    read returns all of the new response (status 200) instead of part of it.
+
+    A private method.
+
+    @return False if the ranges cannot be put together with the bytes
+    already read: a range was answered with a complete response, or its
+    Content-Range does not give \c total as the size of the response. The
+    response must then be read again.
+    @exception Error Thrown if any range could not be read. */
+bool
+HTTPConnect::read_ranges(const string &url, ResponseBody &body, off_t offset, off_t total,
+                         unsigned int num_ranges, unsigned long range_size, const string &validator)
+{
+    // Make room for the complete response
+    if (body.buffer && total <= static_cast<off_t>(body.limit)) {
+        body.buffer->resize(total);
+    }
+    else {
+        if (body.buffer)
+            body.spill();
+        fflush(body.stream);
+        if (ftruncate(fileno(body.stream), total) != 0)
+            throw Error("Could not make room for the response: " + string(strerror(errno)));
+    }
+
+    off_t size = max(static_cast<off_t>(range_size), (total - offset + num_ranges - 1) / num_ranges);
+
+    vector<string> request_headers = d_request_headers;
+    if (!validator.empty())
+        request_headers.push_back("If-Range: " + validator);
+
+    BuildHeaders req_hdrs;
+    req_hdrs = for_each(request_headers.begin(), request_headers.end(), req_hdrs);
+
+    CURLM *multi = curl_multi_init();
+    vector<RangeFetch *> ranges;
+    string error;
+
+    for (off_t start = offset; start < total && error.empty(); start += size) {
+        RangeFetch *range = new RangeFetch(body.buffer, body.stream, start, min(start + size, total));
+        ranges.push_back(range);
+
+        // The copy has all of the options set in www_lib_init()
+        range->curl = curl_easy_duphandle(d_curl);
+        if (!range->curl) {
+            error = "Could not initialize libcurl.";
+            break;
+        }
+
+        ostringstream byte_range;
+        byte_range << range->offset << "-" << range->end - 1;
+
+        curl_easy_setopt(range->curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(range->curl, CURLOPT_RANGE, byte_range.str().c_str());
+        curl_easy_setopt(range->curl, CURLOPT_WRITEDATA, range);
+        curl_easy_setopt(range->curl, CURLOPT_WRITEFUNCTION, &RangeFetch::write);
+        curl_easy_setopt(range->curl, CURLOPT_WRITEHEADER, &range->headers);
+        curl_easy_setopt(range->curl, CURLOPT_HTTPHEADER, req_hdrs.get_headers());
+        curl_easy_setopt(range->curl, CURLOPT_ERRORBUFFER, range->error_buffer);
+        if (url_uses_no_proxy_for(url))
+            curl_easy_setopt(range->curl, CURLOPT_PROXY, 0);
+
+        if (curl_multi_add_handle(multi, range->curl) != CURLM_OK)
+            error = "Could not start the request for " + url;
+    }
+
+    int running = 1;
+    while (error.empty() && running > 0) {
+        if (curl_multi_perform(multi, &running) != CURLM_OK)
+            error = "Could not read " + url;
+        else if (running > 0)
+#if LIBCURL_VERSION_NUM >= 0x071c00
+            curl_multi_wait(multi, 0, 0, 1000, 0);
+#else
+            usleep(1000);
+#endif
+    }
+
+    int queued;
+    CURLMsg *msg;
+    while ((msg = curl_multi_info_read(multi, &queued))) {
+        if (msg->msg == CURLMSG_DONE) {
+            for (vector<RangeFetch *>::iterator i = ranges.begin(); i != ranges.end(); ++i)
+                if ((*i)->curl == msg->easy_handle)
+                    (*i)->result = msg->data.result;
+        }
+    }
+
+    bool restart = false;
+    for (vector<RangeFetch *>::iterator i = ranges.begin(); i != ranges.end(); ++i) {
+        RangeFetch *range = *i;
+        long status = 0;
+        if (range->curl) {
+            curl_easy_getinfo(range->curl, CURLINFO_RESPONSE_CODE, &status);
+            curl_multi_remove_handle(multi, range->curl);
+            curl_easy_cleanup(range->curl);
+        }
+
+        off_t first, last, size;
+        if (!error.empty() || restart) {
+            // Already decided
+        }
+        else if (status == 200) {
+            // The complete response, because it changed since the first
+            // range was read or because the server ignored the range
+            restart = true;
+        }
+        else if (range->result != CURLE_OK) {
+            error = range->error_buffer[0] ? range->error_buffer : curl_easy_strerror(range->result);
+        }
+        else if (status != 206 || !get_content_range(range->headers, first, last, size)
+                 || first != range->start || last != range->end - 1 || range->offset != range->end) {
+            error = "The server did not return the byte range requested from " + url
+                    + " (status " + long_to_string(status) + ")";
+        }
+        else if (size != total) {
+            // Part of a different response
+            restart = true;
+        }
+
+        delete range;
+    }
+
+    curl_multi_cleanup(multi);
+    curl_slist_free_all(req_hdrs.get_headers());
+
+    if (!error.empty())
+        throw Error(error);
+
+    return !restart;
+}
+
+/** Dereference a URL, reading a large response as several byte ranges at
+    the same time. The first request asks for the first \c range_size bytes.
+    If the server returns just those bytes and the response is larger, the
+    rest is split into as many as \c num_ranges ranges of at least \c
+    range_size bytes and they are read at once, each using its own
+    connection. A server that does not support byte ranges returns the
+    complete response to the first request.
+
+    The other ranges are asked for with an If-Range header holding the
+    first response's ETag or Last-Modified time, and each must give the same
+    size for the complete response. If the response changes while it is
+    being read in parts, it is read again with a single request.
+
+    The HTTP cache is not used. The requests do not ask for compressed
+    responses, since part of a compressed response cannot be used by
+    itself.
+
+    @param url The URL to dereference.
+    @param num_ranges Read the response using at most this many connections
+    at once. If less than two, this is the same as fetch_url().
+    @param range_size The smallest range to ask for.
+    @return A pointer to the stream.
+    @exception Error Thrown if the URL or any part of it could not be
+    dereferenced. */
+HTTPResponse *
+HTTPConnect::fetch_url_ranges(const string &url, unsigned int num_ranges, unsigned long range_size)
+{
+    if (num_ranges < 2 || range_size == 0)
+        return fetch_url(url);
+
+    ResponseBody body(d_max_memory_response);
+    vector<string> *resp_hdrs = new vector<string>;
+
+    ostringstream first_range;
+    first_range << "Range: bytes=0-" << range_size - 1;
+    vector<string> range_hdr(1, first_range.str());
+
+    vector<string> request_headers = d_request_headers;
+    d_request_headers.erase(remove_if(d_request_headers.begin(), d_request_headers.end(),
+                                      HeaderMatch("Accept-Encoding:")), d_request_headers.end());
+    try {
+        long status = read_url(url, body, resp_hdrs, &range_hdr);
+        if (status >= 400)
+            throw Error("Error while reading the URL: " + url
+                        + ".\nThe OPeNDAP server returned the following message:\n" + http_status_to_string(status));
+
+        off_t first, last, total;
+        if (status == 206) {
+            if (!get_content_range(*resp_hdrs, first, last, total) || first != 0)
+                throw Error("The server returned an unusable byte range for " + url);
+
+            if (last + 1 < total) {
+                // Read the rest from where the first request ended up
+                char *effective_url = 0;
+                curl_easy_getinfo(d_curl, CURLINFO_EFFECTIVE_URL, &effective_url);
+                if (!read_ranges(effective_url ? string(effective_url) : url, body, last + 1, total, num_ranges,
+                                 range_size, get_range_validator(*resp_hdrs))) {
+                    // The response changed; read all of it again at once
+                    body.clear();
+                    resp_hdrs->clear();
+                    status = read_url(url, body, resp_hdrs);
+                    if (status >= 400)
+                        throw Error("Error while reading the URL: " + url
+                                    + ".\nThe OPeNDAP server returned the following message:\n"
+                                    + http_status_to_string(status));
+                }
+            }
+        }
+
+        body.open();
+    }
+    catch (...) {
+        d_request_headers = request_headers;
+        delete resp_hdrs;
+        throw;
+    }
+    d_request_headers = request_headers;
+
+    HTTPResponse *rs = body.make_response(200, resp_hdrs);
+    try {
+        set_response_info(rs, d_content_type);
+        if (d_use_cpp_streams)
+            rs->transform_to_cpp();
+    }
+    catch (...) {
+        delete rs;
+        throw;
+    }
+
+    return rs;
+}
+
+//@}
+
 /** Set the <em>accept deflate</em> property. If true, the DAP client
     announces to a server that it can accept responses compressed using the
     \c deflate algorithm. This property is automatically set using a value
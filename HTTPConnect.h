@@ -28,6 +28,8 @@
 
 
 #include <string>
+#include <deque>
+#include <utility>
 
 #include <curl/curl.h>
 //No longer used in CURL - pwest April 09, 2012
@@ -60,6 +62,8 @@ using std::vector;
 namespace libdap
 {
 
+class HTTPStreamResponse;
+
 extern int www_trace;
 extern int dods_keep_temps;
 
@@ -94,12 +98,40 @@ private:
 
     bool d_use_cpp_streams;	// Build HTTPResponse objects using fstream and not FILE*
 
+    // Response bodies up to this size are held in memory; see ResponseBody
+    struct ResponseBody;
+    unsigned long d_max_memory_response;
+
+    // Asynchronous requests; see start_fetch_url()
+    struct PendingFetch;
+    typedef std::deque<std::pair<int, HTTPResponse *> > CompletedFetches;
+
+    CURLM *d_multi;
+    vector<PendingFetch *> d_pending;   // Requests in progress
+    CompletedFetches d_completed;       // Responses found in the cache
+    int d_next_request;
+
     void www_lib_init();
     long read_url(const string &url, FILE *stream, vector<string> *resp_hdrs,
                   const vector<string> *headers = 0);
+    long read_url(const string &url, ResponseBody &body, vector<string> *resp_hdrs,
+                  const vector<string> *headers = 0);
+    long perform_request(const string &url, vector<string> *resp_hdrs, const vector<string> *headers);
+    long coalesced_read_url(const string &url, ResponseBody &body,
+                            vector<string> *resp_hdrs, const vector<string> *headers, bool &shared);
+    static int get_num_shared_fetch_waiters();
 
-    HTTPResponse *plain_fetch_url(const string &url);
+    HTTPResponse *plain_fetch_url(const string &url, bool *shared = 0);
     HTTPResponse *caching_fetch_url(const string &url);
+    string set_response_info(HTTPResponse *stream, const string &content_type);
+
+    bool read_ranges(const string &url, ResponseBody &body, off_t offset, off_t total,
+                     unsigned int num_ranges, unsigned long range_size, const string &validator);
+
+    CURL *copy_handle(const string &url, struct curl_slist *&request_headers);
+
+    void free_fetch(PendingFetch *fetch);
+    HTTPResponse *finish_fetch(PendingFetch *fetch, CURLcode result);
 
     bool url_uses_proxy_for(const string &url);
     bool url_uses_no_proxy_for(const string &url) throw();
@@ -134,6 +166,13 @@ public:
     bool use_cpp_streams() const { return d_use_cpp_streams; }
     void set_use_cpp_streams(bool use_cpp_streams) { d_use_cpp_streams = use_cpp_streams; }
 
+    /** Set the size of the largest response body that is held in memory.
+    Larger bodies are written to a temporary file. By default this is the
+    value of the \c MAX_MEMORY_RESPONSE property in the \c .dodsrc file.
+    @param size The size in bytes; zero writes every body to a file. */
+    void set_max_memory_response(unsigned long size) { d_max_memory_response = size; }
+    unsigned long get_max_memory_response() const { return d_max_memory_response; }
+
     /** Set the cookie jar. This function sets the name of a file used to store
     cookies returned by servers. This will help with things like single
     sign on systems.
@@ -156,6 +195,18 @@ public:
     bool is_cache_enabled() { return (d_http_cache) ? d_http_cache->is_cache_enabled() : false; }
 
     HTTPResponse *fetch_url(const string &url);
+    HTTPResponse *fetch_url_ranges(const string &url, unsigned int num_ranges, unsigned long range_size);
+    HTTPStreamResponse *fetch_url_stream(const string &url);
+
+    int start_fetch_url(const string &url);
+    HTTPResponse *get_next_response(int &request);
+    void cancel_fetches();
+
+    /// The number of asynchronous requests whose responses have not been returned
+    unsigned int get_num_pending_responses() const
+    {
+        return d_pending.size() + d_completed.size();
+    }
 };
 
 } // namespace libdap
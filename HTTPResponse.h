@@ -32,6 +32,7 @@
 
 #include <string>
 #include <iostream>
+#include <sstream>
 #include <algorithm>
 #include <iterator>
 #include <vector>
@@ -47,6 +48,52 @@ namespace libdap
 extern int dods_keep_temps;
 extern void close_temp(FILE *s, const string &name);
 
+/** A stream buffer that reads a block of memory in place.
+
+    @note Instead of using this class, use memistream.
+    @see memistream */
+class meminbuf : public std::streambuf
+{
+public:
+    meminbuf(const char *begin, const char *end)
+    {
+        setg(const_cast<char*>(begin), const_cast<char*>(begin), const_cast<char*>(end));
+    }
+
+protected:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                             std::ios_base::openmode which = std::ios_base::in)
+    {
+        if (!(which & std::ios_base::in))
+            return pos_type(off_type(-1));
+
+        char *base = (dir == std::ios_base::beg) ? eback() : (dir == std::ios_base::cur) ? gptr() : egptr();
+        if (off < eback() - base || off > egptr() - base)
+            return pos_type(off_type(-1));
+
+        setg(eback(), base + off, egptr());
+        return pos_type(gptr() - eback());
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in)
+    {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+};
+
+/** An istream that reads a block of memory in place, without copying it.
+    The memory must outlive the stream. */
+class memistream : public std::istream
+{
+protected:
+    meminbuf buf;
+
+public:
+    memistream(const char *begin, const char *end) : std::istream(&buf), buf(begin, end)
+    {
+    }
+};
+
 /** Encapsulate an http response. Instead of directly returning the FILE
     pointer from which a response is read and vector of headers, return an
     instance of this object.
@@ -58,6 +105,7 @@ class HTTPResponse : public Response
 private:
     std::vector<std::string> *d_headers; // Response headers
     std::string d_file;  // Temp file that holds response body
+    std::vector<char> *d_body; // Response body, when it is held in memory
 
 protected:
     /** @name Suppressed default methods */
@@ -85,7 +133,7 @@ public:
     @param temp_file Name a the temporary file that holds the response
     body; this file is deleted when this instance is deleted. */
     HTTPResponse(FILE *s, int status, std::vector<std::string> *h, const std::string &temp_file)
-            : Response(s, status), d_headers(h), d_file(temp_file)
+            : Response(s, status), d_headers(h), d_file(temp_file), d_body(0)
     {
         DBG(cerr << "Headers: " << endl);
         DBGN(copy(d_headers->begin(), d_headers->end(),
@@ -93,6 +141,19 @@ public:
         DBGN(cerr << "end of headers." << endl);
     }
 
+    /** Build an HTTPResponse whose body is held in memory.
+
+    @param s FILE * to the response, opened on \c body using fmemopen().
+    @param status The HTTP response status code.
+    @param h Response headers. This class will delete the pointer when
+    the instance that contains it is destroyed.
+    @param body The response body. This class will delete the pointer
+    once it has closed \c s. */
+    HTTPResponse(FILE *s, int status, std::vector<std::string> *h, std::vector<char> *body)
+            : Response(s, status), d_headers(h), d_file(""), d_body(body)
+    {
+    }
+
     /**
      * @brief Build a HTTPResponse using a cpp fstream
      * When working with DAP4 responses, use C++ streams for I/0.
@@ -103,7 +164,7 @@ public:
      * @param temp_file
      */
     HTTPResponse(std::fstream *s, int status, std::vector<std::string> *h, const std::string &temp_file)
-            : Response(s, status), d_headers(h), d_file(temp_file)
+            : Response(s, status), d_headers(h), d_file(temp_file), d_body(0)
     {
         DBG(cerr << "Headers: " << endl);
         DBGN(copy(d_headers->begin(), d_headers->end(),
@@ -135,6 +196,15 @@ public:
 			}
         }
 
+        // The stream reads from d_body, so close it first
+        if (d_body) {
+            if (get_stream()) {
+                fclose(get_stream());
+                set_stream(0);
+            }
+            delete d_body;
+        }
+
         delete d_headers;
 
         DBGN(cerr << endl);
@@ -142,7 +212,7 @@ public:
 
     /**
      * Build a new HTTPResponse object that works with C++ streams. Assume that
-     * the FILE* references a disk file.
+     * the FILE* references a disk file or a body held in memory.
      * @return
      */
     void transform_to_cpp() {
@@ -150,13 +220,21 @@ public:
     	// code would not leave the FILE* open when it's not needed, but this implementation
     	// can use the existing HTTPConnect and HTTPCache software with very minimal
     	// (or no) modification. jhrg 11/8/13
-    	set_cpp_stream(new std::fstream(d_file.c_str(), std::ios::in|std::ios::binary));
+    	if (d_body) {
+    	    // Read the body where it is
+    	    const char *body = d_body->empty() ? 0 : &(*d_body)[0];
+    	    set_cpp_stream(new memistream(body, body + d_body->size()));
+    	}
+    	else
+    	    set_cpp_stream(new std::fstream(d_file.c_str(), std::ios::in|std::ios::binary));
     }
 
     /** @name Accessors */
     //@{
     virtual std::vector<std::string> *get_headers() const { return d_headers; }
     virtual std::string get_file() const { return d_file; }
+    /// The response body, or null if it is in a file (see get_file())
+    virtual const std::vector<char> *get_body() const { return d_body; }
     //@}
 
     /** @name Mutators */
@@ -0,0 +1,246 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <unistd.h>
+#include <strings.h>
+
+#include <string>
+#include <vector>
+
+#include "HTTPStreamResponse.h"
+#include "Error.h"
+#include "InternalErr.h"
+#include "debug.h"
+
+using namespace std;
+
+namespace libdap {
+
+curl_streambuf::curl_streambuf(CURLM *multi, CURL *curl, vector<string> *headers) :
+    d_multi(multi), d_curl(curl), d_headers(headers), d_redirect(false), d_headers_done(false), d_done(false),
+    d_result(CURLE_OK)
+{
+    curl_easy_setopt(d_curl, CURLOPT_WRITEFUNCTION, &curl_streambuf::write);
+    curl_easy_setopt(d_curl, CURLOPT_WRITEDATA, this);
+    curl_easy_setopt(d_curl, CURLOPT_HEADERFUNCTION, &curl_streambuf::header);
+    curl_easy_setopt(d_curl, CURLOPT_HEADERDATA, this);
+}
+
+/** The libcurl write function; \c data is the curl_streambuf. */
+size_t curl_streambuf::write(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    curl_streambuf *buf = static_cast<curl_streambuf*>(data);
+    size_t bytes = size * nmemb;
+    buf->d_incoming.insert(buf->d_incoming.end(), static_cast<char*>(ptr), static_cast<char*>(ptr) + bytes);
+    return bytes;
+}
+
+/**
+ * The libcurl header function; \c data is the curl_streambuf. Saves the
+ * headers the way HTTPConnect does and notes the empty line that ends the
+ * headers of the final response. libcurl makes another request after a
+ * response that it follows (a redirect) or answers (a request for
+ * credentials), so the headers of those do not count.
+ */
+size_t curl_streambuf::header(void *ptr, size_t size, size_t nmemb, void *data)
+{
+    curl_streambuf *buf = static_cast<curl_streambuf*>(data);
+    size_t bytes = size * nmemb;
+
+    // The header, minus the trailing newline or \r\n pair
+    string line(static_cast<char*>(ptr), bytes);
+    while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+        line.erase(line.size() - 1);
+
+    if (line.empty()) {
+        long status = 0;
+        curl_easy_getinfo(buf->d_curl, CURLINFO_RESPONSE_CODE, &status);
+        buf->d_headers_done = status >= 200 && status != 401 && status != 407
+                              && !(status >= 300 && status < 400 && buf->d_redirect);
+        buf->d_redirect = false;
+    }
+    else if (line.find("HTTP") == string::npos) {
+        // Store all non-empty headers that are not HTTP status codes
+        DBG(cerr << "Header line: " << line << endl);
+        if (line.size() > 9 && strncasecmp(line.c_str(), "location:", 9) == 0)
+            buf->d_redirect = true;
+        buf->d_headers->push_back(line);
+    }
+
+    return bytes;
+}
+
+/**
+ * Run the transfer until libcurl has read more of the body or the transfer
+ * has ended.
+ *
+ * @param headers_only Also stop once the headers of the final response
+ * have been read.
+ */
+void curl_streambuf::perform(bool headers_only)
+{
+    while (!d_done && d_incoming.empty() && !(headers_only && d_headers_done)) {
+        int running = 0;
+        CURLMcode status;
+        while ((status = curl_multi_perform(d_multi, &running)) == CURLM_CALL_MULTI_PERFORM)
+            ;
+
+        if (status != CURLM_OK) {
+            DBG(cerr << "curl_multi_perform: " << curl_multi_strerror(status) << endl);
+            d_done = true;
+            d_result = CURLE_RECV_ERROR;
+            break;
+        }
+
+        int queued;
+        CURLMsg *msg;
+        while ((msg = curl_multi_info_read(d_multi, &queued))) {
+            if (msg->msg == CURLMSG_DONE && msg->easy_handle == d_curl) {
+                d_done = true;
+                d_result = msg->data.result;
+            }
+        }
+
+        if (!d_done && d_incoming.empty() && !(headers_only && d_headers_done)) {
+#if LIBCURL_VERSION_NUM >= 0x071c00
+            curl_multi_wait(d_multi, 0, 0, 1000, 0);
+#else
+            usleep(1000);
+#endif
+        }
+    }
+}
+
+curl_streambuf::int_type curl_streambuf::underflow()
+{
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    perform();
+
+    // Keep the old get area's storage for the next bytes libcurl reads
+    d_buffer.swap(d_incoming);
+    d_incoming.clear();
+    if (d_buffer.empty())
+        return traits_type::eof();
+
+    setg(&d_buffer[0], &d_buffer[0], &d_buffer[0] + d_buffer.size());
+    return traits_type::to_int_type(*gptr());
+}
+
+/**
+ * Build a response that reads the body of the transfer made with \c curl.
+ * Call start() to start the transfer.
+ *
+ * @param curl A libcurl handle, set up to make the request. This object
+ * cleans it up when it is destroyed.
+ * @param request_headers The request headers used by \c curl; freed when
+ * this object is destroyed. May be null.
+ * @param headers The response headers are stored here. This object deletes
+ * the pointer when it is destroyed.
+ */
+HTTPStreamResponse::HTTPStreamResponse(CURL *curl, struct curl_slist *request_headers, vector<string> *headers) :
+    HTTPResponse(static_cast<FILE*>(0), 0, headers, ""), d_multi(0), d_curl(curl),
+    d_request_headers(request_headers), d_buf(0)
+{
+    d_error_buffer[0] = '\0';
+    curl_easy_setopt(d_curl, CURLOPT_ERRORBUFFER, d_error_buffer);
+
+    d_multi = curl_multi_init();
+    if (!d_multi) {
+        curl_easy_cleanup(d_curl);
+        curl_slist_free_all(d_request_headers);
+        throw InternalErr(__FILE__, __LINE__, "Could not initialize libcurl.");
+    }
+
+    d_buf = new curl_streambuf(d_multi, d_curl, headers);
+    set_cpp_stream(new istream(d_buf));
+}
+
+HTTPStreamResponse::~HTTPStreamResponse()
+{
+    // Stop using d_buf before it is deleted
+    delete get_cpp_stream();
+    set_cpp_stream(0);
+
+    // This abandons the transfer if it has not finished
+    curl_multi_remove_handle(d_multi, d_curl);
+    curl_easy_cleanup(d_curl);
+    curl_multi_cleanup(d_multi);
+    curl_slist_free_all(d_request_headers);
+
+    delete d_buf;
+}
+
+/**
+ * Start the transfer and wait for the response headers. When this returns,
+ * get_status(), get_headers() and get_content_type() have their values.
+ * None of the body need have arrived.
+ *
+ * @exception Error Thrown if the transfer failed before the headers were
+ * read.
+ */
+void HTTPStreamResponse::start()
+{
+    if (curl_multi_add_handle(d_multi, d_curl) != CURLM_OK)
+        throw InternalErr(__FILE__, __LINE__, "Could not start the request.");
+
+    while (!d_buf->started())
+        d_buf->perform(true);
+
+    if (d_buf->done() && d_buf->result() != CURLE_OK)
+        throw Error(get_transfer_error());
+
+    long status = 0;
+    curl_easy_getinfo(d_curl, CURLINFO_RESPONSE_CODE, &status);
+    set_status(status);
+}
+
+/// The value of the Content-Type header, or "" if there was none
+string HTTPStreamResponse::get_content_type() const
+{
+    char *ct_ptr = 0;
+    if (curl_easy_getinfo(d_curl, CURLINFO_CONTENT_TYPE, &ct_ptr) == CURLE_OK && ct_ptr)
+        return ct_ptr;
+
+    return "";
+}
+
+/**
+ * Why the transfer failed. Do not call this while another thread is reading
+ * the stream.
+ *
+ * @return The libcurl error message, or "" if the transfer has not failed.
+ */
+string HTTPStreamResponse::get_transfer_error() const
+{
+    if (!d_buf->done() || d_buf->result() == CURLE_OK)
+        return "";
+
+    return d_error_buffer[0] ? string(d_error_buffer) : string(curl_easy_strerror(d_buf->result()));
+}
+
+} // namespace libdap
@@ -0,0 +1,119 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef http_stream_response_h
+#define http_stream_response_h
+
+#include <streambuf>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "HTTPResponse.h"
+
+namespace libdap
+{
+
+/** A streambuf that reads the body of a response while libcurl transfers
+    it. Bytes are handed out as soon as they arrive; underflow() runs the
+    transfer until more are available or it ends. The response headers are
+    saved as they arrive, so the transfer can also be run just until they
+    have all been read. */
+class curl_streambuf : public std::streambuf
+{
+private:
+    CURLM *d_multi;
+    CURL *d_curl;
+
+    std::vector<char> d_buffer;     // The get area
+    std::vector<char> d_incoming;   // Bytes read by libcurl since the last underflow()
+
+    std::vector<std::string> *d_headers;
+    bool d_redirect;        // The current response has a Location header
+    bool d_headers_done;    // The headers of the final response have been read
+
+    bool d_done;
+    CURLcode d_result;
+
+    curl_streambuf(const curl_streambuf &);
+    curl_streambuf &operator=(const curl_streambuf &);
+
+    static size_t write(void *ptr, size_t size, size_t nmemb, void *data);
+    static size_t header(void *ptr, size_t size, size_t nmemb, void *data);
+
+protected:
+    virtual int_type underflow();
+
+public:
+    curl_streambuf(CURLM *multi, CURL *curl, std::vector<std::string> *headers);
+    virtual ~curl_streambuf() { }
+
+    void perform(bool headers_only = false);
+
+    /// True once the headers or some of the body have been read, or the
+    /// transfer has ended
+    bool started() const { return d_headers_done || d_done || !d_incoming.empty() || gptr() != egptr(); }
+    bool done() const { return d_done; }
+    CURLcode result() const { return d_result; }
+};
+
+/** An HTTPResponse whose body is read while it is being transferred. The
+    body is not saved; it is read, once, using get_cpp_stream() (there is
+    no FILE pointer). Build instances using HTTPConnect::fetch_url_stream().
+
+    If the transfer fails part way through, the stream ends early. Use
+    get_transfer_error() to tell that apart from a short response. */
+class HTTPStreamResponse : public HTTPResponse
+{
+private:
+    CURLM *d_multi;
+    CURL *d_curl;
+    struct curl_slist *d_request_headers;
+    char d_error_buffer[CURL_ERROR_SIZE];
+
+    curl_streambuf *d_buf;
+
+protected:
+    /** @name Suppressed default methods */
+    //@{
+    HTTPStreamResponse();
+    HTTPStreamResponse(const HTTPStreamResponse &rs);
+    HTTPStreamResponse &operator=(const HTTPStreamResponse &);
+    //@}
+
+public:
+    HTTPStreamResponse(CURL *curl, struct curl_slist *request_headers, std::vector<std::string> *headers);
+    virtual ~HTTPStreamResponse();
+
+    void start();
+
+    std::string get_content_type() const;
+    std::string get_transfer_error() const;
+};
+
+} // namespace libdap
+
+#endif // http_stream_response_h
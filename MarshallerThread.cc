@@ -32,12 +32,14 @@
 #include "config.h"
 
 #include <pthread.h>
-#include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
+#include <cstring>
 #include <ostream>
 #include <sstream>
+#include <exception>
 
 #include "MarshallerThread.h"
 #include "Error.h"
@@ -47,43 +49,14 @@
 using namespace libdap;
 using namespace std;
 
-#if 0
-bool MarshallerThread::print_time = false;
-
-/**
- * Use this with timeval structures returned by gettimeofday() to compute
- * real time (instead of user time that is returned by std::clock() or
- * get_rusage()).
- */
-static double time_diff_to_hundredths(struct timeval *stop, struct timeval *start)
-{
-    /* Perform the carry for the later subtraction by updating y. */
-    if (stop->tv_usec < start->tv_usec) {
-        int nsec = (start->tv_usec - stop->tv_usec) / 1000000 + 1;
-        start->tv_usec -= 1000000 * nsec;
-        start->tv_sec += nsec;
-    }
-    if (stop->tv_usec - start->tv_usec > 1000000) {
-        int nsec = (start->tv_usec - stop->tv_usec) / 1000000;
-        start->tv_usec += 1000000 * nsec;
-        start->tv_sec -= nsec;
-    }
-
-    double result = stop->tv_sec - start->tv_sec;
-    result += double(stop->tv_usec - start->tv_usec) / 1000000;
-    return result;
-}
-#endif
-
-
 /**
- * Lock the mutex then wait for the child thread to signal using the
+ * Lock the mutex then wait for the writer thread to signal using the
  * condition variable 'cond'. Once the signal is received, re-test count
- * to make sure it's zero (there are no child threads).
+ * to make sure it's zero (there are no queued writes).
  *
- * This is used to lock the main thread and ensure that a second child
- * (writer) thread is not started until any current child thread completes,
- * which keeps the write operations in the correct order.
+ * This is used to lock the main thread and ensure that it does not write
+ * to the output stream until all of the queued writes complete, which
+ * keeps the write operations in the correct order.
  */
 Locker::Locker(pthread_mutex_t &lock, pthread_cond_t &cond, int &count) :
     m_mutex(lock)
@@ -115,190 +88,311 @@ Locker::~Locker()
 
 
 /**
- * Lock the mutex, but do not wait on the condition variable.
- * This is used by the child thread; it helps ensure that the
- * mutex is unlocked and the predicate is reset no matter how the
- * child thread is exited.
+ * Build a MarshallerThread. The writer thread is not started until the
+ * first write is queued.
  *
- * Note we how a reference to the shared 'count' predicate that
- * tells how many (0 or 1) child threads exist so that when this
- * version of the Locker object is destroyed, we can zero that.
- * This enables us to use RAII in the child thread and ensure
- * the invariant if there is an error and the code exits with a
- * summary return.
+ * @param num_buffers The number of buffers in the ring; this bounds how
+ * many writes can be queued before get_buffer() blocks.
+ * @param max_retained_size Buffers larger than this are freed once their
+ * data are written instead of being kept for reuse. This keeps a handful
+ * of very large arrays from pinning memory for the life of the response.
  */
-ChildLocker::ChildLocker(pthread_mutex_t &lock, pthread_cond_t &cond, int &count) :
-    m_mutex(lock), m_cond(cond), m_count(count)
+MarshallerThread::MarshallerThread(unsigned int num_buffers, int64_t max_retained_size) :
+    d_thread(0), d_thread_started(false), d_child_thread_count(0), d_shutdown(false),
+    d_buffers(num_buffers > 0 ? num_buffers : 1), d_next_buffer(0), d_buffers_in_use(0),
+    d_max_retained_size(max_retained_size)
 {
-    int status = pthread_mutex_lock(&m_mutex);
-
-    DBG(cerr << "Locking the mutex! (simple; " << pthread_self() << ")" << endl);
-
-    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not lock m_mutex");
-
-    DBG(cerr << "Locked! (" << pthread_self() << ")" << endl);
+    if (pthread_mutex_init(&d_out_mutex, 0) != 0) throw Error(internal_error, "Failed to initialize mutex.");
+    if (pthread_cond_init(&d_out_cond, 0) != 0) throw Error(internal_error, "Failed to initialize cond.");
+    if (pthread_cond_init(&d_work_cond, 0) != 0) throw Error(internal_error, "Failed to initialize cond.");
 }
 
-ChildLocker::~ChildLocker()
+/**
+ * Wait for the queued writes to complete, then stop the writer thread and
+ * free the buffers.
+ */
+MarshallerThread::~MarshallerThread()
 {
-    DBG(cerr << "Unlocking the mutex! (" << pthread_self() << ")" << endl);
+    pthread_mutex_lock(&d_out_mutex);
+    d_shutdown = true;
+    pthread_cond_signal(&d_work_cond);
+    pthread_mutex_unlock(&d_out_mutex);
 
-    m_count = 0;
-    int status = pthread_cond_signal(&m_cond);
-    if (status != 0)
-        throw InternalErr(__FILE__, __LINE__, "Could not signal main thread from ChildLocker!");
+    // The writer drains the queue before it exits
+    if (d_thread_started) pthread_join(d_thread, 0);
 
-    status = pthread_mutex_unlock(&m_mutex);
-    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not unlock m_mutex");
+    for (vector<write_buffer>::iterator i = d_buffers.begin(), e = d_buffers.end(); i != e; ++i)
+        delete[] i->d_buf;
+
+    pthread_mutex_destroy(&d_out_mutex);
+    pthread_cond_destroy(&d_out_cond);
+    pthread_cond_destroy(&d_work_cond);
 }
 
-MarshallerThread::MarshallerThread() :
-    d_thread(0), d_child_thread_count(0)
+// private; called with the mutex locked
+void MarshallerThread::m_start_thread()
 {
-    if (pthread_attr_init(&d_thread_attr) != 0) throw Error(internal_error, "Failed to initialize pthread attributes.");
-    if (pthread_attr_setdetachstate(&d_thread_attr, PTHREAD_CREATE_DETACHED /*PTHREAD_CREATE_JOINABLE*/) != 0)
-        throw Error(internal_error, "Failed to complete pthread attribute initialization.");
+    int status = pthread_create(&d_thread, 0, writer_thread, this);
+    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not start child thread");
 
-    if (pthread_mutex_init(&d_out_mutex, 0) != 0) throw Error(internal_error, "Failed to initialize mutex.");
-    if (pthread_cond_init(&d_out_cond, 0) != 0) throw Error(internal_error, "Failed to initialize cond.");
+    d_thread_started = true;
 }
 
-MarshallerThread::~MarshallerThread()
+/**
+ * Get the next buffer from the ring. If all of the buffers hold data that
+ * have not yet been written, block until the writer thread finishes with
+ * the oldest one. The returned buffer holds at least 'size' bytes and must
+ * be passed to write() or release_buffer() before get_buffer() is called
+ * again.
+ *
+ * @param size The number of bytes needed
+ * @return A pointer to the buffer.
+ * @exception Error if an earlier write failed.
+ */
+char *MarshallerThread::get_buffer(int64_t size)
 {
     int status = pthread_mutex_lock(&d_out_mutex);
     if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not lock m_mutex");
-    while (d_child_thread_count != 0) {
+
+    while (d_buffers_in_use == d_buffers.size()) {
         status = pthread_cond_wait(&d_out_cond, &d_out_mutex);
-        if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not wait on m_cond");
+        if (status != 0) {
+            pthread_mutex_unlock(&d_out_mutex);
+            throw InternalErr(__FILE__, __LINE__, "Could not wait on m_cond");
+        }
     }
-    if (d_child_thread_count != 0)
-        throw InternalErr(__FILE__, __LINE__, "FAIL: left m_cond wait with non-zero child thread count");
 
-    status = pthread_mutex_unlock(&d_out_mutex);
-    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not unlock m_mutex");
+    if (!d_thread_error.empty()) {
+        string msg = d_thread_error;
+        pthread_mutex_unlock(&d_out_mutex);
+        throw Error(msg);
+    }
 
-    pthread_mutex_destroy(&d_out_mutex);
-    pthread_cond_destroy(&d_out_cond);
+    write_buffer &wb = d_buffers[d_next_buffer];
+    d_next_buffer = (d_next_buffer + 1) % d_buffers.size();
+    ++d_buffers_in_use;
 
-    pthread_attr_destroy(&d_thread_attr);
+    pthread_mutex_unlock(&d_out_mutex);
+
+    // Only the main thread touches a buffer between get_buffer() and write()
+    if (wb.d_size < size) {
+        delete[] wb.d_buf;
+        wb.d_buf = 0;
+        wb.d_size = 0;
+        try {
+            wb.d_buf = new char[size];
+        }
+        catch (...) {
+            m_release_newest_buffer();
+            throw;
+        }
+        wb.d_size = size;
+    }
+
+    return wb.d_buf;
 }
 
-// not a static method
 /**
- * Start the child thread, using the arguments given. This will write 'bytes'
- * bytes from 'byte_buf' to the output stream 'out'
+ * Return a buffer obtained using get_buffer() without writing it. Use
+ * this when an error prevents the data from being sent.
  *
+ * @param buf The buffer. Only the buffer most recently returned by
+ * get_buffer() can be released.
+ * @exception InternalErr if 'buf' is not that buffer.
  */
-void MarshallerThread::start_thread(void* (*thread)(void *arg), ostream &out, char *byte_buf,
-    unsigned int bytes)
+void MarshallerThread::release_buffer(char *buf)
 {
-    write_args *args = new write_args(d_out_mutex, d_out_cond, d_child_thread_count, d_thread_error, out, byte_buf,
-        bytes);
-    int status = pthread_create(&d_thread, &d_thread_attr, thread, args);
-    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not start child thread");
+    int status = pthread_mutex_lock(&d_out_mutex);
+    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not lock m_mutex");
+
+    unsigned int newest = (d_next_buffer + d_buffers.size() - 1) % d_buffers.size();
+    bool is_newest = d_buffers_in_use > 0 && buf == d_buffers[newest].d_buf;
+
+    pthread_mutex_unlock(&d_out_mutex);
+
+    if (!is_newest)
+        throw InternalErr(__FILE__, __LINE__, "Only the most recent buffer from get_buffer() can be released");
+
+    m_release_newest_buffer();
+}
+
+// private; give back the buffer most recently handed out by get_buffer()
+void MarshallerThread::m_release_newest_buffer()
+{
+    pthread_mutex_lock(&d_out_mutex);
+    d_next_buffer = (d_next_buffer + d_buffers.size() - 1) % d_buffers.size();
+    --d_buffers_in_use;
+    pthread_cond_broadcast(&d_out_cond);
+    pthread_mutex_unlock(&d_out_mutex);
+}
+
+// private
+void MarshallerThread::m_queue(const write_job &job)
+{
+    int status = pthread_mutex_lock(&d_out_mutex);
+    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not lock m_mutex");
+
+    try {
+        if (!d_thread_started) m_start_thread();
+    }
+    catch (...) {
+        pthread_mutex_unlock(&d_out_mutex);
+        m_release_newest_buffer();
+        throw;
+    }
+
+    d_jobs.push_back(job);
+    ++d_child_thread_count;
+
+    pthread_cond_signal(&d_work_cond);
+    pthread_mutex_unlock(&d_out_mutex);
 }
 
 /**
- * Write 'bytes' bytes from 'byte_buf' to the file descriptor 'fd'.
+ * Queue 'bytes' bytes from 'buf', starting at 'offset', to be written to
+ * the output stream 'out'. The buffer must have been obtained using
+ * get_buffer(); it is returned to the ring once the data are written.
  */
-void MarshallerThread::start_thread(void* (*thread)(void *arg), int fd, char *byte_buf, unsigned int bytes)
+void MarshallerThread::write(ostream &out, char *buf, int64_t bytes, int64_t offset)
 {
-    write_args *args = new write_args(d_out_mutex, d_out_cond, d_child_thread_count, d_thread_error, fd, byte_buf,
-        bytes);
-    int status = pthread_create(&d_thread, &d_thread_attr, thread, args);
-    if (status != 0) throw InternalErr(__FILE__, __LINE__, "Could not start child thread");
+    m_queue(write_job(&out, -1, buf + offset, bytes));
 }
 
 /**
- * This static method is used to write data to the ostream referenced
- * by the ostream element of write_args. This is used by start_thread()
- * and passed to pthread_create()
+ * Queue 'bytes' bytes from 'buf', starting at 'offset', to be written to
+ * the file descriptor 'fd'.
+ */
+void MarshallerThread::write(int fd, char *buf, int64_t bytes, int64_t offset)
+{
+    m_queue(write_job(0, fd, buf + offset, bytes));
+}
+
+/**
+ * Block until all of the queued writes are done.
  *
- * @note The write_args argument may contain either a file descriptor
- * (d_out_file) or an ostream& (d_out). If the file descriptor is not
- * -1, then use that, else use the ostream reference.
+ * @exception Error if one of the writes failed.
  */
-void *
-MarshallerThread::write_thread(void *arg)
+void MarshallerThread::wait_for_writes()
 {
-    write_args *args = reinterpret_cast<write_args *>(arg);
+    string msg;
+    {
+        Locker lock(d_out_mutex, d_out_cond, d_child_thread_count);
+        msg = d_thread_error;
+    }
 
-    ChildLocker lock(args->d_mutex, args->d_cond, args->d_count); // RAII; will unlock on exit
+    if (!msg.empty()) throw Error(msg);
+}
 
-#if 0
-    struct timeval tp_s;
-    if (print_time && gettimeofday(&tp_s, 0) != 0) cerr << "could not read time" << endl;
-#endif
+// private; called with the mutex locked
+void MarshallerThread::m_release_oldest_buffer()
+{
+    unsigned int oldest = (d_next_buffer + d_buffers.size() - d_buffers_in_use) % d_buffers.size();
+    write_buffer &wb = d_buffers[oldest];
+    if (wb.d_size > d_max_retained_size) {
+        delete[] wb.d_buf;
+        wb.d_buf = 0;
+        wb.d_size = 0;
+    }
 
-    // force an error
-    // return (void*)-1;
+    --d_buffers_in_use;
+}
 
-    if (args->d_out_file != -1) {
-        int bytes_written = write(args->d_out_file, args->d_buf, args->d_num);
-        if (bytes_written != args->d_num)
-            return (void*) -1;
+/**
+ * Write the data described by 'job'.
+ *
+ * @note The write_job argument may contain either a file descriptor
+ * (d_out_file) or an ostream pointer (d_out). If the file descriptor is
+ * not -1, then use that, else use the ostream.
+ *
+ * @return True if successful, false otherwise, in which case 'error'
+ * holds a message.
+ */
+bool MarshallerThread::m_write(const write_job &job, string &error)
+{
+    if (job.d_out_file != -1) {
+        const char *data = job.d_data;
+        int64_t num = job.d_num;
+        while (num > 0) {
+            ssize_t bytes_written = ::write(job.d_out_file, data, num);
+            if (bytes_written < 0 && errno == EINTR) continue;
+            if (bytes_written <= 0) {
+                ostringstream oss;
+                oss << "Could not write data: " << strerror(errno) << " " << __FILE__ << ":" << __LINE__;
+                error = oss.str();
+                return false;
+            }
+            data += bytes_written;
+            num -= bytes_written;
+        }
     }
     else {
-        args->d_out.write(args->d_buf, args->d_num);
-        if (args->d_out.fail()) {
+        // The ostream may be set to throw on failure (D4StreamMarshaller
+        // does this); don't let that escape the thread.
+        try {
+            job.d_out->write(job.d_data, job.d_num);
+        }
+        catch (std::exception &) {
+        }
+
+        if (job.d_out->fail()) {
             ostringstream oss;
             oss << "Could not write data: " << __FILE__ << ":" << __LINE__;
-            args->d_error = oss.str();
-            return (void*) -1;
+            error = oss.str();
+            return false;
         }
     }
 
-    delete [] args->d_buf;
-    delete args;
+    return true;
+}
 
-#if 0
-    struct timeval tp_e;
-    if (print_time) {
-        if (gettimeofday(&tp_e, 0) != 0) cerr << "could not read time" << endl;
+/**
+ * The writer thread. Take jobs from the queue, in order, and write them.
+ * The mutex is not held while the data are written so that the main
+ * thread can fill and queue more buffers. Once an error has been recorded,
+ * the remaining jobs are discarded (but still retired) so that the main
+ * thread never waits forever.
+ */
+void MarshallerThread::m_write_loop()
+{
+    while (true) {
+        pthread_mutex_lock(&d_out_mutex);
+        while (d_jobs.empty() && !d_shutdown)
+            pthread_cond_wait(&d_work_cond, &d_out_mutex);
+
+        if (d_jobs.empty()) {
+            // d_shutdown is set and there's nothing left to write
+            pthread_mutex_unlock(&d_out_mutex);
+            return;
+        }
 
-        cerr << "time for child thread write: " << time_diff_to_hundredths(&tp_e, &tp_s) << endl;
-    }
-#endif
+        write_job job = d_jobs.front();
+        d_jobs.pop_front();
+        bool skip = !d_thread_error.empty();
+        pthread_mutex_unlock(&d_out_mutex);
 
-    return 0;
+        string error;
+        bool ok = skip || m_write(job, error);
+
+        pthread_mutex_lock(&d_out_mutex);
+        if (!ok) d_thread_error = error;
+        m_release_oldest_buffer();
+        --d_child_thread_count;
+        pthread_cond_broadcast(&d_out_cond);
+        pthread_mutex_unlock(&d_out_mutex);
+    }
 }
 
 /**
- * This static method is used to write data to the ostream referenced
- * by the ostream element of write_args. This is used by start_thread()
- * and passed to pthread_create()
- *
- * @note This differers from MarshallerThread::write_thread() in that it
- * writes data starting _after_ the four-byte length prefix that XDR
- * adds to the data. It is used for the put_vector_part() calls in
- * XDRStreamMarshaller.
+ * This static method is passed to pthread_create() by m_start_thread().
  *
- * @return 0 if successful, -1 otherwise.
+ * @param arg The MarshallerThread instance.
  */
 void *
-MarshallerThread::write_thread_part(void *arg)
+MarshallerThread::writer_thread(void *arg)
 {
-    write_args *args = reinterpret_cast<write_args *>(arg);
+    MarshallerThread *mt = reinterpret_cast<MarshallerThread *>(arg);
 
-    ChildLocker lock(args->d_mutex, args->d_cond, args->d_count); // RAII; will unlock on exit
-
-    if (args->d_out_file != -1) {
-        int bytes_written = write(args->d_out_file, args->d_buf, args->d_num);
-        if (bytes_written != args->d_num) return (void*) -1;
-    }
-    else {
-        args->d_out.write(args->d_buf + 4, args->d_num);
-        if (args->d_out.fail()) {
-            ostringstream oss;
-            oss << "Could not write data: " << __FILE__ << ":" << __LINE__;
-            args->d_error = oss.str();
-            return (void*) -1;
-        }
-    }
-
-    delete [] args->d_buf;
-    delete args;
+    mt->m_write_loop();
 
     return 0;
 }
-
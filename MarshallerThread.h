@@ -34,20 +34,23 @@
 #define MARSHALLERTHREAD_H_
 
 #include <pthread.h>
+#include <stdint.h>
 
 #include <iostream>
 #include <ostream>
 #include <string>
+#include <vector>
+#include <deque>
 
 namespace libdap {
 
 /**
  * RAII for the MarshallerThread mutex and condition variable. Used by the
  * Main thread. The constructor locks the mutex and then, if the count of
- * child threads is not zero, blocks on the associated condition variable.
- * When signaled by the child thread using the condition variable (the child
- * thread count should then be zero), the mutex is (re)locked and the ctor
- * returns. The destructor unlocks the mutex.
+ * pending writes is not zero, blocks on the associated condition variable.
+ * When signaled by the writer thread using the condition variable (the
+ * pending write count should then be zero), the mutex is (re)locked and the
+ * ctor returns. The destructor unlocks the mutex.
  */
 class Locker {
 public:
@@ -61,110 +64,109 @@ private:
     Locker(const Locker &rhs);
 };
 
-/**
- * Synchronization for the child thread in the multi-threaded version of
- * the DAP2 and DAP4 (when it gets implement) 'Marshaller' class used to
- * send data. The class declared below (MarshallerThread) manages the
- * child thread.
- *
- * The ctor of this class simply
- * locks the mutex; the dtor clears the child thread count, signals that
- * count has changed and unlocks the mutex.
- */
-class ChildLocker {
-public:
-    ChildLocker(pthread_mutex_t &lock, pthread_cond_t &cond, int &count);
-    virtual ~ChildLocker();
-
-private:
-    pthread_mutex_t& m_mutex;
-    pthread_cond_t& m_cond;
-    int& m_count;
-
-    ChildLocker();
-    ChildLocker(const Locker &rhs);
-};
-
 /**
  * Implement a multi-threaded data transmission sub-system for libdap.
  * This class makes it fairly painless to send data using a child thread
  * so that the main thread can be used to read the next chunk of data
  * while whatever has been read to this point is sent over the wire.
  *
- * This code is used by XDRStreamMarshaller and (soon) D4StreamMarshaller.
+ * A single, persistent writer thread is started the first time data are
+ * queued and it runs until the MarshallerThread is destroyed. Data are
+ * passed to it using a bounded ring of reusable buffers: get_buffer()
+ * hands out the next free buffer (blocking only when all of them are
+ * still waiting to be written) and write() queues that buffer for the
+ * writer thread. Writes are performed in the order they were queued, so
+ * while the writer sends array k, the main thread can encode arrays k+1,
+ * ..., k+N-1.
+ *
+ * Code that writes directly to the output stream must first use Locker
+ * to wait until all of the queued writes are done.
+ *
+ * This code is used by XDRStreamMarshaller and D4StreamMarshaller.
  */
 class MarshallerThread {
 private:
     pthread_t d_thread;
-    pthread_attr_t d_thread_attr;
+    bool d_thread_started;
 
     pthread_mutex_t d_out_mutex;
-    pthread_cond_t d_out_cond;
+    pthread_cond_t d_out_cond;  // signaled by the writer when a write completes
+    pthread_cond_t d_work_cond; // signaled by the main thread when a write is queued
+
+    int d_child_thread_count;   // number of writes queued or in progress
+    std::string d_thread_error; // non-empty indicates an error
+    bool d_shutdown;
 
-    int d_child_thread_count;   // 0 or 1
-    std::string d_thread_error; // non-null indicates an error
+    /**
+     * One of the reusable buffers in the ring. The buffer is grown as
+     * needed by get_buffer(); buffers larger than the retention limit
+     * are freed once they have been written.
+     */
+    struct write_buffer {
+        char *d_buf;
+        int64_t d_size;
 
-#if 0
-    static bool print_time; // false by default
-#endif
+        write_buffer() : d_buf(0), d_size(0) { }
+    };
 
     /**
-     * Used to pass information into the static methods that run the
-     * simple stream writer threads. This can pass both an ostream or
-     * a file descriptor. If a fd is passed, the ostream reference is
-     * set to stderr (i.e., std::cerr).
+     * A queued write of data in one of the ring's buffers. This can hold
+     * both an ostream or a file descriptor. If a fd is used, the ostream
+     * pointer is null.
      */
-    struct write_args {
-        pthread_mutex_t &d_mutex;
-        pthread_cond_t &d_cond;
-        int &d_count;
-        std::string &d_error;
-        std::ostream &d_out;     // The output stream protected by the mutex, ...
-        int d_out_file;       // file descriptor; if not -1, use this.
-        char *d_buf;        // The data to write to the stream
-        int d_num;          // The size of d_buf
-
-        /**
-         * Build args for an ostream. The file descriptor is set to -1
-         */
-        write_args(pthread_mutex_t &m, pthread_cond_t &c, int &count, std::string &e, std::ostream &s, char *vals, int num) :
-            d_mutex(m), d_cond(c), d_count(count), d_error(e), d_out(s), d_out_file(-1), d_buf(vals), d_num(num)
+    struct write_job {
+        std::ostream *d_out;    // The output stream protected by the mutex, ...
+        int d_out_file;         // file descriptor; if not -1, use this.
+        const char *d_data;     // The data to write
+        int64_t d_num;          // The number of bytes to write
+
+        write_job(std::ostream *out, int fd, const char *data, int64_t num) :
+            d_out(out), d_out_file(fd), d_data(data), d_num(num)
         {
         }
+    };
 
-        /**
-         * Build args for a file descriptr. The ostream is set to cerr (because it is
-         * a reference and has to be initialized to something).
-         */
-        write_args(pthread_mutex_t &m, pthread_cond_t &c, int &count, std::string &e, int fd, char *vals, int num) :
-            d_mutex(m), d_cond(c), d_count(count), d_error(e), d_out(std::cerr), d_out_file(fd), d_buf(vals), d_num(num)
-        {
-        }
-   };
+    std::vector<write_buffer> d_buffers;
+    unsigned int d_next_buffer;     // index of the buffer get_buffer() returns next
+    unsigned int d_buffers_in_use;  // handed out and not yet written
+    int64_t d_max_retained_size;
+
+    std::deque<write_job> d_jobs;
+
+    MarshallerThread(const MarshallerThread &rhs);
+    MarshallerThread &operator=(const MarshallerThread &rhs);
+
+    void m_start_thread();
+    void m_queue(const write_job &job);
+    void m_release_oldest_buffer();
+    void m_release_newest_buffer();
+    void m_write_loop();
+
+    static bool m_write(const write_job &job, std::string &error);
+
+    // This is static so it will have c-linkage - required because it
+    // is passed to pthread_create()
+    static void *writer_thread(void *arg);
 
 public:
-    MarshallerThread();
+    MarshallerThread(unsigned int num_buffers = 4, int64_t max_retained_size = 16 * 1024 * 1024);
     virtual ~MarshallerThread();
 
     pthread_mutex_t &get_mutex() { return d_out_mutex; }
     pthread_cond_t &get_cond() { return d_out_cond; }
 
+    /// The number of writes queued or in progress; zero means d_out is idle
     int &get_child_thread_count() { return d_child_thread_count; }
-    void increment_child_thread_count() { ++d_child_thread_count; }
 
-    void start_thread(void* (*thread)(void *arg), std::ostream &out, char *byte_buf, unsigned int bytes_written);
-    void start_thread(void* (*thread)(void *arg), int fd, char *byte_buf, unsigned int bytes_written);
+    unsigned int get_num_buffers() const { return d_buffers.size(); }
 
-    // These are static so they will have c-linkage - required because they
-    // are passed to pthread_create()
-    static void *write_thread(void *arg);
-    static void *write_thread_part(void *arg);
+    char *get_buffer(int64_t size);
+    void release_buffer(char *buf);
 
-#if 0
-    static void set_print_time(bool state) { print_time = state; }
-    static bool get_print_time() { return print_time; }
-#endif
+    void write(std::ostream &out, char *buf, int64_t bytes, int64_t offset = 0);
+    void write(int fd, char *buf, int64_t bytes, int64_t offset = 0);
 
+    void wait_for_writes();
 };
 
 }
@@ -35,7 +35,10 @@
 #ifndef _operators_h
 #define _operators_h
 
+#include <limits>
+
 #include "GNURegex.h"  // GNU Regex class used for string =~ op.
+#include "dods-datatypes.h"
 #include "ce_expr.tab.hh"
 
 namespace libdap {
@@ -178,6 +181,115 @@ bool StrCmp(int op, T1 v1, T2 v2)
     }
 }
 
+/** The comparison used by the ops() methods of Byte, ..., Float64 for a
+ value of type T1 and one of type T2: SUCmp or USCmp when only one of the
+ two is unsigned, otherwise Cmp. A Float32 and a Float64 are compared as
+ floats; see Float64::d4_ops().
+
+ This lets the comparison for a pair of types be chosen when a template is
+ compiled, e.g. by the vector_cmp() kernels.
+
+ @see Cmp
+ @see USCmp
+ @see SUCmp */
+template<class T1, class T2, bool U1 = !std::numeric_limits<T1>::is_signed,
+    bool U2 = !std::numeric_limits<T2>::is_signed>
+struct NumCmp {
+    static bool cmp(int op, T1 v1, T2 v2) { return Cmp<T1, T2>(op, v1, v2); }
+};
+
+template<class T1, class T2>
+struct NumCmp<T1, T2, true, false> {
+    static bool cmp(int op, T1 v1, T2 v2) { return USCmp<T1, T2>(op, v1, v2); }
+};
+
+template<class T1, class T2>
+struct NumCmp<T1, T2, false, true> {
+    static bool cmp(int op, T1 v1, T2 v2) { return SUCmp<T1, T2>(op, v1, v2); }
+};
+
+template<>
+struct NumCmp<dods_float32, dods_float64, false, false> {
+    static bool cmp(int op, dods_float32 v1, dods_float64 v2) { return Cmp<dods_float32, dods_float32>(op, v1, (float)v2); }
+};
+
+template<>
+struct NumCmp<dods_float64, dods_float32, false, false> {
+    static bool cmp(int op, dods_float64 v1, dods_float32 v2) { return Cmp<dods_float32, dods_float32>(op, (float)v1, v2); }
+};
+
+// The operator is a template parameter so that the switch in Cmp() is
+// resolved when these are compiled, leaving loops the compiler can
+// vectorize.
+template<int op, class T1, class T2>
+void vector_op_constant(const T1 *values, T2 c, int64_t n, unsigned char *mask)
+{
+    for (int64_t i = 0; i < n; ++i)
+        mask[i] &= NumCmp<T1, T2>::cmp(op, values[i], c);
+}
+
+template<int op, class T1, class T2>
+void constant_op_vector(T1 c, const T2 *values, int64_t n, unsigned char *mask)
+{
+    for (int64_t i = 0; i < n; ++i)
+        mask[i] &= NumCmp<T1, T2>::cmp(op, c, values[i]);
+}
+
+#define VECTOR_CMP_OP(op, kernel) \
+    case op: \
+        kernel<op>(v1, v2, n, mask); \
+        return true
+
+/** Compare each of \c n numbers with a constant, using the comparison
+ ops() uses for their types (NumCmp). Where <tt>values[i] op c</tt> is
+ false, \c mask[i] is cleared; the other entries of \c mask are not
+ changed, so the results of several comparisons can be combined by
+ passing the same mask. Set every entry to one first to get the result of
+ a single comparison.
+
+ @param op The relational operator (SCAN_EQUAL, ..., SCAN_LESS_EQL)
+ @param v1 The numbers
+ @param v2 The constant
+ @param n The number of values
+ @param mask One entry for each value
+ @return False, and \c mask is not changed, if \c op is not a relational
+ operator for numbers (e.g., SCAN_REGEXP). */
+template<class T1, class T2>
+bool vector_cmp(int op, const T1 *v1, T2 v2, int64_t n, unsigned char *mask)
+{
+    switch (op) {
+        VECTOR_CMP_OP(SCAN_EQUAL, vector_op_constant);
+        VECTOR_CMP_OP(SCAN_NOT_EQUAL, vector_op_constant);
+        VECTOR_CMP_OP(SCAN_GREATER, vector_op_constant);
+        VECTOR_CMP_OP(SCAN_GREATER_EQL, vector_op_constant);
+        VECTOR_CMP_OP(SCAN_LESS, vector_op_constant);
+        VECTOR_CMP_OP(SCAN_LESS_EQL, vector_op_constant);
+        default:
+            return false;
+    }
+}
+
+/** As vector_cmp(), but the constant is the left-hand operand: where
+ <tt>c op values[i]</tt> is false, \c mask[i] is cleared.
+
+ @see vector_cmp */
+template<class T1, class T2>
+bool constant_vector_cmp(int op, T1 v1, const T2 *v2, int64_t n, unsigned char *mask)
+{
+    switch (op) {
+        VECTOR_CMP_OP(SCAN_EQUAL, constant_op_vector);
+        VECTOR_CMP_OP(SCAN_NOT_EQUAL, constant_op_vector);
+        VECTOR_CMP_OP(SCAN_GREATER, constant_op_vector);
+        VECTOR_CMP_OP(SCAN_GREATER_EQL, constant_op_vector);
+        VECTOR_CMP_OP(SCAN_LESS, constant_op_vector);
+        VECTOR_CMP_OP(SCAN_LESS_EQL, constant_op_vector);
+        default:
+            return false;
+    }
+}
+
+#undef VECTOR_CMP_OP
+
 } // namespace libdap
 
 #endif // _operators_h
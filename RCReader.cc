@@ -99,9 +99,15 @@ bool RCReader::write_rc_file(const string &pathname)
         fpo << "CACHE_ROOT=" << d_cache_root << endl;
         fpo << "DEFAULT_EXPIRES=" << _dods_default_expires << endl;
         fpo << "ALWAYS_VALIDATE=" << _dods_always_validate << endl;
+        fpo << "# Can several processes use the cache at the same time?" << endl;
+        fpo << "# 1 (yes) or 0 (no)." << endl;
+        fpo << "SHARED_CACHE=" << d_shared_cache << endl;
         fpo << "# Request servers compress responses if possible?" << endl;
         fpo << "# 1 (yes) or 0 (false)." << endl;
         fpo << "DEFLATE=" << _dods_deflate << endl;
+        fpo << "# Responses up to this size (in kilobytes) are read into" << endl;
+        fpo << "# memory; larger ones are written to a temporary file." << endl;
+        fpo << "MAX_MEMORY_RESPONSE=" << d_max_memory_response << endl;
 
         fpo << "# Should SSL certificates and hosts be validated? SSL" << endl;
         fpo << "# will only work with signed certificates." << endl;
@@ -188,6 +194,12 @@ bool RCReader::read_rc_file(const string &pathname)
             else if ((strncmp(&tempstr[0], "ALWAYS_VALIDATE", 15) == 0) && tokenlength == 15) {
                 _dods_always_validate = atoi(value);
             }
+            else if ((strncmp(&tempstr[0], "SHARED_CACHE", 12) == 0) && tokenlength == 12) {
+                d_shared_cache = atoi(value) ? true : false;
+            }
+            else if ((strncmp(&tempstr[0], "MAX_MEMORY_RESPONSE", 19) == 0) && tokenlength == 19) {
+                d_max_memory_response = atoi(value);
+            }
             else if ((strncmp(&tempstr[0], "VALIDATE_SSL", 12) == 0) && tokenlength == 12) {
                 d_validate_ssl = atoi(value);
             }
@@ -363,6 +375,8 @@ RCReader::RCReader() // throw (Error) jhrg 7/2/15
     _dods_ign_expires = 0;
     _dods_default_expires = 86400;
     _dods_always_validate = 0;
+    d_shared_cache = false;
+    d_max_memory_response = 256;
 
     _dods_deflate = 0;
     d_validate_ssl = 1;
@@ -78,6 +78,8 @@ private:
 
     int _dods_default_expires; // 24 hours in seconds
     int _dods_always_validate; // Let libwww decide by default so set to 0
+    bool d_shared_cache; // 1- other processes may use the cache, 0- they may not
+    int d_max_memory_response; // Largest response body held in memory, in KB
 
     // flags for PROXY_SERVER=<protocol>,<host url>
     string d_dods_proxy_server_protocol;
@@ -162,6 +164,14 @@ public:
     {
         return _dods_always_validate;
     }
+    bool get_shared_cache() const throw()
+    {
+        return d_shared_cache;
+    }
+    int get_max_memory_response() const throw()
+    {
+        return d_max_memory_response;
+    }
     int get_validate_ssl() const throw()
     {
         return d_validate_ssl;
@@ -287,6 +297,14 @@ public:
     {
         _dods_always_validate = i;
     }
+    void set_shared_cache(bool b) throw()
+    {
+        d_shared_cache = b;
+    }
+    void set_max_memory_response(int i) throw()
+    {
+        d_max_memory_response = i;
+    }
     void set_validate_ssl(int i) throw()
     {
         d_validate_ssl = i;
@@ -50,6 +50,8 @@ private:
     btp_func d_func;  // pointer to a function returning BaseType *
     std::vector<rvalue *> *d_args;  // arguments to the function
 
+    friend class ConstraintPlan;
+
 public:
     typedef std::vector<rvalue *>::iterator Args_iter ;
     typedef std::vector<rvalue *>::const_iterator Args_citer ;
@@ -55,7 +55,7 @@ class Response
 private:
     /// The data stream
     FILE *d_stream;
-    std::fstream *d_cpp_stream;
+    std::istream *d_cpp_stream;
 
     /// Response object type
     ObjectType d_type;
@@ -96,8 +96,9 @@ public:
     {
         if (d_stream)
             fclose(d_stream);
-        if (d_cpp_stream)
-        	d_cpp_stream->close();
+        std::fstream *fs = dynamic_cast<std::fstream*>(d_cpp_stream);
+        if (fs)
+        	fs->close();
     }
 
     /** @name getters */
@@ -116,7 +117,7 @@ public:
     virtual void set_status(int s) { d_status = s; }
 
     virtual void set_stream(FILE *s) { d_stream = s; }
-    virtual void set_cpp_stream(std::istream *s) { d_cpp_stream = dynamic_cast<std::fstream*>(s); }
+    virtual void set_cpp_stream(std::istream *s) { d_cpp_stream = s; }
 
     virtual void set_type(ObjectType o) { d_type = o; }
     virtual void set_version(const std::string &v) { d_version = v; }
@@ -263,6 +263,14 @@ UInt16::ops(BaseType *b, int op)
         throw InternalErr(__FILE__, __LINE__, "This value was not read!");
     }
 
+    return d4_ops(b, op);
+}
+
+/**
+ * @see BaseType::d4_ops(BaseType *, int)
+ */
+bool UInt16::d4_ops(BaseType *b, int op)
+{
     switch (b->type()) {
         case dods_int8_c:
             return USCmp<dods_uint16, dods_int8>(op, d_buf, static_cast<Int8*>(b)->value());
@@ -55,8 +55,19 @@
 
 #include "D4StreamMarshaller.h"
 #include "D4StreamUnMarshaller.h"
+#include "vector_filter.h"
 
 #include "D4Enum.h"
+#include "Byte.h"
+#include "Int8.h"
+#include "Int16.h"
+#include "UInt16.h"
+#include "Int32.h"
+#include "UInt32.h"
+#include "Int64.h"
+#include "UInt64.h"
+#include "Float32.h"
+#include "Float64.h"
 
 #include "Type.h"
 #include "dods-datatypes.h"
@@ -64,6 +75,7 @@
 #include "util.h"
 #include "debug.h"
 #include "InternalErr.h"
+#include "Operators.h"
 
 #undef CLEAR_LOCAL_DATA
 
@@ -72,6 +84,9 @@ using std::endl;
 
 namespace libdap {
 
+// Arrays bigger than this are sent in blocks if read_block() is implemented
+static const int64_t default_block_size = 16 * 1024 * 1024;
+
 void Vector::m_duplicate(const Vector & v)
 {
     d_length = v.d_length;
@@ -115,6 +130,7 @@ void Vector::m_duplicate(const Vector & v)
         val2buf(v.d_buf); // store v's value in this's _BUF.
 
     d_capacity = v.d_capacity;
+    d_block_size = v.d_block_size;
 }
 
 /**
@@ -247,7 +263,8 @@ void Vector::m_set_cardinal_values_internal(const CardType* fromArray, int numEl
  @see Type
  @brief The Vector constructor.  */
 Vector::Vector(const string & n, BaseType * v, const Type & t, bool is_dap4 /* default:false */) :
-    BaseType(n, t, is_dap4), d_length(-1), d_proto(0), d_buf(0), d_compound_buf(0), d_capacity(0)
+    BaseType(n, t, is_dap4), d_length(-1), d_proto(0), d_buf(0), d_compound_buf(0), d_capacity(0),
+    d_block_size(default_block_size)
 {
     if (v)
         add_var(v);
@@ -276,7 +293,8 @@ Vector::Vector(const string & n, BaseType * v, const Type & t, bool is_dap4 /* d
  @see Type
  @brief The Vector constructor.  */
 Vector::Vector(const string & n, const string &d, BaseType * v, const Type & t, bool is_dap4 /* default:false */) :
-    BaseType(n, d, t, is_dap4), d_length(-1), d_proto(0), d_buf(0), d_compound_buf(0), d_capacity(0)
+    BaseType(n, d, t, is_dap4), d_length(-1), d_proto(0), d_buf(0), d_compound_buf(0), d_capacity(0),
+    d_block_size(default_block_size)
 {
     if (v)
         add_var(v);
@@ -958,9 +976,148 @@ void Vector::intern_data(/*Crc32 &checksum, DMR &dmr, ConstraintEvaluator &eval*
     }
 }
 
+/**
+ * Write 'num' values of a cardinal type, stored in 'buf', using the put_vector
+ * method of the marshaller that matches the element type.
+ */
+static void put_cardinal_values(D4StreamMarshaller &m, BaseType *proto, char *buf, int64_t num)
+{
+    switch (proto->type()) {
+        case dods_byte_c:
+        case dods_char_c:
+        case dods_int8_c:
+        case dods_uint8_c:
+            m.put_vector(buf, num);
+            break;
+
+        case dods_int16_c:
+        case dods_uint16_c:
+        case dods_int32_c:
+        case dods_uint32_c:
+        case dods_int64_c:
+        case dods_uint64_c:
+        	m.put_vector(buf, num, proto->width());
+        	break;
+
+        case dods_enum_c:
+        	if (proto->width() == 1)
+        		m.put_vector(buf, num);
+        	else
+        		m.put_vector(buf, num, proto->width());
+        	break;
+
+        case dods_float32_c:
+            m.put_vector_float32(buf, num);
+            break;
+
+        case dods_float64_c:
+            m.put_vector_float64(buf, num);
+            break;
+
+        default:
+            throw InternalErr(__FILE__, __LINE__, "Not a cardinal type.");
+    }
+}
+
+/**
+ * @brief Read part of the vector's values
+ *
+ * Handlers that serve very large arrays should specialize this method so
+ * that a DAP4 data response can be built without holding the whole array
+ * in memory. When a vector of a cardinal type has not been read and its
+ * values take more than get_block_size() bytes, serialize() calls this
+ * repeatedly, in order, to read consecutive blocks of the constrained
+ * values. Each block is checksummed and queued for output before the next
+ * one is read.
+ *
+ * The values are numbered in row-major order, after the constraint is
+ * applied. For an Array, each block starts and ends on a boundary of the
+ * largest set of trailing dimensions that fits in the block size, so it can
+ * be read as a few hyperslabs (often one).
+ *
+ * The default version returns false, which makes serialize() fall back to
+ * read().
+ *
+ * @param buf Store the values here, in the byte order of this host; there
+ * is room for num * prototype()->width() bytes.
+ * @param start The index of the first value in the block.
+ * @param num The number of values to read.
+ * @return True if the values were read, false if this method is not
+ * implemented. If some other problem is found, throw Error.
+ */
+bool Vector::read_block(char */*buf*/, int64_t /*start*/, int64_t /*num*/)
+{
+    return false;
+}
+
+/**
+ * How many values to ask read_block() for at once. Specialized by Array so
+ * that blocks fall on 'row' boundaries.
+ *
+ * @param max_elements The most values that fit in the block size.
+ * @return The number of values to read per block, at least one.
+ */
+int64_t Vector::m_block_length(int64_t max_elements)
+{
+    return max_elements;
+}
+
+/**
+ * Serialize the values using read_block(), so that no more than one
+ * block is held in memory at once.
+ *
+ * @return False if the values should be read all at once instead, either
+ * because they are small, not of a cardinal type or read_block() is not
+ * implemented. Vector filters work on whole vectors, so they also turn
+ * this off.
+ */
+bool Vector::m_serialize_blocks(D4StreamMarshaller &m)
+{
+    if (d_block_size <= 0 || !m_is_cardinal_type() || m.get_vector_filter() != vector_filter_none)
+        return false;
+
+    int64_t num = length();
+    int64_t width = d_proto->width();
+    if (num * width <= d_block_size)
+        return false;
+
+    int64_t block = m_block_length(std::max(d_block_size / width, (int64_t)1));
+
+    // The marshaller copies the values, so the block can be refilled as soon
+    // as it has been passed on
+    vector<char> values(block * width);
+    char *buf = &values[0];
+
+    for (int64_t start = 0; start < num; start += block) {
+        int64_t count = std::min(block, num - start);
+
+        if (!read_block(buf, start, count)) {
+            if (start == 0)
+                return false;
+
+            throw InternalErr(__FILE__, __LINE__, "Could not read a block of values for '" + name() + "'.");
+        }
+
+        put_cardinal_values(m, d_proto, buf, count);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Serialize a Vector
+ *
+ * If the Vector holds a large number of values of a cardinal type and has
+ * not been read, and the handler implements read_block(), the values are
+ * read and sent in blocks of no more than get_block_size() bytes.
+ * Otherwise read() is called and the values are sent all at once.
+ */
 void
 Vector::serialize(D4StreamMarshaller &m, DMR &dmr, /*ConstraintEvaluator &eval,*/ bool filter /*= false*/)
 {
+    if (!read_p() && m_serialize_blocks(m))
+        return;
+
     if (!read_p())
         read(); // read() throws Error and InternalErr
 #if 0
@@ -980,31 +1137,16 @@ Vector::serialize(D4StreamMarshaller &m, DMR &dmr, /*ConstraintEvaluator &eval,*
         case dods_char_c:
         case dods_int8_c:
         case dods_uint8_c:
-            m.put_vector(d_buf, num);
-            break;
-
         case dods_int16_c:
         case dods_uint16_c:
         case dods_int32_c:
         case dods_uint32_c:
         case dods_int64_c:
         case dods_uint64_c:
-        	m.put_vector(d_buf, num, d_proto->width());
-        	break;
-
         case dods_enum_c:
-        	if (d_proto->width() == 1)
-        		m.put_vector(d_buf, num);
-        	else
-        		m.put_vector(d_buf, num, d_proto->width());
-        	break;
-
         case dods_float32_c:
-            m.put_vector_float32(d_buf, num);
-            break;
-
         case dods_float64_c:
-            m.put_vector_float64(d_buf, num);
+            put_cardinal_values(m, d_proto, d_buf, num);
             break;
 
         case dods_str_c:
@@ -1934,6 +2076,121 @@ void *Vector::value()
 
     return buffer;
 }
+
+// Compare the n values of type t in buf with c; false if op does not
+// apply to numbers
+template<typename C>
+static bool element_cmp(Type t, const char *buf, int64_t n, int op, C c, unsigned char *mask)
+{
+    switch (t) {
+    case dods_byte_c:
+    case dods_char_c:
+    case dods_uint8_c:
+        return vector_cmp(op, reinterpret_cast<const dods_byte*>(buf), c, n, mask);
+    case dods_int8_c:
+        return vector_cmp(op, reinterpret_cast<const dods_int8*>(buf), c, n, mask);
+    case dods_int16_c:
+        return vector_cmp(op, reinterpret_cast<const dods_int16*>(buf), c, n, mask);
+    case dods_uint16_c:
+        return vector_cmp(op, reinterpret_cast<const dods_uint16*>(buf), c, n, mask);
+    case dods_int32_c:
+        return vector_cmp(op, reinterpret_cast<const dods_int32*>(buf), c, n, mask);
+    case dods_uint32_c:
+        return vector_cmp(op, reinterpret_cast<const dods_uint32*>(buf), c, n, mask);
+    case dods_int64_c:
+        return vector_cmp(op, reinterpret_cast<const dods_int64*>(buf), c, n, mask);
+    case dods_uint64_c:
+        return vector_cmp(op, reinterpret_cast<const dods_uint64*>(buf), c, n, mask);
+    case dods_float32_c:
+        return vector_cmp(op, reinterpret_cast<const dods_float32*>(buf), c, n, mask);
+    case dods_float64_c:
+        return vector_cmp(op, reinterpret_cast<const dods_float64*>(buf), c, n, mask);
+    default:
+        throw Error(malformed_expr, "Relational operators can only compare the elements of an array of numbers.");
+    }
+}
+
+/**
+ * @brief Compare each element of a vector of numbers with a value
+ *
+ * This is ops() for every element at once: for each element, find whether
+ * <tt>element op b</tt> is true, using the comparison ops() uses for the
+ * element's type and b's type. The elements are compared in place, without
+ * building a BaseType for each one. A DAP2 selection uses this when the
+ * first operand of a relational clause is an array; server functions can
+ * use it to select the elements of an array.
+ *
+ * @param b A scalar number, the second operand
+ * @param op The relational operator (SCAN_EQUAL, ..., SCAN_LESS_EQL)
+ * @param mask Set to one entry for each element; non-zero where the
+ * relation is true.
+ * @return True if the relation is true for any element.
+ * @exception Error if the vector does not hold numbers, \c b is not a
+ * scalar number or \c op is not a relational operator for numbers.
+ */
+bool Vector::element_ops(BaseType *b, int op, vector<unsigned char> &mask)
+{
+    if (!read_p() && !read())
+        throw InternalErr(__FILE__, __LINE__, "This value was not read!");
+
+    if (!b || !(b->read_p() || b->read()))
+        throw InternalErr(__FILE__, __LINE__, "This value was not read!");
+
+    int64_t n = length() > 0 ? length() : 0;
+    mask.assign(n, 1);
+
+    Type t = d_proto ? d_proto->type() : dods_null_c;
+    unsigned char *m = n ? &mask[0] : 0;
+
+    // Signed and unsigned integers are compared as 64-bit values; this does
+    // not change the result of any comparison. Float32 is kept because a
+    // Float64 is compared with it as a float.
+    bool cmp;
+    switch (b->type()) {
+    case dods_byte_c:
+    case dods_char_c:
+    case dods_uint8_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_uint64) static_cast<Byte*>(b)->value(), m);
+        break;
+    case dods_int8_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_int64) static_cast<Int8*>(b)->value(), m);
+        break;
+    case dods_int16_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_int64) static_cast<Int16*>(b)->value(), m);
+        break;
+    case dods_uint16_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_uint64) static_cast<UInt16*>(b)->value(), m);
+        break;
+    case dods_int32_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_int64) static_cast<Int32*>(b)->value(), m);
+        break;
+    case dods_uint32_c:
+        cmp = element_cmp(t, d_buf, n, op, (dods_uint64) static_cast<UInt32*>(b)->value(), m);
+        break;
+    case dods_int64_c:
+        cmp = element_cmp(t, d_buf, n, op, static_cast<Int64*>(b)->value(), m);
+        break;
+    case dods_uint64_c:
+        cmp = element_cmp(t, d_buf, n, op, static_cast<UInt64*>(b)->value(), m);
+        break;
+    case dods_float32_c:
+        cmp = element_cmp(t, d_buf, n, op, static_cast<Float32*>(b)->value(), m);
+        break;
+    case dods_float64_c:
+        cmp = element_cmp(t, d_buf, n, op, static_cast<Float64*>(b)->value(), m);
+        break;
+    default:
+        throw Error(malformed_expr, "The elements of an array can only be compared with a number.");
+    }
+
+    if (!cmp) {
+        if (op == SCAN_REGEXP)
+            throw Error(malformed_expr, "Regular expressions are supported for strings only.");
+        throw Error(malformed_expr, "Unrecognized operator.");
+    }
+
+    return find(mask.begin(), mask.end(), 1) != mask.end();
+}
 //@}
 
 /** @brief Add the BaseType pointer to this constructor type
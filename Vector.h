@@ -93,8 +93,14 @@ private:
     // or the capacity of d_str for strings or capacity of _vec.
     unsigned int d_capacity;
 
+    // The largest block, in bytes, read_block() is asked for when a DAP4
+    // response is built. Zero means always read() the whole vector.
+    int64_t d_block_size;
+
     friend class MarshallerTest;
 
+    bool m_serialize_blocks(D4StreamMarshaller &m);
+
     /*
      * Made these template methods private because they can't be
      * overridden anyways (because c++...) - ndp 08/14/2015
@@ -117,6 +123,8 @@ protected:
 
     template <class CardType> void m_set_cardinal_values_internal(const CardType* fromArray, int numElts);
 
+    virtual int64_t m_block_length(int64_t max_elements);
+
 public:
     Vector(const string &n, BaseType *v, const Type &t, bool is_dap4 = false);
     Vector(const string &n, const string &d, BaseType *v, const Type &t, bool is_dap4 = false);
@@ -197,6 +205,13 @@ public:
 #endif
     virtual void deserialize(D4StreamUnMarshaller &um, DMR &dmr);
 
+    virtual bool read_block(char *buf, int64_t start, int64_t num);
+
+    /// Set the largest block read_block() will be asked to read, in bytes.
+    virtual void set_block_size(int64_t bytes) { d_block_size = bytes; }
+    /// @see set_block_size()
+    virtual int64_t get_block_size() const { return d_block_size; }
+
     virtual unsigned int val2buf(void *val, bool reuse = false);
     virtual unsigned int buf2val(void **val);
 
@@ -263,6 +278,8 @@ public:
     virtual void value(vector<unsigned int> *indices, dods_float64 *b) const;
     virtual void value(vector<unsigned int> *index, vector<string> &b) const;
 
+    virtual bool element_ops(BaseType *b, int op, vector<unsigned char> &mask);
+
     virtual void *value();
 
     virtual BaseType *var(const string &name = "", bool exact_match = true, btp_stack *s = 0);
@@ -400,10 +400,15 @@ void XDRStreamMarshaller::put_vector(char *val, int num, Vector &)
 
     // this is the word boundary for writing xdr bytes in a vector.
     const unsigned int add_to = 8;
-    // switch to memory on the heap since the thread will need to access it
-    // after this code returns.
+#ifdef USE_POSIX_THREADS
+    // use one of the writer's buffers since the thread will need to access
+    // it after this code returns.
+    char *byte_buf = tm->get_buffer(num + add_to);
+#else
     char *byte_buf = new char[num + add_to];
+#endif
     XDR byte_sink;
+    unsigned int bytes_written;
     try {
         xdrmem_create(&byte_sink, byte_buf, num + add_to, XDR_ENCODE);
         if (!xdr_setpos(&byte_sink, 0))
@@ -412,28 +417,28 @@ void XDRStreamMarshaller::put_vector(char *val, int num, Vector &)
         if (!xdr_bytes(&byte_sink, (char **) &val, (unsigned int *) &num, num + add_to))
             throw Error("Network I/O Error(2). Could not send byte vector data - unable to encode data.");
 
-        unsigned int bytes_written = xdr_getpos(&byte_sink);
+        bytes_written = xdr_getpos(&byte_sink);
         if (!bytes_written)
             throw Error("Network I/O Error. Could not send byte vector data - unable to get stream position.");
-
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, byte_buf, bytes_written);
-        xdr_destroy(&byte_sink);
-#else
-        d_out.write(byte_buf, bytes_written);
-        xdr_destroy(&byte_sink);
-        delete [] byte_buf;
-#endif
-
     }
     catch (...) {
         DBG(cerr << "Caught an exception in put_vector_thread" << endl);
         xdr_destroy(&byte_sink);
+#ifdef USE_POSIX_THREADS
+        tm->release_buffer(byte_buf);
+#else
         delete [] byte_buf;
+#endif
         throw;
     }
+
+    xdr_destroy(&byte_sink);
+#ifdef USE_POSIX_THREADS
+    tm->write(d_out, byte_buf, bytes_written);
+#else
+    d_out.write(byte_buf, bytes_written);
+    delete [] byte_buf;
+#endif
 }
 
 // private
@@ -465,9 +470,13 @@ void XDRStreamMarshaller::put_vector(char *val, unsigned int num, int width, Typ
     int size = (num * use_width) + 4;
 
     // allocate enough memory for the elements
-    //vector<char> vec_buf(size);
+#ifdef USE_POSIX_THREADS
+    char *vec_buf = tm->get_buffer(size);
+#else
     char *vec_buf = new char[size];
+#endif
     XDR vec_sink;
+    unsigned int bytes_written;
     try {
         xdrmem_create(&vec_sink, vec_buf, size, XDR_ENCODE);
 
@@ -480,26 +489,27 @@ void XDRStreamMarshaller::put_vector(char *val, unsigned int num, int width, Typ
             throw Error("Network I/O Error(2). Could not send vector data - unable to encode.");
 
         // how much was written to the buffer
-        unsigned int bytes_written = xdr_getpos(&vec_sink);
+        bytes_written = xdr_getpos(&vec_sink);
         if (!bytes_written)
             throw Error("Network I/O Error. Could not send vector data - unable to get stream position.");
-
-#ifdef USE_POSIX_THREADS
-        Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-        tm->increment_child_thread_count();
-        tm->start_thread(MarshallerThread::write_thread, d_out, vec_buf, bytes_written);
-        xdr_destroy(&vec_sink);
-#else
-        d_out.write(vec_buf, bytes_written);
-        xdr_destroy(&vec_sink);
-        delete [] vec_buf;
-#endif
     }
     catch (...) {
         xdr_destroy(&vec_sink);
+#ifdef USE_POSIX_THREADS
+        tm->release_buffer(vec_buf);
+#else
         delete [] vec_buf;
+#endif
         throw;
     }
+
+    xdr_destroy(&vec_sink);
+#ifdef USE_POSIX_THREADS
+    tm->write(d_out, vec_buf, bytes_written);
+#else
+    d_out.write(vec_buf, bytes_written);
+    delete [] vec_buf;
+#endif
 }
 
 /**
@@ -520,8 +530,11 @@ void XDRStreamMarshaller::put_vector_part(char *val, unsigned int num, int width
         // we will not send either of those.
         const unsigned int add_to = 8;
         unsigned int bufsiz = num + add_to;
-        //vector<char> byte_buf(bufsiz);
+#ifdef USE_POSIX_THREADS
+        char *byte_buf = tm->get_buffer(bufsiz);
+#else
         char *byte_buf = new char[bufsiz];
+#endif
         XDR byte_sink;
         try {
             xdrmem_create(&byte_sink, byte_buf, bufsiz, XDR_ENCODE);
@@ -530,37 +543,34 @@ void XDRStreamMarshaller::put_vector_part(char *val, unsigned int num, int width
 
             if (!xdr_bytes(&byte_sink, (char **) &val, (unsigned int *) &num, bufsiz))
                 throw Error("Network I/O Error(2). Could not send byte vector data - unable to encode data.");
-
+        }
+        catch (...) {
+            xdr_destroy(&byte_sink);
 #ifdef USE_POSIX_THREADS
-            Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-            tm->increment_child_thread_count();
+            tm->release_buffer(byte_buf);
+#else
+            delete [] byte_buf;
+#endif
+            throw;
+        }
 
-            // Increment the element count so we can figure out about the padding in put_vector_last()
-            d_partial_put_byte_count += num;
+        xdr_destroy(&byte_sink);
 
-            tm->start_thread(MarshallerThread::write_thread_part, d_out, byte_buf, num);
-            xdr_destroy(&byte_sink);
+        // Only send the num bytes that follow the 4 bytes of length info - we skip the
+        // length info because it's already been sent and we don't send any trailing padding
+        // bytes in this method (see put_vector_last() for that).
+#ifdef USE_POSIX_THREADS
+        tm->write(d_out, byte_buf, num, 4);
 #else
-            // Only send the num bytes that follow the 4 bytes of length info - we skip the
-            // length info because it's already been sent and we don't send any trailing padding
-            // bytes in this method (see put_vector_last() for that).
-            d_out.write(byte_buf + 4, num);
+        d_out.write(byte_buf + 4, num);
+        delete [] byte_buf;
 
-            if (d_out.fail())
+        if (d_out.fail())
             throw Error ("Network I/O Error. Could not send initial part of byte vector data");
-
-            // Now increment the element count so we can figure out about the padding in put_vector_last()
-            d_partial_put_byte_count += num;
-
-            xdr_destroy(&byte_sink);
-            delete [] byte_buf;
 #endif
-        }
-        catch (...) {
-            xdr_destroy(&byte_sink);
-            delete [] byte_buf;
-            throw;
-        }
+
+        // Now increment the element count so we can figure out about the padding in put_vector_last()
+        d_partial_put_byte_count += num;
     }
     else {
         int use_width = (width < 4) ? 4 : width;
@@ -570,8 +580,11 @@ void XDRStreamMarshaller::put_vector_part(char *val, unsigned int num, int width
         int size = (num * use_width) + 4;
 
         // allocate enough memory for the elements
-        //vector<char> vec_buf(size);
+#ifdef USE_POSIX_THREADS
+        char *vec_buf = tm->get_buffer(size);
+#else
         char *vec_buf = new char[size];
+#endif
         XDR vec_sink;
         try {
             xdrmem_create(&vec_sink, vec_buf, size, XDR_ENCODE);
@@ -583,35 +596,33 @@ void XDRStreamMarshaller::put_vector_part(char *val, unsigned int num, int width
             // write the array to the buffer
             if (!xdr_array(&vec_sink, (char **) &val, (unsigned int *) &num, size, width, XDRUtils::xdr_coder(type)))
                 throw Error("Network I/O Error(2). Could not send vector data -unable to encode data.");
-
-#ifdef USE_POSIX_THREADS
-            Locker lock(tm->get_mutex(), tm->get_cond(), tm->get_child_thread_count());
-            tm->increment_child_thread_count();
-
-            // Increment the element count so we can figure out about the padding in put_vector_last()
-            d_partial_put_byte_count += (size - 4);
-            tm->start_thread(MarshallerThread::write_thread_part, d_out, vec_buf, size - 4);
-            xdr_destroy(&vec_sink);
-#else
-            // write that much out to the output stream, skipping the length data that
-            // XDR writes since we have already written the length info using put_vector_start()
-            d_out.write(vec_buf + 4, size - 4);
-
-            if (d_out.fail())
-                throw Error ("Network I/O Error. Could not send part of vector data");
-
-            // Now increment the element count so we can figure out about the padding in put_vector_last()
-            d_partial_put_byte_count += (size - 4);
-
-            xdr_destroy(&vec_sink);
-            delete [] vec_buf;
-#endif
         }
         catch (...) {
             xdr_destroy(&vec_sink);
+#ifdef USE_POSIX_THREADS
+            tm->release_buffer(vec_buf);
+#else
             delete [] vec_buf;
+#endif
             throw;
         }
+
+        xdr_destroy(&vec_sink);
+
+        // write that much out to the output stream, skipping the length data that
+        // XDR writes since we have already written the length info using put_vector_start()
+#ifdef USE_POSIX_THREADS
+        tm->write(d_out, vec_buf, size - 4, 4);
+#else
+        d_out.write(vec_buf + 4, size - 4);
+        delete [] vec_buf;
+
+        if (d_out.fail())
+            throw Error ("Network I/O Error. Could not send part of vector data");
+#endif
+
+        // Now increment the element count so we can figure out about the padding in put_vector_last()
+        d_partial_put_byte_count += (size - 4);
     }
 }
 
@@ -93,9 +93,7 @@ using namespace libdap ;
 
 // #define YYPARSE_PARAM arg
 
-int ce_exprlex(void);		/* the scanner; see expr.lex */
-
-void ce_exprerror(ce_parser_arg *arg, const string &s); 
+void ce_exprerror(ce_parser_arg *arg, void *scanner, const string &s); 
 void ce_exprerror(ce_parser_arg *arg, const string &s, const string &s2);
 void no_such_func(ce_parser_arg *arg, const string &name);
 void no_such_ident(ce_parser_arg *arg, const string &name, const string &word);
@@ -130,13 +128,15 @@ template<class arg_list, class arg_type>
 arg_list make_fast_arg_list(arg_list int_values, arg_type arg_value);
 
 template<class t, class T>
-rvalue *build_constant_array(vector<t> *values, DDS *dds);
+rvalue *build_constant_array(vector<t> *values, ce_parser_arg *arg);
 
 }
 
-%require "2.4"
+%require "3.0"
 
+%define api.pure full
 %parse-param {ce_parser_arg *arg}
+%param {void *scanner}
 %name-prefix "ce_expr"
 %defines
 %debug
@@ -230,9 +230,8 @@ rvalue *build_constant_array(vector<t> *values, DDS *dds);
 %type <float64_values> fast_float64_arg_list
 
 %code {
-/* This global is used by the rule 'arg_length_hint' so that the hint can 
-   be used during the paraent rule's parse. See fast_int32_arg_list. */
-unsigned long arg_length_hint_value = 0;
+// The scanner is reentrant; see ce_expr.lex
+int ce_exprlex(YYSTYPE *lval, void *scanner);
 }
 
 %%
@@ -294,70 +293,73 @@ proj_clause: name
                 array->set_send_p(true);
                 DDS(arg)->add_var_nocopy(array);
                 
+                /* The parse cache cannot record new variables. */
+                EVALUATOR(arg)->set_cacheable(false);
+                
                 return true;
             }
             else {
-                ce_exprerror(arg, "Could not create the anonymous vector using the # special form");
+                ce_exprerror(arg, scanner, "Could not create the anonymous vector using the # special form");
                 return false;
             }
         }
 ;
 
-/* The value parsed by arg_length_hint is stored in a global variable by that rule
-   so that it can be used during the parse of fast_byte_arg_list. */
+/* The value parsed by arg_length_hint is stored in the parser's argument by that
+   rule so that it can be used during the parse of fast_byte_arg_list. */
 
 /* return a rvalue */
 array_const_special_form: SCAN_HASH_BYTE '(' arg_length_hint ':' fast_byte_arg_list ')'
         {
-            $$ = build_constant_array<dods_byte, Byte>($5, DDS(arg));
+            $$ = build_constant_array<dods_byte, Byte>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_INT16 '(' arg_length_hint ':' fast_int16_arg_list ')'
         {
-            $$ = build_constant_array<dods_int16, Int16>($5, DDS(arg));
+            $$ = build_constant_array<dods_int16, Int16>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_UINT16 '(' arg_length_hint ':' fast_uint16_arg_list ')'
         {
-            $$ = build_constant_array<dods_uint16, UInt16>($5, DDS(arg));
+            $$ = build_constant_array<dods_uint16, UInt16>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_INT32 '(' arg_length_hint ':' fast_int32_arg_list ')'
         {
-            $$ = build_constant_array<dods_int32, Int32>($5, DDS(arg));
+            $$ = build_constant_array<dods_int32, Int32>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_UINT32 '(' arg_length_hint ':' fast_uint32_arg_list ')'
         {
-            $$ = build_constant_array<dods_uint32, UInt32>($5, DDS(arg));
+            $$ = build_constant_array<dods_uint32, UInt32>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_FLOAT32 '(' arg_length_hint ':' fast_float32_arg_list ')'
         {
-            $$ = build_constant_array<dods_float32, Float32>($5, DDS(arg));
+            $$ = build_constant_array<dods_float32, Float32>($5, arg);
         }
 ;
 
 array_const_special_form: SCAN_HASH_FLOAT64 '(' arg_length_hint ':' fast_float64_arg_list ')'
         {
-            $$ = build_constant_array<dods_float64, Float64>($5, DDS(arg));
+            $$ = build_constant_array<dods_float64, Float64>($5, arg);
         }
 ;
 
-/* Here the arg length hint is stored in a global so it can be used by the 
-   function that allocates the vector. The value is passed to vector::reserve(). */
+/* Here the arg length hint is stored in the parser's argument so it can be used by
+   the function that allocates the vector. The value is passed to vector::reserve(). */
    
 arg_length_hint: SCAN_WORD
           {
               if (!check_int32($1))
                   throw Error(malformed_expr, "$<type>(hint, value, ...) special form expected hint to be an integer");
                    
-              arg_length_hint_value = atoi($1);
+              arg->set_arg_length_hint(atoi($1));
               $$ = true;
           }
 ;
@@ -365,7 +367,7 @@ arg_length_hint: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_byte_arg_list: fast_byte_arg
           {
-              $$ = make_fast_arg_list<byte_arg_list, dods_byte>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<byte_arg_list, dods_byte>(arg->get_arg_length_hint(), $1);
           }
           | fast_byte_arg_list ',' fast_byte_arg
           {
@@ -383,7 +385,7 @@ fast_byte_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_int16_arg_list: fast_int16_arg
           {
-              $$ = make_fast_arg_list<int16_arg_list, dods_int16>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<int16_arg_list, dods_int16>(arg->get_arg_length_hint(), $1);
           }
           | fast_int16_arg_list ',' fast_int16_arg
           {
@@ -401,7 +403,7 @@ fast_int16_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_uint16_arg_list: fast_uint16_arg
           {
-              $$ = make_fast_arg_list<uint16_arg_list, dods_uint16>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<uint16_arg_list, dods_uint16>(arg->get_arg_length_hint(), $1);
           }
           | fast_uint16_arg_list ',' fast_uint16_arg
           {
@@ -419,7 +421,7 @@ fast_uint16_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_int32_arg_list: fast_int32_arg
           {
-              $$ = make_fast_arg_list<int32_arg_list, dods_int32>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<int32_arg_list, dods_int32>(arg->get_arg_length_hint(), $1);
           }
           | fast_int32_arg_list ',' fast_int32_arg
           {
@@ -437,7 +439,7 @@ fast_int32_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_uint32_arg_list: fast_uint32_arg
           {
-              $$ = make_fast_arg_list<uint32_arg_list, dods_uint32>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<uint32_arg_list, dods_uint32>(arg->get_arg_length_hint(), $1);
           }
           | fast_uint32_arg_list ',' fast_uint32_arg
           {
@@ -455,7 +457,7 @@ fast_uint32_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_float32_arg_list: fast_float32_arg
           {
-              $$ = make_fast_arg_list<float32_arg_list, dods_float32>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<float32_arg_list, dods_float32>(arg->get_arg_length_hint(), $1);
           }
           | fast_float32_arg_list ',' fast_float32_arg
           {
@@ -473,7 +475,7 @@ fast_float32_arg: SCAN_WORD
 /* return an int_arg_list (a std::vector<int>*) */
 fast_float64_arg_list: fast_float64_arg
           {
-              $$ = make_fast_arg_list<float64_arg_list, dods_float64>(arg_length_hint_value, $1);
+              $$ = make_fast_arg_list<float64_arg_list, dods_float64>(arg->get_arg_length_hint(), $1);
           }
           | fast_float64_arg_list ',' fast_float64_arg
           {
@@ -499,6 +501,9 @@ proj_function:  SCAN_WORD '(' arg_list ')'
 			    $$ = true;
 		    }
 		    else if ((p_f = get_proj_function(*(EVALUATOR(arg)), $1))) { 
+		        /* Projection functions run now and can change the DDS in ways
+		           the parse cache cannot record. */
+		        EVALUATOR(arg)->set_cacheable(false);
 		        DDS &dds = dynamic_cast<DDS&>(*(DDS(arg)));
 			    BaseType **args = build_btp_args( $3, dds );
 			    (*p_f)(($3) ? $3->size():0, args, dds, *(EVALUATOR(arg)));
@@ -836,7 +841,7 @@ rel_op:		SCAN_EQUAL
 // jhrg.
 
 void
-ce_exprerror(ce_parser_arg *, const string &s)
+ce_exprerror(ce_parser_arg *, void *, const string &s)
 {
     string msg = "Constraint expression parse error: " +s;
     throw Error(malformed_expr, msg);
@@ -1359,7 +1364,7 @@ make_fast_arg_list(arg_type_list values, arg_type value)
 }
 
 template<class t, class T>
-rvalue *build_constant_array(vector<t> *values, DDS *dds)
+rvalue *build_constant_array(vector<t> *values, ce_parser_arg *arg)
 {
     //vector<t> *values = $5;
             
@@ -1374,11 +1379,10 @@ rvalue *build_constant_array(vector<t> *values, DDS *dds)
     delete values;
     array->set_read_p(true);
             
-    static unsigned long counter = 1;
     string name;
     do {
-        name = "g" + long_to_string(counter++);
-    } while (dds->var(name));
+        name = "g" + long_to_string(arg->next_array_number());
+    } while (DDS(arg)->var(name));
     array->set_name(name);
             
     return new rvalue(array);
@@ -5,14 +5,24 @@
 namespace libdap
 {
 
+/** Pass parameters to the constraint expression parser. This also holds the
+    parser's state, so a new one must be used for each expression parsed;
+    that way several expressions may be parsed at once by different
+    threads. */
 struct ce_parser_arg
 {
     ConstraintEvaluator *eval;
     DDS *dds;
 
-    ce_parser_arg() : eval(0), dds(0)
+    // The value of the last arg_length_hint, used by the rules that build
+    // the argument vectors of the $<type>(hint, value, ...) special form
+    unsigned long arg_length_hint;
+    // Used to name the arrays built for constant values
+    unsigned long array_counter;
+
+    ce_parser_arg() : eval(0), dds(0), arg_length_hint(0), array_counter(1)
     {}
-    ce_parser_arg(ConstraintEvaluator *e, DDS *d) : eval(e), dds(d)
+    ce_parser_arg(ConstraintEvaluator *e, DDS *d) : eval(e), dds(d), arg_length_hint(0), array_counter(1)
     {}
     virtual ~ce_parser_arg()
     {}
@@ -34,6 +44,21 @@ struct ce_parser_arg
     {
         dds = obj;
     }
+
+    unsigned long get_arg_length_hint()
+    {
+        return arg_length_hint;
+    }
+    void set_arg_length_hint(unsigned long hint)
+    {
+        arg_length_hint = hint;
+    }
+
+    /// Return a new number for a constant array; see build_constant_array()
+    unsigned long next_array_number()
+    {
+        return array_counter++;
+    }
 };
 
 } // namespace libdap
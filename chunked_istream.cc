@@ -33,11 +33,26 @@
 
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <algorithm>
+
+#ifdef USE_POSIX_THREADS
+#include <pthread.h>
+#endif
+
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#if HAVE_LIBZSTD
+#include <zstd.h>
+#endif
 
 #include "chunked_stream.h"
 #include "chunked_istream.h"
 
 #include "Error.h"
+#include "InternalErr.h"
 
 //#define DODS_DEBUG
 //#define DODS_DEBUG2
@@ -50,6 +65,315 @@
 
 namespace libdap {
 
+/**
+ * Uncompress 'num' bytes from 'data' using 'codec'.
+ *
+ * @param out Put the uncompressed data here
+ * @param size The number of bytes the data uncompress to
+ * @return True if the data uncompressed to exactly 'size' bytes, false
+ * if not or if the codec is not supported.
+ */
+static bool uncompress_chunk(uint32_t codec, const char *data, uint32_t num, char *out, uint32_t size)
+{
+	switch (codec) {
+#if HAVE_LIBZ
+	case CHUNK_DEFLATE: {
+		uLongf len = size;
+		return uncompress(reinterpret_cast<Bytef*>(out), &len, reinterpret_cast<const Bytef*>(data), num) == Z_OK
+			&& len == size;
+	}
+#endif
+#if HAVE_LIBZSTD
+	case CHUNK_ZSTD: {
+		size_t len = ZSTD_decompress(out, size, data, num);
+		return !ZSTD_isError(len) && len == size;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+#ifdef USE_POSIX_THREADS
+/**
+ * Read chunks from an input stream using a child thread. The thread reads
+ * whole chunks (header and body) and queues them; chunked_inbuf takes them
+ * from the front of the queue. At most 'max_chunks' are queued at a time.
+ * The thread stops after it reads an END or ERR chunk, at end of file or
+ * when the stream goes bad, leaving the stream positioned just past the
+ * last chunk it queued. Once it has stopped and the queue is empty,
+ * next_chunk() returns false and the caller can go back to reading the
+ * stream itself.
+ */
+class chunk_reader {
+private:
+    std::istream &d_is;
+    bool d_twiddle_bytes;   // only used when BYTE_ORDER_PREFIX is set
+
+    pthread_t d_thread;
+    pthread_mutex_t d_mutex;
+    pthread_cond_t d_cond;
+
+    struct chunk {
+        uint32_t d_header;          // as read from the stream
+        std::vector<char> d_body;
+    };
+
+    std::deque<chunk> d_chunks;
+    std::vector<std::vector<char> > d_spare;    // bodies returned for reuse
+    unsigned int d_max_chunks;
+    bool d_done;    // the thread has stopped reading
+    bool d_stop;    // the thread should stop before it reads the next chunk
+
+    chunk_reader(const chunk_reader &);
+    chunk_reader &operator=(const chunk_reader &);
+
+    void m_read_loop();
+
+    static void *reader_thread(void *arg)
+    {
+        static_cast<chunk_reader*>(arg)->m_read_loop();
+        return 0;
+    }
+
+public:
+    chunk_reader(std::istream &is, unsigned int max_chunks, bool twiddle_bytes);
+    ~chunk_reader();
+
+    bool next_chunk(uint32_t &header, std::vector<char> &body);
+    void stop();
+};
+
+chunk_reader::chunk_reader(std::istream &is, unsigned int max_chunks, bool twiddle_bytes) :
+    d_is(is), d_twiddle_bytes(twiddle_bytes), d_max_chunks(std::max(max_chunks, 1U)), d_done(false), d_stop(false)
+{
+    if (pthread_mutex_init(&d_mutex, 0) != 0) throw InternalErr(__FILE__, __LINE__, "Could not initialize mutex");
+    if (pthread_cond_init(&d_cond, 0) != 0) throw InternalErr(__FILE__, __LINE__, "Could not initialize cond");
+
+    if (pthread_create(&d_thread, 0, reader_thread, this) != 0) {
+        pthread_cond_destroy(&d_cond);
+        pthread_mutex_destroy(&d_mutex);
+        throw InternalErr(__FILE__, __LINE__, "Could not start read-ahead thread");
+    }
+}
+
+/**
+ * Stop the thread and wait for it to exit. If the thread is blocked reading
+ * the stream, this waits for that read to finish.
+ */
+chunk_reader::~chunk_reader()
+{
+    stop();
+    pthread_join(d_thread, 0);
+
+    pthread_cond_destroy(&d_cond);
+    pthread_mutex_destroy(&d_mutex);
+}
+
+/**
+ * Tell the thread to stop. The chunk it is reading (if any) is still
+ * queued, so nothing read from the stream is lost.
+ */
+void chunk_reader::stop()
+{
+    pthread_mutex_lock(&d_mutex);
+    d_stop = true;
+    pthread_cond_broadcast(&d_cond);
+    pthread_mutex_unlock(&d_mutex);
+}
+
+void chunk_reader::m_read_loop()
+{
+    std::vector<char> body;
+
+    try {
+        while (true) {
+            pthread_mutex_lock(&d_mutex);
+            while (d_chunks.size() >= d_max_chunks && !d_stop)
+                pthread_cond_wait(&d_cond, &d_mutex);
+            bool stop = d_stop;
+            if (!stop && !d_spare.empty()) {
+                body.swap(d_spare.back());
+                d_spare.pop_back();
+            }
+            pthread_mutex_unlock(&d_mutex);
+
+            if (stop) break;
+
+            uint32_t header;
+            d_is.read((char *) &header, 4);
+            if (!d_is.good()) break;
+
+            uint32_t h = header;
+#if BYTE_ORDER_PREFIX
+            if (d_twiddle_bytes) h = bswap_32(h);
+#endif
+            uint32_t chunk_size = h & CHUNK_SIZE_MASK;
+
+            body.resize(chunk_size);
+            if (chunk_size > 0) {
+                d_is.read(&body[0], chunk_size);
+                body.resize(d_is.gcount());
+            }
+
+            // Queue short chunks too; chunked_inbuf reports the error.
+            bool last = (h & CHUNK_TYPE_MASK) != CHUNK_DATA || body.size() != chunk_size || !d_is.good();
+
+            pthread_mutex_lock(&d_mutex);
+            d_chunks.push_back(chunk());
+            d_chunks.back().d_header = header;
+            d_chunks.back().d_body.swap(body);
+            pthread_cond_broadcast(&d_cond);
+            pthread_mutex_unlock(&d_mutex);
+
+            if (last) break;
+        }
+    }
+    catch (...) {
+        // Stop reading; chunked_inbuf will find the stream in an error state
+    }
+
+    pthread_mutex_lock(&d_mutex);
+    d_done = true;
+    pthread_cond_broadcast(&d_cond);
+    pthread_mutex_unlock(&d_mutex);
+}
+
+/**
+ * Get the next chunk, waiting for the thread to read it if needed.
+ *
+ * @param header Value-result parameter; the chunk header as read from the
+ * stream
+ * @param body Value-result parameter; the chunk's body. The vector passed
+ * in is reused by the thread.
+ * @return False if the thread has stopped and there are no more chunks.
+ */
+bool chunk_reader::next_chunk(uint32_t &header, std::vector<char> &body)
+{
+    pthread_mutex_lock(&d_mutex);
+    while (d_chunks.empty() && !d_done)
+        pthread_cond_wait(&d_cond, &d_mutex);
+
+    if (d_chunks.empty()) {
+        pthread_mutex_unlock(&d_mutex);
+        return false;
+    }
+
+    chunk &c = d_chunks.front();
+    header = c.d_header;
+    body.swap(c.d_body);
+    d_spare.push_back(std::vector<char>());
+    d_spare.back().swap(c.d_body);
+    d_chunks.pop_front();
+
+    pthread_cond_broadcast(&d_cond);
+    pthread_mutex_unlock(&d_mutex);
+
+    return true;
+}
+#endif
+
+chunked_inbuf::~chunked_inbuf()
+{
+#ifdef USE_POSIX_THREADS
+    delete d_reader;
+#endif
+    delete[] d_buffer;
+}
+
+/**
+ * @brief Read chunks ahead of the caller
+ * Start (or stop) a child thread that reads chunks from the underlying
+ * stream while the current chunk is being consumed. Turning read-ahead off
+ * does not lose any chunks already read; they are used before the
+ * underlying stream is read again. Does nothing if libdap was built
+ * without pthreads.
+ *
+ * @param state True to turn read-ahead on
+ * @param num_chunks Read at most this many chunks ahead
+ */
+void chunked_inbuf::set_read_ahead(bool state, unsigned int num_chunks)
+{
+#ifdef USE_POSIX_THREADS
+    if (state && !d_reader)
+        d_reader = new chunk_reader(d_is, num_chunks, d_twiddle_bytes);
+    else if (!state && d_reader)
+        d_reader->stop();
+#else
+    (void) state;
+    (void) num_chunks;
+#endif
+}
+
+/**
+ * @brief Read the next chunk header
+ * Read the header from the underlying stream or, when read-ahead is on,
+ * take the next chunk read by the child thread. The first header read sets
+ * d_twiddle_bytes.
+ *
+ * @param header Value-result parameter; the header, in host byte order
+ * @return False at end of file, otherwise true.
+ */
+bool chunked_inbuf::m_read_header(uint32_t &header)
+{
+#ifdef USE_POSIX_THREADS
+    if (d_reader) {
+        d_chunk_pos = 0;
+        if (!d_reader->next_chunk(header, d_chunk)) {
+            // The child thread has stopped and everything it read has been
+            // used; it is safe to read from d_is again.
+            delete d_reader;
+            d_reader = 0;
+        }
+    }
+
+    if (!d_reader) {
+#endif
+        d_is.read((char *) &header, 4);
+#if !BYTE_ORDER_PREFIX
+        // When the endian nature of the server is encoded in the chunk header, the header is
+        // sent using network byte order
+        ntohl(header);
+#endif
+        if (d_is.eof()) return false;
+#ifdef USE_POSIX_THREADS
+    }
+#endif
+
+#if BYTE_ORDER_PREFIX
+    if (d_twiddle_bytes) header = bswap_32(header);
+#else
+    // (header & CHUNK_LITTLE_ENDIAN) --> is the sender little endian
+    if (!d_set_twiddle) {
+        d_twiddle_bytes = (is_host_big_endian() == (header & CHUNK_LITTLE_ENDIAN));
+        d_set_twiddle = true;
+    }
+#endif
+
+    return true;
+}
+
+/**
+ * @brief Read part of the current chunk's body
+ * @param data Put the bytes here
+ * @param num Read this many bytes
+ * @return False if the stream went bad or held fewer than 'num' bytes.
+ */
+bool chunked_inbuf::m_read_body(char *data, uint32_t num)
+{
+#ifdef USE_POSIX_THREADS
+    if (d_reader) {
+        if (num > d_chunk.size() - d_chunk_pos) return false;
+        if (num > 0) memcpy(data, &d_chunk[d_chunk_pos], num);
+        d_chunk_pos += num;
+        return true;
+    }
+#endif
+
+    d_is.read(data, num);
+    return !d_is.bad() && d_is.gcount() == (std::streamsize)num;
+}
+
 /*
   This code does not use a 'put back' buffer, but here's a picture of the
   d_buffer pointer, eback(), gptr() and egptr() that can be used to see how
@@ -94,28 +418,14 @@ chunked_inbuf::underflow()
 	// gptr() == egptr() so read more data from the underlying input source.
 
 	// To read data from the chunked stream, first read the header
-	uint32_t header;
-	d_is.read((char *) &header, 4);
-#if !BYTE_ORDER_PREFIX
-	// When the endian nature of the server is encoded in the chunk header, the header is
-	// sent using network byte order
-	ntohl(header);
-#endif
 
 	// There are two 'EOF' cases: One where the END chunk is zero bytes and one where
 	// it holds data. In the latter case, bytes those will be read and moved into the
 	// buffer. Once those data are consumed, we'll be back here again and this read()
 	// will return EOF. See below for the other case...
-	if (d_is.eof()) return traits_type::eof();
-#if BYTE_ORDER_PREFIX
-	if (d_twiddle_bytes) header = bswap_32(header);
-#else
-	// (header & CHUNK_LITTLE_ENDIAN) --> is the sender little endian
-	if (!d_set_twiddle) {
-	    d_twiddle_bytes = (is_host_big_endian() == (header & CHUNK_LITTLE_ENDIAN));
-	    d_set_twiddle = true;
-	}
-#endif
+	uint32_t header;
+	if (!m_read_header(header)) return traits_type::eof();
+
 	uint32_t chunk_size = header & CHUNK_SIZE_MASK;
 
 	DBG(cerr << "underflow: chunk size from header: " << chunk_size << endl);
@@ -131,15 +441,18 @@ chunked_inbuf::underflow()
 	// If the END chunk has zero bytes, return EOF. See above for more information
 	if (chunk_size == 0 && (header & CHUNK_TYPE_MASK) == CHUNK_END) return traits_type::eof();
 
-	// Read the chunk's data
-	d_is.read(d_buffer, chunk_size);
-	DBG2(cerr << "underflow: size read: " << d_is.gcount() << ", eof: " << d_is.eof() << ", bad: " << d_is.bad() << endl);
-	if (d_is.bad()) return traits_type::eof();
-
-	DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
-	setg(d_buffer, 						// beginning of put back area
-			d_buffer,                	// read position (gptr() == eback())
-			d_buffer + chunk_size);  	// end of buffer (egptr()) chunk_size == d_is.gcount() unless there's an error
+	if (header & CHUNK_CODEC_MASK) {
+		if (m_uncompress_chunk(header, chunk_size) == traits_type::eof()) return traits_type::eof();
+	}
+	else {
+		// Read the chunk's data
+		if (!m_read_body(d_buffer, chunk_size)) return traits_type::eof();
+
+		DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
+		setg(d_buffer, 						// beginning of put back area
+				d_buffer,                	// read position (gptr() == eback())
+				d_buffer + chunk_size);  	// end of buffer (egptr()) chunk_size == d_is.gcount() unless there's an error
+	}
 
 	DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
 
@@ -171,10 +484,11 @@ chunked_inbuf::underflow()
  * first reading from the internal beffer and then from the stream. Any
  * characters read from the last chunk that won't fit in to \c s are put
  * in the buffer, otherwise all data are read directly into \c s, bypassing
- * the internal buffer (and the extra copy operation that would imply). If
- * the END chunk is found EOF is not returned and the final read of the
- * underlying stream is not made; the next call to read(), get(), ..., will
- * return EOF.
+ * the internal buffer (and the extra copy operation that would imply). This
+ * is true for compressed chunks too; they are uncompressed directly into
+ * \c s when they fit. If the END chunk is found EOF is not returned and the
+ * final read of the underlying stream is not made; the next call to read(),
+ * get(), ..., will return EOF.
  * @param s Address of a buffer to hold the data
  * @param num Number of bytes to read
  * @return NUmber of bytes actually transferred into \c s. Note that this
@@ -195,7 +509,7 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 	}
 
 	// else they asked for more
-	uint32_t bytes_left_to_read = num;
+	std::streamsize bytes_left_to_read = num;
 
 	// are there any bytes in the buffer? if so grab them first
 	if (gptr() < egptr()) {
@@ -218,26 +532,14 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 	bool done = false;
     while (!done) {
         // Get a chunk header
-        uint32_t header;
-        d_is.read((char *) &header, 4);
-#if !BYTE_ORDER_PREFIX
-        ntohl(header);
-#endif
 
         // There are two EOF cases: One where the END chunk is zero bytes and one where
         // it holds data. In the latter case, those will be read and moved into the
         // buffer. Once those data are consumed, we'll be back here again and this read()
-        // will return EOF. See below for the other case...
-        if (d_is.eof()) return traits_type::eof();
-#if BYTE_ORDER_PREFIX
-        if (d_twiddle_bytes) header = bswap_32(header);
-#else
-        // (header & CHUNK_LITTLE_ENDIAN) --> is the sender little endian
-        if (!d_set_twiddle) {
-            d_twiddle_bytes = (is_host_big_endian() == (header & CHUNK_LITTLE_ENDIAN));
-            d_set_twiddle = true;
-        }
-#endif
+        // will return EOF. See below for the other case... Return the bytes already
+        // moved from the buffer to 's' so they are not lost.
+        uint32_t header;
+        if (!m_read_header(header)) return traits_type::not_eof(num-bytes_left_to_read);
 
 	    uint32_t chunk_size = header & CHUNK_SIZE_MASK;
 		DBG(cerr << "xsgetn: chunk size from header: " << chunk_size << endl);
@@ -251,8 +553,8 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 			// small to hold the error message. At this point, there's not much reason
 			// to optimize transport efficiency, however.
 			std::vector<char> message(chunk_size);
-			d_is.read(&message[0], chunk_size);
-			d_error_message = string(&message[0], chunk_size);
+			if (chunk_size > 0) m_read_body(&message[0], chunk_size);
+			d_error_message = string(message.begin(), message.end());
 			// leave the buffer and gptr(), ..., in a consistent state (empty)
 			setg(d_buffer, d_buffer, d_buffer);
 	    }
@@ -260,11 +562,35 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 	    else if (chunk_size == 0 && (header & CHUNK_TYPE_MASK) == CHUNK_END) {
 	    	return traits_type::not_eof(num-bytes_left_to_read);
 	    }
+	    // Compressed chunks are uncompressed directly into 's' if they fit. If
+	    // not, they are uncompressed into the internal buffer and as much as is
+	    // needed is copied to 's'
+	    else if (header & CHUNK_CODEC_MASK) {
+	    	uint32_t size;
+	    	if (!m_read_compressed(chunk_size, size)) return traits_type::eof();
+
+	    	if (size <= bytes_left_to_read) {
+	    		if (!m_uncompress(header, chunk_size, s, size)) return traits_type::eof();
+	    		s += size;
+	    		bytes_left_to_read -= size;
+	    	}
+	    	else {
+	    		if (size > d_buf_size) {
+	    			d_buf_size = size;
+	    			m_buffer_alloc();
+	    		}
+
+	    		if (!m_uncompress(header, chunk_size, d_buffer, size)) return traits_type::eof();
+
+	    		memcpy(s, d_buffer, bytes_left_to_read);
+	    		setg(d_buffer, d_buffer + bytes_left_to_read, d_buffer + size);
+	    		bytes_left_to_read = 0;
+	    	}
+	    }
 	    // The next case is complicated because we read some data from the current
 	    // chunk into 's' an some into the internal buffer.
 	    else if (chunk_size > bytes_left_to_read) {
-			d_is.read(s, bytes_left_to_read);
-			if (d_is.bad()) return traits_type::eof();
+			if (!m_read_body(s, bytes_left_to_read)) return traits_type::eof();
 
 			// Now slurp up the remain part of the chunk and store it in the buffer
 			uint32_t bytes_leftover = chunk_size - bytes_left_to_read;
@@ -274,8 +600,7 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 		        m_buffer_alloc();
 		    }
 		    // read the remain stuff in to d_buffer
-			d_is.read(d_buffer, bytes_leftover);
-			if (d_is.bad()) return traits_type::eof();
+			if (!m_read_body(d_buffer, bytes_leftover)) return traits_type::eof();
 
 			setg(d_buffer, 										// beginning of put back area
 				 d_buffer,                						// read position (gptr() == eback())
@@ -283,17 +608,13 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 
 			bytes_left_to_read = 0 /* -= d_is.gcount()*/;
 		}
+		// The whole chunk fits in 's'; the internal buffer is not used so
+		// it does not need to be as large as the chunk.
 		else {
-			// expand the internal buffer if needed
-		    if (chunk_size > d_buf_size) {
-		        d_buf_size = chunk_size;
-		        m_buffer_alloc();
-		    }
 		    // If we get a chunk that's zero bytes, Don't call read()
 		    // to save the kernel context switch overhead.
 			if (chunk_size > 0) {
-				d_is.read(s, chunk_size);
-				if (d_is.bad()) return traits_type::eof();
+				if (!m_read_body(s, chunk_size)) return traits_type::eof();
 				bytes_left_to_read -= chunk_size /*d_is.gcount()*/;
 				s += chunk_size;
 			}
@@ -325,6 +646,87 @@ chunked_inbuf::xsgetn(char* s, std::streamsize num)
 	return traits_type::not_eof(num-bytes_left_to_read);
 }
 
+/**
+ * @brief Read the body of a compressed chunk
+ * Read the body of a chunk whose header has one of the CHUNK_CODEC_MASK
+ * bits set into d_zbuf and get the size of the uncompressed data.
+ * @param chunk_size The size of the compressed chunk body
+ * @param size Value-result parameter; the size of the uncompressed data
+ * @return False on error.
+ */
+bool
+chunked_inbuf::m_read_compressed(uint32_t chunk_size, uint32_t &size)
+{
+	if (chunk_size < sizeof(uint32_t)) {
+		d_error = true;
+		d_error_message = "Found a compressed chunk with no size.";
+		return false;
+	}
+
+	if (d_zbuf.size() < chunk_size)
+		d_zbuf.resize(chunk_size);
+
+	if (!m_read_body(&d_zbuf[0], chunk_size)) return false;
+
+	memcpy(&size, &d_zbuf[0], sizeof(uint32_t));
+	if (d_twiddle_bytes) size = bswap_32(size);
+
+	if (size > CHUNK_SIZE_MASK) {
+		d_error = true;
+		d_error_message = "Found a compressed chunk that is too large.";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Uncompress the chunk read by m_read_compressed()
+ * @param header The chunk header
+ * @param chunk_size The size of the compressed chunk body
+ * @param data Put the uncompressed data here
+ * @param size The size of the uncompressed data
+ * @return False on error.
+ */
+bool
+chunked_inbuf::m_uncompress(uint32_t header, uint32_t chunk_size, char *data, uint32_t size)
+{
+	if (!uncompress_chunk(header & CHUNK_CODEC_MASK, &d_zbuf[sizeof(uint32_t)], chunk_size - sizeof(uint32_t),
+		data, size)) {
+		d_error = true;
+		d_error_message = "Could not uncompress a chunk (unsupported codec or corrupt data).";
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Read and uncompress a compressed chunk
+ * Read the body of a chunk whose header has one of the CHUNK_CODEC_MASK
+ * bits set and uncompress it into the internal buffer.
+ * @param header The chunk header
+ * @param chunk_size The size of the compressed chunk body
+ * @return EOF on error, otherwise the number of bytes in the buffer.
+ */
+std::streambuf::int_type
+chunked_inbuf::m_uncompress_chunk(uint32_t header, uint32_t chunk_size)
+{
+	uint32_t size;
+	if (!m_read_compressed(chunk_size, size)) return traits_type::eof();
+
+	if (size > d_buf_size) {
+		d_buf_size = size;
+		m_buffer_alloc();
+	}
+
+	if (!m_uncompress(header, chunk_size, d_buffer, size)) return traits_type::eof();
+
+	setg(d_buffer, d_buffer, d_buffer + size);
+
+	return traits_type::not_eof(size);
+}
+
 /**
  * @brief Read a chunk
  * Normally the chunked nature of a chunked_istream/chunked_inbuf is
@@ -341,26 +743,13 @@ std::streambuf::int_type
 chunked_inbuf::read_next_chunk()
 {
 	// To read data from the chunked stream, first read the header
-	uint32_t header;
-	d_is.read((char *) &header, 4);
-#if !BYTE_ORDER_PREFIX
-    ntohl(header);
-#endif
 
 	// There are two 'EOF' cases: One where the END chunk is zero bytes and one where
 	// it holds data. In the latter case, bytes those will be read and moved into the
 	// buffer. Once those data are consumed, we'll be back here again and this read()
 	// will return EOF. See below for the other case...
-	if (d_is.eof()) return traits_type::eof();
-#if BYTE_ORDER_PREFIX
-    if (d_twiddle_bytes) header = bswap_32(header);
-#else
-    // (header & CHUNK_LITTLE_ENDIAN) --> is the sender little endian
-    if (!d_set_twiddle) {
-        d_twiddle_bytes = (is_host_big_endian() == (header & CHUNK_LITTLE_ENDIAN));
-        d_set_twiddle = true;
-    }
-#endif
+	uint32_t header;
+	if (!m_read_header(header)) return traits_type::eof();
 
 	uint32_t chunk_size = header & CHUNK_SIZE_MASK;
 
@@ -377,15 +766,21 @@ chunked_inbuf::read_next_chunk()
 	// If the END chunk has zero bytes, return EOF. See above for more information
 	if (chunk_size == 0 && (header & CHUNK_TYPE_MASK) == CHUNK_END) return traits_type::eof();
 
-	// Read the chunk's data
-	d_is.read(d_buffer, chunk_size);
-	DBG2(cerr << "read_next_chunk: size read: " << d_is.gcount() << ", eof: " << d_is.eof() << ", bad: " << d_is.bad() << endl);
-	if (d_is.bad()) return traits_type::eof();
-
-	DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
-	setg(d_buffer, 						// beginning of put back area
-			d_buffer,                	// read position (gptr() == eback())
-			d_buffer + chunk_size);  	// end of buffer (egptr()) chunk_size == d_is.gcount() unless there's an error
+	if (header & CHUNK_CODEC_MASK) {
+		int_type size = m_uncompress_chunk(header, chunk_size);
+		if (size == traits_type::eof()) return traits_type::eof();
+		// The caller sees the uncompressed size
+		chunk_size = size;
+	}
+	else {
+		// Read the chunk's data
+		if (!m_read_body(d_buffer, chunk_size)) return traits_type::eof();
+
+		DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
+		setg(d_buffer, 						// beginning of put back area
+				d_buffer,                	// read position (gptr() == eback())
+				d_buffer + chunk_size);  	// end of buffer (egptr()) chunk_size == d_is.gcount() unless there's an error
+	}
 
 	DBG2(cerr << "eback(): " << (void*)eback() << ", gptr(): " << (void*)(gptr()-eback()) << ", egptr(): " << (void*)(egptr()-eback()) << endl);
 
@@ -36,9 +36,12 @@
 #include <istream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 namespace libdap {
 
+class chunk_reader;
+
 class chunked_inbuf: public std::streambuf {
 private:
 	std::istream &d_is;
@@ -58,6 +61,21 @@ private:
 	std::string d_error_message;
 	bool d_error;
 
+	std::vector<char> d_zbuf;	// compressed chunks are read into this
+
+	// When read-ahead is on, a chunk_reader reads chunks from d_is using a
+	// child thread. The body of the current chunk is held in d_chunk.
+	chunk_reader *d_reader;
+	std::vector<char> d_chunk;
+	uint32_t d_chunk_pos;		// how much of d_chunk has been consumed
+
+	bool m_read_header(uint32_t &header);
+	bool m_read_body(char *data, uint32_t num);
+
+	bool m_read_compressed(uint32_t chunk_size, uint32_t &size);
+	bool m_uncompress(uint32_t header, uint32_t chunk_size, char *data, uint32_t size);
+	int_type m_uncompress_chunk(uint32_t header, uint32_t chunk_size);
+
 	/**
 	 * @brief allocate the internal buffer.
 	 * Allocate d_buf_size + putBack characters for the read buffer.
@@ -65,7 +83,7 @@ private:
 	 * chars.
 	 */
 	void m_buffer_alloc() {
-		delete d_buffer;
+		delete[] d_buffer;
 		d_buffer = new char[d_buf_size];
 		setg(d_buffer, 	// beginning of put back area
 			 d_buffer, 	// read position
@@ -97,7 +115,8 @@ public:
 	 */
 #if BYTE_ORDER_PREFIX
 	chunked_inbuf(std::istream &is, int size, bool twiddle_bytes = false)
-        : d_is(is), d_buf_size(size), d_buffer(0), d_twiddle_bytes(twiddle_bytes), d_error(false) {
+        : d_is(is), d_buf_size(size), d_buffer(0), d_twiddle_bytes(twiddle_bytes), d_error(false), d_reader(0),
+          d_chunk_pos(0) {
 		if (d_buf_size & CHUNK_TYPE_MASK)
 			throw std::out_of_range("A chunked_outbuf (or chunked_ostream) was built using a buffer larger than 0x00ffffff");
 
@@ -105,7 +124,8 @@ public:
 	}
 #else
     chunked_inbuf(std::istream &is, int size)
-        : d_is(is), d_buf_size(size), d_buffer(0), d_twiddle_bytes(false), d_set_twiddle(false), d_error(false) {
+        : d_is(is), d_buf_size(size), d_buffer(0), d_twiddle_bytes(false), d_set_twiddle(false), d_error(false),
+          d_reader(0), d_chunk_pos(0) {
         if (d_buf_size & CHUNK_TYPE_MASK)
             throw std::out_of_range("A chunked_outbuf (or chunked_ostream) was built using a buffer larger than 0x00ffffff");
 
@@ -113,12 +133,13 @@ public:
     }
 #endif
 
-	virtual ~chunked_inbuf() {
-		delete d_buffer;
-	}
+	virtual ~chunked_inbuf();
 
 	int_type read_next_chunk();
 
+	void set_read_ahead(bool state, unsigned int num_chunks = 2);
+	bool read_ahead() const { return d_reader != 0; }
+
 	int bytes_in_buffer() const { return (egptr() - gptr()); }
 
 	// d_twiddle_bytes is false initially and is set to the correct value
@@ -146,6 +167,19 @@ public:
 
 	int read_next_chunk() { return d_cbuf.read_next_chunk(); }
 
+	/**
+	 * Read chunks from the underlying stream using a child thread, so that
+	 * the next chunk is already in memory when the current one has been
+	 * consumed. Once this is on, the underlying stream must not be used
+	 * until the END chunk has been read or read-ahead is turned off. This
+	 * does nothing if libdap was built without pthreads.
+	 *
+	 * @param state True to turn read-ahead on, false to turn it off
+	 * @param num_chunks Read at most this many chunks ahead
+	 */
+	void set_read_ahead(bool state, unsigned int num_chunks = 2) { d_cbuf.set_read_ahead(state, num_chunks); }
+	bool read_ahead() const { return d_cbuf.read_ahead(); }
+
 	/**
 	 * How many bytes have been read from the stream and are now in the internal buffer?
 	 * @return Number of buffered bytes.
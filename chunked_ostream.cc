@@ -33,17 +33,313 @@
 
 #include <string>
 #include <streambuf>
+#include <algorithm>
 
 #include <cstring>
 
+#if HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#if HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
 //#define DODS_DEBUG
 
 #include "chunked_stream.h"
 #include "chunked_ostream.h"
+#ifdef USE_POSIX_THREADS
+#include "MarshallerThread.h"
+#endif
+#include "Error.h"
+#include "InternalErr.h"
 #include "debug.h"
 
 namespace libdap {
 
+// Chunks smaller than this are not worth compressing
+static const uint32_t min_compressed_chunk = 64;
+
+/**
+ * Compress 'num' bytes from 'data' using 'codec'.
+ *
+ * @param out Put the compressed data here
+ * @param max The space available in 'out'
+ * @return The number of compressed bytes, or zero if they would not fit
+ * in 'max' bytes or the codec is not supported.
+ */
+static uint32_t compress_chunk(uint32_t codec, int level, const char *data, uint32_t num, char *out, uint32_t max)
+{
+	switch (codec) {
+#if HAVE_LIBZ
+	case CHUNK_DEFLATE: {
+		uLongf len = max;
+		if (compress2(reinterpret_cast<Bytef*>(out), &len, reinterpret_cast<const Bytef*>(data), num, level) != Z_OK)
+			return 0;
+		return len;
+	}
+#endif
+#if HAVE_LIBZSTD
+	case CHUNK_ZSTD: {
+		size_t len = ZSTD_compress(out, max, data, num, level);
+		return ZSTD_isError(len) ? 0 : len;
+	}
+#endif
+	default:
+		return 0;
+	}
+}
+
+chunked_outbuf::~chunked_outbuf()
+{
+	// call end_chunk() and not sync()
+	end_chunk();
+
+#ifdef USE_POSIX_THREADS
+	// Waits for any queued chunks to be written
+	delete d_thread;
+#endif
+
+	delete[] d_chunk;
+}
+
+/**
+ * Allocate the buffer, along with room for a chunk header in front of it
+ * so that a full buffer can be sent with one write.
+ */
+void
+chunked_outbuf::m_buffer_alloc(unsigned int buf_size)
+{
+	if (buf_size & ~CHUNK_SIZE_MASK)
+		throw std::out_of_range("A chunked_outbuf (or chunked_ostream) was built using a buffer larger than 0x00ffffff");
+	if (buf_size == 0)
+		throw std::out_of_range("A chunked_outbuf (or chunked_ostream) was built using a zero length buffer");
+
+	char *chunk = new char[buf_size + sizeof(uint32_t)];
+	delete[] d_chunk;
+	d_chunk = chunk;
+	d_buffer = d_chunk + sizeof(uint32_t);
+	d_buf_size = buf_size;
+
+	// Trick: making the pointers think the buffer is one char smaller than it
+	// really is ensures that overflow() will be called when there's space for
+	// one more character.
+	setp(d_buffer, d_buffer + (d_buf_size - 1));
+}
+
+/**
+ * @brief Change the size of the buffer
+ * Any data in the buffer are sent as a DATA chunk first.
+ * @return EOF if the buffered data could not be sent, zero otherwise.
+ * @see chunked_ostream::set_chunk_size()
+ */
+std::streambuf::int_type
+chunked_outbuf::set_chunk_size(unsigned int size)
+{
+	if ((size & ~CHUNK_SIZE_MASK) || size == 0)
+		throw std::out_of_range("The chunk size must be between 1 and 0x00ffffff bytes");
+
+	if (data_chunk() == traits_type::eof())
+		return traits_type::eof();
+
+	if (size != d_buf_size)
+		m_buffer_alloc(size);
+
+	return 0;
+}
+
+/**
+ * @brief Limit the size of the chunks sent for large writes
+ * @see chunked_ostream::set_max_chunk_size()
+ */
+void
+chunked_outbuf::set_max_chunk_size(unsigned int size)
+{
+	if ((size & ~CHUNK_SIZE_MASK) || size == 0)
+		throw std::out_of_range("The chunk size must be between 1 and 0x00ffffff bytes");
+
+	d_max_chunk_size = size;
+}
+
+/**
+ * @brief Can chunks be compressed using this codec?
+ * @param codec CHUNK_DEFLATE or CHUNK_ZSTD
+ */
+bool
+chunked_outbuf::is_codec_supported(uint32_t codec)
+{
+	switch (codec) {
+#if HAVE_LIBZ
+	case CHUNK_DEFLATE:
+		return true;
+#endif
+#if HAVE_LIBZSTD
+	case CHUNK_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Compress the DATA and END chunks
+ * @see chunked_ostream::set_compression()
+ */
+void
+chunked_outbuf::set_compression(uint32_t codec, int level)
+{
+	if (codec != 0 && !is_codec_supported(codec))
+		throw InternalErr(__FILE__, __LINE__, "This build of libdap cannot compress chunks with the requested codec.");
+
+	d_codec = codec;
+	d_level = level;
+
+#ifdef USE_POSIX_THREADS
+	// Once started, the thread writes every chunk so they stay in order
+	if (d_codec && !d_thread)
+		d_thread = new MarshallerThread;
+#endif
+}
+
+/**
+ * @brief Write one chunk
+ *
+ * Write the header and 'num' bytes from 'data' as a chunk of the given
+ * type. DATA and END chunks are compressed if a codec has been set and
+ * that makes them smaller. If a writer thread is running, the chunk is
+ * copied to one of its buffers and queued; the data can be reused as soon
+ * as this returns.
+ *
+ * @return EOF on error, otherwise num.
+ */
+std::streambuf::int_type
+chunked_outbuf::m_write_chunk(uint32_t type, const char *data, uint32_t num)
+{
+	uint32_t header = type | num;
+#if !BYTE_ORDER_PREFIX
+	// Add encoding of host's byte order. jhrg 11/24/13
+	if (!d_big_endian) header |= CHUNK_LITTLE_ENDIAN;
+#endif
+
+	bool compress = d_codec && type != CHUNK_ERR && num >= min_compressed_chunk;
+
+	if (!compress && !d_thread)
+		return m_write_uncompressed(header, data, num);
+
+	try {
+		// Room for the header, the uncompressed size and the data
+		char *buf;
+#ifdef USE_POSIX_THREADS
+		if (d_thread) {
+			buf = d_thread->get_buffer(num + 2 * sizeof(uint32_t));
+		}
+		else
+#endif
+		{
+			if (d_zbuf.size() < num + 2 * sizeof(uint32_t))
+				d_zbuf.resize(num + 2 * sizeof(uint32_t));
+			buf = &d_zbuf[0];
+		}
+
+		// The compressed body, including the size prefix, must be smaller
+		// than the data or the chunk is sent as is.
+		uint32_t len = 0;
+		if (compress)
+			len = compress_chunk(d_codec, d_level, data, num, buf + 2 * sizeof(uint32_t), num - sizeof(uint32_t) - 1);
+
+		uint32_t bytes;
+		if (len > 0) {
+			uint32_t zheader = (header & ~CHUNK_SIZE_MASK) | d_codec | (len + sizeof(uint32_t));
+			memcpy(buf, &zheader, sizeof(uint32_t));
+			memcpy(buf + sizeof(uint32_t), &num, sizeof(uint32_t));
+			bytes = len + 2 * sizeof(uint32_t);
+		}
+		else if (d_thread) {
+			memcpy(buf, &header, sizeof(uint32_t));
+			memcpy(buf + sizeof(uint32_t), data, num);
+			bytes = num + sizeof(uint32_t);
+		}
+		else {
+			// Not worth copying the data just to write it
+			return m_write_uncompressed(header, data, num);
+		}
+
+#ifdef USE_POSIX_THREADS
+		if (d_thread) {
+			d_thread->write(d_os, buf, bytes);
+			return num;
+		}
+#endif
+		d_os.write(buf, bytes);
+		if (d_os.eof() || d_os.bad())
+			return traits_type::eof();
+	}
+	catch (Error &e) {
+		// The writer thread reports a failed write this way
+		DBG(cerr << "chunked_outbuf::m_write_chunk: " << e.get_error_message() << endl);
+		return traits_type::eof();
+	}
+
+	return num;
+}
+
+/**
+ * @brief Write a chunk header and body to the output stream
+ *
+ * Each chunk is sent with one write to the output stream. The buffer has
+ * room for the header in front of it, so a chunk built there is sent from
+ * where it is. Other data come straight from the caller of xsputn() and
+ * are copied after a header in d_zbuf first; writing the header and the
+ * body separately would leave it to the ostream to combine them, and
+ * most streambufs would send the four byte header on its own.
+ *
+ * @return EOF on error, otherwise num.
+ */
+std::streambuf::int_type
+chunked_outbuf::m_write_uncompressed(uint32_t header, const char *data, uint32_t num)
+{
+	if (data == d_buffer) {
+		memcpy(d_chunk, &header, sizeof(uint32_t));
+		d_os.write(d_chunk, num + sizeof(uint32_t));
+	}
+	else {
+		if (d_zbuf.size() < num + sizeof(uint32_t))
+			d_zbuf.resize(num + sizeof(uint32_t));
+
+		memcpy(&d_zbuf[0], &header, sizeof(uint32_t));
+		memcpy(&d_zbuf[sizeof(uint32_t)], data, num);
+		d_os.write(&d_zbuf[0], num + sizeof(uint32_t));
+	}
+
+	if (d_os.eof() || d_os.bad())
+		return traits_type::eof();
+
+	return num;
+}
+
+/**
+ * @brief Wait until the chunks queued for the writer thread are written
+ * @return EOF if a write failed, zero otherwise.
+ */
+std::streambuf::int_type
+chunked_outbuf::m_wait_for_writes()
+{
+#ifdef USE_POSIX_THREADS
+	if (d_thread) {
+		try {
+			d_thread->wait_for_writes();
+		}
+		catch (Error &e) {
+			DBG(cerr << "chunked_outbuf::m_wait_for_writes: " << e.get_error_message() << endl);
+			return traits_type::eof();
+		}
+	}
+#endif
+	return 0;
+}
+
 // flush the characters in the buffer
 /**
  * @brief Write out the contents of the buffer as a chunk.
@@ -62,31 +358,7 @@ chunked_outbuf::data_chunk()
 	if (num == 0)
 		return 0;
 
-	// here, write out the chunk headers: CHUNKTYPE and CHUNKSIZE
-	// as a 32-bit unsigned int. Here I assume that num is never
-	// more than 2^24 because that was tested in the constructor
-
-	// Trick: This method always writes CHUNK_DATA type chunks so
-	// the chunk type is always 0x00, and given that num never has
-	// anything bigger than 24-bits, the high order byte is always
-	// 0x00. Of course bit-wise OR with 0x00 isn't going to do
-	// much anyway... Here's the general idea all the same:
-	//
-	// unsigned int chunk_header = (unsigned int)num | CHUNK_type;
-	uint32_t header = num;
-#if !BYTE_ORDER_PREFIX
-	// Add encoding of host's byte order. jhrg 11/24/13
-	if (!d_big_endian) header |= CHUNK_LITTLE_ENDIAN;
-	// network byte order for the header
-	htonl(header);
-#endif
-
-	d_os.write((const char *)&header, sizeof(int32_t));
-
-	// Should bad() throw an error?
-	// Are these functions fast or would the bits be faster?
-	d_os.write(d_buffer, num);
-	if (d_os.eof() || d_os.bad())
+	if (m_write_chunk(CHUNK_DATA, d_buffer, num) == traits_type::eof())
 		return traits_type::eof();
 
 	pbump(-num);
@@ -111,31 +383,15 @@ chunked_outbuf::end_chunk()
 
 	int32_t num = pptr() - pbase();	// num needs to be signed for the call to pbump
 
-	// write out the chunk headers: CHUNKTYPE and CHUNKSIZE
-	// as a 32-bit unsigned int. Here I assume that num is never
-	// more than 2^24 because that was tested in the constructor
-
-	uint32_t header = (uint32_t)num | CHUNK_END;
-
-#if !BYTE_ORDER_PREFIX
-    // Add encoding of host's byte order. jhrg 11/24/13
-    if (!d_big_endian) header |= CHUNK_LITTLE_ENDIAN;
-    // network byte order for the header
-    htonl(header);
-#endif
+	if (m_write_chunk(CHUNK_END, d_buffer, num) == traits_type::eof())
+		return traits_type::eof();
 
-    // Write out the CHUNK_END header with the byte count.
-	// This should be called infrequently, so it's probably not worth
-	// optimizing away chunk_header
-	d_os.write((const char *)&header, sizeof(uint32_t));
+	pbump(-num);
 
-	// Should bad() throw an error?
-	// Are these functions fast or would the bits be faster?
-	d_os.write(d_buffer, num);
-	if (d_os.eof() || d_os.bad())
+	// The end chunk is often the last thing written; make sure it has been
+	if (m_wait_for_writes() == traits_type::eof())
 		return traits_type::eof();
 
-	pbump(-num);
 	return num;
 }
 
@@ -162,24 +418,8 @@ chunked_outbuf::err_chunk(const std::string &m)
 	if (msg.length() > 0x00FFFFFF)
 		msg = "Error message too long";
 
-	uint32_t header = (uint32_t)msg.length() | CHUNK_ERR;
-
-#if !BYTE_ORDER_PREFIX
-    // Add encoding of host's byte order. jhrg 11/24/13
-    if (!d_big_endian) header |= CHUNK_LITTLE_ENDIAN;
-    // network byte order for the header
-    htonl(header);
-#endif
-
-    // Write out the CHUNK_END header with the byte count.
-	// This should be called infrequently, so it's probably not worth
-	// optimizing away chunk_header
-	d_os.write((const char *)&header, sizeof(uint32_t));
-
-	// Should bad() throw an error?
-	// Are these functions fast or would the bits be faster?
-	d_os.write(msg.data(), msg.length());
-	if (d_os.eof() || d_os.bad())
+	if (m_write_chunk(CHUNK_ERR, msg.data(), msg.length()) == traits_type::eof()
+		|| m_wait_for_writes() == traits_type::eof())
 		return traits_type::eof();
 
 	// Reset the buffer pointer, effectively ignoring what's in there now
@@ -249,12 +489,12 @@ chunked_outbuf::xsputn(const char *s, std::streamsize num)
 	DBG(cerr << "In chunked_outbuf::xsputn: num: " << num << endl);
 
 	// if the current block of data will fit in the buffer, put it there.
-	// else, there is at least a complete chunk between what's in the buffer
-	// and what's in 's'; send a chunk header, the stuff in the buffer and
-	// bytes from 's' to make a complete chunk. Then iterate over 's' sending
-	// more chunks until there's less than a complete chunk left in 's'. Put
-	// the bytes remaining 's' in the buffer. Return the number of bytes sent
-	// or 0 if an error is encountered.
+	// else, fill out the buffer (if it holds anything) from 's' and send it
+	// as a chunk. Then send the rest of 's' directly, without copying it to
+	// the buffer, in chunks of up to d_max_chunk_size bytes until there's
+	// less than a buffer's worth left. Put the bytes remaining in 's' in the
+	// buffer. Return the number of bytes sent or 0 if an error is
+	// encountered.
 
 	int32_t bytes_in_buffer = pptr() - pbase();	// num needs to be signed for the call to pbump
 
@@ -268,42 +508,32 @@ chunked_outbuf::xsputn(const char *s, std::streamsize num)
 		return traits_type::not_eof(num);
 	}
 
-	// If here, write a chunk header and a chunk's worth of data by combining the
-	// data in the buffer and some data from 's'.
-	uint32_t header = d_buf_size;
-#if !BYTE_ORDER_PREFIX
-    // Add encoding of host's byte order. jhrg 11/24/13
-    if (!d_big_endian) header |= CHUNK_LITTLE_ENDIAN;
-    // network byte order for the header
-    htonl(header);
-#endif
-	d_os.write((const char *)&header, sizeof(int32_t));	// Data chunk's CHUNK_TYPE is 0x00000000
+	std::streamsize bytes_still_to_send = num;
 
-	// Reset the pptr() and epptr() now in case of an error exit. See the 'if'
-	// at teh end of this for the only code from here down that will modify the
-	// pptr() value.
-	setp(d_buffer, d_buffer + (d_buf_size - 1));
+	if (bytes_in_buffer > 0) {
+		// Reset the pptr() and epptr() first in case of an error exit. See the 'if'
+		// at the end of this for the only code from here down that will modify the
+		// pptr() value.
+		int bytes_to_fill_out_buffer = d_buf_size - bytes_in_buffer;
+		memcpy(pptr(), s, bytes_to_fill_out_buffer);
+		setp(d_buffer, d_buffer + (d_buf_size - 1));
 
-	d_os.write(d_buffer, bytes_in_buffer);
-	if (d_os.eof() || d_os.bad())
-		return traits_type::not_eof(0);
+		if (m_write_chunk(CHUNK_DATA, d_buffer, d_buf_size) == traits_type::eof())
+			return traits_type::not_eof(0);
 
-	int bytes_to_fill_out_buffer =  d_buf_size - bytes_in_buffer;
-	d_os.write(s, bytes_to_fill_out_buffer);
-	if (d_os.eof() || d_os.bad())
-		return traits_type::not_eof(0);
-	s += bytes_to_fill_out_buffer;
-	uint32_t bytes_still_to_send = num - bytes_to_fill_out_buffer;
+		s += bytes_to_fill_out_buffer;
+		bytes_still_to_send -= bytes_to_fill_out_buffer;
+	}
 
-	// Now send all the remaining data in s until the amount remaining doesn't
-	// fill a complete chunk and buffer those data.
+	// Send the rest of 's' from where it is. For a large array this makes
+	// a few big chunks instead of many buffer-sized ones.
+	uint32_t max_chunk = std::max(d_buf_size, d_max_chunk_size);
 	while (bytes_still_to_send >= d_buf_size) {
-		// This is header for  a chunk of d_buf_size bytes; the size was set above
-		d_os.write((const char *) &header, sizeof(int32_t));
-		d_os.write(s, d_buf_size);
-		if (d_os.eof() || d_os.bad()) return traits_type::not_eof(0);
-		s += d_buf_size;
-		bytes_still_to_send -= d_buf_size;
+		uint32_t bytes = std::min(bytes_still_to_send, static_cast<std::streamsize>(max_chunk));
+		if (m_write_chunk(CHUNK_DATA, s, bytes) == traits_type::eof())
+			return traits_type::not_eof(0);
+		s += bytes;
+		bytes_still_to_send -= bytes;
 	}
 
 	if (bytes_still_to_send > 0) {
@@ -329,7 +559,7 @@ chunked_outbuf::sync()
 {
 	DBG(cerr << "In chunked_outbuf::sync" << endl);
 
-	if (data_chunk() == traits_type::eof()) {
+	if (data_chunk() == traits_type::eof() || m_wait_for_writes() == traits_type::eof()) {
 		// Error
 		return traits_type::not_eof(-1);
 	}
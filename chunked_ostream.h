@@ -30,15 +30,19 @@
 
 #include "chunked_stream.h"
 
+#include <stdint.h>
+
 #include <streambuf>
 #include <ostream>
 #include <stdexcept>      // std::out_of_range
+#include <vector>
 
 #include "util.h"
 
 namespace libdap {
 
 class chunked_ostream;
+class MarshallerThread;
 
 /**
  * @brief output buffer for a chunked stream
@@ -49,34 +53,56 @@ class chunked_ostream;
  * data, end and error, indicated by the code values 0x00, 0x01 and 0x02.
  * The size of a chunk is limited to 2^24 data bytes + 4 bytes for the
  * chunk header.
+ *
+ * Small writes are collected in a buffer and sent as a chunk when it is
+ * full. Writes larger than the buffer are sent directly from the caller's
+ * memory in chunks of up to get_max_chunk_size() bytes.
+ *
+ * Optionally, DATA and END chunks can be compressed (see set_compression()).
+ * When libdap is built with pthreads, compressed chunks are written by a
+ * second thread so that compressing one chunk overlaps writing the one
+ * before it.
  */
 class chunked_outbuf: public std::streambuf {
 	friend class chunked_ostream;
 protected:
 	std::ostream &d_os;			// Write stuff here
 	unsigned int d_buf_size; 	// Size of the data buffer
-	char *d_buffer;				// Data buffer
+	unsigned int d_max_chunk_size;	// Largest chunk sent from xsputn()'s caller
+	char *d_chunk;				// Room for a chunk header, then...
+	char *d_buffer;				// ...the data buffer
 	bool d_big_endian;
 
-public:
-	chunked_outbuf(std::ostream &os, unsigned int buf_size) : d_os(os), d_buf_size(buf_size), d_buffer(0) {
-		if (d_buf_size & CHUNK_TYPE_MASK)
-			throw std::out_of_range("A chunked_outbuf (or chunked_ostream) was built using a buffer larger than 0x00ffffff");
+	uint32_t d_codec;			// CHUNK_DEFLATE, CHUNK_ZSTD or 0 for none
+	int d_level;				// compression level passed to the codec
+	std::vector<char> d_zbuf;	// chunks not built in d_chunk are built here...
+	MarshallerThread *d_thread;	// ...or in this thread's buffers
 
+	int_type m_write_chunk(uint32_t type, const char *data, uint32_t num);
+	int_type m_write_uncompressed(uint32_t header, const char *data, uint32_t num);
+	int_type m_wait_for_writes();
+
+	void m_buffer_alloc(unsigned int buf_size);
+
+public:
+	chunked_outbuf(std::ostream &os, unsigned int buf_size) : d_os(os), d_buf_size(0),
+		d_max_chunk_size(CHUNK_SIZE_MASK), d_chunk(0), d_buffer(0), d_codec(0), d_level(1), d_thread(0) {
 		d_big_endian = is_host_big_endian();
-		d_buffer = new char[buf_size];
-		// Trick: making the pointers think the buffer is one char smaller than it
-		// really is ensures that overflow() will be called when there's space for
-		// one more character.
-		setp(d_buffer, d_buffer + (buf_size - 1));
+		m_buffer_alloc(buf_size);
 	}
 
-	virtual ~chunked_outbuf() {
-		// call end_chunk() and not sync()
-		end_chunk();
+	virtual ~chunked_outbuf();
 
-		delete[] d_buffer;
-	}
+	int_type set_chunk_size(unsigned int size);
+	unsigned int get_chunk_size() const { return d_buf_size; }
+
+	void set_max_chunk_size(unsigned int size);
+	unsigned int get_max_chunk_size() const { return d_max_chunk_size; }
+
+	void set_compression(uint32_t codec, int level = 1);
+	uint32_t get_compression() const { return d_codec; }
+
+	static bool is_codec_supported(uint32_t codec);
 
 protected:
 	// data_chunk and end_chunk might not be needed because they
@@ -157,6 +183,55 @@ public:
 	 * @return The number of bytes 'dumped' from the write buffer.
 	 */
 	int_type write_err_chunk(const std::string &msg) { return d_cbuf.err_chunk(msg); }
+
+	/**
+	 * @brief Compress the data chunks
+	 * Compress each DATA and END chunk sent after this call using the given
+	 * codec. The codec is recorded in each chunk's header, so a
+	 * chunked_istream needs no other information to read the stream. A chunk
+	 * that would not be made smaller is sent uncompressed. Use
+	 * is_codec_supported() to find which codecs this build of libdap has.
+	 *
+	 * @param codec CHUNK_DEFLATE, CHUNK_ZSTD or zero to stop compressing
+	 * @param level The compression level passed to the codec; lower is faster
+	 * @exception InternalErr if the codec is not supported
+	 */
+	void set_compression(uint32_t codec, int level = 1) { d_cbuf.set_compression(codec, level); }
+
+	/// @return CHUNK_DEFLATE, CHUNK_ZSTD or zero if chunks are not compressed
+	uint32_t get_compression() const { return d_cbuf.get_compression(); }
+
+	/// @return True if chunks can be compressed (and read) using the codec
+	static bool is_codec_supported(uint32_t codec) { return chunked_outbuf::is_codec_supported(codec); }
+
+	/**
+	 * @brief Change the size of the buffer
+	 * Data written in small pieces are collected in a buffer of this size
+	 * and sent as a DATA chunk when it is full. Whatever is in the buffer
+	 * now is sent first. Sets badbit if that fails.
+	 * @param size The new buffer size; must be less than 2^24 bytes
+	 * @exception std::out_of_range if the size is too large or too small
+	 */
+	void set_chunk_size(unsigned int size) {
+		if (d_cbuf.set_chunk_size(size) == traits_type::eof())
+			setstate(std::ios_base::badbit);
+	}
+
+	/// @return The size of the buffer
+	unsigned int get_chunk_size() const { return d_cbuf.get_chunk_size(); }
+
+	/**
+	 * @brief Limit the size of chunks sent for large writes
+	 * A write larger than the buffer skips the buffer; the data are sent
+	 * directly in DATA chunks of up to this many bytes. The default is the
+	 * largest chunk allowed (2^24 - 1 bytes). Use the buffer size to always
+	 * send chunks of that size.
+	 * @exception std::out_of_range if the size is 2^24 bytes or more
+	 */
+	void set_max_chunk_size(unsigned int size) { d_cbuf.set_max_chunk_size(size); }
+
+	/// @return The largest chunk sent for a write larger than the buffer
+	unsigned int get_max_chunk_size() const { return d_cbuf.get_max_chunk_size(); }
 };
 
 }
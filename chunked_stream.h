@@ -24,6 +24,14 @@
 #define CHUNK_TYPE_MASK 0x03000000
 #define CHUNK_SIZE_MASK 0x00FFFFFF
 
+// If either of these bits is set, the chunk body is compressed. The body
+// starts with the four-byte size of the uncompressed data (using the same
+// byte order as the header) followed by the compressed data. Only DATA and
+// END chunks are compressed and then only when that makes them smaller.
+#define CHUNK_DEFLATE 0x08000000
+#define CHUNK_ZSTD    0x10000000
+#define CHUNK_CODEC_MASK 0x18000000
+
 #define CHUNK_SIZE 4096
 
 #endif /* CHUNK_STREAM_H_ */
@@ -0,0 +1,252 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+/*
+ * The CRC 32 code used by the Crc32 class (crc.h). This is the same CRC
+ * (the reflected 0x04C11DB7 polynomial used by zlib, Ethernet, etc.) that
+ * the original table-driven class computed, but it processes eight bytes
+ * per step using 'slice-by-8' tables and, when the CPU supports carry-less
+ * multiplication, folds 64 bytes per step using PCLMULQDQ. The folding
+ * constants and the Barrett reduction are from Gopal, et al., "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction," Intel,
+ * 2009.
+ */
+
+#include "config.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define USE_X86_CRC_KERNELS 1
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "crc.h"
+
+namespace libdap {
+
+static const uint32_t crc32_polynomial = 0xedb88320;
+
+typedef uint32_t (*crc_kernel)(uint32_t crc, const uint8_t *data, size_t length);
+
+/**
+ * The slice-by-8 tables. Table 0 is the classic byte-at-a-time table; table
+ * k holds the CRC of a byte followed by k zero bytes.
+ */
+struct crc_tables {
+    uint32_t d_table[8][256];
+
+    crc_tables()
+    {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++j)
+                c = (c & 1) ? (c >> 1) ^ crc32_polynomial : c >> 1;
+            d_table[0][i] = c;
+        }
+
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int k = 1; k < 8; ++k)
+                d_table[k][i] = (d_table[k - 1][i] >> 8) ^ d_table[0][d_table[k - 1][i] & 0xff];
+    }
+};
+
+static const crc_tables &tables()
+{
+    static crc_tables t;
+    return t;
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+uint32_t crc32_update_bytewise(uint32_t crc, const uint8_t *data, size_t length)
+{
+    const uint32_t (&t0)[256] = tables().d_table[0];
+    while (length--)
+        crc = (crc >> 8) ^ t0[(crc ^ *data++) & 0xff];
+
+    return crc;
+}
+
+static uint32_t crc32_slice_by_8(uint32_t crc, const uint8_t *data, size_t length)
+{
+    const uint32_t (*t)[256] = tables().d_table;
+
+    while (length >= 8) {
+        uint32_t one = load_le32(data) ^ crc;
+        uint32_t two = load_le32(data + 4);
+        crc = t[7][one & 0xff] ^ t[6][(one >> 8) & 0xff] ^ t[5][(one >> 16) & 0xff] ^ t[4][one >> 24]
+            ^ t[3][two & 0xff] ^ t[2][(two >> 8) & 0xff] ^ t[1][(two >> 16) & 0xff] ^ t[0][two >> 24];
+        data += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+
+    return crc;
+}
+
+#if USE_X86_CRC_KERNELS
+
+// Fold 'length' bytes (a multiple of 16, at least 64) into 'crc'.
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *data, size_t length)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+    data += 64;
+    length -= 64;
+
+    // Fold four 128-bit lanes in parallel, 64 bytes per step
+    while (length >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)));
+
+        data += 64;
+        length -= 64;
+    }
+
+    // Fold the four lanes into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Fold any remaining 16-byte blocks
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data))), x5);
+
+        data += 16;
+        length -= 16;
+    }
+
+    // Fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t length)
+{
+    // Short buffers (most scalars) are faster with the tables
+    if (length >= 64) {
+        size_t blocks = length & ~static_cast<size_t>(15);
+        crc = crc32_fold_pclmul(crc, data, blocks);
+        data += blocks;
+        length -= blocks;
+    }
+
+    return crc32_slice_by_8(crc, data, length);
+}
+
+#endif // USE_X86_CRC_KERNELS
+
+/**
+ * The code used by crc32_update(); chosen once, the first time it is needed.
+ */
+struct crc_kernels {
+    crc_kernel d_update;
+    const char *d_name;
+
+    crc_kernels() : d_update(crc32_slice_by_8), d_name("slice-by-8")
+    {
+        // Build the tables now so that the first caller does not race to do it
+        tables();
+
+#if USE_X86_CRC_KERNELS
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL)) {
+            d_update = crc32_pclmul;
+            d_name = "pclmul";
+        }
+#endif
+    }
+};
+
+static const crc_kernels &kernels()
+{
+    static crc_kernels k;
+    return k;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length)
+{
+    return kernels().d_update(crc, data, length);
+}
+
+const char *crc32_kernels()
+{
+    return kernels().d_name;
+}
+
+} // namespace libdap
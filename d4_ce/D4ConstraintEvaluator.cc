@@ -43,16 +43,184 @@
 
 #include "D4RValue.h"
 #include "D4FilterClause.h"
+#include "CEParseCache.h"
 
 #include "parser.h"		// for get_ull()
 #include "debug.h"
 
 namespace libdap {
 
+/**
+ * The result of parsing a DAP4 constraint expression: the parser's calls to
+ * the evaluator's methods that change the DMR, with their arguments.
+ * Replaying the calls using another copy of the DMR has the same effect as
+ * parsing the expression again. Variables are recorded using their path
+ * from the root group (see CEParsePlan::find_path()).
+ */
+class D4ConstraintPlan : public CEParsePlan {
+public:
+	enum call {
+		mark,
+		mark_array,
+		slice,
+		filter
+	};
+
+private:
+	struct Action {
+		call d_call;
+		std::vector<int> d_path;	// The variable, unless d_call is slice
+		std::string d_name;			// The variable or the dimension
+		Type d_type;
+		std::vector<D4ConstraintEvaluator::index> d_indexes;
+		std::string d_op, d_arg1, d_arg2;	// For a filter
+
+		Action(call c) : d_call(c), d_type(dods_null_c) { }
+	};
+
+	std::vector<Action> d_actions;
+	bool d_cacheable;
+	bool d_result;
+
+public:
+	D4ConstraintPlan() : d_cacheable(true), d_result(false) { }
+	virtual ~D4ConstraintPlan() { }
+
+	bool cacheable() const { return d_cacheable; }
+	void set_result(bool r) { d_result = r; }
+
+	void add_var(call c, BaseType *btp, const D4ConstraintEvaluator &eval);
+	void add_slice(const std::string &id, const D4ConstraintEvaluator::index &i);
+	void add_filter(D4Sequence *s, const std::string &op, const std::string &arg1, const std::string &arg2,
+		const D4ConstraintEvaluator &eval);
+
+	bool replay(D4ConstraintEvaluator &eval) const;
+};
+
+void
+D4ConstraintPlan::add_var(call c, BaseType *btp, const D4ConstraintEvaluator &eval)
+{
+	Action a(c);
+	// Only variables in the DMR can be found in another copy of it
+	if (find_path(btp, a.d_path) != eval.dmr()->root())
+		d_cacheable = false;
+
+	a.d_name = btp->name();
+	a.d_type = btp->type();
+	a.d_indexes = eval.d_indexes;
+
+	d_actions.push_back(a);
+}
+
+void
+D4ConstraintPlan::add_slice(const std::string &id, const D4ConstraintEvaluator::index &i)
+{
+	Action a(slice);
+	a.d_name = id;
+	a.d_indexes.push_back(i);
+
+	d_actions.push_back(a);
+}
+
+void
+D4ConstraintPlan::add_filter(D4Sequence *s, const std::string &op, const std::string &arg1, const std::string &arg2,
+	const D4ConstraintEvaluator &eval)
+{
+	add_var(filter, s, eval);
+
+	Action &a = d_actions.back();
+	a.d_op = op;
+	a.d_arg1 = arg1;
+	a.d_arg2 = arg2;
+}
+
+/**
+ * Make the recorded calls using the evaluator's DMR.
+ * @return False, and the DMR is not changed, if one of the variables or
+ * dimensions cannot be found in the DMR.
+ */
+bool
+D4ConstraintPlan::replay(D4ConstraintEvaluator &eval) const
+{
+	D4Group *root = eval.dmr()->root();
+
+	std::vector<BaseType*> vars(d_actions.size(), 0);
+	for (std::vector<Action>::size_type i = 0; i < d_actions.size(); ++i) {
+		const Action &a = d_actions[i];
+		if (a.d_call == slice) {
+			if (!root->find_dim(a.d_name))
+				return false;
+		}
+		else {
+			vars[i] = follow_path(root, a.d_path);
+			if (!vars[i] || vars[i]->type() != a.d_type || vars[i]->name() != a.d_name)
+				return false;
+		}
+	}
+
+	for (std::vector<Action>::size_type i = 0; i < d_actions.size(); ++i) {
+		const Action &a = d_actions[i];
+		switch (a.d_call) {
+		case mark:
+			eval.d_indexes = a.d_indexes;
+			eval.m_mark_variable(vars[i]);
+			break;
+		case mark_array:
+			eval.d_indexes = a.d_indexes;
+			eval.m_mark_array_variable(vars[i]);
+			break;
+		case slice:
+			eval.m_slice_dimension(a.d_name, a.d_indexes.at(0));
+			break;
+		case filter:
+			eval.m_add_filter_clause(static_cast<D4Sequence*>(vars[i]), a.d_op, a.d_arg1, a.d_arg2);
+			break;
+		}
+	}
+
+	eval.set_result(d_result);
+	return true;
+}
+
+/**
+ * Parse a constraint expression and apply it to the DMR.
+ *
+ * If the evaluator has a parse cache (see set_parse_cache()) and the
+ * expression was parsed before for the same dataset, the saved result is
+ * applied to the DMR and the expression is not parsed again.
+ *
+ * @param expr The constraint expression
+ * @return True if the parse succeeded
+ * @exception Error if the expression is not valid for the DMR
+ */
 bool D4ConstraintEvaluator::parse(const std::string &expr)
 {
 	d_expr = expr;	// set for error messages. See the %initial-action section of .yy
 
+	std::string key;
+	if (d_parse_cache && d_dmr) {
+		key = "dap4\n" + d_dmr->filename() + "\n" + d_dmr->name() + "\n" + expr;
+
+		CEParsePlan *plan = d_parse_cache->find(key);
+		if (plan) {
+			D4ConstraintPlan *dap4_plan = dynamic_cast<D4ConstraintPlan*>(plan);
+			bool replayed;
+			try {
+				replayed = dap4_plan && dap4_plan->replay(*this);
+			}
+			catch (...) {
+				d_parse_cache->release(plan, false);
+				throw;
+			}
+
+			d_parse_cache->release(plan, replayed);
+			if (replayed)
+				return true;
+		}
+
+		d_plan = new D4ConstraintPlan;
+	}
+
 	std::istringstream iss(expr);
 	D4CEScanner scanner(iss);
 	D4CEParser parser(scanner, *this /* driver */);
@@ -62,7 +230,29 @@ bool D4ConstraintEvaluator::parse(const std::string &expr)
 		parser.set_debug_stream(std::cerr);
 	}
 
-	return parser.parse() == 0;
+	bool status;
+	try {
+		status = parser.parse() == 0;
+	}
+	catch (...) {
+		delete d_plan;
+		d_plan = 0;
+		throw;
+	}
+
+	if (d_plan) {
+		if (status && d_plan->cacheable()) {
+			d_plan->set_result(d_result);
+			d_parse_cache->insert(key, d_plan);
+		}
+		else {
+			delete d_plan;
+		}
+
+		d_plan = 0;
+	}
+
+	return status;
 }
 
 void
@@ -89,7 +279,7 @@ D4ConstraintEvaluator::search_for_and_mark_arrays(BaseType *btp)
 		switch ((*i)->type()) {
 		case dods_array_c:
 			DBG(cerr << "Found an array: " << (*i)->name() << endl);
-			mark_array_variable(*i);
+			m_mark_array_variable(*i);
 			break;
 		case dods_structure_c:
 		case dods_sequence_c:
@@ -116,12 +306,21 @@ D4ConstraintEvaluator::mark_variable(BaseType *btp)
 {
     assert(btp);
 
+    if (d_plan)
+        d_plan->add_var(D4ConstraintPlan::mark, btp, *this);
+
+    return m_mark_variable(btp);
+}
+
+BaseType *
+D4ConstraintEvaluator::m_mark_variable(BaseType *btp)
+{
     DBG(cerr << "In D4ConstraintEvaluator::mark_variable... (" << btp->name() << "; " << btp->type_name() << ")" << endl);
 
     btp->set_send_p(true);
 
     if (btp->type() == dods_array_c ) {
-    	mark_array_variable(btp);
+    	m_mark_array_variable(btp);
     }
 
     // Test for Constructors and marks arrays they contain
@@ -173,6 +372,17 @@ D4ConstraintEvaluator::mark_array_variable(BaseType *btp)
 {
 	assert(btp->type() == dods_array_c);
 
+	if (d_plan)
+		d_plan->add_var(D4ConstraintPlan::mark_array, btp, *this);
+
+	return m_mark_array_variable(btp);
+}
+
+BaseType *
+D4ConstraintEvaluator::m_mark_array_variable(BaseType *btp)
+{
+	assert(btp->type() == dods_array_c);
+
 	Array *a = static_cast<Array*>(btp);
 
 	// If an array appears in a CE without the slicing operators ([]) we still have to
@@ -265,6 +475,15 @@ D4ConstraintEvaluator::mark_array_variable(BaseType *btp)
  */
 D4Dimension *
 D4ConstraintEvaluator::slice_dimension(const std::string &id, const index &i)
+{
+    if (d_plan)
+        d_plan->add_slice(id, i);
+
+    return m_slice_dimension(id, i);
+}
+
+D4Dimension *
+D4ConstraintEvaluator::m_slice_dimension(const std::string &id, const index &i)
 {
     D4Dimension *dim = dmr()->root()->find_dim(id);
 
@@ -387,6 +606,16 @@ D4ConstraintEvaluator::add_filter_clause(const std::string &op, const std::strin
         throw Error(malformed_expr,
             "When a filter expression is used, it must be bound to a Sequence variable: " + expr_msg(op, arg1, arg2));
 
+    if (d_plan)
+        d_plan->add_filter(s, op, arg1, arg2, *this);
+
+    m_add_filter_clause(s, op, arg1, arg2);
+}
+
+void
+D4ConstraintEvaluator::m_add_filter_clause(D4Sequence *s, const std::string &op, const std::string &arg1,
+    const std::string &arg2)
+{
     DBG(cerr << "s->name(): " << s->name() << endl);
 
     // Check that arg1 and 2 are valid
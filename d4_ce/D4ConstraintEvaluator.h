@@ -39,6 +39,9 @@ class Array;
 class D4Dimension;
 class D4FilterClause;
 class D4FilterClauseList;
+class D4Sequence;
+class CEParseCache;
+class D4ConstraintPlan;
 
 /**
  * Driver for the DAP4 Constraint Expression parser.
@@ -90,6 +93,9 @@ class D4ConstraintEvaluator {
 
 	std::stack<BaseType*> d_basetype_stack;
 
+	CEParseCache *d_parse_cache;	// Weak pointer; may be null
+	D4ConstraintPlan *d_plan;		// Records the parse when there is a cache
+
 	// d_expr should be set by parse! Its value is used by the parser right before
 	// the actual parsing operation starts. jhrg 11/26/13
 	std::string *expression() { return &d_expr; }
@@ -100,6 +106,12 @@ class D4ConstraintEvaluator {
 
 	D4Dimension *slice_dimension(const std::string &id, const index &i);
 
+	// These do the work of the above methods; the parser's calls to those are
+	// recorded in d_plan, the evaluator's own calls to these are not.
+	BaseType *m_mark_variable(BaseType *btp);
+	BaseType *m_mark_array_variable(BaseType *btp);
+	D4Dimension *m_slice_dimension(const std::string &id, const index &i);
+
 	void push_index(const index &i) { d_indexes.push_back(i); }
 
 	void push_basetype(BaseType *btp) { d_basetype_stack.push(btp); }
@@ -112,12 +124,16 @@ class D4ConstraintEvaluator {
 
 	// Build FilterClauseList for filter clauses for a Sequence
 	void add_filter_clause(const std::string &op, const std::string &arg1, const std::string &arg2);
+	void m_add_filter_clause(D4Sequence *s, const std::string &op, const std::string &arg1, const std::string &arg2);
 
 	friend class D4CEParser;
+	friend class D4ConstraintPlan;
 
 public:
-	D4ConstraintEvaluator() : d_trace_scanning(false), d_trace_parsing(false), d_result(false), d_expr(""), d_dmr(0) { }
-	D4ConstraintEvaluator(DMR *dmr) : d_trace_scanning(false), d_trace_parsing(false), d_result(false), d_expr(""), d_dmr(dmr) { }
+	D4ConstraintEvaluator() : d_trace_scanning(false), d_trace_parsing(false), d_result(false), d_expr(""), d_dmr(0),
+		d_parse_cache(0), d_plan(0) { }
+	D4ConstraintEvaluator(DMR *dmr) : d_trace_scanning(false), d_trace_parsing(false), d_result(false), d_expr(""), d_dmr(dmr),
+		d_parse_cache(0), d_plan(0) { }
 
 	virtual ~D4ConstraintEvaluator() { }
 
@@ -135,6 +151,10 @@ public:
 	DMR *dmr() const { return d_dmr; }
 	void set_dmr(DMR *dmr) { d_dmr = dmr; }
 
+	/// Save parsed expressions in this cache; null (the default) for none
+	void set_parse_cache(CEParseCache *cache) { d_parse_cache = cache; }
+	CEParseCache *get_parse_cache() const { return d_parse_cache; }
+
 	void error(const libdap::location &l, const std::string &m);
 };
 
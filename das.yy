@@ -34,6 +34,11 @@
    generator to build a parser for the DAS. It assumes that a scanner called
    `daslex()' exists and that the objects DAS and AttrTable also exist.
 
+   The parser is pure and the scanner reentrant; the attribute table stack
+   and the type and name of the attribute being parsed are kept in a
+   das_parser_state that belongs to one call of dasparse(), so several DASs
+   may be parsed at once by different threads. Use das_parse_file().
+
    jhrg 7/12/94 
 */
 
@@ -50,6 +55,7 @@
 
 #include "DAS.h"
 #include "Error.h"
+#include "InternalErr.h"
 #include "util.h"
 #include "escaping.h"
 #include "debug.h"
@@ -78,28 +84,41 @@ using namespace libdap ;
 
 //#define YYPARSE_PARAM arg
 
-extern int das_line_num;	/* defined in das.lex */
+struct das_parser_state;
+
+int das_parse_file(FILE *in, parser_arg *arg);
 
 } // code requires
 
 %code {
 // No global static objects. We go through this every so often, I guess I
 // should learn... 1/24/2000 jhrg
-static string *name;	/* holds name in attr_pair rule */
-static string *type;	/* holds type in attr_pair rule */
+// The parser's state is held here, one instance for each DAS parsed.
+struct das_parser_state {
+    string *name;	/* holds name in attr_pair rule */
+    string *type;	/* holds type in attr_pair rule */
+
+    vector<AttrTable *> *attr_tab_stack;
 
-static vector<AttrTable *> *attr_tab_stack;
+    das_parser_state() : name(0), type(0), attr_tab_stack(0) {}
+    ~das_parser_state()
+    {
+        delete name;
+        delete type;
+        delete attr_tab_stack;
+    }
+};
 
 // I use a vector of AttrTable pointers for a stack
 
-#define TOP_OF_STACK (attr_tab_stack->back())
-#define PUSH(x) (attr_tab_stack->push_back((x)))
-#define POP (attr_tab_stack->pop_back())
-#define STACK_LENGTH (attr_tab_stack->size())
-#define OUTER_TABLE_ONLY (attr_tab_stack->size() == 1)
-#define STACK_EMPTY (attr_tab_stack->empty())
+#define TOP_OF_STACK (state->attr_tab_stack->back())
+#define PUSH(x) (state->attr_tab_stack->push_back((x)))
+#define POP (state->attr_tab_stack->pop_back())
+#define STACK_LENGTH (state->attr_tab_stack->size())
+#define OUTER_TABLE_ONLY (state->attr_tab_stack->size() == 1)
+#define STACK_EMPTY (state->attr_tab_stack->empty())
 
-#define TYPE_NAME_VALUE(x) *type << " " << *name << " " << (x)
+#define TYPE_NAME_VALUE(x) *state->type << " " << *state->name << " " << (x)
 
 static const char *ATTR_TUPLE_MSG = 
 "Expected an attribute type (Byte, Int16, UInt16, Int32, UInt32, Float32,\n\
@@ -110,11 +129,19 @@ Check that the URL is correct.";
 
 typedef int checker(const char *);
 
-int daslex(void);
-static void daserror(parser_arg *arg, const string &s /*char *s*/);
-static void add_attribute(const string &type, const string &name, 
+// These are defined by the reentrant scanner; see das.lex
+int daslex(YYSTYPE *lval, void *scanner);
+int daslex_init(void **scanner);
+int daslex_destroy(void *scanner);
+int dasget_lineno(void *scanner);
+void *das_buffer(FILE *fp, void *scanner);
+void das_switch_to_buffer(void *buf, void *scanner);
+void das_delete_buffer(void *buf, void *scanner);
+
+static void daserror(parser_arg *arg, das_parser_state *state, void *scanner, const string &s /*char *s*/);
+static void add_attribute(das_parser_state *state, void *scanner, const string &type, const string &name, 
 			  const string &value, checker *chk) throw (Error);
-static void add_alias(AttrTable *das, AttrTable *current, const string &name, 
+static void add_alias(void *scanner, AttrTable *das, AttrTable *current, const string &name, 
 		      const string &src) throw (Error);
 static void add_bad_attribute(AttrTable *attr, const string &type,
 			      const string &name, const string &value,
@@ -122,9 +149,11 @@ static void add_bad_attribute(AttrTable *attr, const string &type,
 
 } // code
 
-%require "2.4"
+%require "3.0"
 
-%parse-param {parser_arg *arg}
+%define api.pure full
+%parse-param {parser_arg *arg} {das_parser_state *state}
+%param {void *scanner}
 %name-prefix "das"
 %defines
 %debug
@@ -192,9 +221,9 @@ static void add_bad_attribute(AttrTable *attr, const string &type,
 
 attr_start:
 	{
-		if (!name) name = new string();
-		if (!type) type = new string();
-		if (!attr_tab_stack) attr_tab_stack = new vector<AttrTable *>;
+		if (!state->name) state->name = new string();
+		if (!state->type) state->type = new string();
+		if (!state->attr_tab_stack) state->attr_tab_stack = new vector<AttrTable *>;
 
 		// push outermost AttrTable
 		PUSH(DAS_OBJ(arg)->get_top_level_attributes());
@@ -202,9 +231,9 @@ attr_start:
     attributes
     {
 		POP;	// pop the DAS/AttrTable before stack's dtor
-		delete name; name = 0;
-		delete type; type = 0;
-		delete attr_tab_stack; attr_tab_stack = 0;
+		delete state->name; state->name = 0;
+		delete state->type; state->type = 0;
+		delete state->attr_tab_stack; state->attr_tab_stack = 0;
 	}
 ;
 
@@ -216,7 +245,7 @@ attributes:     attribute
 attribute:    	SCAN_ATTR '{' attr_list '}'
         | error
         {
-		    parse_error((parser_arg *)arg, NO_DAS_MSG, das_line_num);
+		    parse_error((parser_arg *)arg, NO_DAS_MSG, dasget_lineno(scanner));
 		}
 ;
 
@@ -227,44 +256,44 @@ attr_list:  	/* empty */
 
 attr_tuple:	alias
 
-        | SCAN_BYTE { save_str(*type, "Byte", das_line_num); }
-                name { save_str(*name, $3, das_line_num); } 
+        | SCAN_BYTE { save_str(*state->type, "Byte", dasget_lineno(scanner)); }
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		bytes ';'
 
-		| SCAN_INT16 { save_str(*type, "Int16", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_INT16 { save_str(*state->type, "Int16", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		int16 ';'
 
-		| SCAN_UINT16 { save_str(*type, "UInt16", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_UINT16 { save_str(*state->type, "UInt16", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		uint16 ';'
 
-		| SCAN_INT32 { save_str(*type, "Int32", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_INT32 { save_str(*state->type, "Int32", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		int32 ';'
 
-		| SCAN_UINT32 { save_str(*type, "UInt32", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_UINT32 { save_str(*state->type, "UInt32", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		uint32 ';'
 
-		| SCAN_FLOAT32 { save_str(*type, "Float32", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_FLOAT32 { save_str(*state->type, "Float32", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		float32 ';'
 
-		| SCAN_FLOAT64 { save_str(*type, "Float64", das_line_num); } 
-                name { save_str(*name, $3, das_line_num); } 
+		| SCAN_FLOAT64 { save_str(*state->type, "Float64", dasget_lineno(scanner)); } 
+                name { save_str(*state->name, $3, dasget_lineno(scanner)); } 
 		float64 ';'
 
-		| SCAN_STRING { *type = "String"; } 
-                name { *name = $3; } 
+		| SCAN_STRING { *state->type = "String"; } 
+                name { *state->name = $3; } 
 		strs ';'
 
-                | SCAN_URL { *type = "Url"; } 
-                name { *name = $3; } 
+                | SCAN_URL { *state->type = "Url"; } 
+                name { *state->name = $3; } 
                 urls ';'
 
-                | SCAN_XML { *type = "OtherXML"; } 
-                name { *name = $3; } 
+                | SCAN_XML { *state->type = "OtherXML"; } 
+                name { *state->name = $3; } 
                 xml ';'
 
 		| SCAN_WORD
@@ -279,7 +308,7 @@ attr_tuple:	alias
 			catch (Error &e) {
 			    // re-throw with line number info
 			    parse_error(e.get_error_message().c_str(), 
-					das_line_num);
+					dasget_lineno(scanner));
 			}
 		    }
 		    PUSH(at);
@@ -297,99 +326,99 @@ attr_tuple:	alias
 
 		| error 
                 { 
-		    parse_error(ATTR_TUPLE_MSG, das_line_num, $1);
+		    parse_error(ATTR_TUPLE_MSG, dasget_lineno(scanner), $1);
 		} ';'
 ;
 
 bytes:		SCAN_WORD
 		{
-		    add_attribute(*type, *name, $1, &check_byte);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_byte);
 		}
 		| bytes ',' SCAN_WORD
 		{
-		    add_attribute(*type, *name, $3, &check_byte);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_byte);
 		}
 ;
 
 int16:		SCAN_WORD
 		{
-		    add_attribute(*type, *name, $1, &check_int16);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_int16);
 		}
 		| int16 ',' SCAN_WORD
 		{
-		    add_attribute(*type, *name, $3, &check_int16);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_int16);
 		}
 ;
 
 uint16:		SCAN_WORD
 		{
-		    add_attribute(*type, *name, $1, &check_uint16);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_uint16);
 		}
 		| uint16 ',' SCAN_WORD
 		{
-		    add_attribute(*type, *name, $3, &check_uint16);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_uint16);
 		}
 ;
 
 int32:		SCAN_WORD
 		{
-		    add_attribute(*type, *name, $1, &check_int32);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_int32);
 		}
 		| int32 ',' SCAN_WORD
 		{
-		    add_attribute(*type, *name, $3, &check_int32);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_int32);
 		}
 ;
 
 uint32:		SCAN_WORD
 		{
-		    add_attribute(*type, *name, $1, &check_uint32);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_uint32);
 		}
 		| uint32 ',' SCAN_WORD
 		{
-		    add_attribute(*type, *name, $3, &check_uint32);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_uint32);
 		}
 ;
 
 float32:	float_or_int
 		{
-		    add_attribute(*type, *name, $1, &check_float32);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_float32);
 		}
 		| float32 ',' float_or_int
 		{
-		    add_attribute(*type, *name, $3, &check_float32);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_float32);
 		}
 ;
 
 float64:	float_or_int
 		{
-		    add_attribute(*type, *name, $1, &check_float64);
+		    add_attribute(state, scanner, *state->type, *state->name, $1, &check_float64);
 		}
 		| float64 ',' float_or_int
 		{
-		    add_attribute(*type, *name, $3, &check_float64);
+		    add_attribute(state, scanner, *state->type, *state->name, $3, &check_float64);
 		}
 ;
 
 strs:		str_or_id
 		{
 		    string attr = remove_quotes($1);
-		    add_attribute(*type, *name, attr, 0);
+		    add_attribute(state, scanner, *state->type, *state->name, attr, 0);
 		}
 		| strs ',' str_or_id
 		{
 		    string attr = remove_quotes($3);
-		    add_attribute(*type, *name, attr, 0);
+		    add_attribute(state, scanner, *state->type, *state->name, attr, 0);
 		}
 ;
 
 urls:           url
                 {
-                    add_attribute(*type, *name, $1, &check_url);
+                    add_attribute(state, scanner, *state->type, *state->name, $1, &check_url);
                 }
                 | urls ',' url
                 {
-                    add_attribute(*type, *name, $3, &check_url);
+                    add_attribute(state, scanner, *state->type, *state->name, $3, &check_url);
                 }
 ;
 
@@ -401,9 +430,9 @@ xml:            SCAN_WORD
                     string xml = unescape_double_quotes($1);
                     
                     if (is_quoted(xml))
-                        add_attribute(*type, *name, remove_quotes(xml), 0);
+                        add_attribute(state, scanner, *state->type, *state->name, remove_quotes(xml), 0);
                     else
-                        add_attribute(*type, *name, xml, 0);
+                        add_attribute(state, scanner, *state->type, *state->name, xml, 0);
                 }
 ;
 
@@ -423,12 +452,12 @@ name:           SCAN_WORD | SCAN_ATTR | SCAN_ALIAS | SCAN_BYTE | SCAN_INT16
 
 alias:          SCAN_ALIAS SCAN_WORD
                 { 
-		    *name = $2;
+		    *state->name = $2;
 		} 
                 SCAN_WORD
                 {
-		    add_alias( DAS_OBJ(arg)->get_top_level_attributes(),
-		               TOP_OF_STACK, *name, string($4) ) ;
+		    add_alias(scanner, DAS_OBJ(arg)->get_top_level_attributes(),
+		               TOP_OF_STACK, *state->name, string($4) ) ;
                 }
                 ';'
 ;
@@ -439,8 +468,42 @@ alias:          SCAN_ALIAS SCAN_WORD
 // reporting mechanism.
 
 static void
-daserror(parser_arg *, const string &)
+daserror(parser_arg *, das_parser_state *, void *, const string &)
+{
+}
+
+/*
+ Parse a DAS read from IN and store the attributes in the DAS held by ARG.
+ Each call uses its own scanner and parser state, so DASs may be parsed by
+ several threads at once.
+
+ Returns: the value returned by dasparse().
+ */
+
+int das_parse_file(FILE *in, parser_arg *arg)
 {
+    void *scanner;
+    if (daslex_init(&scanner) != 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not make the DAS scanner.");
+
+    void *buffer = das_buffer(in, scanner);
+    das_switch_to_buffer(buffer, scanner);
+
+    das_parser_state state;
+    int status;
+    try {
+        status = dasparse(arg, &state, scanner);
+    }
+    catch (...) {
+        das_delete_buffer(buffer, scanner);
+        daslex_destroy(scanner);
+        throw;
+    }
+
+    das_delete_buffer(buffer, scanner);
+    daslex_destroy(scanner);
+
+    return status;
 }
 
 static string
@@ -460,7 +523,7 @@ a_or_an(const string &subject)
 // and stores the parser's error message in a string attribute named
 // `explanation.' 
 static void
-add_attribute(const string &type, const string &name, const string &value,
+add_attribute(das_parser_state *state, void *scanner, const string &type, const string &name, const string &value,
 	      checker *chk) throw (Error)
 {
     DBG(cerr << "Adding: " << type << " " << name << " " << value \
@@ -476,7 +539,7 @@ add_attribute(const string &type, const string &name, const string &value,
     if (STACK_EMPTY) {
 		string msg = "Whoa! Attribute table stack empty when adding `" ;
 		msg += name + ".' ";
-		parse_error(msg, das_line_num);
+		parse_error(msg, dasget_lineno(scanner));
     }
     
     try {
@@ -491,12 +554,12 @@ add_attribute(const string &type, const string &name, const string &value,
     }
     catch (Error &e) {
 	 	// re-throw with line number
-		parse_error(e.get_error_message().c_str(), das_line_num);
+		parse_error(e.get_error_message().c_str(), dasget_lineno(scanner));
     }
 }
 
 static void
-add_alias(AttrTable *das, AttrTable *current, const string &name, 
+add_alias(void *scanner, AttrTable *das, AttrTable *current, const string &name, 
 	  const string &src) throw (Error)
 {
     DBG(cerr << "Adding an alias: " << name << ": " << src << endl);
@@ -507,7 +570,7 @@ add_alias(AttrTable *das, AttrTable *current, const string &name,
 	    current->add_container_alias(name, table);
 	}
 	catch (Error &e) {
-	    parse_error(e.get_error_message().c_str(), das_line_num);
+	    parse_error(e.get_error_message().c_str(), dasget_lineno(scanner));
 	}
     }
     else {
@@ -515,7 +578,7 @@ add_alias(AttrTable *das, AttrTable *current, const string &name,
 	    current->add_value_alias(das, name, src);
 	}
 	catch (Error &e) {
-	    parse_error(e.get_error_message().c_str(), das_line_num);
+	    parse_error(e.get_error_message().c_str(), dasget_lineno(scanner));
 	}
     }
 }
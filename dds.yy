@@ -34,12 +34,13 @@
    generator to build a parser for the DDS. It assumes that a scanner called
    `ddslex()' exists and returns several token types (see das.tab.h)
    in addition to several single character token types. The matched lexeme
-   for an ID is stored by the scanner in a global char * `ddslval'.
-   Because the scanner returns a value via this global and because the parser
-   stores ddslval (not the information pointed to), the values of rule
-   components must be stored as they are parsed and used once accumulated at
-   or near the end of a rule. If ddslval returned a value (instead of a
-   pointer to a value) this would not be necessary.
+   for an ID is stored by the scanner in the `word' field of the YYSTYPE it
+   is passed.
+
+   The parser is pure and the scanner reentrant. The values of rule
+   components that are accumulated while a declaration is parsed are kept
+   in a dds_parser_state that belongs to one call of ddsparse(), so several
+   DDSs may be parsed at once by different threads. Use dds_parse_file().
 
    jhrg 8/29/94 
 */
@@ -70,6 +71,7 @@
 
 #include "DDS.h"
 #include "Error.h"
+#include "InternalErr.h"
 #include "parser.h"
 #include "util.h"
 
@@ -86,17 +88,36 @@ using namespace libdap;
 
 // #define YYPARSE_PARAM arg
 
-extern int dds_line_num;	/* defined in dds.lex */
+struct dds_parser_state;
+
+int dds_parse_file(FILE *in, parser_arg *arg);
 
 } // code requires
 
 %code {
 
 // No global static objects in the dap library! 1/24/2000 jhrg
-static stack<BaseType *> *ctor;
-static BaseType *current;
-static string *id;
-static Part part = nil;		/* Part is defined in BaseType */
+// The parser's state is held here, one instance for each DDS parsed.
+struct dds_parser_state {
+    stack<BaseType *> *ctor;
+    BaseType *current;
+    string *id;
+    Part part;		/* Part is defined in BaseType */
+
+    dds_parser_state() : ctor(0), current(0), id(0), part(nil) {}
+    ~dds_parser_state()
+    {
+        delete id;
+        delete current;
+        if (ctor) {
+            while (!ctor->empty()) {
+                delete ctor->top();
+                ctor->pop();
+            }
+            delete ctor;
+        }
+    }
+};
 
 static const char *NO_DDS_MSG =
 "The descriptor object returned from the dataset was null.\n\
@@ -108,19 +129,29 @@ static const char *BAD_DECLARATION =
 of a datatype and that the Array: and Maps: sections of a Grid are\n\
 labeled properly.";
 
-int ddslex();
-void ddserror(parser_arg *arg, const string &s /*char *s*/);
-void error_exit_cleanup();
+// These are defined by the reentrant scanner; see dds.lex
+int ddslex(YYSTYPE *lval, void *scanner);
+int ddslex_init(void **scanner);
+int ddslex_destroy(void *scanner);
+int ddsget_lineno(void *scanner);
+void *dds_buffer(FILE *fp, void *scanner);
+void dds_switch_to_buffer(void *buf, void *scanner);
+void dds_delete_buffer(void *buf, void *scanner);
+
+void ddserror(parser_arg *arg, dds_parser_state *state, void *scanner, const string &s /*char *s*/);
+void error_exit_cleanup(dds_parser_state *state);
 void add_entry(DDS &table, stack<BaseType *> **ctor, BaseType **current, 
 	       Part p);
-void invalid_declaration(parser_arg *arg, string semantic_err_msg, 
+void invalid_declaration(parser_arg *arg, void *scanner, string semantic_err_msg, 
 			 char *type, char *name);
 
 } // code
 
-%require "2.4"
+%require "3.0"
 
-%parse-param {parser_arg *arg}
+%define api.pure full
+%parse-param {parser_arg *arg} {dds_parser_state *state}
+%param {void *scanner}
 %name-prefix "dds"
 %defines
 %debug
@@ -159,17 +190,17 @@ void invalid_declaration(parser_arg *arg, string semantic_err_msg,
 start:
         {
 		    /* On entry to the parser, make the BaseType stack. 
-		       I use if (!ctor) here because in the tab.cc file,
+		       I use if (!state->ctor) here because in the tab.cc file,
 		       this is a case block in a switch, so it could be
 		       run more than once, causing the storage to be
 		       overwritten. jhrg 6/26/15 */
 		       
-		    if (!ctor)
-		    	ctor = new stack<BaseType *>;
+		    if (!state->ctor)
+		    	state->ctor = new stack<BaseType *>;
         }
         datasets
         {
-		    delete ctor; ctor = 0;
+		    delete state->ctor; state->ctor = 0;
 		}
 ;
 
@@ -183,8 +214,8 @@ dataset:	SCAN_DATASET '{' declarations '}' name ';'
 		}
         | error
         {
-		    parse_error((parser_arg *)arg, NO_DDS_MSG, dds_line_num, $<word>1);
-		    error_exit_cleanup();
+		    parse_error((parser_arg *)arg, NO_DDS_MSG, ddsget_lineno(scanner), $<word>1);
+		    error_exit_cleanup(state);
 		    YYABORT;
 		}
 ;
@@ -206,11 +237,11 @@ declarations:	/* empty */
 declaration:  base_type var ';' 
         { 
 		    string smsg;
-		    if (current->check_semantics(smsg)) {
-			    add_entry(*DDS_OBJ(arg), &ctor, &current, part); 
+		    if (state->current->check_semantics(smsg)) {
+			    add_entry(*DDS_OBJ(arg), &state->ctor, &state->current, state->part); 
 		    } else {
-		      invalid_declaration((parser_arg *)arg, smsg, $1, $2);
-		      error_exit_cleanup();
+		      invalid_declaration((parser_arg *)arg, scanner, smsg, $1, $2);
+		      error_exit_cleanup(state);
 		      YYABORT;
 		    }
             strncpy($$,$2,ID_MAX);
@@ -219,19 +250,19 @@ declaration:  base_type var ';'
 
 		| structure  '{' declarations '}' 
 		{ 
-		    if( current ) delete current ;
-		    current = ctor->top(); 
-		    ctor->pop();
+		    if( state->current ) delete state->current ;
+		    state->current = state->ctor->top(); 
+		    state->ctor->pop();
 		} 
         var ';' 
         { 
 		    string smsg;
-		    if (current->check_semantics(smsg)) {
-			    add_entry(*DDS_OBJ(arg), &ctor, &current, part); 
+		    if (state->current->check_semantics(smsg)) {
+			    add_entry(*DDS_OBJ(arg), &state->ctor, &state->current, state->part); 
 			}
 		    else {
-		        invalid_declaration((parser_arg *)arg, smsg, $1, $6);
-		        error_exit_cleanup();
+		        invalid_declaration((parser_arg *)arg, scanner, smsg, $1, $6);
+		        error_exit_cleanup(state);
 		        YYABORT;
 		    }
             strncpy($$,$6,ID_MAX);
@@ -240,19 +271,19 @@ declaration:  base_type var ';'
 
 		| sequence '{' declarations '}' 
         { 
-		    if( current ) delete current ;
-		    current = ctor->top(); 
-		    ctor->pop();
+		    if( state->current ) delete state->current ;
+		    state->current = state->ctor->top(); 
+		    state->ctor->pop();
 		} 
         var ';' 
         { 
 		    string smsg;
-		    if (current->check_semantics(smsg)) {
-			    add_entry(*DDS_OBJ(arg), &ctor, &current, part); 
+		    if (state->current->check_semantics(smsg)) {
+			    add_entry(*DDS_OBJ(arg), &state->ctor, &state->current, state->part); 
 			}
 		    else {
-		      invalid_declaration((parser_arg *)arg, smsg, $1, $6);
-		      error_exit_cleanup();
+		      invalid_declaration((parser_arg *)arg, scanner, smsg, $1, $6);
+		      error_exit_cleanup(state);
 		      YYABORT;
 		    }
             strncpy($$,$6,ID_MAX);
@@ -262,43 +293,43 @@ declaration:  base_type var ';'
 		| grid '{' SCAN_WORD ':'
 		{ 
 		    if (is_keyword(string($3), "array")) {
-			    part = libdap::array;
+			    state->part = libdap::array;
 			}
 		    else {
 			    ostringstream msg;
 			    msg << BAD_DECLARATION;
-			    parse_error((parser_arg *)arg, msg.str().c_str(), dds_line_num, $3);
+			    parse_error((parser_arg *)arg, msg.str().c_str(), ddsget_lineno(scanner), $3);
 			    YYABORT;
 		    }
         }
         declaration SCAN_WORD ':'
 		{ 
 		    if (is_keyword(string($7), "maps")) {
-			    part = maps; 
+			    state->part = maps; 
 			}
 		    else {
 			    ostringstream msg;
 			    msg << BAD_DECLARATION;
-			    parse_error((parser_arg *)arg, msg.str().c_str(), dds_line_num, $7);
+			    parse_error((parser_arg *)arg, msg.str().c_str(), ddsget_lineno(scanner), $7);
 			    YYABORT;
 		    }
         }
         declarations '}' 
 		{
-		    if( current ) delete current ;
-		    current = ctor->top(); 
-		    ctor->pop();
+		    if( state->current ) delete state->current ;
+		    state->current = state->ctor->top(); 
+		    state->ctor->pop();
 		}
         var ';' 
         {
 		    string smsg;
-		    if (current->check_semantics(smsg)) {
-			    part = nil; 
-			    add_entry(*DDS_OBJ(arg), &ctor, &current, part); 
+		    if (state->current->check_semantics(smsg)) {
+			    state->part = nil; 
+			    add_entry(*DDS_OBJ(arg), &state->ctor, &state->current, state->part); 
 		    }
 		    else {
-		      invalid_declaration((parser_arg *)arg, smsg, $1, $13);
-		      error_exit_cleanup();
+		      invalid_declaration((parser_arg *)arg, scanner, smsg, $1, $13);
+		      error_exit_cleanup(state);
 		      YYABORT;
 		    }
         strncpy($$,$13,ID_MAX);
@@ -309,7 +340,7 @@ declaration:  base_type var ';'
         {
 		    ostringstream msg;
 		    msg << BAD_DECLARATION;
-		    parse_error((parser_arg *)arg, msg.str().c_str(), dds_line_num, $<word>1);
+		    parse_error((parser_arg *)arg, msg.str().c_str(), ddsget_lineno(scanner), $<word>1);
 		    YYABORT;
 		}
 ;
@@ -317,34 +348,34 @@ declaration:  base_type var ';'
 
 structure:	SCAN_STRUCTURE
 		{ 
-		    ctor->push(DDS_OBJ(arg)->get_factory()->NewStructure()); 
+		    state->ctor->push(DDS_OBJ(arg)->get_factory()->NewStructure()); 
 		}
 ;
 
 sequence:	SCAN_SEQUENCE 
 		{ 
-		    ctor->push(DDS_OBJ(arg)->get_factory()->NewSequence()); 
+		    state->ctor->push(DDS_OBJ(arg)->get_factory()->NewSequence()); 
 		}
 ;
 
 grid:		SCAN_GRID 
 		{ 
-		    ctor->push(DDS_OBJ(arg)->get_factory()->NewGrid()); 
+		    state->ctor->push(DDS_OBJ(arg)->get_factory()->NewGrid()); 
 		}
 ;
 
-base_type:	SCAN_BYTE { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewByte(); }
-		| SCAN_INT16 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewInt16(); }
-		| SCAN_UINT16 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewUInt16(); }
-		| SCAN_INT32 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewInt32(); }
-		| SCAN_UINT32 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewUInt32(); }
-		| SCAN_FLOAT32 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewFloat32(); }
-		| SCAN_FLOAT64 { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewFloat64(); }
-		| SCAN_STRING { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewStr(); }
-		| SCAN_URL { if( current ) delete current ;current = DDS_OBJ(arg)->get_factory()->NewUrl(); }
+base_type:	SCAN_BYTE { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewByte(); }
+		| SCAN_INT16 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewInt16(); }
+		| SCAN_UINT16 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewUInt16(); }
+		| SCAN_INT32 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewInt32(); }
+		| SCAN_UINT32 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewUInt32(); }
+		| SCAN_FLOAT32 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewFloat32(); }
+		| SCAN_FLOAT64 { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewFloat64(); }
+		| SCAN_STRING { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewStr(); }
+		| SCAN_URL { if( state->current ) delete state->current ;state->current = DDS_OBJ(arg)->get_factory()->NewUrl(); }
 ;
 
-var:		var_name { current->set_name($1); }
+var:		var_name { state->current->set_name($1); }
  		| var array_decl
 ;
 
@@ -359,17 +390,17 @@ array_decl:	'[' SCAN_WORD ']'
 		    if (!check_int32($2)) {
 			    string msg = "In the dataset descriptor object:\n";
 			    msg += "Expected an array subscript.\n";
-			    parse_error((parser_arg *)arg, msg.c_str(), dds_line_num, $2);
+			    parse_error((parser_arg *)arg, msg.c_str(), ddsget_lineno(scanner), $2);
 		    }
-		    if (current->type() == dods_array_c && check_int32($2)) {
-			    ((Array *)current)->append_dim(atoi($2));
+		    if (state->current->type() == dods_array_c && check_int32($2)) {
+			    ((Array *)state->current)->append_dim(atoi($2));
 		    }
 		    else {
 			    Array *a = DDS_OBJ(arg)->get_factory()->NewArray(); 
-			    a->add_var(current); 
+			    a->add_var(state->current); 
 			    a->append_dim(atoi($2));
-			    if( current ) delete current ;
-			    current = a;
+			    if( state->current ) delete state->current ;
+			    state->current = a;
 		    }
 
 		    $$ = true;
@@ -377,29 +408,29 @@ array_decl:	'[' SCAN_WORD ']'
 
 		 | '[' SCAN_WORD 
 		 {
-		     if (!id) id = new string($2);
+		     if (!state->id) state->id = new string($2);
 		 } 
          '=' SCAN_WORD 
          { 
 		     if (!check_int32($5)) {
 			     string msg = "In the dataset descriptor object:\n";
 			     msg += "Expected an array subscript.\n";
-			     parse_error((parser_arg *)arg, msg.c_str(), dds_line_num, $5);
-			     error_exit_cleanup();
+			     parse_error((parser_arg *)arg, msg.c_str(), ddsget_lineno(scanner), $5);
+			     error_exit_cleanup(state);
 			     YYABORT;
 		     }
-		     if (current->type() == dods_array_c) {
-			     ((Array *)current)->append_dim(atoi($5), *id);
+		     if (state->current->type() == dods_array_c) {
+			     ((Array *)state->current)->append_dim(atoi($5), *state->id);
 		     }
 		     else {
 			     Array *a = DDS_OBJ(arg)->get_factory()->NewArray(); 
-			     a->add_var(current); 
-			     a->append_dim(atoi($5), *id);
-			     if( current ) delete current ;
-			     current = a;
+			     a->add_var(state->current); 
+			     a->append_dim(atoi($5), *state->id);
+			     if( state->current ) delete state->current ;
+			     state->current = a;
 		     }
 
-		     delete id; id = 0;
+		     delete state->id; state->id = 0;
 		 }
 		 ']'
          {
@@ -411,7 +442,7 @@ array_decl:	'[' SCAN_WORD ']'
 		     ostringstream msg;
 		     msg << "In the dataset descriptor object:" << endl
 			     << "Expected an array subscript." << endl;
-		     parse_error((parser_arg *)arg, msg.str().c_str(), dds_line_num, $<word>1);
+		     parse_error((parser_arg *)arg, msg.str().c_str(), ddsget_lineno(scanner), $<word>1);
 		     YYABORT;
 		 }
 ;
@@ -423,7 +454,7 @@ name:		var_name { (*DDS_OBJ(arg)).set_dataset_name($1); $$ = true;}
 		    ostringstream msg;
 		    msg << "Error parsing the dataset name." << endl
 		        << "The name may be missing or may contain an illegal character." << endl;
-		    parse_error((parser_arg *)arg, msg.str().c_str(), dds_line_num, $<word>1);
+		    parse_error((parser_arg *)arg, msg.str().c_str(), ddsget_lineno(scanner), $<word>1);
 		    YYABORT;
 		}
 ;
@@ -436,35 +467,69 @@ name:		var_name { (*DDS_OBJ(arg)).set_dataset_name($1); $$ = true;}
  */
 
 void
-ddserror(parser_arg *, const string &)
+ddserror(parser_arg *, dds_parser_state *, void *, const string &)
 {
 }
 
+/*
+ Parse a DDS read from IN and store the variables in the DDS held by ARG.
+ Each call uses its own scanner and parser state, so DDSs may be parsed by
+ several threads at once.
+
+ Returns: the value returned by ddsparse().
+ */
+
+int dds_parse_file(FILE *in, parser_arg *arg)
+{
+    void *scanner;
+    if (ddslex_init(&scanner) != 0)
+        throw InternalErr(__FILE__, __LINE__, "Could not make the DDS scanner.");
+
+    void *buffer = dds_buffer(in, scanner);
+    dds_switch_to_buffer(buffer, scanner);
+
+    dds_parser_state state;
+    int status;
+    try {
+        status = ddsparse(arg, &state, scanner);
+    }
+    catch (...) {
+        dds_delete_buffer(buffer, scanner);
+        ddslex_destroy(scanner);
+        throw;
+    }
+
+    dds_delete_buffer(buffer, scanner);
+    ddslex_destroy(scanner);
+
+    return status;
+}
+
 /*
  Error clean up. Call this before calling YYBORT. Don't call this on a
  normal exit.
  */
 
-void error_exit_cleanup()
+void error_exit_cleanup(dds_parser_state *state)
 {
-    delete id;
-    id = 0;
-    delete current;
-    current = 0;
-    delete ctor;
-    ctor = 0;
+    delete state->id;
+    state->id = 0;
+    delete state->current;
+    state->current = 0;
+    delete state->ctor;
+    state->ctor = 0;
 }
 
 /*
  Invalid declaration message.
  */
 
-void invalid_declaration(parser_arg *arg, string semantic_err_msg, char *type, char *name)
+void invalid_declaration(parser_arg *arg, void *scanner, string semantic_err_msg, char *type, char *name)
 {
     ostringstream msg;
     msg << "In the dataset descriptor object: `" << type << " " << name << "'" << endl << "is not a valid declaration."
             << endl << semantic_err_msg;
-    parse_error((parser_arg *) arg, msg.str().c_str(), dds_line_num);
+    parse_error((parser_arg *) arg, msg.str().c_str(), ddsget_lineno(scanner));
 }
 
 /*
@@ -154,6 +154,7 @@ void D4ResponseBuilder::send_dap(ostream &out, DMR &dmr, bool with_mime_headers,
 
 	    // Write the data, chunked with checksums
 	    D4StreamMarshaller m(cos);
+	    m.set_vector_filter(dmr.vector_filter());
 	    dmr.root()->serialize(m, dmr, constrained);
 
 		out << flush;
@@ -56,7 +56,9 @@ void load_attr_table_ptr(AttrTable *atp);
 void parser_driver(DAS &das, bool deref_alias, bool as_xml);
 void test_scanner();
 
-int daslex();
+int daslex(YYSTYPE *lval, void *scanner);
+int daslex_init(void **scanner);
+int daslex_destroy(void *scanner);
 
 extern int dasdebug;
 const char *prompt = "das-test: ";
@@ -148,11 +150,15 @@ int main(int argc, char *argv[])
 void
 test_scanner()
 {
+    void *scanner;
+    daslex_init(&scanner);	// reads from stdin
+
+    YYSTYPE lval;
     int tok;
 
     fprintf( stdout, "%s", prompt ) ; // first prompt
     fflush( stdout ) ;
-    while ((tok = daslex())) {
+    while ((tok = daslex(&lval, scanner))) {
 	switch (tok) {
 	  case SCAN_ATTR:
 	    fprintf( stdout, "ATTR\n" ) ;
@@ -161,7 +167,7 @@ test_scanner()
 	    fprintf( stdout, "ALIAS\n" ) ;
 	    break;
 	  case SCAN_WORD:
-	    fprintf( stdout, "WORD=%s\n", daslval ) ;
+	    fprintf( stdout, "WORD=%s\n", lval ) ;
 	    break;
 
 	  case SCAN_BYTE:
@@ -216,6 +222,8 @@ test_scanner()
 	fprintf( stdout, "%s", prompt ) ; // print prompt after output
 	fflush( stdout ) ;
     }
+
+    daslex_destroy(scanner);
 }
 
 
@@ -62,10 +62,10 @@ void test_class();
 void test_dap4_parser(const string &name);
 #endif
 
-int ddslex();
-// int ddsparse(DDS &);
+int ddslex(YYSTYPE *lval, void *scanner);
+int ddslex_init(void **scanner);
+int ddslex_destroy(void *scanner);
 
-extern YYSTYPE ddslval;
 extern int ddsdebug;
 static bool print_ddx = false;
 
@@ -160,11 +160,15 @@ int main(int argc, char *argv[]) {
 }
 
 void test_scanner(void) {
+    void *scanner;
+    ddslex_init(&scanner);  // reads from stdin
+
+    YYSTYPE lval;
     int tok;
 
     cout << prompt << flush; // first prompt
 
-    while ((tok = ddslex())) {
+    while ((tok = ddslex(&lval, scanner))) {
         switch (tok) {
         case SCAN_DATASET:
             cout << "DATASET" << endl;
@@ -212,7 +216,7 @@ void test_scanner(void) {
             cout << "Url" << endl;
             break;
         case SCAN_WORD:
-            cout << "WORD: " << ddslval.word << endl;
+            cout << "WORD: " << lval.word << endl;
             break;
         case '{':
             cout << "Left Brace" << endl;
@@ -241,6 +245,8 @@ void test_scanner(void) {
         }
         cout << prompt << flush; // print prompt after output
     }
+
+    ddslex_destroy(scanner);
 }
 
 void test_parser(const string &name) {
@@ -264,6 +264,7 @@ read_data_plain(const string &file_name, bool debug)
     }
 
     D4StreamUnMarshaller um(cis, cis.twiddle_bytes());
+    um.set_vector_filter(dmr->vector_filter());
 
     dmr->root()->deserialize(um, *dmr);
 
@@ -86,7 +86,7 @@ int test_variable_sleep_interval = 0;   // Used in Test* classes for testing
 #define YY_BUFFER_STATE (void *)
 
 void test_scanner(const string & str);
-void test_scanner(bool show_prompt);
+void test_scanner(bool show_prompt, void *scanner);
 void test_parser(ConstraintEvaluator & eval, DDS & table,
                  const string & dds_name, string constraint);
 bool read_table(DDS & table, const string & name, bool print);
@@ -96,14 +96,14 @@ void constrained_trans(const string & dds_name, const bool constraint_expr,
 void intern_data_test(const string & dds_name, const bool constraint_expr,
                  const string & ce, const bool series_values);
 
-int ce_exprlex();               // exprlex() uses the global ce_exprlval
-// int ce_exprparse(void *arg);
-void ce_exprrestart(FILE * in);
+int ce_exprlex(YYSTYPE *lval, void *scanner);
+int ce_exprlex_init(void **scanner);
+int ce_exprlex_destroy(void *scanner);
 
 // Glue routines declared in expr.lex
-void ce_expr_switch_to_buffer(void *new_buffer);
-void ce_expr_delete_buffer(void *buffer);
-void *ce_expr_string(const char *yy_str);
+void ce_expr_switch_to_buffer(void *new_buffer, void *scanner);
+void ce_expr_delete_buffer(void *buffer, void *scanner);
+void *ce_expr_string(const char *yy_str, void *scanner);
 
 extern int ce_exprdebug;
 
@@ -236,10 +236,15 @@ int main(int argc, char *argv[])
         // run selected tests
 
         if (scanner_test) {
-            if (scan_string)
+            if (scan_string) {
                 test_scanner(constraint);
-            else
-                test_scanner(true);
+            }
+            else {
+                void *scanner;
+                ce_exprlex_init(&scanner);  // reads from stdin
+                test_scanner(true, scanner);
+                ce_exprlex_destroy(scanner);
+            }
 
             exit(0);
         }
@@ -277,52 +282,55 @@ int main(int argc, char *argv[])
 
 void test_scanner(const string & str)
 {
-    ce_exprrestart(0);
-    void *buffer = ce_expr_string(str.c_str());
-    ce_expr_switch_to_buffer(buffer);
+    void *scanner;
+    ce_exprlex_init(&scanner);
+    void *buffer = ce_expr_string(str.c_str(), scanner);
+    ce_expr_switch_to_buffer(buffer, scanner);
 
-    test_scanner(false);
+    test_scanner(false, scanner);
 
-    ce_expr_delete_buffer(buffer);
+    ce_expr_delete_buffer(buffer, scanner);
+    ce_exprlex_destroy(scanner);
 }
 
-void test_scanner(bool show_prompt)
+void test_scanner(bool show_prompt, void *scanner)
 {
     if (show_prompt)
         cout << prompt;
 
+    YYSTYPE lval;
     int tok;
-    while ((tok = ce_exprlex())) {
+    while ((tok = ce_exprlex(&lval, scanner))) {
         switch (tok) {
         case SCAN_WORD:
-            cout << "WORD: " << ce_exprlval.id << endl;
+            cout << "WORD: " << lval.id << endl;
             break;
         case SCAN_STR:
-            cout << "STR: " << *ce_exprlval.val.v.s << endl;
+            cout << "STR: " << *lval.val.v.s << endl;
             break;
         case SCAN_EQUAL:
-            cout << "EQUAL: " << ce_exprlval.op << endl;
+            cout << "EQUAL: " << lval.op << endl;
             break;
         case SCAN_NOT_EQUAL:
-            cout << "NOT_EQUAL: " << ce_exprlval.op << endl;
+            cout << "NOT_EQUAL: " << lval.op << endl;
             break;
         case SCAN_GREATER:
-            cout << "GREATER: " << ce_exprlval.op << endl;
+            cout << "GREATER: " << lval.op << endl;
             break;
         case SCAN_GREATER_EQL:
-            cout << "GREATER_EQL: " << ce_exprlval.op << endl;
+            cout << "GREATER_EQL: " << lval.op << endl;
             break;
         case SCAN_LESS:
-            cout << "LESS: " << ce_exprlval.op << endl;
+            cout << "LESS: " << lval.op << endl;
             break;
         case SCAN_LESS_EQL:
-            cout << "LESS_EQL: " << ce_exprlval.op << endl;
+            cout << "LESS_EQL: " << lval.op << endl;
             break;
         case SCAN_REGEXP:
-            cout << "REGEXP: " << ce_exprlval.op << endl;
+            cout << "REGEXP: " << lval.op << endl;
             break;
         case SCAN_STAR:
-            cout << "STAR: " << ce_exprlval.op << endl;
+            cout << "STAR: " << lval.op << endl;
             break;
         case '.':
             cout << "Field Selector" << endl;
@@ -28,15 +28,36 @@
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <cstring>
+#include <limits>
+#include <memory>
 #include <string>
+#include <sstream>
+#include <vector>
 
 #include "GNURegex.h"
 
 #include "Array.h"
+#include "Byte.h"
+#include "Int8.h"
 #include "Int16.h"
+#include "UInt16.h"
+#include "Int32.h"
+#include "UInt32.h"
+#include "Int64.h"
+#include "UInt64.h"
+#include "Float32.h"
+#include "Float64.h"
+#include "DMR.h"
+#include "D4StreamMarshaller.h"
 #include "Str.h"
 #include "Structure.h"
+#include "Error.h"
+#include "DDS.h"
+#include "BaseTypeFactory.h"
+#include "Clause.h"
 
+#include "ce_expr.tab.hh"
+#include "util.h"
 #include "debug.h"
 
 using namespace CppUnit;
@@ -45,6 +66,117 @@ using namespace std;
 namespace libdap
 {
 
+// An Array of Int32 whose values are i * 3; it records the blocks it is
+// asked to read.
+class BlockArray: public Array {
+public:
+    bool d_blocks;
+    vector<int64_t> d_starts;
+
+    BlockArray(const string &n, bool blocks) : Array(n, 0, true), d_blocks(blocks) {
+        add_var_nocopy(new Int32(n));
+    }
+
+    virtual BaseType *ptr_duplicate() { return new BlockArray(*this); }
+
+    virtual bool read() {
+        vector<dods_int32> v(length());
+        for (int i = 0; i < length(); ++i)
+            v[i] = i * 3;
+        set_value(v, length());
+        set_read_p(true);
+        return true;
+    }
+
+    virtual bool read_block(char *buf, int64_t start, int64_t num) {
+        if (!d_blocks)
+            return false;
+        d_starts.push_back(start);
+        dods_int32 *v = reinterpret_cast<dods_int32*>(buf);
+        for (int64_t i = 0; i < num; ++i)
+            v[i] = (start + i) * 3;
+        return true;
+    }
+};
+
+// Convert a test value to T; negative values wrap for unsigned types
+template<typename T>
+static T number_value(double v)
+{
+    return std::numeric_limits<T>::is_integer ? static_cast<T>(static_cast<dods_int64>(v)) : static_cast<T>(v);
+}
+
+template<typename T, class DT>
+static BaseType *number(double v)
+{
+    DT *n = new DT("n");
+    n->set_value(number_value<T>(v));
+    n->set_read_p(true);
+    return n;
+}
+
+// A scalar number of type t holding v
+static BaseType *make_number(Type t, double v)
+{
+    switch (t) {
+    case dods_byte_c: return number<dods_byte, Byte>(v);
+    case dods_int8_c: return number<dods_int8, Int8>(v);
+    case dods_int16_c: return number<dods_int16, Int16>(v);
+    case dods_uint16_c: return number<dods_uint16, UInt16>(v);
+    case dods_int32_c: return number<dods_int32, Int32>(v);
+    case dods_uint32_c: return number<dods_uint32, UInt32>(v);
+    case dods_int64_c: return number<dods_int64, Int64>(v);
+    case dods_uint64_c: return number<dods_uint64, UInt64>(v);
+    case dods_float32_c: return number<dods_float32, Float32>(v);
+    case dods_float64_c: return number<dods_float64, Float64>(v);
+    default: return 0;
+    }
+}
+
+template<typename T>
+static void set_numbers(Array &a, const double *v, int n)
+{
+    vector<T> values(n);
+    for (int i = 0; i < n; ++i)
+        values[i] = number_value<T>(v[i]);
+    a.set_value(values, n);
+}
+
+// An Array of numbers of type t holding the values v
+static Array *make_number_array(Type t, const double *v, int n)
+{
+    BaseType *proto = make_number(t, 0);
+    Array *a = new Array("a", proto);
+    delete proto;
+    a->append_dim(n);
+
+    switch (t) {
+    case dods_byte_c: set_numbers<dods_byte>(*a, v, n); break;
+    case dods_int8_c: set_numbers<dods_int8>(*a, v, n); break;
+    case dods_int16_c: set_numbers<dods_int16>(*a, v, n); break;
+    case dods_uint16_c: set_numbers<dods_uint16>(*a, v, n); break;
+    case dods_int32_c: set_numbers<dods_int32>(*a, v, n); break;
+    case dods_uint32_c: set_numbers<dods_uint32>(*a, v, n); break;
+    case dods_int64_c: set_numbers<dods_int64>(*a, v, n); break;
+    case dods_uint64_c: set_numbers<dods_uint64>(*a, v, n); break;
+    case dods_float32_c: set_numbers<dods_float32>(*a, v, n); break;
+    case dods_float64_c: set_numbers<dods_float64>(*a, v, n); break;
+    default: break;
+    }
+
+    a->set_read_p(true);
+    a->var()->set_read_p(true);
+    return a;
+}
+
+static const Type number_types[] = { dods_byte_c, dods_int8_c, dods_int16_c, dods_uint16_c, dods_int32_c,
+    dods_uint32_c, dods_int64_c, dods_uint64_c, dods_float32_c, dods_float64_c };
+static const int num_number_types = sizeof(number_types) / sizeof(Type);
+
+static const int relops[] = { SCAN_EQUAL, SCAN_NOT_EQUAL, SCAN_GREATER, SCAN_GREATER_EQL, SCAN_LESS,
+    SCAN_LESS_EQL };
+static const int num_relops = sizeof(relops) / sizeof(int);
+
 class ArrayTest : public TestFixture {
 private:
     Array *d_cardinal, *d_string, *d_structure;
@@ -125,9 +257,161 @@ public:
     CPPUNIT_TEST(duplicate_cardinal_test);
     CPPUNIT_TEST(duplicate_string_test);
     CPPUNIT_TEST(duplicate_structure_test);
+    CPPUNIT_TEST(serialize_blocks_test);
+    CPPUNIT_TEST(serialize_blocks_fallback_test);
+    CPPUNIT_TEST(block_length_test);
+    CPPUNIT_TEST(element_ops_test);
+    CPPUNIT_TEST(element_ops_bad_operand_test);
+    CPPUNIT_TEST(clause_element_value_test);
 
     CPPUNIT_TEST_SUITE_END();
+
+    // Serialize 'a' and return the bytes and checksum written
+    string serialize(Array &a, string &checksum) {
+        ostringstream oss;
+        DMR dmr;
+        {
+            D4StreamMarshaller m(oss);
+            m.reset_checksum();
+            a.serialize(m, dmr);
+            checksum = m.get_checksum();
+        }
+        return oss.str();
+    }
+
+    void serialize_blocks_test() {
+        BlockArray whole("a", false), blocks("a", true);
+        whole.append_dim(1000);
+        blocks.append_dim(1000);
+        blocks.set_block_size(400);
+
+        string whole_crc, blocks_crc;
+        string expected = serialize(whole, whole_crc);
+        CPPUNIT_ASSERT(expected.size() == 4000);
+        CPPUNIT_ASSERT(serialize(blocks, blocks_crc) == expected);
+        CPPUNIT_ASSERT(blocks_crc == whole_crc);
+
+        CPPUNIT_ASSERT(blocks.d_starts.size() == 10);
+        CPPUNIT_ASSERT(blocks.d_starts[9] == 900);
+        CPPUNIT_ASSERT(!blocks.read_p());
+    }
+
+    void serialize_blocks_fallback_test() {
+        // Small arrays and Arrays that don't implement read_block() are read
+        BlockArray small("a", true), no_blocks("a", false);
+        small.append_dim(10);
+        no_blocks.append_dim(1000);
+        no_blocks.set_block_size(400);
+
+        string crc;
+        CPPUNIT_ASSERT(serialize(small, crc).size() == 40);
+        CPPUNIT_ASSERT(small.d_starts.empty());
+        CPPUNIT_ASSERT(small.read_p());
+        CPPUNIT_ASSERT(serialize(no_blocks, crc).size() == 4000);
+        CPPUNIT_ASSERT(no_blocks.read_p());
+    }
+
+    void block_length_test() {
+        BlockArray a("a", true);
+        a.append_dim(10);
+        a.append_dim(20);
+        a.append_dim(30);
+
+        // Whole 20x30 planes, whole 30-element rows, then single elements
+        CPPUNIT_ASSERT(a.m_block_length(1500) == 1200);
+        CPPUNIT_ASSERT(a.m_block_length(599) == 570);
+        CPPUNIT_ASSERT(a.m_block_length(29) == 29);
+    }
     
+    // element_ops() must give the same result as ops() does for each
+    // element, for every pair of number types
+    void element_ops_test() {
+        const double values[] = { -70000.5, -3, -1, 0, 1, 2.5, 7, 127, 200, 70000, 3e9, 16777217 };
+        const int n = sizeof(values) / sizeof(double);
+        const double constants[] = { -1, 0, 2.5, 7, 200, 3e9, 16777217 };
+        const int num_constants = sizeof(constants) / sizeof(double);
+
+        for (int t = 0; t < num_number_types; ++t) {
+            auto_ptr<Array> a(make_number_array(number_types[t], values, n));
+            for (int ct = 0; ct < num_number_types; ++ct) {
+                for (int c = 0; c < num_constants; ++c) {
+                    auto_ptr<BaseType> constant(make_number(number_types[ct], constants[c]));
+                    for (int op = 0; op < num_relops; ++op) {
+                        vector<unsigned char> mask;
+                        bool any = a->element_ops(constant.get(), relops[op], mask);
+                        CPPUNIT_ASSERT(mask.size() == (unsigned int)n);
+
+                        bool expected_any = false;
+                        for (int i = 0; i < n; ++i) {
+                            bool expected = a->var(i)->ops(constant.get(), relops[op]);
+                            DBG(cerr << type_name(number_types[t]) << " " << relops[op] << " "
+                                << type_name(number_types[ct]) << " " << constants[c] << " [" << i << "]: "
+                                << expected << endl);
+                            CPPUNIT_ASSERT((mask[i] != 0) == expected);
+                            expected_any = expected_any || expected;
+                        }
+                        CPPUNIT_ASSERT(any == expected_any);
+                    }
+                }
+            }
+        }
+    }
+
+    void element_ops_bad_operand_test() {
+        const double values[] = { 1, 2, 3 };
+        auto_ptr<Array> a(make_number_array(dods_int32_c, values, 3));
+        auto_ptr<BaseType> two(make_number(dods_int32_c, 2));
+        vector<unsigned char> mask;
+
+        Str str("s");
+        str.set_value("2");
+        str.set_read_p(true);
+        CPPUNIT_ASSERT_THROW(a->element_ops(&str, SCAN_EQUAL, mask), Error);
+        CPPUNIT_ASSERT_THROW(a->element_ops(two.get(), SCAN_REGEXP, mask), Error);
+
+        d_string->set_read_p(true);
+        CPPUNIT_ASSERT_THROW(d_string->element_ops(two.get(), SCAN_EQUAL, mask), Error);
+
+        CPPUNIT_ASSERT(a->element_ops(two.get(), SCAN_GREATER_EQL, mask));
+        CPPUNIT_ASSERT(mask.size() == 3 && !mask[0] && mask[1] && mask[2]);
+    }
+
+    // A relational clause's list of second operands is an OR, for each
+    // element of the array; a scalar first operand gives a one-entry mask
+    void clause_element_value_test() {
+        BaseTypeFactory factory;
+        DDS dds(&factory, "test");
+
+        const double values[] = { 1, 5, 3, 8 };
+        auto_ptr<Array> a(make_number_array(dods_int32_c, values, 4));
+        auto_ptr<BaseType> three(make_number(dods_int32_c, 3));
+        auto_ptr<BaseType> eight(make_number(dods_float64_c, 8));
+        auto_ptr<BaseType> hundred(make_number(dods_int32_c, 100));
+        auto_ptr<BaseType> five(make_number(dods_int32_c, 5));
+        vector<unsigned char> mask;
+
+        rvalue_list *args = make_rvalue_list(new rvalue(three.get()));
+        append_rvalue_list(args, new rvalue(eight.get()));
+        Clause equal(SCAN_EQUAL, new rvalue(a.get()), args);
+        CPPUNIT_ASSERT(equal.element_value(dds, mask));
+        CPPUNIT_ASSERT(mask.size() == 4 && !mask[0] && !mask[1] && mask[2] && mask[3]);
+
+        Clause greater(SCAN_GREATER, new rvalue(a.get()), make_rvalue_list(new rvalue(hundred.get())));
+        CPPUNIT_ASSERT(!greater.element_value(dds, mask));
+        CPPUNIT_ASSERT(mask.size() == 4 && !mask[0] && !mask[1] && !mask[2] && !mask[3]);
+
+        args = make_rvalue_list(new rvalue(eight.get()));
+        append_rvalue_list(args, new rvalue(three.get()));
+        Clause scalar(SCAN_GREATER, new rvalue(five.get()), args);
+        CPPUNIT_ASSERT(scalar.element_value(dds, mask));
+        CPPUNIT_ASSERT(mask.size() == 1 && mask[0]);
+        CPPUNIT_ASSERT(scalar.value(dds));
+
+        Clause scalar_false(SCAN_LESS, new rvalue(five.get()), make_rvalue_list(new rvalue(three.get())));
+        CPPUNIT_ASSERT(!scalar_false.element_value(dds, mask));
+        CPPUNIT_ASSERT(mask.size() == 1 && !mask[0]);
+    }
+
     void duplicate_structure_test() {
         Array::Dim_iter i = d_structure->dim_begin();
         CPPUNIT_ASSERT(d_structure->dimension_size(i) == 4);
@@ -0,0 +1,538 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "Int32.h"
+#include "Float64.h"
+#include "Array.h"
+#include "Structure.h"
+#include "Sequence.h"
+#include "D4Sequence.h"
+#include "D4RValue.h"
+#include "D4FilterClause.h"
+#include "D4Group.h"
+#include "D4Dimensions.h"
+
+#include "BaseTypeFactory.h"
+#include "D4BaseTypeFactory.h"
+#include "DDS.h"
+#include "DMR.h"
+#include "XMLWriter.h"
+
+#include "ConstraintEvaluator.h"
+#include "D4ConstraintEvaluator.h"
+#include "CEParseCache.h"
+
+#include "GetOpt.h"
+#include "util.h"
+#include "debug.h"
+
+// D4FilterClause.h includes the DAP2 parser's header, which defines DDS(arg)
+#undef DDS
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+// Count the plans the cache deletes
+class TestPlan: public CEParsePlan {
+    int &d_deleted;
+public:
+    TestPlan(int &deleted) : d_deleted(deleted) { }
+    virtual ~TestPlan() { ++d_deleted; }
+};
+
+// The state a constraint sets for every variable of a DDS
+static void print_state(BaseType *var, ostream &oss)
+{
+    oss << var->name() << " " << var->send_p() << var->is_in_selection();
+
+    if (var->type() == dods_array_c) {
+        Array *a = static_cast<Array*>(var);
+        for (Array::Dim_iter d = a->dim_begin(), e = a->dim_end(); d != e; ++d)
+            oss << " [" << d->start << ":" << d->stride << ":" << d->stop << "]";
+    }
+    else if (var->type() == dods_sequence_c) {
+        Sequence *s = static_cast<Sequence*>(var);
+        oss << " [" << s->get_starting_row_number() << ":" << s->get_row_stride() << ":"
+            << s->get_ending_row_number() << "]";
+    }
+    oss << endl;
+
+    if (var->is_constructor_type()) {
+        Constructor *c = static_cast<Constructor*>(var);
+        for (Constructor::Vars_iter i = c->var_begin(), e = c->var_end(); i != e; ++i)
+            print_state(*i, oss);
+    }
+    else if (var->is_vector_type() && var->var()) {
+        print_state(var->var(), oss);
+    }
+}
+
+static string dds_state(DDS &dds)
+{
+    ostringstream oss;
+    for (DDS::Vars_iter i = dds.var_begin(), e = dds.var_end(); i != e; ++i)
+        print_state(*i, oss);
+    return oss.str();
+}
+
+static string dmr_state(DMR &dmr)
+{
+    ostringstream oss;
+    XMLWriter xml;
+    dmr.print_dap4(xml, true);
+    oss << xml.get_doc();
+
+    // The filter clauses are not part of the DMR
+    D4Sequence *q = static_cast<D4Sequence*>(dmr.root()->var("q"));
+    oss << "clauses: " << q->clauses().size() << endl;
+
+    return oss.str();
+}
+
+class CEParseCacheTest: public TestFixture {
+private:
+    BaseTypeFactory d_factory;
+    D4BaseTypeFactory d_d4_factory;
+
+    DDS *make_dds()
+    {
+        DDS *dds = new DDS(&d_factory, "test");
+        dds->filename("test.nc");
+
+        dds->add_var_nocopy(new Int32("i"));
+        dds->add_var_nocopy(new Float64("x"));
+
+        Int32 a_proto("a");
+        Array *a = new Array("a", &a_proto);
+        a->append_dim(10, "a_dim");
+        dds->add_var_nocopy(a);
+
+        Structure *s = new Structure("s");
+        s->add_var_nocopy(new Int32("j"));
+        s->add_var_nocopy(new Float64("f"));
+        dds->add_var_nocopy(s);
+
+        Sequence *q = new Sequence("q");
+        q->add_var_nocopy(new Int32("k"));
+        dds->add_var_nocopy(q);
+
+        return dds;
+    }
+
+    DMR *make_dmr()
+    {
+        DMR *dmr = new DMR(&d_d4_factory, "test");
+        dmr->set_filename("test.nc");
+        D4Group *root = dmr->root();
+
+        D4Dimension *dim = new D4Dimension("d1", 10);
+        root->dims()->add_dim_nocopy(dim);
+
+        root->add_var_nocopy(new Int32("i"));
+
+        Int32 a_proto("a");
+        Array *a = new Array("a", &a_proto);
+        a->append_dim(dim);
+        root->add_var_nocopy(a);
+
+        Int32 b_proto("b");
+        Array *b = new Array("b", &b_proto);
+        b->append_dim(8, "b_dim");
+        root->add_var_nocopy(b);
+
+        D4Sequence *q = new D4Sequence("q");
+        q->add_var_nocopy(new Int32("k"));
+        root->add_var_nocopy(q);
+
+        D4Group *g = new D4Group("g");
+        g->add_var_nocopy(new Float64("x"));
+        root->add_group_nocopy(g);
+
+        return dmr;
+    }
+
+public:
+    CEParseCacheTest() { }
+    ~CEParseCacheTest() { }
+
+    void setUp() { }
+    void tearDown() { }
+
+    CPPUNIT_TEST_SUITE( CEParseCacheTest );
+
+    CPPUNIT_TEST(lru_test);
+    CPPUNIT_TEST(replace_test);
+    CPPUNIT_TEST(dap2_replay_test);
+    CPPUNIT_TEST(dap2_changed_dds_test);
+    CPPUNIT_TEST(dap2_not_cached_test);
+    CPPUNIT_TEST(dap2_concurrent_replay_test);
+    CPPUNIT_TEST(dap4_replay_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    void lru_test()
+    {
+        int deleted = 0;
+        CEParseCache cache(2);
+
+        cache.insert("a", new TestPlan(deleted));
+        cache.insert("b", new TestPlan(deleted));
+        CPPUNIT_ASSERT(cache.size() == 2);
+
+        CEParsePlan *plan = cache.find("a");    // 'b' is now the least recently used
+        CPPUNIT_ASSERT(plan);
+        cache.release(plan, true);
+        CPPUNIT_ASSERT(!cache.find("c"));
+
+        cache.insert("c", new TestPlan(deleted));
+        CPPUNIT_ASSERT(cache.size() == 2);
+        CPPUNIT_ASSERT(deleted == 1);
+
+        CPPUNIT_ASSERT(!cache.find("b"));
+        CPPUNIT_ASSERT((plan = cache.find("a")));
+        cache.release(plan, true);
+        CPPUNIT_ASSERT((plan = cache.find("c")));
+        cache.release(plan, true);
+
+        CPPUNIT_ASSERT(cache.get_hits() == 3);
+        CPPUNIT_ASSERT(cache.get_misses() == 2);
+
+        // A plan that is found but not used is a miss
+        CPPUNIT_ASSERT((plan = cache.find("c")));
+        CPPUNIT_ASSERT(cache.get_hits() == 3);
+        cache.release(plan, false);
+        CPPUNIT_ASSERT(cache.get_hits() == 3);
+        CPPUNIT_ASSERT(cache.get_misses() == 3);
+
+        cache.set_max_entries(1);
+        CPPUNIT_ASSERT(cache.size() == 1);
+        CPPUNIT_ASSERT(deleted == 2);
+
+        // A plan in use is deleted when it is released, not when the cache
+        // discards it
+        CPPUNIT_ASSERT((plan = cache.find("c")));
+        cache.clear();
+        CPPUNIT_ASSERT(cache.size() == 0);
+        CPPUNIT_ASSERT(deleted == 2);
+        cache.release(plan, true);
+        CPPUNIT_ASSERT(deleted == 3);
+        CPPUNIT_ASSERT(cache.get_hits() == 4);
+
+        cache.set_max_entries(0);
+        cache.insert("d", new TestPlan(deleted));
+        CPPUNIT_ASSERT(cache.size() == 0);
+        CPPUNIT_ASSERT(deleted == 4);
+    }
+
+    void replace_test()
+    {
+        int deleted = 0;
+        CEParseCache cache;
+
+        TestPlan *plan = new TestPlan(deleted);
+        cache.insert("a", new TestPlan(deleted));
+        cache.insert("a", plan);
+        CPPUNIT_ASSERT(cache.size() == 1);
+        CPPUNIT_ASSERT(deleted == 1);
+
+        CPPUNIT_ASSERT(cache.find("a") == plan);
+
+        // Replacing a plan in use keeps it until it is released
+        cache.insert("a", new TestPlan(deleted));
+        CPPUNIT_ASSERT(deleted == 1);
+        cache.release(plan, true);
+        CPPUNIT_ASSERT(deleted == 2);
+        CPPUNIT_ASSERT(cache.size() == 1);
+    }
+
+    void dap2_replay_test()
+    {
+        const string ce = "a[2:2:8],s.f,q[1:3]&i>3&x<2.5";
+        CEParseCache cache;
+
+        auto_ptr<DDS> dds1(make_dds());
+        ConstraintEvaluator eval1;
+        eval1.set_parse_cache(&cache);
+        eval1.parse_constraint(ce, *dds1);
+        CPPUNIT_ASSERT(cache.size() == 1);
+        CPPUNIT_ASSERT(cache.get_misses() == 1);
+
+        auto_ptr<DDS> dds2(make_dds());
+        ConstraintEvaluator eval2;
+        eval2.set_parse_cache(&cache);
+        eval2.parse_constraint(ce, *dds2);
+        CPPUNIT_ASSERT(cache.get_hits() == 1);
+        CPPUNIT_ASSERT(cache.get_misses() == 1);
+
+        auto_ptr<DDS> dds3(make_dds());
+        ConstraintEvaluator eval3;
+        eval3.parse_constraint(ce, *dds3);
+
+        DBG(cerr << "Parsed:" << endl << dds_state(*dds3) << "Cached:" << endl << dds_state(*dds2));
+        CPPUNIT_ASSERT(dds_state(*dds2) == dds_state(*dds3));
+        CPPUNIT_ASSERT(dds_state(*dds1) == dds_state(*dds3));
+
+        // The clauses must use the variables of dds2, not dds1
+        static_cast<Int32*>(dds2->var("i"))->set_value(5);
+        static_cast<Int32*>(dds2->var("i"))->set_read_p(true);
+        static_cast<Float64*>(dds2->var("x"))->set_value(1.0);
+        static_cast<Float64*>(dds2->var("x"))->set_read_p(true);
+        CPPUNIT_ASSERT(eval2.eval_selection(*dds2, ""));
+
+        static_cast<Int32*>(dds2->var("i"))->set_value(1);
+        CPPUNIT_ASSERT(!eval2.eval_selection(*dds2, ""));
+    }
+
+    void dap2_changed_dds_test()
+    {
+        const string ce = "a[2:2:8]&i>3";
+        CEParseCache cache;
+
+        auto_ptr<DDS> dds1(make_dds());
+        ConstraintEvaluator eval1;
+        eval1.set_parse_cache(&cache);
+        eval1.parse_constraint(ce, *dds1);
+
+        // The expression is found, but this DDS differs from the first one
+        // so it is parsed and the result replaces the cached one.
+        auto_ptr<DDS> dds2(make_dds());
+        dds2->del_var("i");
+        dds2->add_var_nocopy(new Float64("i"));
+        ConstraintEvaluator eval2;
+        eval2.set_parse_cache(&cache);
+        eval2.parse_constraint(ce, *dds2);
+        CPPUNIT_ASSERT(cache.get_hits() == 0);
+        CPPUNIT_ASSERT(cache.get_misses() == 2);
+        CPPUNIT_ASSERT(cache.size() == 1);
+
+        static_cast<Float64*>(dds2->var("i"))->set_value(3.5);
+        static_cast<Float64*>(dds2->var("i"))->set_read_p(true);
+        CPPUNIT_ASSERT(eval2.eval_selection(*dds2, ""));
+
+        // Here the DDS has already been constrained
+        auto_ptr<DDS> dds3(make_dds());
+        Array *a = static_cast<Array*>(dds3->var("a"));
+        a->add_constraint(a->dim_begin(), 0, 1, 4);
+        ConstraintEvaluator eval3;
+        eval3.set_parse_cache(&cache);
+        eval3.parse_constraint(ce, *dds3);
+
+        auto_ptr<DDS> dds4(make_dds());
+        a = static_cast<Array*>(dds4->var("a"));
+        a->add_constraint(a->dim_begin(), 0, 1, 4);
+        ConstraintEvaluator eval4;
+        eval4.parse_constraint(ce, *dds4);
+        CPPUNIT_ASSERT(dds_state(*dds3) == dds_state(*dds4));
+
+        // ...and a new one is the same as the first
+        auto_ptr<DDS> dds5(make_dds());
+        ConstraintEvaluator eval5;
+        eval5.set_parse_cache(&cache);
+        eval5.parse_constraint(ce, *dds5);
+        CPPUNIT_ASSERT(dds_state(*dds5) == dds_state(*dds1));
+
+        // Each time the expression was found, but could not be used
+        CPPUNIT_ASSERT(cache.get_hits() == 0);
+        CPPUNIT_ASSERT(cache.get_misses() == 4);
+        CPPUNIT_ASSERT(cache.size() == 1);
+    }
+
+    void dap2_not_cached_test()
+    {
+        CEParseCache cache;
+
+        // The special form adds a variable to the DDS
+        auto_ptr<DDS> dds(make_dds());
+        ConstraintEvaluator eval;
+        eval.set_parse_cache(&cache);
+        eval.parse_constraint("$Int32(3:1,2,3)", *dds);
+        CPPUNIT_ASSERT(cache.size() == 0);
+
+        // An expression that does not parse
+        auto_ptr<DDS> dds2(make_dds());
+        ConstraintEvaluator eval2;
+        eval2.set_parse_cache(&cache);
+        CPPUNIT_ASSERT_THROW(eval2.parse_constraint("no_such_var", *dds2), Error);
+        CPPUNIT_ASSERT(cache.size() == 0);
+    }
+
+    // Constrain many copies of a DDS using a cache that is shared with other
+    // threads and emptied while they use it
+    struct ReplayThread {
+        CEParseCacheTest *test;
+        CEParseCache *cache;
+        string ce;
+        string expected;
+        int errors;
+    };
+
+    static void *replay_thread(void *arg)
+    {
+        ReplayThread *t = static_cast<ReplayThread*>(arg);
+        for (int i = 0; i < 200; ++i) {
+            try {
+                auto_ptr<DDS> dds(t->test->make_dds());
+                ConstraintEvaluator eval;
+                eval.set_parse_cache(t->cache);
+                eval.parse_constraint(t->ce, *dds);
+                if (dds_state(*dds) != t->expected)
+                    ++t->errors;
+            }
+            catch (Error &e) {
+                DBG(cerr << "Error: " << e.get_error_message() << endl);
+                ++t->errors;
+            }
+        }
+        return 0;
+    }
+
+    void dap2_concurrent_replay_test()
+    {
+        const string ce = "a[2:2:8],s.f,q[1:3]&i>3&x<2.5";
+        CEParseCache cache;
+
+        auto_ptr<DDS> dds(make_dds());
+        ConstraintEvaluator eval;
+        eval.parse_constraint(ce, *dds);
+
+        ReplayThread t = { this, &cache, ce, dds_state(*dds), 0 };
+        vector<ReplayThread> threads(4, t);
+        vector<pthread_t> ids(threads.size());
+        for (unsigned int i = 0; i < threads.size(); ++i)
+            CPPUNIT_ASSERT(pthread_create(&ids[i], 0, replay_thread, &threads[i]) == 0);
+
+        for (int i = 0; i < 1000; ++i) {
+            cache.clear();
+            usleep(100);
+        }
+
+        for (unsigned int i = 0; i < threads.size(); ++i) {
+            pthread_join(ids[i], 0);
+            CPPUNIT_ASSERT(threads[i].errors == 0);
+        }
+
+        CPPUNIT_ASSERT(cache.get_hits() + cache.get_misses() == 800);
+    }
+
+    void dap4_replay_test()
+    {
+        const string ce = "d1=[2:5];/a[];/b[1:2:7];/g/x;q|k>3";
+        CEParseCache cache;
+
+        auto_ptr<DMR> dmr1(make_dmr());
+        D4ConstraintEvaluator eval1(dmr1.get());
+        eval1.set_parse_cache(&cache);
+        CPPUNIT_ASSERT(eval1.parse(ce));
+        CPPUNIT_ASSERT(cache.size() == 1);
+
+        auto_ptr<DMR> dmr2(make_dmr());
+        D4ConstraintEvaluator eval2(dmr2.get());
+        eval2.set_parse_cache(&cache);
+        CPPUNIT_ASSERT(eval2.parse(ce));
+        CPPUNIT_ASSERT(eval2.result());
+        CPPUNIT_ASSERT(cache.get_hits() == 1);
+        CPPUNIT_ASSERT(cache.get_misses() == 1);
+
+        auto_ptr<DMR> dmr3(make_dmr());
+        D4ConstraintEvaluator eval3(dmr3.get());
+        CPPUNIT_ASSERT(eval3.parse(ce));
+
+        DBG(cerr << "Parsed:" << endl << dmr_state(*dmr3) << "Cached:" << endl << dmr_state(*dmr2));
+        CPPUNIT_ASSERT(dmr_state(*dmr2) == dmr_state(*dmr3));
+        CPPUNIT_ASSERT(dmr_state(*dmr1) == dmr_state(*dmr3));
+
+        // The filter must use the variables of dmr2
+        D4Sequence *q = static_cast<D4Sequence*>(dmr2->root()->var("q"));
+        static_cast<Int32*>(q->var("k"))->set_value(5);
+        CPPUNIT_ASSERT(q->clauses().value());
+        static_cast<Int32*>(q->var("k"))->set_value(1);
+        CPPUNIT_ASSERT(!q->clauses().value());
+
+        // A DMR without the variables is parsed, not replayed
+        auto_ptr<DMR> dmr4(make_dmr());
+        dmr4->root()->del_var("b");
+        D4ConstraintEvaluator eval4(dmr4.get());
+        eval4.set_parse_cache(&cache);
+        CPPUNIT_ASSERT_THROW(eval4.parse(ce), Error);
+        CPPUNIT_ASSERT(cache.get_hits() == 1);
+        CPPUNIT_ASSERT(cache.get_misses() == 2);
+        CPPUNIT_ASSERT(cache.size() == 1);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CEParseCacheTest);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    char option_char;
+
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::CEParseCacheTest::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+#include "config.h"
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <stdint.h>
+
+#include <vector>
+#include <cstring>
+
+#include "crc.h"
+
+#include "GetOpt.h"
+#include "debug.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+class Crc32Test: public TestFixture {
+private:
+    vector<uint8_t> d_data;
+
+public:
+    Crc32Test() { }
+    ~Crc32Test() { }
+
+    void setUp() {
+        d_data.resize(4096);
+        uint32_t x = 17;
+        for (vector<uint8_t>::size_type i = 0; i < d_data.size(); ++i) {
+            x = x * 1103515245 + 12345;
+            d_data[i] = static_cast<uint8_t>(x >> 16);
+        }
+    }
+
+    void tearDown() { }
+
+    // The standard CRC 32 check value
+    void check_value_test() {
+        Crc32 crc;
+        crc.AddData(reinterpret_cast<const uint8_t*>("123456789"), 9);
+        DBG(cerr << "Using the " << crc32_kernels() << " code" << endl);
+        CPPUNIT_ASSERT(crc.GetCrc32() == 0xcbf43926);
+    }
+
+    void empty_test() {
+        Crc32 crc;
+        uint32_t before = crc.GetCrc32();
+        crc.AddData(&d_data[0], 0);
+        CPPUNIT_ASSERT(crc.GetCrc32() == before);
+        CPPUNIT_ASSERT(before == 0);
+    }
+
+    // Compare with the byte-at-a-time code for many lengths and alignments
+    void bytewise_test() {
+        for (size_t len = 0; len < 600; ++len) {
+            for (size_t offset = 0; offset < 4; ++offset) {
+                uint32_t expected = crc32_update_bytewise(~0U, &d_data[offset], len);
+                CPPUNIT_ASSERT(crc32_update(~0U, &d_data[offset], len) == expected);
+            }
+        }
+
+        CPPUNIT_ASSERT(crc32_update(~0U, &d_data[0], d_data.size())
+            == crc32_update_bytewise(~0U, &d_data[0], d_data.size()));
+    }
+
+    // Computing the checksum incrementally must give the same value
+    void incremental_test() {
+        Crc32 all;
+        all.AddData(&d_data[0], d_data.size());
+
+        Crc32 parts;
+        size_t pos = 0, step = 1;
+        while (pos < d_data.size()) {
+            size_t len = min(step, d_data.size() - pos);
+            parts.AddData(&d_data[pos], len);
+            pos += len;
+            step = step * 3 + 1;
+        }
+
+        CPPUNIT_ASSERT(parts.GetCrc32() == all.GetCrc32());
+    }
+
+    CPPUNIT_TEST_SUITE( Crc32Test );
+
+    CPPUNIT_TEST(check_value_test);
+    CPPUNIT_TEST(empty_test);
+    CPPUNIT_TEST(bytewise_test);
+    CPPUNIT_TEST(incremental_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Crc32Test);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    int option_char;
+
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::Crc32Test::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
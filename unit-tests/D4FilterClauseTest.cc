@@ -29,6 +29,7 @@
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <sstream>
+#include <algorithm>
 
 #include "Byte.h"
 #include "Int8.h"
@@ -36,6 +37,8 @@
 #include "UInt16.h"
 #include "Int32.h"
 #include "UInt32.h"
+#include "Int64.h"
+#include "UInt64.h"
 
 #include "Float32.h"
 #include "Float64.h"
@@ -47,6 +50,8 @@
 
 #include "D4RValue.h"
 #include "D4FilterClause.h"
+#include "D4Sequence.h"
+#include "D4SeqBatch.h"
 #include "DMR.h"    // We need this because D4FilterClause::value needs it (sort of).
 
 #include "GetOpt.h"
@@ -66,6 +71,18 @@ using namespace std;
 
 namespace libdap {
 
+// Values used to fill the columns of a D4SeqBatch
+static const long long batch_values[] = { -300, -1, 0, 1, 17, 21, 255, 256, 70000, 5000000000LL };
+static const unsigned int num_batch_values = sizeof(batch_values) / sizeof(batch_values[0]);
+
+template<typename T>
+static void fill_column(D4SeqBatch &batch, unsigned int column, double scale)
+{
+    T *col = reinterpret_cast<T*>(batch.get_buf(column));
+    for (unsigned int i = 0; i < num_batch_values; ++i)
+        col[i] = static_cast<T>(batch_values[i]) * static_cast<T>(scale);
+}
+
 class D4FilterClauseTest: public TestFixture {
 	// Build a DMR and build several D4RValue objects that reference its variables.
 	// Then build several D4RValue objects that hold constants
@@ -524,6 +541,185 @@ public:
         }
     }
 
+    // A sequence with one variable of each type that can be read in batches
+    D4Sequence *make_batch_sequence() {
+        D4Sequence *seq = new D4Sequence("seq");
+        seq->add_var_nocopy(new Byte("byte"));
+        seq->add_var_nocopy(new Int8("int8"));
+        seq->add_var_nocopy(new Int16("int16"));
+        seq->add_var_nocopy(new UInt16("uint16"));
+        seq->add_var_nocopy(new Int32("int32"));
+        seq->add_var_nocopy(new UInt32("uint32"));
+        seq->add_var_nocopy(new Int64("int64"));
+        seq->add_var_nocopy(new UInt64("uint64"));
+        seq->add_var_nocopy(new Float32("f32"));
+        seq->add_var_nocopy(new Float64("f64"));
+        seq->add_var_nocopy(new Str("str"));
+        return seq;
+    }
+
+    void fill_batch(D4SeqBatch &batch) {
+        batch.set_size(num_batch_values);
+        fill_column<dods_byte>(batch, 0, 1);
+        fill_column<dods_int8>(batch, 1, 1);
+        fill_column<dods_int16>(batch, 2, 1);
+        fill_column<dods_uint16>(batch, 3, 1);
+        fill_column<dods_int32>(batch, 4, 1);
+        fill_column<dods_uint32>(batch, 5, 1);
+        fill_column<dods_int64>(batch, 6, 1);
+        fill_column<dods_uint64>(batch, 7, 1);
+        fill_column<dods_float32>(batch, 8, 0.25);
+        fill_column<dods_float64>(batch, 9, 0.25);
+
+        const char *names[] = { "Einstein", "Bohr", "Feynman", "Curie", "Dirac", "Fermi", "Bose", "Noether", "Pauli", "Born" };
+        vector<string> &str = batch.get_str(10);
+        for (unsigned int i = 0; i < num_batch_values; ++i)
+            str[i] = names[i];
+    }
+
+    // Evaluate 'clause' for the batch and then for each row using value()
+    void check_batch_clause(D4SeqBatch &batch, D4FilterClause &clause) {
+        batch.set_size(num_batch_values);
+        clause.value(batch);
+        vector<unsigned char> selection = batch.selection();
+
+        for (unsigned int i = 0; i < num_batch_values; ++i) {
+            batch.load_row(i);
+            CPPUNIT_ASSERT_EQUAL(clause.value(), (bool)selection[i]);
+        }
+    }
+
+    // The batch comparisons must match those made by the d4_ops() methods
+    void batch_numbers_test() {
+        auto_ptr<D4Sequence> seq(make_batch_sequence());
+        D4SeqBatch batch(*seq, num_batch_values);
+        fill_batch(batch);
+
+        const D4FilterClause::ops ops[] = { D4FilterClause::less, D4FilterClause::greater,
+            D4FilterClause::less_equal, D4FilterClause::greater_equal, D4FilterClause::equal,
+            D4FilterClause::not_equal };
+
+        for (unsigned int col = 0; col < 10; ++col) {
+            for (unsigned int op = 0; op < sizeof(ops) / sizeof(ops[0]); ++op) {
+                for (unsigned int v = 0; v < num_batch_values; ++v) {
+                    D4RValue *constants[] = { new D4RValue(batch_values[v]),
+                        new D4RValue((unsigned long long)batch_values[v]),
+                        new D4RValue(batch_values[v] * 0.25) };
+
+                    for (unsigned int c = 0; c < 3; ++c) {
+                        DBG(cerr << batch.get_var(col)->name() << " op " << ops[op] << " value " << batch_values[v] << endl);
+
+                        D4FilterClause column_first(ops[op], new D4RValue(batch.get_var(col)), new D4RValue(*constants[c]));
+                        check_batch_clause(batch, column_first);
+
+                        D4FilterClause constant_first(ops[op], new D4RValue(*constants[c]), new D4RValue(batch.get_var(col)));
+                        check_batch_clause(batch, constant_first);
+
+                        delete constants[c];
+                    }
+                }
+            }
+        }
+    }
+
+    void batch_strings_test() {
+        auto_ptr<D4Sequence> seq(make_batch_sequence());
+        D4SeqBatch batch(*seq, num_batch_values);
+        fill_batch(batch);
+
+        D4FilterClause equal(D4FilterClause::equal, new D4RValue(batch.get_var(10)), new D4RValue("Fermi"));
+        check_batch_clause(batch, equal);
+
+        D4FilterClause greater(D4FilterClause::greater, new D4RValue("Dirac"), new D4RValue(batch.get_var(10)));
+        check_batch_clause(batch, greater);
+
+        D4FilterClause match(D4FilterClause::match, new D4RValue(batch.get_var(10)), new D4RValue("^B.*r"));
+        check_batch_clause(batch, match);
+
+        vector<unsigned char> &selection = batch.selection();
+        CPPUNIT_ASSERT_EQUAL(2, (int)count(selection.begin(), selection.end(), 1));
+    }
+
+    // Clauses that are not a column and a constant are evaluated row by row
+    void batch_clauses_test() {
+        auto_ptr<D4Sequence> seq(make_batch_sequence());
+        D4SeqBatch batch(*seq, 16);
+        fill_batch(batch);
+
+        D4FilterClauseList clauses;
+        clauses.add_clause(new D4FilterClause(D4FilterClause::greater, new D4RValue(batch.get_var(4)), new D4RValue((long long)0)));
+        clauses.add_clause(new D4FilterClause(D4FilterClause::less, new D4RValue(batch.get_var(9)), new D4RValue(batch.get_var(6))));
+
+        clauses.value(batch);
+
+        vector<unsigned char> &selection = batch.selection();
+        for (unsigned int i = 0; i < num_batch_values; ++i)
+            CPPUNIT_ASSERT_EQUAL((bool)selection[i], batch_values[i] > 0);
+
+        // The second clause's error is found when a row reaches it
+        clauses.add_clause(new D4FilterClause(D4FilterClause::equal, new D4RValue(batch.get_var(10)), new D4RValue(17.0)));
+        batch.set_size(num_batch_values);
+        CPPUNIT_ASSERT_THROW(clauses.value(batch), Error);
+
+        batch.set_size(0);
+        clauses.value(batch);
+        CPPUNIT_ASSERT(batch.selection().empty());
+    }
+
+    // Clauses are compiled for the types of their operands; the compiled
+    // comparisons must match those made by the d4_ops() methods
+    void compiled_clause_test() {
+        auto_ptr<D4Sequence> seq(make_batch_sequence());
+        D4SeqBatch batch(*seq, num_batch_values);
+        fill_batch(batch);
+
+        const D4FilterClause::ops ops[] = { D4FilterClause::less, D4FilterClause::greater,
+            D4FilterClause::less_equal, D4FilterClause::greater_equal, D4FilterClause::equal,
+            D4FilterClause::not_equal };
+
+        for (unsigned int row = 0; row < num_batch_values; ++row) {
+            batch.load_row(row);
+            for (unsigned int col = 0; col < 10; ++col) {
+                BaseType *var = batch.get_var(col);
+                for (unsigned int op = 0; op < sizeof(ops) / sizeof(ops[0]); ++op) {
+                    for (unsigned int v = 0; v < num_batch_values; ++v) {
+                        D4RValue int_constant(batch_values[v]);
+                        D4RValue uint_constant((unsigned long long)batch_values[v]);
+                        D4RValue float_constant(batch_values[v] * 0.25);
+                        D4RValue *constants[] = { &int_constant, &uint_constant, &float_constant };
+
+                        for (unsigned int c = 0; c < 3; ++c) {
+                            D4FilterClause variable_first(ops[op], new D4RValue(var), new D4RValue(*constants[c]));
+                            CPPUNIT_ASSERT_EQUAL(var->d4_ops(constants[c]->value(), ops[op]), variable_first.value());
+
+                            D4FilterClause constant_first(ops[op], new D4RValue(*constants[c]), new D4RValue(var));
+                            CPPUNIT_ASSERT_EQUAL(constants[c]->value()->d4_ops(var, ops[op]), constant_first.value());
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void compiled_clause_copy_test() {
+        D4FilterClause match(D4FilterClause::match, new D4RValue(str), new D4RValue("^Ein"));
+        D4FilterClause copy(match);
+        CPPUNIT_ASSERT(copy.value());
+
+        D4FilterClause less(D4FilterClause::less, new D4RValue((long long)21), new D4RValue(byte));
+        copy = less;
+        CPPUNIT_ASSERT(!copy.value());
+
+        str->set_value("Bohr");
+        CPPUNIT_ASSERT(!match.value());
+    }
+
+    // A bad pattern is still reported when the clause is evaluated
+    void compiled_clause_bad_regex_test() {
+        D4FilterClause match(D4FilterClause::match, new D4RValue(str), new D4RValue("[Ein"));
+        CPPUNIT_ASSERT_THROW(match.value(), Error);
+    }
+
     CPPUNIT_TEST_SUITE( D4FilterClauseTest );
 
     CPPUNIT_TEST(Byte_and_long_long_test);
@@ -554,6 +750,16 @@ public:
     CPPUNIT_TEST(evaluation_order_test);
     CPPUNIT_TEST(evaluation_order_test_2);
 
+    // Batch evaluation
+    CPPUNIT_TEST(batch_numbers_test);
+    CPPUNIT_TEST(batch_strings_test);
+    CPPUNIT_TEST(batch_clauses_test);
+
+    // Compiled clauses
+    CPPUNIT_TEST(compiled_clause_test);
+    CPPUNIT_TEST(compiled_clause_copy_test);
+    CPPUNIT_TEST(compiled_clause_bad_regex_test);
+
     CPPUNIT_TEST_SUITE_END();
 };
 
@@ -24,6 +24,12 @@
 
 #include "config.h"
 
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <vector>
+
 #include <cppunit/TextTestRunner.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
@@ -34,9 +40,17 @@
 #include "D4Attributes.h"
 
 #include "Byte.h"
+#include "Int32.h"
 #include "Int64.h"
+#include "Array.h"
 #include "Structure.h"
 
+#include "DMR.h"
+#include "D4BaseTypeFactory.h"
+#include "D4StreamMarshaller.h"
+#include "Error.h"
+#include "InternalErr.h"
+
 #include "XMLWriter.h"
 #include "debug.h"
 
@@ -53,6 +67,57 @@ using namespace CppUnit;
 using namespace std;
 using namespace libdap;
 
+/**
+ * An Int32 array whose read() takes a while, so that reads of different
+ * variables overlap when D4Group::serialize() uses threads. Records the
+ * largest number of reads in progress at once.
+ */
+class SlowArray: public Array {
+    bool d_fail;
+    bool d_internal;    // fail with InternalErr instead of Error
+
+public:
+    static pthread_mutex_t mutex;
+    static int reads;
+    static int max_reads;
+
+    SlowArray(const string &name, int size, bool fail = false, bool internal = false) :
+        Array(name, new Int32(name)), d_fail(fail), d_internal(internal) {
+        append_dim(size);
+    }
+
+    virtual BaseType *ptr_duplicate() { return new SlowArray(*this); }
+
+    virtual bool read() {
+        pthread_mutex_lock(&mutex);
+        max_reads = max(max_reads, ++reads);
+        pthread_mutex_unlock(&mutex);
+
+        usleep(20000);
+
+        pthread_mutex_lock(&mutex);
+        --reads;
+        pthread_mutex_unlock(&mutex);
+
+        if (d_fail && d_internal)
+            throw InternalErr(__FILE__, __LINE__, "Could not read " + name());
+        if (d_fail)
+            throw Error("Could not read " + name());
+
+        vector<dods_int32> values(length());
+        for (vector<dods_int32>::size_type i = 0; i < values.size(); ++i)
+            values[i] = i * name().size();
+        set_value(values, values.size());
+        set_read_p(true);
+
+        return true;
+    }
+};
+
+pthread_mutex_t SlowArray::mutex = PTHREAD_MUTEX_INITIALIZER;
+int SlowArray::reads = 0;
+int SlowArray::max_reads = 0;
+
 class D4GroupTest: public TestFixture {
 private:
     XMLWriter *xml;
@@ -316,6 +381,74 @@ public:
 		CPPUNIT_ASSERT(btp && btp->FQN() == "/child/p.c.b");
     }
 
+    // Serialize a Group with 'num' arrays (the one at 'fail' throws Error,
+    // or InternalErr if 'internal' is true) and return the response
+    string serialize_arrays(int num, unsigned int read_threads, int fail = -1, bool internal = false) {
+        D4BaseTypeFactory factory;
+        DMR dmr(&factory);
+        dmr.set_read_threads(read_threads);
+
+        for (int i = 0; i < num; ++i) {
+            SlowArray *a = new SlowArray(string("a") + string(i + 1, 'x'), 1000 + i, i == fail, internal);
+            a->set_send_p(true);
+            dmr.root()->add_var_nocopy(a);
+        }
+
+        SlowArray::max_reads = 0;
+
+        ostringstream oss;
+        D4StreamMarshaller m(oss);
+        dmr.root()->serialize(m, dmr);
+        m.reset_checksum();
+
+        return oss.str();
+    }
+
+    void test_serialize_read_threads() {
+        string serial = serialize_arrays(8, 0);
+        CPPUNIT_ASSERT(SlowArray::max_reads == 1);
+
+        // Same values, same order, same checksums
+        CPPUNIT_ASSERT(serialize_arrays(8, 4) == serial);
+#ifdef USE_POSIX_THREADS
+        DBG(cerr << "Reads at once: " << SlowArray::max_reads << endl);
+        CPPUNIT_ASSERT(SlowArray::max_reads > 1);
+#endif
+        CPPUNIT_ASSERT(serialize_arrays(8, 1) == serial);
+        CPPUNIT_ASSERT(serialize_arrays(8, 16) == serial);
+    }
+
+    void test_serialize_read_threads_error() {
+        const unsigned int read_threads[] = { 0, 4 };
+        for (int t = 0; t < 2; ++t) {
+            try {
+                serialize_arrays(8, read_threads[t], 5);
+                CPPUNIT_FAIL("Expected an Error");
+            }
+            catch (Error &e) {
+                CPPUNIT_ASSERT(e.get_error_message() == "Could not read axxxxxx");
+            }
+        }
+    }
+
+    // An InternalErr thrown by read() on a reader thread is not sliced
+    void test_serialize_read_threads_internal_err() {
+        const unsigned int read_threads[] = { 0, 4 };
+        for (int t = 0; t < 2; ++t) {
+            try {
+                serialize_arrays(8, read_threads[t], 5, true);
+                CPPUNIT_FAIL("Expected an InternalErr");
+            }
+            catch (InternalErr &e) {
+                CPPUNIT_ASSERT(e.get_error_code() == internal_error);
+                CPPUNIT_ASSERT(e.get_error_message().find("Could not read axxxxxx") != string::npos);
+            }
+            catch (Error &e) {
+                CPPUNIT_FAIL("The InternalErr was thrown as an Error: " + e.get_error_message());
+            }
+        }
+    }
+
     CPPUNIT_TEST_SUITE( D4GroupTest );
 
         CPPUNIT_TEST(test_print_empty);
@@ -339,6 +472,10 @@ public:
         CPPUNIT_TEST(test_fqn_3);
         CPPUNIT_TEST(test_fqn_4);
 
+        CPPUNIT_TEST(test_serialize_read_threads);
+        CPPUNIT_TEST(test_serialize_read_threads_error);
+        CPPUNIT_TEST(test_serialize_read_threads_internal_err);
+
     CPPUNIT_TEST_SUITE_END();
 };
 
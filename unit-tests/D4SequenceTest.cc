@@ -36,6 +36,10 @@
 #include "D4Group.h"
 #include "D4RValue.h"
 #include "D4FilterClause.h"
+#include "D4SeqBatch.h"
+#include "Int32.h"
+#include "Float64.h"
+#include "InternalErr.h"
 
 #include "../tests/D4TestTypeFactory.h"
 #include "../tests/TestD4Sequence.h"
@@ -69,6 +73,41 @@ const static string two_clause_txt = "TestD4Sequence_two_clause.txt";
 namespace libdap
 {
 
+// A sequence that fills batches directly, the way a handler that reads
+// columns of a table would. The values of row r are i32 = r and f64 = r / 2.
+class BatchD4Sequence : public D4Sequence {
+private:
+    int d_rows;
+    int d_next;
+
+public:
+    int d_batches;
+
+    BatchD4Sequence(const string &n, int rows) : D4Sequence(n), d_rows(rows), d_next(0), d_batches(0) {
+        add_var_nocopy(new Int32("i32"));
+        add_var_nocopy(new Float64("f64"));
+    }
+
+    virtual bool read() {
+        throw InternalErr(__FILE__, __LINE__, "BatchD4Sequence is read in batches");
+    }
+
+    virtual unsigned int read_batch(D4SeqBatch &batch) {
+        dods_int32 *i32 = reinterpret_cast<dods_int32*>(batch.get_buf(0));
+        dods_float64 *f64 = reinterpret_cast<dods_float64*>(batch.get_buf(1));
+
+        unsigned int rows = 0;
+        for (; rows < batch.capacity() && d_next < d_rows; ++rows, ++d_next) {
+            i32[rows] = d_next;
+            f64[rows] = d_next / 2.0;
+        }
+
+        ++d_batches;
+        batch.set_size(rows);
+        return rows;
+    }
+};
+
 class D4SequenceTest : public TestFixture {
 private:
     TestD4Sequence *s;
@@ -195,6 +234,63 @@ public:
         CPPUNIT_ASSERT(oss.str() == readTestBaseline(prefix + one_clause_txt));
     }
 
+    // The batched read must give the same values as the row-at-a-time read
+    void batch_one_clause_test() {
+        s->set_batch_size(3);
+        one_clause_test();
+    }
+
+    void batch_two_clause_test() {
+        s->set_batch_size(2);
+        two_clause_test();
+    }
+
+    void batch_two_variable_test() {
+        s->set_batch_size(100);
+        two_variable_test();
+    }
+
+    void batch_no_clause_test() {
+        s->set_batch_size(4);
+        ctor_test();
+    }
+
+    void batch_read_test() {
+        BatchD4Sequence bs("bs", 1000);
+        bs.set_send_p(true);
+        bs.set_batch_size(64);
+
+        bs.clauses().add_clause(new D4FilterClause(D4FilterClause::greater_equal,
+            new D4RValue(bs.var("i32")), new D4RValue((long long)100)));
+        bs.clauses().add_clause(new D4FilterClause(D4FilterClause::less,
+            new D4RValue(bs.var("f64")), new D4RValue(150.0)));
+
+        bs.intern_data();
+
+        CPPUNIT_ASSERT_EQUAL(200, bs.length());
+        CPPUNIT_ASSERT_EQUAL(17, bs.d_batches);    // 15 full batches, a partial one and the empty one
+
+        CPPUNIT_ASSERT_EQUAL(100, static_cast<Int32*>(bs.var_value(0, "i32"))->value());
+        CPPUNIT_ASSERT_EQUAL(299, static_cast<Int32*>(bs.var_value(199, "i32"))->value());
+        CPPUNIT_ASSERT_EQUAL(149.5, static_cast<Float64*>(bs.var_value(199, "f64"))->value());
+    }
+
+    // Only the projected variables are copied into the sequence's values
+    void batch_projection_test() {
+        BatchD4Sequence bs("bs", 10);
+        bs.set_batch_size(4);
+        bs.var("f64")->set_send_p(true);
+
+        bs.clauses().add_clause(new D4FilterClause(D4FilterClause::not_equal,
+            new D4RValue(bs.var("i32")), new D4RValue((long long)3)));
+
+        bs.intern_data();
+
+        CPPUNIT_ASSERT_EQUAL(9, bs.length());
+        CPPUNIT_ASSERT_EQUAL((size_t)1, bs.row_value(0)->size());
+        CPPUNIT_ASSERT_EQUAL(2.0, static_cast<Float64*>(bs.var_value(3, "f64"))->value());
+    }
+
     CPPUNIT_TEST_SUITE( D4SequenceTest );
 
     CPPUNIT_TEST(ctor_test);
@@ -205,6 +301,13 @@ public:
     CPPUNIT_TEST(two_clause_test);
     CPPUNIT_TEST(two_variable_test);
 
+    CPPUNIT_TEST(batch_one_clause_test);
+    CPPUNIT_TEST(batch_two_clause_test);
+    CPPUNIT_TEST(batch_two_variable_test);
+    CPPUNIT_TEST(batch_no_clause_test);
+    CPPUNIT_TEST(batch_read_test);
+    CPPUNIT_TEST(batch_projection_test);
+
     CPPUNIT_TEST_SUITE_END();
 };
 
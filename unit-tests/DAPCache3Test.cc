@@ -0,0 +1,454 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "DAPCache3.h"
+#include "InternalErr.h"
+
+#include "GetOpt.h"
+#include "debug.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+// The cache files are 't3#<name>'; the cache's own files (dap.cache.info.N
+// and dap.cache.index.N) must not match the prefix.
+static const string cache_dir = "cache-testsuite/dap_cache3";
+static const string cache_prefix = "t3";
+
+class DAPCache3Test: public TestFixture {
+private:
+    // A 1MB cache; the purge target is 80% of that
+    DAPCache3 *open_cache()
+    {
+        return new DAPCache3(cache_dir, cache_prefix, 1);
+    }
+
+    // Add a file of 'size' bytes to the cache the way a server does
+    string add_file(DAPCache3 *cache, const string &name, unsigned long size)
+    {
+        string target = cache->get_cache_file_name(name, false);
+
+        int fd;
+        if (!cache->create_and_lock(target, fd))
+            throw InternalErr(__FILE__, __LINE__, "The file " + target + " is already in the cache");
+
+        vector<char> buf(size, 'x');
+        if (write(fd, &buf[0], size) != (ssize_t) size)
+            throw InternalErr(__FILE__, __LINE__, "Could not write " + target);
+
+        cache->update_cache_info(target);
+        cache->unlock_and_close(target);
+
+        return target;
+    }
+
+    // Return 'count' cache file names that hash to shard 'n'
+    vector<string> shard_files(DAPCache3 *cache, unsigned int n, unsigned int count)
+    {
+        vector<string> files;
+        for (unsigned int i = 0; files.size() < count; ++i) {
+            ostringstream oss;
+            oss << "file_" << n << "_" << i;
+            string target = cache->get_cache_file_name(oss.str(), false);
+            if (&cache->m_shard(target) == &cache->d_shards[n])
+                files.push_back(oss.str());
+        }
+
+        return files;
+    }
+
+    // Bring the index of the shard holding 'file' up to date and return it
+    DAPCache3::cache_shard &index(DAPCache3 *cache, const string &file)
+    {
+        DAPCache3::cache_shard &shard = cache->m_shard(file);
+        cache->m_lock_shard(shard, F_RDLCK);
+        cache->m_read_index(shard);
+        cache->m_unlock_shard(shard);
+
+        return shard;
+    }
+
+    static unsigned long long file_size(const string &file)
+    {
+        struct stat buf;
+        if (stat(file.c_str(), &buf) != 0)
+            return 0;
+        return buf.st_size;
+    }
+
+    static bool exists(const string &file)
+    {
+        return access(file.c_str(), F_OK) == 0;
+    }
+
+    // Wait for a child process and return its exit status
+    static int wait_for(pid_t pid)
+    {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+            return -1;
+        return WEXITSTATUS(status);
+    }
+
+public:
+    DAPCache3Test()
+    {
+    }
+
+    ~DAPCache3Test()
+    {
+    }
+
+    void setUp()
+    {
+        system(("rm -rf " + cache_dir).c_str());
+    }
+
+    void tearDown()
+    {
+        system(("rm -rf " + cache_dir).c_str());
+    }
+
+    CPPUNIT_TEST_SUITE( DAPCache3Test );
+
+    CPPUNIT_TEST(index_replay_test);
+    CPPUNIT_TEST(index_compaction_test);
+    CPPUNIT_TEST(index_rebuild_test);
+    CPPUNIT_TEST(purge_order_test);
+    CPPUNIT_TEST(shard_writers_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    // Changes made by one cache are read from the journal by another
+    void index_replay_test()
+    {
+        DAPCache3 *a = open_cache();
+        DAPCache3 *b = open_cache();
+
+        string one = add_file(a, "one", 1000);
+        string two = add_file(a, "two", 2000);
+
+        DAPCache3::cache_shard &shard_one = index(b, one);
+        CPPUNIT_ASSERT(shard_one.files.count(one) == 1);
+        CPPUNIT_ASSERT(shard_one.files[one].size == 1000);
+        DAPCache3::cache_shard &shard_two = index(b, two);
+        CPPUNIT_ASSERT(shard_two.files.count(two) == 1);
+        CPPUNIT_ASSERT(shard_two.files[two].size == 2000);
+        CPPUNIT_ASSERT(b->get_cache_size() == 3000);
+
+        a->purge_file(two);
+        CPPUNIT_ASSERT(!exists(two));
+        CPPUNIT_ASSERT(index(b, two).files.count(two) == 0);
+        CPPUNIT_ASSERT(b->get_cache_size() == 1000);
+
+        // A cache opened later reads the whole journal; it does not scan the
+        // directory.
+        DAPCache3 *c = open_cache();
+        DAPCache3::cache_shard &shard = index(c, one);
+        CPPUNIT_ASSERT(!shard.index_rebuild);
+        CPPUNIT_ASSERT(shard.files.count(one) == 1);
+        CPPUNIT_ASSERT(shard.files[one].size == 1000);
+        CPPUNIT_ASSERT(index(c, two).files.count(two) == 0);
+
+        delete a;
+        delete b;
+        delete c;
+    }
+
+    // A journal holding many more records than files is rewritten, even in
+    // a cache that is never purged; other caches notice and reload it.
+    void index_compaction_test()
+    {
+        DAPCache3 *a = open_cache();
+        DAPCache3 *b = open_cache();
+
+        string one = add_file(a, "one", 1000);
+        unsigned long long ino = index(a, one).index_ino;
+
+        // Cache hits only add records; they compact the journal too
+        for (int i = 0; i < 1100; ++i) {
+            int fd;
+            CPPUNIT_ASSERT(a->get_read_lock(one, fd));
+            a->unlock_and_close(one);
+        }
+
+        DAPCache3::cache_shard &shard = index(a, one);
+        CPPUNIT_ASSERT(shard.index_ino != ino);
+        CPPUNIT_ASSERT(shard.index_records < 1100);
+        CPPUNIT_ASSERT(shard.files.count(one) == 1);
+        CPPUNIT_ASSERT(exists(one));
+
+        DAPCache3::cache_shard &shard_b = index(b, one);
+        CPPUNIT_ASSERT(shard_b.index_ino == shard.index_ino);
+        CPPUNIT_ASSERT(shard_b.index_records == shard.index_records);
+        CPPUNIT_ASSERT(shard_b.files.count(one) == 1);
+        CPPUNIT_ASSERT(shard_b.files[one].size == 1000);
+
+        // New records are appended to the new journal
+        string two = add_file(b, "two", 2000);
+        CPPUNIT_ASSERT(index(a, two).files.count(two) == 1);
+
+        // Records added without the write lock leave the journal long...
+        a->m_lock_shard(shard, F_RDLCK);
+        for (int i = 0; i < 1100; ++i)
+            a->m_write_index_record(shard, 2 /* index_touch */, one, 0, time(0));
+        a->m_unlock_shard(shard);
+        CPPUNIT_ASSERT(shard.index_records > 1100);
+        unsigned long long journal_size = file_size(shard.index);
+        ino = shard.index_ino;
+
+        // ...until the shard is purged, even when nothing needs to go
+        a->m_lock_shard(shard, F_WRLCK);
+        a->m_purge_shard(shard, "", 1ULL << 40);
+        a->m_unlock_shard(shard);
+
+        CPPUNIT_ASSERT(shard.index_records == shard.files.size());
+        CPPUNIT_ASSERT(shard.index_ino != ino);
+        CPPUNIT_ASSERT(file_size(shard.index) < journal_size);
+        CPPUNIT_ASSERT(exists(one));
+
+        // ...or a cache is opened
+        a->m_lock_shard(shard, F_RDLCK);
+        for (int i = 0; i < 1100; ++i)
+            a->m_write_index_record(shard, 2 /* index_touch */, one, 0, time(0));
+        a->m_unlock_shard(shard);
+        CPPUNIT_ASSERT(shard.index_records > 1100);
+        ino = shard.index_ino;
+
+        DAPCache3 *c = open_cache();
+        DAPCache3::cache_shard &shard_c = index(c, one);
+        CPPUNIT_ASSERT(shard_c.index_ino != ino);
+        CPPUNIT_ASSERT(shard_c.index_records == shard_c.files.size());
+        CPPUNIT_ASSERT(shard_c.files.count(one) == 1);
+        CPPUNIT_ASSERT(shard_c.files[one].size == 1000);
+
+        delete a;
+        delete b;
+        delete c;
+    }
+
+    // A corrupt or missing journal is rebuilt from the cache directory when
+    // the cache is opened.
+    void index_rebuild_test()
+    {
+        DAPCache3 *a = open_cache();
+        string one = add_file(a, "one", 1000);
+        string two = add_file(a, "two", 2000);
+        string one_journal = a->m_shard(one).index;
+        string two_journal = a->m_shard(two).index;
+        delete a;
+
+        int fd = open(one_journal.c_str(), O_WRONLY | O_TRUNC);
+        CPPUNIT_ASSERT(fd != -1);
+        const char garbage[] = "this is not a cache index journal";
+        CPPUNIT_ASSERT(write(fd, garbage, sizeof(garbage)) == sizeof(garbage));
+        close(fd);
+
+        if (two_journal != one_journal)
+            CPPUNIT_ASSERT(unlink(two_journal.c_str()) == 0);
+
+        DAPCache3 *b = open_cache();
+        DAPCache3::cache_shard &shard_one = index(b, one);
+        CPPUNIT_ASSERT(!shard_one.index_rebuild);
+        CPPUNIT_ASSERT(shard_one.files.count(one) == 1);
+        CPPUNIT_ASSERT(shard_one.files[one].size == 1000);
+        DAPCache3::cache_shard &shard_two = index(b, two);
+        CPPUNIT_ASSERT(!shard_two.index_rebuild);
+        CPPUNIT_ASSERT(shard_two.files.count(two) == 1);
+        CPPUNIT_ASSERT(shard_two.files[two].size == 2000);
+
+        // The rebuilt journal is valid
+        fd = open(one_journal.c_str(), O_RDONLY);
+        CPPUNIT_ASSERT(fd != -1);
+        char magic[8];
+        CPPUNIT_ASSERT(read(fd, magic, sizeof(magic)) == sizeof(magic));
+        close(fd);
+        CPPUNIT_ASSERT(memcmp(magic, "DAPIDX01", sizeof(magic)) == 0);
+
+        delete b;
+    }
+
+    // Within a shard, files are purged least recently used first and the
+    // file just added is kept.
+    void purge_order_test()
+    {
+        DAPCache3 *a = open_cache();
+
+        vector<string> names = shard_files(a, 0, 5);
+        vector<string> files;
+        for (vector<string>::iterator i = names.begin(); i != names.end(); ++i)
+            files.push_back(add_file(a, *i, 300 * 1024));
+        CPPUNIT_ASSERT(a->get_cache_size() == 5 * 300 * 1024);
+
+        // Use the files in the order 3, 1, 4, 0, 2
+        DAPCache3::cache_shard &shard = a->d_shards[0];
+        time_t now = time(0);
+        int order[] = { 3, 1, 4, 0, 2 };
+        a->m_lock_shard(shard, F_WRLCK);
+        for (int i = 0; i < 5; ++i)
+            a->m_write_index_record(shard, 2 /* index_touch */, files[order[i]], 0, now + 10 * (i + 1));
+        a->m_unlock_shard(shard);
+
+        // The cache is 1.5MB and the target is 0.8MB, so the three least
+        // recently used files go.
+        DBG(a->dump(cerr));
+        a->update_and_purge(files[2]);
+
+        CPPUNIT_ASSERT(!exists(files[3]));
+        CPPUNIT_ASSERT(!exists(files[1]));
+        CPPUNIT_ASSERT(!exists(files[4]));
+        CPPUNIT_ASSERT(exists(files[0]));
+        CPPUNIT_ASSERT(exists(files[2]));
+        CPPUNIT_ASSERT(a->get_cache_size() == 2 * 300 * 1024);
+
+        // The purge is in the journal
+        DAPCache3 *b = open_cache();
+        CPPUNIT_ASSERT(index(b, files[0]).files.size() == 2);
+        CPPUNIT_ASSERT(index(b, files[0]).index_size == 2 * 300 * 1024);
+
+        delete a;
+        delete b;
+    }
+
+    // Several processes add files to different shards at once, each
+    // purging after every file. The shard sizes must match the files left
+    // and the cache must end up within its budget.
+    void shard_writers_test()
+    {
+        DAPCache3 *a = open_cache();
+
+        const int writers = 4;
+        const int files_per_writer = 6;
+        const unsigned long file_size = 100 * 1024;
+
+        vector<pid_t> pids;
+        for (int w = 0; w < writers; ++w) {
+            pid_t pid = fork();
+            CPPUNIT_ASSERT(pid >= 0);
+            if (pid == 0) {
+                int status = 0;
+                try {
+                    DAPCache3 *c = open_cache();
+                    vector<string> names = shard_files(c, w * 4, files_per_writer);
+                    for (vector<string>::iterator i = names.begin(); i != names.end(); ++i)
+                        c->update_and_purge(add_file(c, *i, file_size));
+                    delete c;
+                }
+                catch (...) {
+                    status = 1;
+                }
+                _exit(status);
+            }
+            pids.push_back(pid);
+        }
+
+        for (vector<pid_t>::iterator i = pids.begin(); i != pids.end(); ++i)
+            CPPUNIT_ASSERT(wait_for(*i) == 0);
+
+        CacheFiles contents;
+        unsigned long long disk_size = a->m_collect_cache_dir_info(contents);
+        DBG(cerr << "files: " << contents.size() << ", size: " << disk_size << endl);
+
+        // Files were purged
+        CPPUNIT_ASSERT(disk_size < writers * files_per_writer * file_size);
+
+        // Each shard's size is the size of its files
+        for (unsigned int s = 0; s < a->d_shards.size(); ++s) {
+            unsigned long long shard_size = 0;
+            for (CacheFiles::iterator i = contents.begin(); i != contents.end(); ++i)
+                if (&a->m_shard(i->name) == &a->d_shards[s])
+                    shard_size += i->size;
+            CPPUNIT_ASSERT(a->m_read_shard_size(a->d_shards[s]) == shard_size);
+        }
+
+        CPPUNIT_ASSERT(a->get_cache_size() == disk_size);
+        CPPUNIT_ASSERT(!a->cache_too_big(a->get_cache_size()));
+
+        delete a;
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DAPCache3Test);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    char option_char;
+
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::DAPCache3Test::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
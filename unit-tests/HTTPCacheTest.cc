@@ -25,6 +25,7 @@
 #include <unistd.h>   // for access stat
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h> // for shared_cache_test
 
 #include <cstdio>     // for create_cache_root_test
 #include <string>
@@ -162,7 +163,11 @@ public:
     CPPUNIT_TEST(cache_index_read_test);
     CPPUNIT_TEST(cache_index_parse_line_test);
     CPPUNIT_TEST(get_entry_from_cache_table_test);
+    CPPUNIT_TEST(cache_table_growth_test);
     CPPUNIT_TEST(cache_index_write_test);
+    CPPUNIT_TEST(cache_index_journal_test);
+    CPPUNIT_TEST(cache_index_migration_test);
+    CPPUNIT_TEST(shared_cache_test);
     CPPUNIT_TEST(create_cache_root_test);
     CPPUNIT_TEST(set_cache_root_test);
     CPPUNIT_TEST(get_single_user_lock_test);
@@ -248,24 +253,108 @@ public:
         CPPUNIT_ASSERT(e2->url == localhost_url);
         e2->unlock_read_response();
 
-        // Now test what happens when two entries collide.
-        HTTPCacheTable::CacheEntry *e3 = hc->d_http_cache_table->cache_index_parse_line(index_file_line.c_str());
+        HTTPCacheTable::CacheEntry *g = hc->d_http_cache_table->get_locked_entry_from_cache_table("http://not.in.table/never.x");
+        CPPUNIT_ASSERT(g == 0);
+
+        // Now test what happens when two entries collide. Shrink the index
+        // of an empty table to eight slots and find two URLs whose hashes
+        // have the same low three bits, so they share a home slot.
+        hc->create_cache_root("cache-testsuite/collision_cache/");
+        HTTPCacheTable table("cache-testsuite/collision_cache/", 4096);
+        table.m_rebuild_index(8);
+        const uint64_t mask = 7;
+
+        string url1 = localhost_url + "?0";
+        string url2;
+        for (int i = 1; url2.empty(); ++i) {
+            string url = localhost_url + "?" + long_to_string(i);
+            if ((get_url_hash(url) & mask) == (get_url_hash(url1) & mask))
+                url2 = url;
+        }
+        uint64_t home = get_url_hash(url1) & mask;
+
+        HTTPCacheTable::CacheEntry *e3 = table.cache_index_parse_line(index_file_line.c_str());
+        e3->url = url1;
+        e3->cachename = "cache-testsuite/collision_cache/no_such_file";
+        table.add_entry_to_cache_table(e3);
 
-        // Change the url so we can tell the difference (the hash is the same)
-        e3->url = "http://new.url.same.hash/test/collisions.gif";
+        HTTPCacheTable::CacheEntry *e4 = table.cache_index_parse_line(index_file_line.c_str());
+        e4->url = url2;
+        e4->cachename = "cache-testsuite/collision_cache/no_such_file";
+        table.add_entry_to_cache_table(e4);
+        CPPUNIT_ASSERT(table.d_index.size() == 8);
 
-        hc->d_http_cache_table->add_entry_to_cache_table(e3);
+        // The second entry had to be probed past its home slot
+        CPPUNIT_ASSERT(table.m_find_slot(get_url_hash(url1), url1) == (int)home);
+        CPPUNIT_ASSERT(table.m_find_slot(get_url_hash(url2), url2) == (int)((home + 1) & mask));
 
         // Use the version of get_entry... that lets us pass in the hash
         // value (as opposed to the normal version which calculates the hash
         // from the url. 10/01/02 jhrg
-        HTTPCacheTable::CacheEntry *g = hc->d_http_cache_table->get_locked_entry_from_cache_table(hash_value, e3->url);
-        CPPUNIT_ASSERT(g);
-        CPPUNIT_ASSERT(g->url == e3->url);
+        g = table.get_locked_entry_from_cache_table(get_url_hash(url2), url2);
+        CPPUNIT_ASSERT(g == e4);
         g->unlock_read_response();
 
-        g = hc->d_http_cache_table->get_locked_entry_from_cache_table("http://not.in.table/never.x");
-        CPPUNIT_ASSERT(g == 0);
+        g = table.get_locked_entry_from_cache_table(url1);
+        CPPUNIT_ASSERT(g == e3);
+        g->unlock_read_response();
+
+        // The slot hashes must match too, not only the home slots
+        CPPUNIT_ASSERT(table.get_locked_entry_from_cache_table(get_url_hash(url1), url2) == 0);
+
+        // Removing the first entry moves the second back to its home slot
+        table.remove_entry_from_cache_table(url1);
+        CPPUNIT_ASSERT(table.get_locked_entry_from_cache_table(url1) == 0);
+        CPPUNIT_ASSERT(table.m_find_slot(get_url_hash(url2), url2) == (int)home);
+        g = table.get_locked_entry_from_cache_table(url2);
+        CPPUNIT_ASSERT(g == e4);
+        g->unlock_read_response();
+    }
+
+    // Add enough entries to grow the table's index several times, then remove
+    // some of them, both one at a time and with a garbage collection walk.
+    void cache_table_growth_test()
+    {
+        hc->create_cache_root("cache-testsuite/table_cache/");
+        HTTPCacheTable table("cache-testsuite/table_cache/", 4096);
+        const int num = 10000;
+
+        for (int i = 0; i < num; ++i) {
+            HTTPCacheTable::CacheEntry *e = table.cache_index_parse_line(index_file_line.c_str());
+            e->url = localhost_url + "?" + long_to_string(i);
+            e->cachename = "cache-testsuite/table_cache/no_such_file";
+            e->size = i % 2 ? 10 : 10000;
+            table.add_entry_to_cache_table(e);
+        }
+        CPPUNIT_ASSERT(table.get_num_entries() == num);
+        CPPUNIT_ASSERT(table.d_index.size() >= num);
+
+        for (int i = 0; i < num; ++i) {
+            HTTPCacheTable::CacheEntry *e = table.get_locked_entry_from_cache_table(localhost_url + "?" + long_to_string(i));
+            CPPUNIT_ASSERT(e);
+            CPPUNIT_ASSERT(e->url == localhost_url + "?" + long_to_string(i));
+            e->unlock_read_response();
+        }
+
+        // Remove every third entry
+        for (int i = 0; i < num; i += 3)
+            table.remove_entry_from_cache_table(localhost_url + "?" + long_to_string(i));
+
+        // Remove the big (even numbered) entries
+        table.delete_by_size(100);
+
+        for (int i = 0; i < num; ++i) {
+            HTTPCacheTable::CacheEntry *e = table.get_locked_entry_from_cache_table(localhost_url + "?" + long_to_string(i));
+            if (i % 3 == 0 || i % 2 == 0) {
+                CPPUNIT_ASSERT(!e);
+            }
+            else {
+                CPPUNIT_ASSERT(e);
+                CPPUNIT_ASSERT(e->url == localhost_url + "?" + long_to_string(i));
+                e->unlock_read_response();
+            }
+        }
+        CPPUNIT_ASSERT(table.get_num_entries() == num / 3);
     }
 
     void cache_index_write_test()
@@ -299,6 +388,180 @@ public:
         }
     }
 
+    // Changes to the table are appended to the journal as they are made, so
+    // they are not lost if the table is never written (e.g., a crash).
+    void cache_index_journal_test()
+    {
+        string root = "cache-testsuite/journal_cache/";
+        hc->create_cache_root(root);
+        remove((root + ".index.journal").c_str());
+
+        {
+            HTTPCacheTable table(root, 4096);
+            for (int i = 0; i < 3; ++i) {
+                HTTPCacheTable::CacheEntry *e = table.cache_index_parse_line(index_file_line.c_str());
+                e->url = localhost_url + "?" + long_to_string(i);
+                e->cachename = root + "no_such_file";
+                table.add_entry_to_cache_table(e);
+            }
+            table.remove_entry_from_cache_table(localhost_url + "?1");
+        }
+
+        // Add a partial record, as if a write was interrupted
+        FILE *fp = fopen((root + ".index.journal").c_str(), "ab");
+        CPPUNIT_ASSERT(fp);
+        fwrite("\001\000\000\000\377", 5, 1, fp);
+        fclose(fp);
+
+        {
+            HTTPCacheTable table(root, 4096);
+            CPPUNIT_ASSERT(table.get_num_entries() == 2);
+
+            HTTPCacheTable::CacheEntry *e = table.get_locked_entry_from_cache_table(localhost_url + "?0");
+            CPPUNIT_ASSERT(e);
+            CPPUNIT_ASSERT(e->cachename == root + "no_such_file");
+            CPPUNIT_ASSERT(e->etag == "\"3f62c-157-139c2680\"");
+            CPPUNIT_ASSERT(e->lm == 1121283146);
+            CPPUNIT_ASSERT(e->hash == 656);
+            e->unlock_read_response();
+
+            CPPUNIT_ASSERT(!table.get_locked_entry_from_cache_table(localhost_url + "?1"));
+
+            // The partial record was dropped, so this one can be read
+            HTTPCacheTable::CacheEntry *e3 = table.cache_index_parse_line(index_file_line.c_str());
+            e3->url = localhost_url + "?3";
+            table.add_entry_to_cache_table(e3);
+        }
+
+        {
+            HTTPCacheTable table(root, 4096);
+            CPPUNIT_ASSERT(table.get_num_entries() == 3);
+
+            // Compacting the journal leaves one record per entry
+            table.cache_index_write();
+            CPPUNIT_ASSERT(table.d_journal_records == 3);
+        }
+
+        HTTPCacheTable table(root, 4096);
+        CPPUNIT_ASSERT(table.get_num_entries() == 3);
+        HTTPCacheTable::CacheEntry *e = table.get_locked_entry_from_cache_table(localhost_url + "?3");
+        CPPUNIT_ASSERT(e);
+        e->unlock_read_response();
+    }
+
+    // An old text index is read and replaced by a journal
+    void cache_index_migration_test()
+    {
+        string root = "cache-testsuite/journal_cache/";
+        hc->create_cache_root(root);
+        remove((root + ".index.journal").c_str());
+
+        FILE *fp = fopen((root + ".index").c_str(), "w");
+        CPPUNIT_ASSERT(fp);
+        fprintf(fp, "%s\r\n", index_file_line.c_str());
+        fclose(fp);
+
+        {
+            HTTPCacheTable table(root, 4096);
+            CPPUNIT_ASSERT(table.get_num_entries() == 1);
+        }
+
+        CPPUNIT_ASSERT(access((root + ".index").c_str(), F_OK) != 0);
+        CPPUNIT_ASSERT(access((root + ".index.journal").c_str(), F_OK) == 0);
+
+        HTTPCacheTable table(root, 4096);
+        HTTPCacheTable::CacheEntry *e = table.get_locked_entry_from_cache_table(localhost_url);
+        CPPUNIT_ASSERT(e);
+        CPPUNIT_ASSERT(e->cachename == "cache-testsuite/dods_cache/656/dodsKbcD0h");
+        e->unlock_read_response();
+    }
+
+    // Wait for a child process and return its exit status
+    static int wait_for(pid_t pid)
+    {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+            return -1;
+        return WEXITSTATUS(status);
+    }
+
+    // Two processes using one cache: what one caches the other sees, a
+    // response one is reading is not removed by the other and the fill lock
+    // for a URL is held by only one of them.
+    void shared_cache_test()
+    {
+        string root = "cache-testsuite/shared_cache/";
+        auto_ptr<HTTPCache> pc(new HTTPCache(root, false, true));
+        CPPUNIT_ASSERT(pc->is_cache_shared());
+        CPPUNIT_ASSERT(!pc->get_cached_response(localhost_url));
+
+        pid_t pid = fork();
+        CPPUNIT_ASSERT(pid >= 0);
+        if (pid == 0) {
+            HTTPCache *c = new HTTPCache(root, false, true);
+            FILE *body = tmpfile();
+            fputs("Hello, World.", body);
+            rewind(body);
+            bool status = c->cache_response(localhost_url, time(0), h, body);
+            delete c;
+            _exit(status ? 0 : 1);
+        }
+        CPPUNIT_ASSERT(wait_for(pid) == 0);
+
+        // The response cached by the other process is found
+        FILE *body = pc->get_cached_response(localhost_url);
+        CPPUNIT_ASSERT(body);
+        char buf[64];
+        CPPUNIT_ASSERT(fgets(buf, sizeof buf, body));
+        CPPUNIT_ASSERT(string(buf) == "Hello, World.");
+
+        // Garbage collection by the other process leaves it alone while it
+        // is in use here...
+        pid = fork();
+        CPPUNIT_ASSERT(pid >= 0);
+        if (pid == 0) {
+            HTTPCache *c = new HTTPCache(root, false, true);
+            c->d_http_cache_table->delete_by_size(0);
+            bool found = c->is_url_in_cache(localhost_url);
+            delete c;
+            _exit(found ? 0 : 1);
+        }
+        CPPUNIT_ASSERT(wait_for(pid) == 0);
+
+        pc->release_cached_response(body);
+        fclose(body);
+
+        // ... but not once it has been released.
+        pid = fork();
+        CPPUNIT_ASSERT(pid >= 0);
+        if (pid == 0) {
+            HTTPCache *c = new HTTPCache(root, false, true);
+            c->d_http_cache_table->delete_by_size(0);
+            bool found = c->is_url_in_cache(localhost_url);
+            delete c;
+            _exit(found ? 1 : 0);
+        }
+        CPPUNIT_ASSERT(wait_for(pid) == 0);
+
+        CPPUNIT_ASSERT(!pc->get_cached_response(localhost_url));
+
+        // The other process waits for the fill lock
+        pc->lock_cache_fill(localhost_url);
+        pid = fork();
+        CPPUNIT_ASSERT(pid >= 0);
+        if (pid == 0) {
+            HTTPCache *c = new HTTPCache(root, false, true);
+            c->lock_cache_fill(localhost_url);
+            c->unlock_cache_fill(localhost_url);
+            delete c;
+            _exit(0);
+        }
+        sleep(1);
+        CPPUNIT_ASSERT(waitpid(pid, 0, WNOHANG) == 0);
+        pc->unlock_cache_fill(localhost_url);
+        CPPUNIT_ASSERT(wait_for(pid) == 0);
+    }
+
     void create_cache_root_test()
     {
         hc->create_cache_root("/tmp/silly/");
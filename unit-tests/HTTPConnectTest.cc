@@ -27,14 +27,23 @@
 #include <cppunit/extensions/TestFactoryRegistry.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
 #include <cstring>
 #include <iterator>
 #include <string>
+#include <map>
+#include <sstream>
 #include <algorithm>
 #include <functional>
 
 #include "GNURegex.h"
 #include "HTTPConnect.h"
+#include "HTTPStreamResponse.h"
 #include "RCReader.h"
 
 #include "debug.h"
@@ -150,6 +159,20 @@ class HTTPConnectTest: public TestFixture {
     CPPUNIT_TEST(set_xdap_protocol_test);
     CPPUNIT_TEST(read_url_password_test);
     CPPUNIT_TEST(read_url_password_test2);
+    CPPUNIT_TEST(coalesced_fetch_test);
+    CPPUNIT_TEST(coalesced_fetch_error_test);
+    CPPUNIT_TEST(async_fetch_test);
+    CPPUNIT_TEST(memory_response_test);
+    CPPUNIT_TEST(range_fetch_test);
+    CPPUNIT_TEST(range_fetch_memory_test);
+    CPPUNIT_TEST(range_fetch_no_ranges_test);
+    CPPUNIT_TEST(range_fetch_small_test);
+    CPPUNIT_TEST(range_fetch_if_range_test);
+    CPPUNIT_TEST(range_fetch_restart_test);
+    CPPUNIT_TEST(range_fetch_total_test);
+    CPPUNIT_TEST(stream_fetch_test);
+    CPPUNIT_TEST(stream_fetch_headers_test);
+    CPPUNIT_TEST(stream_fetch_error_test);
 
   // CPPUNIT_TEST(read_url_password_proxy_test);
 
@@ -711,6 +734,615 @@ class HTTPConnectTest: public TestFixture {
         resp_h = 0;
     }
 
+    // Each thread fetches a URL using its own HTTPConnect
+    struct Fetch {
+        string url;
+        HTTPResponse *response;
+        string error;
+    };
+
+    static void *fetch_url_thread(void *arg) {
+        Fetch *fetch = static_cast<Fetch*>(arg);
+        try {
+            HTTPConnect connect(RCReader::instance());
+            fetch->response = connect.fetch_url(fetch->url);
+        }
+        catch (Error &e) {
+            fetch->error = e.get_error_message();
+        }
+        return 0;
+    }
+
+    static void run_fetches(vector<Fetch> &fetches) {
+        vector<pthread_t> threads(fetches.size());
+        for (unsigned int i = 0; i < fetches.size(); ++i)
+            CPPUNIT_ASSERT(pthread_create(&threads[i], 0, fetch_url_thread, &fetches[i]) == 0);
+        for (unsigned int i = 0; i < fetches.size(); ++i)
+            pthread_join(threads[i], 0);
+    }
+
+    static string read_all(FILE *fp) {
+        string s;
+        char buf[1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+            s.append(buf, n);
+        return s;
+    }
+
+    static string read_test_file(const string &name) {
+        FILE *fp = fopen((string(TEST_SRC_DIR) + "/" + name).c_str(), "rb");
+        CPPUNIT_ASSERT(fp);
+        string s = read_all(fp);
+        fclose(fp);
+        return s;
+    }
+
+    // Eight threads fetch the same URL from a server that holds the response
+    // half sent until seven of them are waiting for the first one's transfer
+    void check_coalesced_fetch(bool in_memory) {
+        int hold[2];
+        CPPUNIT_ASSERT(pipe(hold) == 0);
+
+        TestServer server;
+        start_server(server, 128 * 1024, false);
+        server.hold = hold[0];
+
+        Fetch f = { server_url(server), 0, "" };
+        vector<Fetch> fetches(8, f);
+        vector<pthread_t> threads(fetches.size());
+        for (unsigned int i = 0; i < fetches.size(); ++i)
+            CPPUNIT_ASSERT(pthread_create(&threads[i], 0, fetch_url_thread, &fetches[i]) == 0);
+
+        for (int tries = 0; tries < 1000 && HTTPConnect::get_num_shared_fetch_waiters() < 7; ++tries)
+            usleep(10000);
+        int waiters = HTTPConnect::get_num_shared_fetch_waiters();
+
+        // Enough to release every request, should there be more than one
+        for (unsigned int i = 0; i < fetches.size(); ++i)
+            CPPUNIT_ASSERT(write(hold[1], "x", 1) == 1);
+        for (unsigned int i = 0; i < fetches.size(); ++i)
+            pthread_join(threads[i], 0);
+        stop_server(server);
+        close(hold[0]);
+        close(hold[1]);
+
+        DBG(cerr << "Waiters: " << waiters << ", requests: " << server.requests.size() << endl);
+        CPPUNIT_ASSERT(waiters == 7);
+        CPPUNIT_ASSERT(server.requests.size() == 1);
+
+        for (unsigned int i = 0; i < fetches.size(); ++i) {
+            DBG(cerr << "Fetch " << i << ": " << fetches[i].error << endl);
+            CPPUNIT_ASSERT(fetches[i].error.empty());
+            CPPUNIT_ASSERT(fetches[i].response);
+            CPPUNIT_ASSERT(read_all(fetches[i].response->get_stream()) == server.body);
+
+            string temp = fetches[i].response->get_file();
+            CPPUNIT_ASSERT(temp.empty() == in_memory);
+            CPPUNIT_ASSERT((fetches[i].response->get_body() != 0) == in_memory);
+            delete fetches[i].response;
+            if (!in_memory)
+                CPPUNIT_ASSERT(access(temp.c_str(), F_OK) != 0);
+        }
+    }
+
+    // Threads that request the same URL at the same time share one request
+    // and each get a complete response that they can read and free
+    // independently.
+    void coalesced_fetch_test() {
+        int limit = RCReader::instance()->get_max_memory_response();
+
+        check_coalesced_fetch(true);
+
+        RCReader::instance()->set_max_memory_response(0);
+        try {
+            check_coalesced_fetch(false);
+        }
+        catch (...) {
+            RCReader::instance()->set_max_memory_response(limit);
+            throw;
+        }
+        RCReader::instance()->set_max_memory_response(limit);
+    }
+
+    // When the request fails, every thread waiting for it sees the error.
+    void coalesced_fetch_error_test() {
+        Fetch f = { string("file://") + TEST_SRC_DIR + "/no-such-file", 0, "" };
+        vector<Fetch> fetches(4, f);
+        run_fetches(fetches);
+
+        for (unsigned int i = 0; i < fetches.size(); ++i) {
+            CPPUNIT_ASSERT(!fetches[i].response);
+            CPPUNIT_ASSERT(!fetches[i].error.empty());
+        }
+    }
+
+    // Several requests made at once; each response (or error) is returned
+    // once, along with the number of its request.
+    void async_fetch_test() {
+        vector<string> files;
+        files.push_back(string(TEST_SRC_DIR) + "/HTTPConnectTest.cc");
+        files.push_back(string(TEST_SRC_DIR) + "/HTTPCacheTest.cc");
+        files.push_back(string(TEST_SRC_DIR) + "/no-such-file");
+        files.push_back(string(TEST_SRC_DIR) + "/HTTPConnectTest.cc");
+
+        map<int, string> requests;
+        for (unsigned int i = 0; i < files.size(); ++i)
+            requests[http->start_fetch_url("file://" + files[i])] = files[i];
+        CPPUNIT_ASSERT(requests.size() == files.size());
+        CPPUNIT_ASSERT(http->get_num_pending_responses() == files.size());
+
+        int responses = 0, errors = 0;
+        while (true) {
+            int request = 0;
+            HTTPResponse *rs = 0;
+            try {
+                rs = http->get_next_response(request);
+                if (!rs)
+                    break;
+            }
+            catch (Error &e) {
+                DBG(cerr << "Request " << request << ": " << e.get_error_message() << endl);
+                CPPUNIT_ASSERT(requests[request] == files[2]);
+                requests.erase(request);
+                ++errors;
+                continue;
+            }
+
+            CPPUNIT_ASSERT(requests.find(request) != requests.end());
+            FILE *fp = fopen(requests[request].c_str(), "rb");
+            CPPUNIT_ASSERT(fp);
+            string expected = read_all(fp);
+            fclose(fp);
+            CPPUNIT_ASSERT(read_all(rs->get_stream()) == expected);
+
+            requests.erase(request);
+            delete rs;
+            ++responses;
+        }
+
+        CPPUNIT_ASSERT(responses == 3);
+        CPPUNIT_ASSERT(errors == 1);
+        CPPUNIT_ASSERT(requests.empty());
+        CPPUNIT_ASSERT(http->get_num_pending_responses() == 0);
+    }
+
+    // Small bodies are held in memory; a body that outgrows the limit is
+    // moved to a temporary file part way through the transfer.
+    void memory_response_test() {
+        string url = string("file://") + TEST_SRC_DIR + "/HTTPConnectTest.cc";
+        string expected = read_test_file("HTTPConnectTest.cc");
+
+        http->set_max_memory_response(expected.size());
+        HTTPResponse *rs = http->fetch_url(url);
+        CPPUNIT_ASSERT(rs->get_body() && rs->get_body()->size() == expected.size());
+        CPPUNIT_ASSERT(rs->get_file().empty());
+        CPPUNIT_ASSERT(read_all(rs->get_stream()) == expected);
+        delete rs;
+
+        http->set_max_memory_response(1024);
+        rs = http->fetch_url(url);
+        CPPUNIT_ASSERT(!rs->get_body());
+        string temp = rs->get_file();
+        CPPUNIT_ASSERT(!temp.empty());
+        CPPUNIT_ASSERT(read_all(rs->get_stream()) == expected);
+        delete rs;
+        CPPUNIT_ASSERT(access(temp.c_str(), F_OK) != 0);
+
+        http->set_max_memory_response(expected.size());
+        http->set_use_cpp_streams(true);
+        rs = http->fetch_url(url);
+        CPPUNIT_ASSERT(rs->get_body());
+        ostringstream oss;
+        oss << rs->get_cpp_stream()->rdbuf();
+        CPPUNIT_ASSERT(oss.str() == expected);
+
+        // The stream can be repositioned, as an istringstream can
+        istream *in = rs->get_cpp_stream();
+        in->clear();
+        CPPUNIT_ASSERT(in->seekg(100).tellg() == 100);
+        CPPUNIT_ASSERT(char(in->get()) == expected[100]);
+        CPPUNIT_ASSERT(char(in->seekg(-1, ios::end).get()) == expected[expected.size() - 1]);
+        CPPUNIT_ASSERT(in->seekg(1, ios::end).fail());
+        delete rs;
+    }
+
+    // A stand-in for a DAP4 server, listening on the loopback interface. It
+    // answers every GET with 'body' (sending just the requested part if
+    // 'ranges' is true) and records the Range header of each request. If
+    // 'hold' is a file descriptor, the server sends the first half of the
+    // body (none of it if 'hold_body' is true) and then waits until it can
+    // read a byte from 'hold'. If 'etag'
+    // is not empty it is sent as the ETag and, if 'honor_if_range' is true,
+    // a request whose If-Range does not match it gets the whole body. Once
+    // 'change_after' requests have been answered, 'next_body' (if not empty)
+    // replaces the body and the ETag changes.
+    struct TestServer {
+        int fd;
+        int port;
+        string body;
+        bool ranges;
+        int hold;
+        bool hold_body;
+        bool stop;
+        string etag;
+        bool honor_if_range;
+        string next_body;
+        size_t change_after;
+        vector<string> requests;
+        vector<string> if_ranges;
+        pthread_t thread;
+    };
+
+    static string get_header(const string &request, const string &name) {
+        string::size_type i = request.find("\r\n" + name + ": ");
+        if (i == string::npos)
+            return "";
+        i += name.size() + 4;
+        return request.substr(i, request.find("\r\n", i) - i);
+    }
+
+    static void *serve(void *arg) {
+        TestServer *server = static_cast<TestServer*>(arg);
+        while (true) {
+            int conn = accept(server->fd, 0, 0);
+            if (conn < 0 || server->stop) {
+                if (conn >= 0) close(conn);
+                return 0;
+            }
+
+            string request;
+            char buf[1024];
+            ssize_t n;
+            while (request.find("\r\n\r\n") == string::npos && (n = read(conn, buf, sizeof buf)) > 0)
+                request.append(buf, n);
+
+            if (!server->next_body.empty() && server->requests.size() == server->change_after) {
+                server->body.swap(server->next_body);
+                server->next_body.clear();
+                server->etag += "+";
+            }
+
+            size_t first = 0, last = server->body.size() - 1;
+            string::size_type range = request.find("Range: bytes=");
+            server->requests.push_back(range == string::npos ? "" : request.substr(range + 13, request.find("\r\n", range) - range - 13));
+            string if_range = get_header(request, "If-Range");
+            server->if_ranges.push_back(if_range);
+            bool partial = server->ranges && range != string::npos
+                           && (if_range.empty() || !server->honor_if_range || if_range == "\"" + server->etag + "\"")
+                           && sscanf(request.c_str() + range, "Range: bytes=%zu-%zu", &first, &last) == 2;
+            if (!partial) {
+                first = 0;
+                last = server->body.size() - 1;
+            }
+            if (last >= server->body.size())
+                last = server->body.size() - 1;
+
+            ostringstream oss;
+            oss << (partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n")
+                << "Content-Type: application/vnd.opendap.dap4.data\r\n"
+                << "Content-Length: " << last - first + 1 << "\r\n";
+            if (partial)
+                oss << "Content-Range: bytes " << first << "-" << last << "/" << server->body.size() << "\r\n";
+            if (server->ranges)
+                oss << "Accept-Ranges: bytes\r\n";
+            if (!server->etag.empty())
+                oss << "ETag: \"" << server->etag << "\"\r\n";
+            oss << "Connection: close\r\n\r\n";
+
+            string response = oss.str() + server->body.substr(first, last - first + 1);
+            size_t body_size = last - first + 1;
+            size_t half = server->hold >= 0 ? response.size() - (server->hold_body ? body_size : body_size / 2)
+                                            : response.size();
+            for (size_t sent = 0; sent < response.size(); ) {
+                if (sent == half) {
+                    char c;
+                    if (read(server->hold, &c, 1) != 1) break;
+                }
+                // The client may hang up on a response it does not want
+                if ((n = send(conn, response.data() + sent, (sent < half ? half : response.size()) - sent, MSG_NOSIGNAL)) <= 0) break;
+                sent += n;
+            }
+            close(conn);
+        }
+    }
+
+    static void start_server(TestServer &server, size_t size, bool ranges) {
+        server.body.resize(size);
+        for (size_t i = 0; i < size; ++i)
+            server.body[i] = static_cast<char>((i * 7919) >> 3);
+        server.ranges = ranges;
+        server.hold = -1;
+        server.hold_body = false;
+        server.stop = false;
+        server.honor_if_range = true;
+        server.change_after = 0;
+
+        server.fd = socket(AF_INET, SOCK_STREAM, 0);
+        CPPUNIT_ASSERT(server.fd >= 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        CPPUNIT_ASSERT(bind(server.fd, (struct sockaddr *)&addr, len) == 0);
+        CPPUNIT_ASSERT(listen(server.fd, 16) == 0);
+        CPPUNIT_ASSERT(getsockname(server.fd, (struct sockaddr *)&addr, &len) == 0);
+        server.port = ntohs(addr.sin_port);
+
+        CPPUNIT_ASSERT(pthread_create(&server.thread, 0, serve, &server) == 0);
+    }
+
+    static void stop_server(TestServer &server) {
+        // Wake the server with one last connection
+        server.stop = true;
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(server.port);
+        connect(fd, (struct sockaddr *)&addr, sizeof addr);
+        close(fd);
+
+        pthread_join(server.thread, 0);
+        close(server.fd);
+    }
+
+    static string server_url(const TestServer &server) {
+        return "http://127.0.0.1:" + long_to_string(server.port) + "/data.dap";
+    }
+
+    // Fetch the server's body using byte ranges and check what was requested
+    void check_range_fetch(size_t size, bool ranges, const vector<string> &expected_requests) {
+        TestServer server;
+        start_server(server, size, ranges);
+
+        HTTPResponse *rs = 0;
+        try {
+            rs = http->fetch_url_ranges(server_url(server), 4, 64 * 1024);
+        }
+        catch (Error &e) {
+            stop_server(server);
+            CPPUNIT_FAIL("Caught an Error from fetch_url_ranges: " + e.get_error_message());
+        }
+        stop_server(server);
+
+        CPPUNIT_ASSERT(rs->get_type() == dap4_data);
+        CPPUNIT_ASSERT(read_all(rs->get_stream()) == server.body);
+        delete rs;
+
+        DBG(copy(server.requests.begin(), server.requests.end(), ostream_iterator<string>(cerr, "\n")));
+        sort(server.requests.begin(), server.requests.end());
+        vector<string> expected = expected_requests;
+        sort(expected.begin(), expected.end());
+        CPPUNIT_ASSERT(server.requests == expected);
+    }
+
+    // A large response is read using a request for the first range and then
+    // four requests for the rest, written to a temporary file.
+    void range_fetch_test() {
+        vector<string> expected;
+        expected.push_back("0-65535");
+        expected.push_back("65536-311295");
+        expected.push_back("311296-557055");
+        expected.push_back("557056-802815");
+        expected.push_back("802816-1048575");
+        check_range_fetch(1024 * 1024, true, expected);
+    }
+
+    // The same, but held in memory
+    void range_fetch_memory_test() {
+        http->set_max_memory_response(2 * 1024 * 1024);
+        range_fetch_test();
+    }
+
+    // A server without byte range support returns everything at once
+    void range_fetch_no_ranges_test() {
+        check_range_fetch(1024 * 1024, false, vector<string>(1, "0-65535"));
+    }
+
+    // A response that fits in the first range needs just one request
+    void range_fetch_small_test() {
+        check_range_fetch(1000, true, vector<string>(1, "0-65535"));
+    }
+
+    // A body to replace the server's body with, different from the first
+    static string changed_body(size_t size) {
+        string body(size, 0);
+        for (size_t i = 0; i < size; ++i)
+            body[i] = static_cast<char>((i * 104729) >> 5);
+        return body;
+    }
+
+    // Fetch the server's body using byte ranges and return the complete
+    // response
+    string fetch_ranges(TestServer &server) {
+        HTTPResponse *rs = 0;
+        try {
+            rs = http->fetch_url_ranges(server_url(server), 4, 64 * 1024);
+        }
+        catch (Error &e) {
+            stop_server(server);
+            CPPUNIT_FAIL("Caught an Error from fetch_url_ranges: " + e.get_error_message());
+        }
+        stop_server(server);
+
+        string body = read_all(rs->get_stream());
+        delete rs;
+
+        DBG(copy(server.requests.begin(), server.requests.end(), ostream_iterator<string>(cerr, "\n")));
+        DBG(copy(server.if_ranges.begin(), server.if_ranges.end(), ostream_iterator<string>(cerr, "\n")));
+        return body;
+    }
+
+    // The other ranges ask for the same response as the first one
+    void range_fetch_if_range_test() {
+        TestServer server;
+        start_server(server, 1024 * 1024, true);
+        server.etag = "v1";
+
+        CPPUNIT_ASSERT(fetch_ranges(server) == server.body);
+        CPPUNIT_ASSERT(server.requests.size() == 5);
+        CPPUNIT_ASSERT(server.if_ranges[0].empty());
+        CPPUNIT_ASSERT(count(server.if_ranges.begin(), server.if_ranges.end(), "\"v1\"") == 4);
+    }
+
+    // A response that changes after the first range was read is sent whole
+    // in answer to the other ranges, and is then read again at once
+    void range_fetch_restart_test() {
+        TestServer server;
+        start_server(server, 1024 * 1024, true);
+        server.etag = "v1";
+        server.next_body = changed_body(server.body.size());
+        server.change_after = 1;
+        string old_body = server.body;
+
+        string body = fetch_ranges(server);
+        CPPUNIT_ASSERT(body != old_body);
+        CPPUNIT_ASSERT(body == server.body);
+        CPPUNIT_ASSERT(server.requests.size() == 6);
+        CPPUNIT_ASSERT(server.requests.back().empty());
+        CPPUNIT_ASSERT(server.if_ranges.back().empty());
+    }
+
+    // A server that ignores If-Range still gives the size of the new
+    // response, which does not match the first one
+    void range_fetch_total_test() {
+        TestServer server;
+        start_server(server, 1024 * 1024, true);
+        server.etag = "v1";
+        server.honor_if_range = false;
+        server.next_body = changed_body(2 * server.body.size());
+        server.change_after = 1;
+
+        CPPUNIT_ASSERT(fetch_ranges(server) == server.body);
+        CPPUNIT_ASSERT(server.body.size() == 2 * 1024 * 1024);
+        CPPUNIT_ASSERT(server.requests.size() == 6);
+        CPPUNIT_ASSERT(server.requests.back().empty());
+    }
+
+    // The body can be read while the server is still sending it
+    void stream_fetch_test() {
+        int hold[2];
+        CPPUNIT_ASSERT(pipe(hold) == 0);
+
+        TestServer server;
+        start_server(server, 256 * 1024, false);
+        server.hold = hold[0];
+
+        HTTPStreamResponse *rs = 0;
+        string first, rest;
+        try {
+            rs = http->fetch_url_stream(server_url(server));
+            CPPUNIT_ASSERT(rs->get_status() == 200);
+            CPPUNIT_ASSERT(rs->get_type() == dap4_data);
+            CPPUNIT_ASSERT(!rs->get_stream() && rs->get_file().empty() && !rs->get_body());
+
+            // The server sends the second half only after this is read
+            first.resize(server.body.size() / 2);
+            rs->get_cpp_stream()->read(&first[0], first.size());
+            CPPUNIT_ASSERT(rs->get_cpp_stream()->gcount() == (streamsize)first.size());
+
+            CPPUNIT_ASSERT(write(hold[1], "x", 1) == 1);
+            ostringstream oss;
+            oss << rs->get_cpp_stream()->rdbuf();
+            rest = oss.str();
+            CPPUNIT_ASSERT(rs->get_transfer_error().empty());
+        }
+        catch (...) {
+            if (write(hold[1], "x", 1) != 1) { }
+            stop_server(server);
+            close(hold[0]); close(hold[1]);
+            delete rs;
+            throw;
+        }
+        stop_server(server);
+        close(hold[0]); close(hold[1]);
+        delete rs;
+
+        CPPUNIT_ASSERT(first + rest == server.body);
+    }
+
+    // A request that cannot be made throws an Error
+    // Write to a server's 'hold' after five seconds, unless told not to wait
+    struct Release {
+        int fd;
+        volatile bool done;
+        volatile bool released;
+    };
+
+    static void *release_thread(void *arg) {
+        Release *release = static_cast<Release*>(arg);
+        for (int i = 0; i < 500 && !release->done; ++i)
+            usleep(10000);
+        release->released = !release->done;
+        if (write(release->fd, "x", 1) != 1) { }
+        return 0;
+    }
+
+    // The response is returned once the headers have been read, before any
+    // of the body is sent
+    void stream_fetch_headers_test() {
+        int hold[2];
+        CPPUNIT_ASSERT(pipe(hold) == 0);
+
+        TestServer server;
+        start_server(server, 64 * 1024, false);
+        server.hold = hold[0];
+        server.hold_body = true;
+
+        Release release = { hold[1], false, false };
+        pthread_t thread;
+        CPPUNIT_ASSERT(pthread_create(&thread, 0, release_thread, &release) == 0);
+
+        HTTPStreamResponse *rs = 0;
+        string error;
+        try {
+            rs = http->fetch_url_stream(server_url(server));
+        }
+        catch (Error &e) {
+            error = e.get_error_message();
+        }
+        bool released = release.released;
+        release.done = true;
+        pthread_join(thread, 0);
+
+        string body;
+        if (rs) {
+            ostringstream oss;
+            oss << rs->get_cpp_stream()->rdbuf();
+            body = oss.str();
+        }
+        stop_server(server);
+        close(hold[0]);
+        close(hold[1]);
+
+        CPPUNIT_ASSERT(error.empty() && rs);
+        CPPUNIT_ASSERT(!released);
+        CPPUNIT_ASSERT(rs->get_status() == 200);
+        CPPUNIT_ASSERT(rs->get_type() == dap4_data);
+        CPPUNIT_ASSERT(find(rs->get_headers()->begin(), rs->get_headers()->end(), "Content-Length: 65536")
+                       != rs->get_headers()->end());
+        delete rs;
+        CPPUNIT_ASSERT(body == server.body);
+    }
+
+    void stream_fetch_error_test() {
+        TestServer server;
+        start_server(server, 1, false);
+        stop_server(server);    // Nothing listens on the port now
+
+        try {
+            HTTPResponse *rs = http->fetch_url_stream(server_url(server));
+            delete rs;
+            CPPUNIT_FAIL("fetch_url_stream() should have thrown an Error");
+        }
+        catch (Error &e) {
+            DBG(cerr << e.get_error_message() << endl);
+        }
+    }
+
     void read_url_password_test2() {
         FILE *dump = fopen("/dev/null", "w");
         vector < string > *resp_h = new vector < string >;
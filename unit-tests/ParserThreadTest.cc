@@ -0,0 +1,268 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <pthread.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BaseTypeFactory.h"
+#include "DAS.h"
+#include "DDS.h"
+#include "ConstraintEvaluator.h"
+#include "Error.h"
+
+#include "GetOpt.h"
+#include "test_config.h"
+#include "debug.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+// The DAS, DDS and CE parsers keep their state in the parser argument and
+// a per-call scanner, so any number of threads may parse at once. Each job
+// here is run once serially; the threads then run every job many times and
+// the text they produce must match the serial run exactly.
+
+enum job_kind { das_job, dds_job, ce_job };
+
+struct ParseJob {
+    job_kind kind;
+    string file;
+    string ce;
+};
+
+static const int num_threads = 8;
+static const int num_passes = 20;
+
+static string run_job(const ParseJob &job)
+{
+    ostringstream oss;
+    try {
+        switch (job.kind) {
+        case das_job: {
+            DAS das;
+            das.parse(job.file);
+            das.print(oss);
+            break;
+        }
+        case dds_job: {
+            BaseTypeFactory factory;
+            DDS dds(&factory);
+            dds.parse(job.file);
+            dds.print(oss);
+            break;
+        }
+        case ce_job: {
+            BaseTypeFactory factory;
+            DDS dds(&factory);
+            dds.parse(job.file);
+            ConstraintEvaluator eval;
+            eval.parse_constraint(job.ce, dds);
+            dds.print_constrained(oss);
+            break;
+        }
+        }
+    }
+    catch (Error &e) {
+        oss << "Error: " << e.get_error_message();
+    }
+
+    return oss.str();
+}
+
+struct ThreadArgs {
+    const vector<ParseJob> *jobs;
+    const vector<string> *expected;
+    int offset;
+    int mismatches;
+};
+
+static void *parse_jobs(void *arg)
+{
+    ThreadArgs *args = static_cast<ThreadArgs*>(arg);
+    const vector<ParseJob> &jobs = *args->jobs;
+
+    // Start each thread at a different job so different parsers overlap
+    for (int pass = 0; pass < num_passes; ++pass) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            size_t j = (i + args->offset) % jobs.size();
+            if (run_job(jobs[j]) != (*args->expected)[j])
+                ++args->mismatches;
+        }
+    }
+
+    return 0;
+}
+
+class ParserThreadTest: public TestFixture {
+private:
+    vector<ParseJob> jobs;
+
+    void add_job(job_kind kind, const string &file, const string &ce = "")
+    {
+        ParseJob job;
+        job.kind = kind;
+        job.file = (string) TEST_SRC_DIR + file;
+        job.ce = ce;
+        jobs.push_back(job);
+    }
+
+public:
+    ParserThreadTest()
+    {
+    }
+    ~ParserThreadTest()
+    {
+    }
+
+    void setUp()
+    {
+        add_job(das_job, "/das-testsuite/test.1");
+        add_job(das_job, "/das-testsuite/test.2");
+        add_job(das_job, "/das-testsuite/test.34");
+        add_job(das_job, "/das-testsuite/bad_value_test.1");
+        add_job(das_job, "/dds-testsuite/fnoc1.nc.das");
+        add_job(das_job, "/dds-testsuite/coads_climatology.nc.das");
+
+        add_job(dds_job, "/dds-testsuite/fnoc1.nc.dds");
+        add_job(dds_job, "/dds-testsuite/coads_climatology.nc.dds");
+        add_job(dds_job, "/dds-testsuite/3B42.980909.5.HDF.dds");
+        add_job(dds_job, "/dds-testsuite/S2000415.HDF.dds");
+        add_job(dds_job, "/dds-testsuite/sequence.1.dds");
+
+        add_job(ce_job, "/dds-testsuite/fnoc1.nc.dds", "u[0:2:15][3][4:6]");
+        add_job(ce_job, "/dds-testsuite/fnoc1.nc.dds", "lat,lon&lat>10.0");
+        add_job(ce_job, "/dds-testsuite/fnoc1.nc.dds", "v[1][1:5][1],time&time<3");
+        add_job(ce_job, "/dds-testsuite/coads_climatology.nc.dds", "SST[0][10:20][30:40]");
+        add_job(ce_job, "/dds-testsuite/coads_climatology.nc.dds", "AIRT.TIME,UWND.COADSY[2:4]");
+        // Errors are reported the same way from every thread
+        add_job(ce_job, "/dds-testsuite/fnoc1.nc.dds", "no_such_var");
+        add_job(ce_job, "/dds-testsuite/fnoc1.nc.dds", "u[0:1");
+    }
+
+    void tearDown()
+    {
+        jobs.clear();
+    }
+
+    CPPUNIT_TEST_SUITE( ParserThreadTest );
+
+    CPPUNIT_TEST(serial_test);
+    CPPUNIT_TEST(concurrent_test);
+
+    CPPUNIT_TEST_SUITE_END();
+
+    // The jobs used below must parse, except for the ones meant to fail
+    void serial_test()
+    {
+        int errors = 0;
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            string result = run_job(jobs[i]);
+            DBG(cerr << jobs[i].file << " " << jobs[i].ce << ":" << endl << result << endl);
+            CPPUNIT_ASSERT(!result.empty());
+            if (result.find("Error: ") == 0) ++errors;
+        }
+
+        CPPUNIT_ASSERT(errors == 2);
+    }
+
+    void concurrent_test()
+    {
+        vector<string> expected;
+        for (size_t i = 0; i < jobs.size(); ++i)
+            expected.push_back(run_job(jobs[i]));
+
+        vector<ThreadArgs> args(num_threads);
+        vector<pthread_t> threads(num_threads);
+        for (int t = 0; t < num_threads; ++t) {
+            args[t].jobs = &jobs;
+            args[t].expected = &expected;
+            args[t].offset = t;
+            args[t].mismatches = 0;
+            CPPUNIT_ASSERT(pthread_create(&threads[t], 0, parse_jobs, &args[t]) == 0);
+        }
+
+        int mismatches = 0;
+        for (int t = 0; t < num_threads; ++t) {
+            CPPUNIT_ASSERT(pthread_join(threads[t], 0) == 0);
+            mismatches += args[t].mismatches;
+        }
+
+        DBG(cerr << "mismatches: " << mismatches << endl);
+        CPPUNIT_ASSERT(mismatches == 0);
+    }
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ParserThreadTest);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    char option_char;
+
+    while ((option_char = getopt()) != EOF)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::ParserThreadTest::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+#include "config.h"
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <stdint.h>
+
+#include <vector>
+#include <cstring>
+#include <sstream>
+
+#include "vector_filter.h"
+#include "vector_swap.h"
+#include "D4StreamMarshaller.h"
+#include "D4StreamUnMarshaller.h"
+#include "D4ParserSax2.h"
+#include "D4BaseTypeFactory.h"
+#include "DMR.h"
+#include "XMLWriter.h"
+#include "InternalErr.h"
+
+#include "GetOpt.h"
+#include "debug.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+class VectorFilterTest: public TestFixture {
+private:
+    // Fill the buffer with a pattern that will reveal misplaced bytes
+    void m_fill(vector<char> &buf) {
+        for (vector<char>::size_type i = 0; i < buf.size(); ++i)
+            buf[i] = static_cast<char>(i * 7 + 3);
+    }
+
+    // Check the dispatched shuffle kernels against the definition, for
+    // several lengths (to exercise the vector loops and the tails) and at
+    // offsets that leave the data unaligned.
+    void m_compare_shuffle(int width) {
+        for (int64_t num = 0; num < 131; ++num) {
+            for (int offset = 0; offset < 3; ++offset) {
+                vector<char> data(num * width + offset), result(num * width + offset);
+                m_fill(data);
+
+                filter_vector(&data[0] + offset, &result[0] + offset, num, width, vector_filter_shuffle);
+
+                for (int64_t i = 0; i < num; ++i)
+                    for (int j = 0; j < width; ++j)
+                        CPPUNIT_ASSERT(result[offset + j * num + i] == data[offset + i * width + j]);
+
+                vector<char> back(num * width + offset);
+                unshuffle_vector(&result[0] + offset, &back[0] + offset, num, width);
+                CPPUNIT_ASSERT(memcmp(&back[0] + offset, &data[0] + offset, num * width) == 0);
+            }
+        }
+    }
+
+    // Filter and unfilter, using every combination of the filters
+    void m_round_trip(int width) {
+        for (unsigned int filters = 0; filters < 4; ++filters) {
+            for (int64_t num = 0; num < 1100; num += 37) {
+                vector<char> data(num * width), result(num * width), back(num * width);
+                m_fill(data);
+
+                filter_vector(&data[0], &result[0], num, width, filters);
+
+                if (filters & vector_filter_shuffle)
+                    unshuffle_vector(&result[0], &back[0], num, width);
+                else
+                    back = result;
+
+                if (filters & vector_filter_delta)
+                    undelta_vector(&back[0], num, width);
+
+                CPPUNIT_ASSERT(back == data);
+            }
+        }
+    }
+
+public:
+    VectorFilterTest() { }
+    ~VectorFilterTest() { }
+
+    void setUp() { }
+
+    void tearDown() { }
+
+    void shuffle_values_test() {
+        uint16_t vals[3] = { 0x0102, 0x0304, 0x0506 };
+        char result[6];
+        filter_vector(reinterpret_cast<char*>(vals), result, 3, 2, vector_filter_shuffle);
+
+        const char *p = reinterpret_cast<char*>(vals);
+        CPPUNIT_ASSERT(result[0] == p[0] && result[1] == p[2] && result[2] == p[4]);
+        CPPUNIT_ASSERT(result[3] == p[1] && result[4] == p[3] && result[5] == p[5]);
+    }
+
+    void delta_values_test() {
+        int32_t vals[4] = { 10, 12, 11, -5 };
+        int32_t result[4];
+        filter_vector(reinterpret_cast<char*>(vals), reinterpret_cast<char*>(result), 4, 4, vector_filter_delta);
+        CPPUNIT_ASSERT(result[0] == 10);
+        CPPUNIT_ASSERT(result[1] == 2);
+        CPPUNIT_ASSERT(result[2] == -1);
+        CPPUNIT_ASSERT(result[3] == -16);
+
+        undelta_vector(reinterpret_cast<char*>(result), 4, 4);
+        CPPUNIT_ASSERT(memcmp(result, vals, sizeof(vals)) == 0);
+    }
+
+    void shuffle_16_test() {
+        DBG(cerr << "Using the " << vector_filter_kernels() << " kernels" << endl);
+        m_compare_shuffle(2);
+    }
+
+    void shuffle_32_test() {
+        m_compare_shuffle(4);
+    }
+
+    void shuffle_64_test() {
+        m_compare_shuffle(8);
+    }
+
+    void round_trip_test() {
+        m_round_trip(1);
+        m_round_trip(2);
+        m_round_trip(4);
+        m_round_trip(8);
+    }
+
+    void bad_width_test() {
+        char data[6], result[6];
+        CPPUNIT_ASSERT_THROW(filter_vector(data, result, 2, 3, vector_filter_shuffle), InternalErr);
+        CPPUNIT_ASSERT_THROW(unshuffle_vector(data, result, 2, 3), InternalErr);
+    }
+
+    void names_test() {
+        CPPUNIT_ASSERT(vector_filter_names(vector_filter_none) == "");
+        CPPUNIT_ASSERT(vector_filter_names(vector_filter_shuffle) == "shuffle");
+        CPPUNIT_ASSERT(vector_filter_names(vector_filter_shuffle | vector_filter_delta) == "shuffle delta");
+
+        CPPUNIT_ASSERT(vector_filter_flags("") == vector_filter_none);
+        CPPUNIT_ASSERT(vector_filter_flags("delta") == vector_filter_delta);
+        CPPUNIT_ASSERT(vector_filter_flags(" delta  shuffle") == (vector_filter_shuffle | vector_filter_delta));
+        CPPUNIT_ASSERT_THROW(vector_filter_flags("lz4"), Error);
+    }
+
+    // Values sent with filters by D4StreamMarshaller come back unchanged
+    void marshaller_test() {
+        vector<dods_int32> ints(1000);
+        vector<dods_float64> reals(333);
+        vector<dods_byte> bytes(100);
+        for (unsigned int i = 0; i < ints.size(); ++i)
+            ints[i] = 100000 + 3 * i - (i % 5);
+        for (unsigned int i = 0; i < reals.size(); ++i)
+            reals[i] = 273.15 + i / 8.0;
+        for (unsigned int i = 0; i < bytes.size(); ++i)
+            bytes[i] = i * 2;
+
+        for (unsigned int filters = 0; filters < 4; ++filters) {
+            ostringstream oss;
+            string checksum;
+            {
+                D4StreamMarshaller m(oss);
+                m.set_vector_filter(filters);
+                m.reset_checksum();
+                m.put_vector(reinterpret_cast<char*>(&ints[0]), ints.size(), sizeof(dods_int32));
+                m.put_vector_float64(reinterpret_cast<char*>(&reals[0]), reals.size());
+                m.put_vector(reinterpret_cast<char*>(&bytes[0]), bytes.size());
+                checksum = m.get_checksum();
+            }
+
+            // The checksum is for the values, not the bytes sent
+            ostringstream plain;
+            D4StreamMarshaller p(plain, false);
+            p.reset_checksum();
+            p.put_vector(reinterpret_cast<char*>(&ints[0]), ints.size(), sizeof(dods_int32));
+            p.put_vector_float64(reinterpret_cast<char*>(&reals[0]), reals.size());
+            p.put_vector(reinterpret_cast<char*>(&bytes[0]), bytes.size());
+            CPPUNIT_ASSERT(p.get_checksum() == checksum);
+
+            istringstream iss(oss.str());
+            D4StreamUnMarshaller um(iss, false);
+            um.set_vector_filter(filters);
+
+            vector<dods_int32> ints2(ints.size());
+            vector<dods_float64> reals2(reals.size());
+            vector<dods_byte> bytes2(bytes.size());
+            um.get_vector(reinterpret_cast<char*>(&ints2[0]), ints2.size(), sizeof(dods_int32));
+            um.get_vector_float64(reinterpret_cast<char*>(&reals2[0]), reals2.size());
+            um.get_vector(reinterpret_cast<char*>(&bytes2[0]), bytes2.size());
+
+            CPPUNIT_ASSERT(ints2 == ints);
+            CPPUNIT_ASSERT(reals2 == reals);
+            CPPUNIT_ASSERT(bytes2 == bytes);
+        }
+    }
+
+    // A sender with the other byte order takes the deltas in its own order
+    void twiddle_test() {
+        vector<dods_uint16> vals(100);
+        for (unsigned int i = 0; i < vals.size(); ++i)
+            vals[i] = 60000 + 977 * i;
+
+        int64_t num = vals.size();
+        vector<char> deltas(num * 2), sent(num * 2);
+        filter_vector(reinterpret_cast<char*>(&vals[0]), &deltas[0], num, 2, vector_filter_delta);
+        swap_vector_elements(&deltas[0], num, 2);
+        filter_vector(&deltas[0], &sent[0], num, 2, vector_filter_shuffle);
+
+        istringstream iss(string(sent.begin(), sent.end()));
+        D4StreamUnMarshaller um(iss, true);
+        um.set_vector_filter(vector_filter_shuffle | vector_filter_delta);
+
+        vector<dods_uint16> result(num);
+        um.get_vector(reinterpret_cast<char*>(&result[0]), num, 2);
+        CPPUNIT_ASSERT(result == vals);
+    }
+
+    void dmr_test() {
+        D4BaseTypeFactory factory;
+        DMR dmr(&factory, "filtered");
+        CPPUNIT_ASSERT(dmr.vector_filter() == vector_filter_none);
+        dmr.set_vector_filter(vector_filter_shuffle | vector_filter_delta);
+
+        XMLWriter xml;
+        dmr.print_dap4(xml);
+        string doc = xml.get_doc();
+        DBG(cerr << doc << endl);
+        CPPUNIT_ASSERT(doc.find("vectorFilter=\"shuffle delta\"") != string::npos);
+
+        DMR parsed(&factory);
+        D4ParserSax2 parser;
+        parser.intern(doc, &parsed);
+        CPPUNIT_ASSERT(parsed.vector_filter() == (vector_filter_shuffle | vector_filter_delta));
+
+        DMR copy(parsed);
+        CPPUNIT_ASSERT(copy.vector_filter() == parsed.vector_filter());
+    }
+
+    CPPUNIT_TEST_SUITE( VectorFilterTest );
+
+    CPPUNIT_TEST(shuffle_values_test);
+    CPPUNIT_TEST(delta_values_test);
+    CPPUNIT_TEST(shuffle_16_test);
+    CPPUNIT_TEST(shuffle_32_test);
+    CPPUNIT_TEST(shuffle_64_test);
+    CPPUNIT_TEST(round_trip_test);
+    CPPUNIT_TEST(bad_width_test);
+    CPPUNIT_TEST(names_test);
+    CPPUNIT_TEST(marshaller_test);
+    CPPUNIT_TEST(twiddle_test);
+    CPPUNIT_TEST(dmr_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VectorFilterTest);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    int option_char;
+
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::VectorFilterTest::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
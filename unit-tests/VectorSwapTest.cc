@@ -0,0 +1,189 @@
+
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+#include "config.h"
+
+#include <cppunit/TextTestRunner.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <byteswap.h>
+#include <stdint.h>
+
+#include <vector>
+#include <cstring>
+
+#include "vector_swap.h"
+#include "InternalErr.h"
+
+#include "GetOpt.h"
+#include "debug.h"
+
+static bool debug = false;
+
+#undef DBG
+#define DBG(x) do { if (debug) {x;} } while(false)
+
+using namespace CppUnit;
+using namespace std;
+
+namespace libdap {
+
+class VectorSwapTest: public TestFixture {
+private:
+    vector<char> d_data;
+
+    // Fill the buffer with a pattern that will reveal misplaced bytes
+    void m_fill(vector<char> &buf) {
+        for (vector<char>::size_type i = 0; i < buf.size(); ++i)
+            buf[i] = static_cast<char>(i * 7 + 3);
+    }
+
+    // Compare the dispatched kernels with the scalar code for several
+    // lengths (to exercise the vector loops and the tails) and at offsets
+    // that leave the data unaligned.
+    void m_compare(int width) {
+        for (int64_t num = 0; num < 131; ++num) {
+            for (int offset = 0; offset < 3; ++offset) {
+                vector<char> expected(num * width + offset), result(num * width + offset);
+                m_fill(expected);
+                m_fill(result);
+
+                swap_vector_elements_portable(&expected[0] + offset, num, width);
+                swap_vector_elements(&result[0] + offset, num, width);
+
+                CPPUNIT_ASSERT(expected == result);
+            }
+        }
+    }
+
+public:
+    VectorSwapTest() { }
+    ~VectorSwapTest() { }
+
+    void setUp() {
+        d_data.resize(64);
+        m_fill(d_data);
+    }
+
+    void tearDown() { }
+
+    void swap_16_values_test() {
+        uint16_t vals[3] = { 0x0102, 0xa0b0, 0xff00 };
+        swap_vector_elements(reinterpret_cast<char*>(vals), 3, 2);
+        CPPUNIT_ASSERT(vals[0] == 0x0201);
+        CPPUNIT_ASSERT(vals[1] == 0xb0a0);
+        CPPUNIT_ASSERT(vals[2] == 0x00ff);
+    }
+
+    void swap_32_values_test() {
+        uint32_t vals[2] = { 0x01020304, 0xa0b0c0d0 };
+        swap_vector_elements(reinterpret_cast<char*>(vals), 2, 4);
+        CPPUNIT_ASSERT(vals[0] == 0x04030201);
+        CPPUNIT_ASSERT(vals[1] == 0xd0c0b0a0);
+    }
+
+    void swap_64_values_test() {
+        uint64_t vals[2] = { 0x0102030405060708ULL, 0xa0b0c0d0e0f01020ULL };
+        swap_vector_elements(reinterpret_cast<char*>(vals), 2, 8);
+        CPPUNIT_ASSERT(vals[0] == 0x0807060504030201ULL);
+        CPPUNIT_ASSERT(vals[1] == 0x2010f0e0d0c0b0a0ULL);
+    }
+
+    void swap_16_test() {
+        DBG(cerr << "Using the " << swap_vector_kernels() << " kernels" << endl);
+        m_compare(2);
+    }
+
+    void swap_32_test() {
+        m_compare(4);
+    }
+
+    void swap_64_test() {
+        m_compare(8);
+    }
+
+    void swap_twice_test() {
+        vector<char> data(d_data);
+        swap_vector_elements(&data[0], data.size() / 8, 8);
+        CPPUNIT_ASSERT(data != d_data);
+        swap_vector_elements(&data[0], data.size() / 8, 8);
+        CPPUNIT_ASSERT(data == d_data);
+    }
+
+    void bad_width_test() {
+        CPPUNIT_ASSERT_THROW(swap_vector_elements(&d_data[0], 2, 3), InternalErr);
+    }
+
+    CPPUNIT_TEST_SUITE( VectorSwapTest );
+
+    CPPUNIT_TEST(swap_16_values_test);
+    CPPUNIT_TEST(swap_32_values_test);
+    CPPUNIT_TEST(swap_64_values_test);
+    CPPUNIT_TEST(swap_16_test);
+    CPPUNIT_TEST(swap_32_test);
+    CPPUNIT_TEST(swap_64_test);
+    CPPUNIT_TEST(swap_twice_test);
+    CPPUNIT_TEST(bad_width_test);
+
+    CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(VectorSwapTest);
+
+} // namespace libdap
+
+int main(int argc, char*argv[]) {
+    CppUnit::TextTestRunner runner;
+    runner.addTest(CppUnit::TestFactoryRegistry::getRegistry().makeTest());
+
+    GetOpt getopt(argc, argv, "d");
+    int option_char;
+
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 'd':
+            debug = 1;  // debug is a static global
+            break;
+        default:
+            break;
+        }
+
+    bool wasSuccessful = true;
+    string test = "";
+    int i = getopt.optind;
+    if (i == argc) {
+        // run them all
+        wasSuccessful = runner.run("");
+    }
+    else {
+        while (i < argc) {
+            test = string("libdap::VectorSwapTest::") + argv[i++];
+            DBG(cerr << "test: " << test << endl);
+            wasSuccessful = wasSuccessful && runner.run(test);
+        }
+    }
+
+    return wasSuccessful ? 0 : 1;
+}
@@ -30,10 +30,14 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "GetOpt.h"
 
@@ -55,6 +59,27 @@ using namespace std;
 using namespace CppUnit;
 using namespace libdap;
 
+// Record the size of each write made to a stream. There's no buffer, so
+// every write reaches xsputn() or overflow().
+class write_log: public std::streambuf {
+public:
+    string d_data;
+    vector<streamsize> d_writes;
+
+protected:
+    virtual streamsize xsputn(const char *s, streamsize num) {
+        d_data.append(s, num);
+        d_writes.push_back(num);
+        return num;
+    }
+
+    virtual int_type overflow(int_type c) {
+        d_data.push_back(traits_type::to_char_type(c));
+        d_writes.push_back(1);
+        return c;
+    }
+};
+
 /**
  * The intent is to test writing to and reading from a chunked iostream,
  * using various combinations of chunk/buffer sizes and character red/write
@@ -121,7 +146,7 @@ public:
     }
 
     void
-    write_128char_data(const string &file, int buf_size)
+    write_128char_data(const string &file, int buf_size, uint32_t codec = 0)
     {
     	fstream infile(file.c_str(), ios::in|ios::binary);
     	if (!infile.good())
@@ -131,6 +156,8 @@ public:
     	fstream outfile(out.c_str(), ios::out|ios::binary);
 
     	chunked_ostream chunked_outfile(outfile, buf_size);
+    	if (codec)
+    		chunked_outfile.set_compression(codec);
 
     	char str[128];
     	infile.read(str, 128);
@@ -156,7 +183,7 @@ public:
     // sending the last data chunk with fewer than buf_size and then sending a
     // zero length END chunk).
     void
-    write_24char_data_with_error_option(const string &file, int buf_size, bool error = false)
+    write_24char_data_with_error_option(const string &file, int buf_size, bool error = false, uint32_t codec = 0)
     {
     	fstream infile(file.c_str(), ios::in|ios::binary);
     	if (!infile.good())
@@ -166,6 +193,8 @@ public:
     	fstream outfile(out.c_str(), ios::out|ios::binary);
 
     	chunked_ostream chunked_outfile(outfile, buf_size);
+    	if (codec)
+    		chunked_outfile.set_compression(codec);
 
     	try {
     		char str[24];
@@ -491,6 +520,299 @@ public:
 		}
 	}
 
+    // Compressed chunks
+
+    void compressed_test(uint32_t codec) {
+        if (!chunked_ostream::is_codec_supported(codec)) {
+            DBG(cerr << "Codec " << hex << codec << " not supported; skipping" << endl);
+            return;
+        }
+
+        write_128char_data(text_file, 1024, codec);
+        read_128char_data(text_file, 1024);
+        string cmp = "cmp " + text_file + " " + text_file + ".plain";
+        CPPUNIT_ASSERT(system(cmp.c_str()) == 0);
+
+        // Text compresses, so the chunked file should be smaller
+        ifstream plain(text_file.c_str(), ios::binary|ios::ate);
+        ifstream chunked((text_file + ".chunked").c_str(), ios::binary|ios::ate);
+        CPPUNIT_ASSERT(chunked.tellg() < plain.tellg());
+
+        write_128char_data(big_file, 4096, codec);
+        single_char_read(big_file, 4096);
+        cmp = "cmp " + big_file + " " + big_file + ".plain";
+        CPPUNIT_ASSERT(system(cmp.c_str()) == 0);
+
+        write_24char_data_with_error_option(big_file_2, 2048, false, codec);
+        read_128char_data(big_file_2, 2048);
+        cmp = "cmp " + big_file_2 + " " + big_file_2 + ".plain";
+        CPPUNIT_ASSERT(system(cmp.c_str()) == 0);
+
+        write_24char_data_with_error_option(big_file_2, 2048, true /*error*/, codec);
+        try {
+            read_24char_data_with_error_option(big_file_2, 2048);
+            CPPUNIT_FAIL("Should have caught an error message");
+        }
+        catch (Error &e) {
+            CPPUNIT_ASSERT(!e.get_error_message().empty());
+        }
+    }
+
+    void test_deflate() {
+        compressed_test(CHUNK_DEFLATE);
+    }
+
+    void test_zstd() {
+        compressed_test(CHUNK_ZSTD);
+    }
+
+    void test_unsupported_codec() {
+        ostringstream oss;
+        chunked_ostream chunked_out(oss, 1024);
+        try {
+            chunked_out.set_compression(0x20000000);
+            CPPUNIT_FAIL("Should have thrown InternalErr");
+        }
+        catch (InternalErr &e) {
+            CPPUNIT_ASSERT(chunked_out.get_compression() == 0);
+        }
+    }
+
+    // Large writes
+
+    // Return the sizes of the chunks in a chunked stream
+    vector<uint32_t> chunk_sizes(const string &chunks) {
+        vector<uint32_t> sizes;
+        string::size_type pos = 0;
+        while (pos + sizeof(uint32_t) <= chunks.size()) {
+            uint32_t header;
+            memcpy(&header, chunks.data() + pos, sizeof(uint32_t));
+            sizes.push_back(header & CHUNK_SIZE_MASK);
+            pos += sizeof(uint32_t) + (header & CHUNK_SIZE_MASK);
+        }
+
+        return sizes;
+    }
+
+    void fill(vector<char> &data) {
+        for (vector<char>::size_type i = 0; i < data.size(); ++i)
+            data[i] = static_cast<char>(i * 13 + (i >> 12));
+    }
+
+    // Write 'data' using a small write and then two large ones
+    string write_bulk_data(const vector<char> &data, unsigned int max_chunk_size) {
+        ostringstream oss;
+        {
+            chunked_ostream chunked_out(oss, 4096);
+            chunked_out.set_max_chunk_size(max_chunk_size);
+            chunked_out.write(&data[0], 100);
+            chunked_out.write(&data[100], 1024 * 1024);
+            chunked_out.write(&data[100 + 1024 * 1024], data.size() - 100 - 1024 * 1024);
+        }
+
+        return oss.str();
+    }
+
+    // Read 'size' bytes, 'read_size' bytes at a time
+    vector<char> read_bulk_data(const string &chunks, vector<char>::size_type size, bool read_ahead = false,
+        vector<char>::size_type read_size = 0) {
+        istringstream iss(chunks);
+#if BYTE_ORDER_PREFIX
+        chunked_istream chunked_in(iss, 4096, 0x00);
+#else
+        chunked_istream chunked_in(iss, 4096);
+#endif
+        chunked_in.set_read_ahead(read_ahead);
+        if (read_size == 0) read_size = size;
+
+        vector<char> data(size);
+        for (vector<char>::size_type pos = 0; pos < size; pos += read_size) {
+            streamsize num = min(read_size, size - pos);
+            chunked_in.read(&data[pos], num);
+            CPPUNIT_ASSERT(chunked_in.gcount() == num);
+        }
+
+        // All the data have been read
+        char c;
+        CPPUNIT_ASSERT(!chunked_in.read(&c, 1));
+        CPPUNIT_ASSERT(chunked_in.eof() && !chunked_in.error());
+
+        return data;
+    }
+
+    void test_bulk_write() {
+        vector<char> data(3 * 1024 * 1024 + 17);
+        fill(data);
+
+        // By default, large writes go out as one chunk each (after the
+        // buffered bytes are topped up and sent), plus the END chunk
+        string chunks = write_bulk_data(data, CHUNK_SIZE_MASK);
+        vector<uint32_t> sizes = chunk_sizes(chunks);
+        DBG(cerr << "Number of chunks: " << sizes.size() << endl);
+        CPPUNIT_ASSERT(sizes.size() == 4);
+        CPPUNIT_ASSERT(sizes[0] == 4096);
+        CPPUNIT_ASSERT(sizes[3] == 0);
+        CPPUNIT_ASSERT(read_bulk_data(chunks, data.size()) == data);
+
+        // Limited to the buffer size, all the chunks are that size
+        chunks = write_bulk_data(data, 4096);
+        sizes = chunk_sizes(chunks);
+        CPPUNIT_ASSERT(sizes.size() == data.size() / 4096 + 1);
+        for (vector<uint32_t>::size_type i = 0; i < sizes.size() - 1; ++i)
+            CPPUNIT_ASSERT(sizes[i] == 4096);
+        CPPUNIT_ASSERT(read_bulk_data(chunks, data.size()) == data);
+    }
+
+    // Each chunk, including those sent from the caller's memory, is passed
+    // to the underlying stream with one write
+    void test_bulk_write_calls() {
+        vector<char> data(3 * 1024 * 1024 + 17);
+        fill(data);
+
+        write_log log;
+        {
+            ostream os(&log);
+            chunked_ostream chunked_out(os, 4096);
+            chunked_out.set_max_chunk_size(1024 * 1024);
+            chunked_out.write(&data[0], 100);
+            chunked_out.write(&data[100], data.size() - 100);
+        }
+
+        vector<uint32_t> sizes = chunk_sizes(log.d_data);
+        CPPUNIT_ASSERT(sizes.size() == 5);
+        CPPUNIT_ASSERT(log.d_writes.size() == sizes.size());
+        for (vector<uint32_t>::size_type i = 0; i < sizes.size(); ++i)
+            CPPUNIT_ASSERT(log.d_writes[i] == (streamsize) (sizeof(uint32_t) + sizes[i]));
+
+        CPPUNIT_ASSERT(read_bulk_data(log.d_data, data.size()) == data);
+    }
+
+    void test_chunk_size() {
+        ostringstream oss;
+        {
+            chunked_ostream chunked_out(oss, 1024);
+            CPPUNIT_ASSERT(chunked_out.get_chunk_size() == 1024);
+            chunked_out.write("0123456789", 10);
+
+            // The buffered bytes are sent before the buffer is resized
+            chunked_out.set_chunk_size(64);
+            CPPUNIT_ASSERT(chunked_out.get_chunk_size() == 64);
+            CPPUNIT_ASSERT(oss.str().size() == sizeof(uint32_t) + 10);
+
+            for (int i = 0; i < 10; ++i)
+                chunked_out.write("0123456789", 10);
+
+            CPPUNIT_ASSERT_THROW(chunked_out.set_chunk_size(0x01000000), std::out_of_range);
+            CPPUNIT_ASSERT_THROW(chunked_out.set_max_chunk_size(0), std::out_of_range);
+        }
+
+        vector<uint32_t> sizes = chunk_sizes(oss.str());
+        CPPUNIT_ASSERT(sizes.size() == 3);
+        CPPUNIT_ASSERT(sizes[0] == 10);
+        CPPUNIT_ASSERT(sizes[1] == 64);
+        CPPUNIT_ASSERT(sizes[2] == 36);
+    }
+
+    // Large reads
+
+    void test_bulk_read() {
+        vector<char> data(3 * 1024 * 1024 + 17);
+        fill(data);
+
+        // Reads that span many chunks, that end in the middle of a chunk
+        // and that are smaller than a chunk
+        const vector<char>::size_type read_sizes[] = { 0, 1024 * 1024, 5000, 100 };
+        const unsigned int max_chunk_sizes[] = { 4096, CHUNK_SIZE_MASK };
+        for (int c = 0; c < 2; ++c) {
+            string chunks = write_bulk_data(data, max_chunk_sizes[c]);
+            for (int r = 0; r < 4; ++r) {
+                CPPUNIT_ASSERT(read_bulk_data(chunks, data.size(), false, read_sizes[r]) == data);
+                CPPUNIT_ASSERT(read_bulk_data(chunks, data.size(), true, read_sizes[r]) == data);
+            }
+        }
+    }
+
+    void test_bulk_read_compressed() {
+        if (!chunked_ostream::is_codec_supported(CHUNK_DEFLATE)) return;
+
+        vector<char> data(1024 * 1024 + 17);
+        fill(data);
+
+        ostringstream oss;
+        {
+            chunked_ostream chunked_out(oss, 4096);
+            chunked_out.set_compression(CHUNK_DEFLATE);
+            chunked_out.write(&data[0], data.size());
+        }
+
+        // Whole chunks are uncompressed directly into the caller's memory,
+        // the last part of a chunk is left in the buffer
+        CPPUNIT_ASSERT(read_bulk_data(oss.str(), data.size()) == data);
+        CPPUNIT_ASSERT(read_bulk_data(oss.str(), data.size(), false, 5000) == data);
+        CPPUNIT_ASSERT(read_bulk_data(oss.str(), data.size(), true, 5000) == data);
+    }
+
+    void test_read_ahead() {
+        // Two chunked streams, one after the other; read-ahead stops at the
+        // END chunk, so the second one can still be read.
+        ostringstream oss;
+        {
+            chunked_ostream chunked_out(oss, 1024);
+            chunked_out.write("first", 5);
+        }
+        {
+            chunked_ostream chunked_out(oss, 1024);
+            chunked_out.write("second", 6);
+            chunked_out.flush();
+            chunked_out.write_err_chunk("Error message");
+        }
+
+        istringstream iss(oss.str());
+#if BYTE_ORDER_PREFIX
+        chunked_istream chunked_in(iss, 1024, 0x00);
+#else
+        chunked_istream chunked_in(iss, 1024);
+#endif
+        chunked_in.set_read_ahead(true);
+
+        char buf[16];
+        chunked_in.read(buf, sizeof(buf));
+        CPPUNIT_ASSERT(chunked_in.gcount() == 5 && string(buf, 5) == "first");
+        CPPUNIT_ASSERT(chunked_in.eof());
+
+        chunked_in.clear();
+        chunked_in.read(buf, 6);
+        CPPUNIT_ASSERT(chunked_in.gcount() == 6 && string(buf, 6) == "second");
+        CPPUNIT_ASSERT(!chunked_in.error());
+
+        chunked_in.read(buf, sizeof(buf));
+        CPPUNIT_ASSERT(chunked_in.error());
+        CPPUNIT_ASSERT(chunked_in.error_message() == "Error message");
+
+        // Turning read-ahead off does not lose chunks that were read ahead
+        ostringstream oss2;
+        {
+            chunked_ostream chunked_out(oss2, 16);
+            for (int i = 0; i < 10; ++i)
+                chunked_out.write("0123456789abcdef", 16);
+        }
+
+        istringstream iss2(oss2.str());
+#if BYTE_ORDER_PREFIX
+        chunked_istream chunked_in2(iss2, 16, 0x00);
+#else
+        chunked_istream chunked_in2(iss2, 16);
+#endif
+        chunked_in2.set_read_ahead(true, 4);
+        chunked_in2.read(buf, 16);
+        chunked_in2.set_read_ahead(false);
+        int num = 16;
+        while (chunked_in2.read(buf, 16))
+            num += chunked_in2.gcount();
+        CPPUNIT_ASSERT(num == 160);
+        CPPUNIT_ASSERT(!chunked_in2.read_ahead());
+    }
+
     CPPUNIT_TEST_SUITE(chunked_iostream_test);
 
     CPPUNIT_TEST(test_write_1_read_1_small_file);
@@ -521,6 +843,17 @@ public:
 
     CPPUNIT_TEST(test_write_24_read_24_big_file_2_error);
 
+    CPPUNIT_TEST(test_deflate);
+    CPPUNIT_TEST(test_zstd);
+    CPPUNIT_TEST(test_unsupported_codec);
+
+    CPPUNIT_TEST(test_bulk_write);
+    CPPUNIT_TEST(test_bulk_write_calls);
+    CPPUNIT_TEST(test_chunk_size);
+    CPPUNIT_TEST(test_bulk_read);
+    CPPUNIT_TEST(test_bulk_read_compressed);
+    CPPUNIT_TEST(test_read_ahead);
+
     CPPUNIT_TEST_SUITE_END();
 };
 
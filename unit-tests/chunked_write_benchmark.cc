@@ -0,0 +1,119 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+/*
+ * Compare the throughput of large writes to a chunked_ostream when every
+ * chunk is at most the buffer size with the throughput when the chunks
+ * grow to fit the writes. The chunks are written to /dev/null. This is not
+ * run by 'make check'; build it with 'make chunked_write_benchmark'.
+ *
+ * Usage: chunked_write_benchmark [-s <MB>] [-r <repetitions>]
+ */
+
+#include "config.h"
+
+#include <sys/time.h>
+#include <cstdlib>
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+
+#include "chunked_ostream.h"
+
+#include "GetOpt.h"
+
+using namespace std;
+using namespace libdap;
+
+static double elapsed_seconds(const struct timeval &start, const struct timeval &stop)
+{
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+// MB/s written using writes of write_size bytes and chunks of at most
+// max_chunk_size bytes
+static double measure(const vector<char> &data, unsigned int write_size, unsigned int max_chunk_size, int reps,
+    bool &ok)
+{
+    fstream out("/dev/null", ios::out | ios::binary);
+
+    struct timeval start, stop;
+    gettimeofday(&start, 0);
+    {
+        chunked_ostream chunked_out(out, CHUNK_SIZE);
+        chunked_out.set_max_chunk_size(max_chunk_size);
+        for (int r = 0; r < reps; ++r)
+            for (vector<char>::size_type pos = 0; pos < data.size(); pos += write_size)
+                chunked_out.write(&data[pos], min((vector<char>::size_type) write_size, data.size() - pos));
+    }
+    gettimeofday(&stop, 0);
+
+    ok = out.good();
+    return (double(data.size()) * reps / (1024 * 1024)) / elapsed_seconds(start, stop);
+}
+
+int main(int argc, char *argv[])
+{
+    int megabytes = 32;
+    int reps = 4;
+
+    GetOpt getopt(argc, argv, "s:r:");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 's':
+            megabytes = atoi(getopt.optarg);
+            break;
+        case 'r':
+            reps = atoi(getopt.optarg);
+            break;
+        default:
+            cerr << "Usage: chunked_write_benchmark [-s <MB>] [-r <repetitions>]" << endl;
+            return 1;
+        }
+
+    vector<char> data(megabytes * 1024 * 1024);
+    for (vector<char>::size_type i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 13 + (i >> 12));
+
+    cout << "Data: " << megabytes << " MB, repetitions: " << reps << endl;
+    cout << setw(10) << "write" << setw(18) << "fixed MB/s" << setw(18) << "adaptive MB/s" << endl;
+
+    // Small writes, typical buffer sizes and a whole large array
+    const unsigned int write_sizes[] = { 128, 64 * 1024, 1024 * 1024, static_cast<unsigned int>(data.size()) };
+    for (int w = 0; w < 4; ++w) {
+        bool fixed_ok, adaptive_ok;
+        double fixed_rate = measure(data, write_sizes[w], CHUNK_SIZE, reps, fixed_ok);
+        double adaptive_rate = measure(data, write_sizes[w], CHUNK_SIZE_MASK, reps, adaptive_ok);
+
+        cout << setw(10) << write_sizes[w] << fixed << setprecision(0) << setw(18) << fixed_rate << setw(18)
+            << adaptive_rate;
+        if (!fixed_ok || !adaptive_ok) cout << " (write failed!)";
+        cout << endl;
+    }
+
+    return 0;
+}
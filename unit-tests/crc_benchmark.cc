@@ -0,0 +1,110 @@
+
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+/*
+ * Compare the throughput of the CRC 32 code in crc.cc with the original
+ * byte-at-a-time table code from crc.h. This is not run by 'make check';
+ * build it with 'make crc_benchmark'.
+ *
+ * Usage: crc_benchmark [-s <MB>] [-r <repetitions>]
+ */
+
+#include "config.h"
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <cstdlib>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "crc.h"
+
+#include "GetOpt.h"
+
+using namespace std;
+using namespace libdap;
+
+static double elapsed_seconds(const struct timeval &start, const struct timeval &stop)
+{
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+static double measure(uint32_t (*update)(uint32_t, const uint8_t *, size_t), const vector<uint8_t> &buf,
+    size_t block, int reps, uint32_t &crc)
+{
+    struct timeval start, stop;
+    gettimeofday(&start, 0);
+    for (int i = 0; i < reps; ++i) {
+        crc = ~0U;
+        for (size_t pos = 0; pos < buf.size(); pos += block)
+            crc = update(crc, &buf[pos], min(block, buf.size() - pos));
+    }
+    gettimeofday(&stop, 0);
+
+    return (double(buf.size()) * reps / 1.0e9) / elapsed_seconds(start, stop);
+}
+
+int main(int argc, char *argv[])
+{
+    int megabytes = 64;
+    int reps = 5;
+
+    GetOpt getopt(argc, argv, "s:r:");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 's':
+            megabytes = atoi(getopt.optarg);
+            break;
+        case 'r':
+            reps = atoi(getopt.optarg);
+            break;
+        default:
+            cerr << "Usage: crc_benchmark [-s <MB>] [-r <repetitions>]" << endl;
+            return 1;
+        }
+
+    vector<uint8_t> buf(megabytes * 1024 * 1024);
+    for (vector<uint8_t>::size_type i = 0; i < buf.size(); ++i)
+        buf[i] = static_cast<uint8_t>(i * 31);
+
+    cout << "Buffer: " << megabytes << " MB, repetitions: " << reps << ", code: " << crc32_kernels() << endl;
+    cout << setw(10) << "block" << setw(16) << "bytewise GB/s" << setw(12) << "new GB/s" << endl;
+
+    // Scalars, typical small arrays and whole large arrays
+    const size_t blocks[] = { 8, 256, 4096, 1024 * 1024, buf.size() };
+    for (int b = 0; b < 5; ++b) {
+        uint32_t old_crc, new_crc;
+        double old_rate = measure(crc32_update_bytewise, buf, blocks[b], reps, old_crc);
+        double new_rate = measure(crc32_update, buf, blocks[b], reps, new_crc);
+
+        cout << setw(10) << blocks[b] << fixed << setprecision(2) << setw(16) << old_rate << setw(12) << new_rate;
+        if (old_crc != new_crc) cout << " (checksums differ!)";
+        cout << endl;
+    }
+
+    return 0;
+}
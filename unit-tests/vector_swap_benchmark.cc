@@ -0,0 +1,104 @@
+
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+
+/*
+ * Report the throughput of the byte-swap kernels in vector_swap.cc. This
+ * is not run by 'make check'; build it with 'make vector_swap_benchmark'.
+ *
+ * Usage: vector_swap_benchmark [-s <MB>] [-r <repetitions>]
+ */
+
+#include "config.h"
+
+#include <sys/time.h>
+#include <cstdlib>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include "vector_swap.h"
+
+#include "GetOpt.h"
+
+using namespace std;
+using namespace libdap;
+
+static double elapsed_seconds(const struct timeval &start, const struct timeval &stop)
+{
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+static double measure(void (*swap)(char *, int64_t, int), vector<char> &buf, int width, int reps)
+{
+    struct timeval start, stop;
+    gettimeofday(&start, 0);
+    for (int i = 0; i < reps; ++i)
+        swap(&buf[0], buf.size() / width, width);
+    gettimeofday(&stop, 0);
+
+    return (double(buf.size()) * reps / 1.0e9) / elapsed_seconds(start, stop);
+}
+
+int main(int argc, char *argv[])
+{
+    int megabytes = 64;
+    int reps = 20;
+
+    GetOpt getopt(argc, argv, "s:r:");
+    int option_char;
+    while ((option_char = getopt()) != -1)
+        switch (option_char) {
+        case 's':
+            megabytes = atoi(getopt.optarg);
+            break;
+        case 'r':
+            reps = atoi(getopt.optarg);
+            break;
+        default:
+            cerr << "Usage: vector_swap_benchmark [-s <MB>] [-r <repetitions>]" << endl;
+            return 1;
+        }
+
+    vector<char> buf(megabytes * 1024 * 1024);
+    for (vector<char>::size_type i = 0; i < buf.size(); ++i)
+        buf[i] = static_cast<char>(i);
+
+    cout << "Buffer: " << megabytes << " MB, repetitions: " << reps << ", kernels: " << swap_vector_kernels() << endl;
+    cout << setw(6) << "width" << setw(14) << "portable GB/s" << setw(14) << "vector GB/s" << endl;
+
+    const int widths[] = { 2, 4, 8 };
+    for (int w = 0; w < 3; ++w) {
+        // Touch the buffer once so page faults are not counted
+        swap_vector_elements(&buf[0], buf.size() / widths[w], widths[w]);
+
+        double portable = measure(swap_vector_elements_portable, buf, widths[w], reps);
+        double vectored = measure(swap_vector_elements, buf, widths[w], reps);
+
+        cout << setw(6) << widths[w] << fixed << setprecision(2) << setw(14) << portable << setw(14) << vectored
+            << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,450 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+// The shuffle kernels need gcc/clang on x86. Unshuffling only needs the
+// SSE2 unpack instructions; shuffling uses the SSSE3 byte shuffle, which is
+// tested for at run time.
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define USE_X86_FILTER_KERNELS 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+#include "dods-datatypes.h"
+#include "vector_filter.h"
+#include "InternalErr.h"
+#include "Error.h"
+
+using namespace std;
+
+namespace libdap {
+
+// Shuffle 'num' elements from 'src' to 'dst'; byte j of element i goes to
+// dst[j * stride + i]. Unshuffle does the reverse.
+typedef void (*shuffle_kernel)(const char *src, char *dst, int64_t num, int64_t stride);
+
+// When both filters are used, the deltas are computed this many elements
+// at a time and then shuffled into place.
+static const int64_t delta_block_elements = 512;
+
+template<int width>
+static void shuffle_portable(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    for (int j = 0; j < width; ++j) {
+        char *plane = dst + j * stride;
+        for (int64_t i = 0; i < num; ++i)
+            plane[i] = src[i * width + j];
+    }
+}
+
+template<int width>
+static void unshuffle_portable(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    for (int j = 0; j < width; ++j) {
+        const char *plane = src + j * stride;
+        for (int64_t i = 0; i < num; ++i)
+            dst[i * width + j] = plane[i];
+    }
+}
+
+#if USE_X86_FILTER_KERNELS
+
+// Each kernel handles 16 elements per step so that every store is a full
+// 16 bytes of one byte plane. The SSSE3 byte shuffle gathers the bytes of
+// each load by plane; the unpacks then transpose those across the loads.
+
+__attribute__((target("ssse3")))
+static void shuffle_16_ssse3(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    const __m128i mask = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m128i *p = reinterpret_cast<const __m128i*>(src + (i << 1));
+        __m128i r0 = _mm_shuffle_epi8(_mm_loadu_si128(p), mask);
+        __m128i r1 = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi64(r0, r1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + stride + i), _mm_unpackhi_epi64(r0, r1));
+    }
+
+    shuffle_portable<2>(src + (i << 1), dst + i, num - i, stride);
+}
+
+__attribute__((target("ssse3")))
+static void shuffle_32_ssse3(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    const __m128i mask = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m128i *p = reinterpret_cast<const __m128i*>(src + (i << 2));
+        __m128i r0 = _mm_shuffle_epi8(_mm_loadu_si128(p), mask);
+        __m128i r1 = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask);
+        __m128i r2 = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), mask);
+        __m128i r3 = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), mask);
+
+        __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+        __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+        __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+        __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + stride + i), _mm_unpackhi_epi64(t0, t2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * stride + i), _mm_unpacklo_epi64(t1, t3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * stride + i), _mm_unpackhi_epi64(t1, t3));
+    }
+
+    shuffle_portable<4>(src + (i << 2), dst + i, num - i, stride);
+}
+
+__attribute__((target("ssse3")))
+static void shuffle_64_ssse3(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    const __m128i mask = _mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        const __m128i *p = reinterpret_cast<const __m128i*>(src + (i << 3));
+        __m128i r[8];
+        for (int k = 0; k < 8; ++k)
+            r[k] = _mm_shuffle_epi8(_mm_loadu_si128(p + k), mask);
+
+        // An 8x8 transpose of 16-bit words
+        __m128i t0 = _mm_unpacklo_epi16(r[0], r[1]);
+        __m128i t1 = _mm_unpackhi_epi16(r[0], r[1]);
+        __m128i t2 = _mm_unpacklo_epi16(r[2], r[3]);
+        __m128i t3 = _mm_unpackhi_epi16(r[2], r[3]);
+        __m128i t4 = _mm_unpacklo_epi16(r[4], r[5]);
+        __m128i t5 = _mm_unpackhi_epi16(r[4], r[5]);
+        __m128i t6 = _mm_unpacklo_epi16(r[6], r[7]);
+        __m128i t7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+        __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+        __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+        __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+        __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+        __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+        __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+        __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+        __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi64(u0, u4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + stride + i), _mm_unpackhi_epi64(u0, u4));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * stride + i), _mm_unpacklo_epi64(u1, u5));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 3 * stride + i), _mm_unpackhi_epi64(u1, u5));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * stride + i), _mm_unpacklo_epi64(u2, u6));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 5 * stride + i), _mm_unpackhi_epi64(u2, u6));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 6 * stride + i), _mm_unpacklo_epi64(u3, u7));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 7 * stride + i), _mm_unpackhi_epi64(u3, u7));
+    }
+
+    shuffle_portable<8>(src + (i << 3), dst + i, num - i, stride);
+}
+
+static void unshuffle_16_sse2(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + stride + i));
+
+        __m128i *q = reinterpret_cast<__m128i*>(dst + (i << 1));
+        _mm_storeu_si128(q, _mm_unpacklo_epi8(p0, p1));
+        _mm_storeu_si128(q + 1, _mm_unpackhi_epi8(p0, p1));
+    }
+
+    unshuffle_portable<2>(src + i, dst + (i << 1), num - i, stride);
+}
+
+static void unshuffle_32_sse2(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + stride + i));
+        __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * stride + i));
+        __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * stride + i));
+
+        __m128i a = _mm_unpacklo_epi8(p0, p1);
+        __m128i b = _mm_unpackhi_epi8(p0, p1);
+        __m128i c = _mm_unpacklo_epi8(p2, p3);
+        __m128i d = _mm_unpackhi_epi8(p2, p3);
+
+        __m128i *q = reinterpret_cast<__m128i*>(dst + (i << 2));
+        _mm_storeu_si128(q, _mm_unpacklo_epi16(a, c));
+        _mm_storeu_si128(q + 1, _mm_unpackhi_epi16(a, c));
+        _mm_storeu_si128(q + 2, _mm_unpacklo_epi16(b, d));
+        _mm_storeu_si128(q + 3, _mm_unpackhi_epi16(b, d));
+    }
+
+    unshuffle_portable<4>(src + i, dst + (i << 2), num - i, stride);
+}
+
+static void unshuffle_64_sse2(const char *src, char *dst, int64_t num, int64_t stride)
+{
+    int64_t i = 0;
+    for (; i + 16 <= num; i += 16) {
+        __m128i a[4], b[4];
+        for (int k = 0; k < 4; ++k) {
+            __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * k * stride + i));
+            __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + (2 * k + 1) * stride + i));
+            a[k] = _mm_unpacklo_epi8(p0, p1);
+            b[k] = _mm_unpackhi_epi8(p0, p1);
+        }
+
+        __m128i *q = reinterpret_cast<__m128i*>(dst + (i << 3));
+        __m128i c0 = _mm_unpacklo_epi16(a[0], a[1]);
+        __m128i c1 = _mm_unpackhi_epi16(a[0], a[1]);
+        __m128i c2 = _mm_unpacklo_epi16(a[2], a[3]);
+        __m128i c3 = _mm_unpackhi_epi16(a[2], a[3]);
+        _mm_storeu_si128(q, _mm_unpacklo_epi32(c0, c2));
+        _mm_storeu_si128(q + 1, _mm_unpackhi_epi32(c0, c2));
+        _mm_storeu_si128(q + 2, _mm_unpacklo_epi32(c1, c3));
+        _mm_storeu_si128(q + 3, _mm_unpackhi_epi32(c1, c3));
+
+        c0 = _mm_unpacklo_epi16(b[0], b[1]);
+        c1 = _mm_unpackhi_epi16(b[0], b[1]);
+        c2 = _mm_unpacklo_epi16(b[2], b[3]);
+        c3 = _mm_unpackhi_epi16(b[2], b[3]);
+        _mm_storeu_si128(q + 4, _mm_unpacklo_epi32(c0, c2));
+        _mm_storeu_si128(q + 5, _mm_unpackhi_epi32(c0, c2));
+        _mm_storeu_si128(q + 6, _mm_unpacklo_epi32(c1, c3));
+        _mm_storeu_si128(q + 7, _mm_unpackhi_epi32(c1, c3));
+    }
+
+    unshuffle_portable<8>(src + i, dst + (i << 3), num - i, stride);
+}
+
+#endif // USE_X86_FILTER_KERNELS
+
+/**
+ * The kernels used by filter_vector() and unshuffle_vector(). These are
+ * chosen once, the first time they are needed.
+ */
+struct filter_kernels {
+    shuffle_kernel d_shuffle_16;
+    shuffle_kernel d_shuffle_32;
+    shuffle_kernel d_shuffle_64;
+    shuffle_kernel d_unshuffle_16;
+    shuffle_kernel d_unshuffle_32;
+    shuffle_kernel d_unshuffle_64;
+    const char *d_name;
+
+    filter_kernels() :
+        d_shuffle_16(shuffle_portable<2>), d_shuffle_32(shuffle_portable<4>), d_shuffle_64(shuffle_portable<8>),
+        d_unshuffle_16(unshuffle_portable<2>), d_unshuffle_32(unshuffle_portable<4>),
+        d_unshuffle_64(unshuffle_portable<8>), d_name("portable")
+    {
+#if USE_X86_FILTER_KERNELS
+        d_unshuffle_16 = unshuffle_16_sse2;
+        d_unshuffle_32 = unshuffle_32_sse2;
+        d_unshuffle_64 = unshuffle_64_sse2;
+        d_name = "sse2";
+
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("ssse3")) {
+            d_shuffle_16 = shuffle_16_ssse3;
+            d_shuffle_32 = shuffle_32_ssse3;
+            d_shuffle_64 = shuffle_64_ssse3;
+            d_name = "ssse3";
+        }
+#endif
+    }
+};
+
+static const filter_kernels &kernels()
+{
+    static filter_kernels k;
+    return k;
+}
+
+static void shuffle(const char *src, char *dst, int64_t num, int64_t stride, int width)
+{
+    switch (width) {
+    case 1:
+        memcpy(dst, src, num);
+        break;
+    case 2:
+        kernels().d_shuffle_16(src, dst, num, stride);
+        break;
+    case 4:
+        kernels().d_shuffle_32(src, dst, num, stride);
+        break;
+    case 8:
+        kernels().d_shuffle_64(src, dst, num, stride);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+// Write the deltas of elements [first, first + num) of 'src' to 'dst'. The
+// arithmetic is unsigned so that it wraps the same way on every host.
+template<typename T>
+static void delta_encode(const char *src, char *dst, int64_t first, int64_t num)
+{
+    const T *s = reinterpret_cast<const T*>(src);
+    T *d = reinterpret_cast<T*>(dst);
+
+    int64_t i = first;
+    if (i == 0 && num > 0) {
+        *d++ = s[0];
+        ++i;
+    }
+
+    for (int64_t end = first + num; i < end; ++i)
+        *d++ = s[i] - s[i - 1];
+}
+
+template<typename T>
+static void delta_decode(char *vals, int64_t num)
+{
+    T *v = reinterpret_cast<T*>(vals);
+    for (int64_t i = 1; i < num; ++i)
+        v[i] += v[i - 1];
+}
+
+static void delta(const char *src, char *dst, int64_t first, int64_t num, int width)
+{
+    switch (width) {
+    case 1:
+        delta_encode<dods_byte>(src, dst, first, num);
+        break;
+    case 2:
+        delta_encode<dods_uint16>(src, dst, first, num);
+        break;
+    case 4:
+        delta_encode<dods_uint32>(src, dst, first, num);
+        break;
+    case 8:
+        delta_encode<dods_uint64>(src, dst, first, num);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+void filter_vector(const char *src, char *dst, int64_t num, int width, unsigned int filters)
+{
+    if (!(filters & vector_filter_delta)) {
+        if (filters & vector_filter_shuffle)
+            shuffle(src, dst, num, num, width);
+        else
+            memcpy(dst, src, num * width);
+    }
+    else if (!(filters & vector_filter_shuffle) || width == 1) {
+        delta(src, dst, 0, num, width);
+    }
+    else {
+        // Take the deltas a block at a time, while the block is in the
+        // cache, and shuffle each into its place in the byte planes.
+        char block[delta_block_elements * sizeof(dods_uint64)];
+        for (int64_t i = 0; i < num; i += delta_block_elements) {
+            int64_t n = std::min(delta_block_elements, num - i);
+            delta(src, block, i, n, width);
+            shuffle(block, dst + i, n, num, width);
+        }
+    }
+}
+
+void unshuffle_vector(const char *src, char *dst, int64_t num, int width)
+{
+    switch (width) {
+    case 1:
+        memcpy(dst, src, num);
+        break;
+    case 2:
+        kernels().d_unshuffle_16(src, dst, num, num);
+        break;
+    case 4:
+        kernels().d_unshuffle_32(src, dst, num, num);
+        break;
+    case 8:
+        kernels().d_unshuffle_64(src, dst, num, num);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+void undelta_vector(char *vals, int64_t num, int width)
+{
+    switch (width) {
+    case 1:
+        delta_decode<dods_byte>(vals, num);
+        break;
+    case 2:
+        delta_decode<dods_uint16>(vals, num);
+        break;
+    case 4:
+        delta_decode<dods_uint32>(vals, num);
+        break;
+    case 8:
+        delta_decode<dods_uint64>(vals, num);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+const char *vector_filter_kernels()
+{
+    return kernels().d_name;
+}
+
+string vector_filter_names(unsigned int filters)
+{
+    string names;
+    if (filters & vector_filter_shuffle) names = "shuffle";
+    if (filters & vector_filter_delta) names += names.empty() ? "delta" : " delta";
+
+    return names;
+}
+
+unsigned int vector_filter_flags(const string &names)
+{
+    unsigned int filters = vector_filter_none;
+
+    istringstream iss(names);
+    string name;
+    while (iss >> name) {
+        if (name == "shuffle")
+            filters |= vector_filter_shuffle;
+        else if (name == "delta")
+            filters |= vector_filter_delta;
+        else
+            throw Error("Unknown vector filter '" + name + "'.");
+    }
+
+    return filters;
+}
+
+} // namespace libdap
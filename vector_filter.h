@@ -0,0 +1,78 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef VECTOR_FILTER_H_
+#define VECTOR_FILTER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace libdap {
+
+/**
+ * Filters D4StreamMarshaller can apply to the values of a vector before
+ * they are written. Neither changes the number of bytes sent; they arrange
+ * the bytes so that a compressor (see chunked_ostream::set_compression())
+ * does much better with them. This is the same idea as the HDF5 and
+ * netCDF-4 'shuffle' filter.
+ *
+ * vector_filter_shuffle: Send byte 0 of every element, then byte 1 of
+ * every element, and so on. Applies to all types wider than one byte.
+ *
+ * vector_filter_delta: Send the difference between each element and the
+ * one before it. Applies to the integer types only. When both are set,
+ * the delta is taken first.
+ */
+enum vector_filter {
+    vector_filter_none = 0x00,
+    vector_filter_shuffle = 0x01,
+    vector_filter_delta = 0x02
+};
+
+/**
+ * Apply 'filters' to 'num' elements, each 'width' bytes wide, read from
+ * 'src' and written to 'dst'. The two must not overlap. Width must be 1, 2,
+ * 4 or 8.
+ */
+void filter_vector(const char *src, char *dst, int64_t num, int width, unsigned int filters);
+
+/// Undo vector_filter_shuffle; 'src' and 'dst' must not overlap.
+void unshuffle_vector(const char *src, char *dst, int64_t num, int width);
+
+/// Undo vector_filter_delta, in place. The values must be in host byte order.
+void undelta_vector(char *vals, int64_t num, int width);
+
+/// Which kernels the shuffle code uses: "ssse3", "sse2" or "portable"
+const char *vector_filter_kernels();
+
+/// The names of the filters in 'filters', separated by spaces ("shuffle delta")
+std::string vector_filter_names(unsigned int filters);
+
+/// The inverse of vector_filter_names(); throws Error for an unknown name
+unsigned int vector_filter_flags(const std::string &names);
+
+} // namespace libdap
+
+#endif /* VECTOR_FILTER_H_ */
@@ -0,0 +1,241 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#include "config.h"
+
+#include <byteswap.h>
+
+// The SSE2 and AVX2 kernels need gcc/clang on x86; SSE2 is part of the
+// x86-64 ABI, AVX2 support is tested at run time.
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define USE_X86_SWAP_KERNELS 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#include "dods-datatypes.h"
+#include "vector_swap.h"
+#include "InternalErr.h"
+
+namespace libdap {
+
+typedef void (*swap_kernel)(char *vals, int64_t num);
+
+static void swap_16_portable(char *vals, int64_t num)
+{
+    dods_int16 *local = reinterpret_cast<dods_int16*>(vals);
+    while (num--) {
+        *local = bswap_16(*local);
+        local++;
+    }
+}
+
+static void swap_32_portable(char *vals, int64_t num)
+{
+    dods_int32 *local = reinterpret_cast<dods_int32*>(vals);
+    while (num--) {
+        *local = bswap_32(*local);
+        local++;
+    }
+}
+
+static void swap_64_portable(char *vals, int64_t num)
+{
+    dods_int64 *local = reinterpret_cast<dods_int64*>(vals);
+    while (num--) {
+        *local = bswap_64(*local);
+        local++;
+    }
+}
+
+#if USE_X86_SWAP_KERNELS
+
+// SSE2 has no byte shuffle, so swap the two bytes of each 16-bit word with
+// shifts and reorder the words with the 16-bit shuffles.
+
+static inline __m128i swap_bytes_in_words(__m128i x)
+{
+    return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static void swap_16_sse2(char *vals, int64_t num)
+{
+    int64_t i = 0;
+    for (; i + 8 <= num; i += 8) {
+        __m128i *p = reinterpret_cast<__m128i*>(vals + (i << 1));
+        _mm_storeu_si128(p, swap_bytes_in_words(_mm_loadu_si128(p)));
+    }
+
+    swap_16_portable(vals + (i << 1), num - i);
+}
+
+static void swap_32_sse2(char *vals, int64_t num)
+{
+    int64_t i = 0;
+    for (; i + 4 <= num; i += 4) {
+        __m128i *p = reinterpret_cast<__m128i*>(vals + (i << 2));
+        __m128i x = _mm_loadu_si128(p);
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+        x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(p, swap_bytes_in_words(x));
+    }
+
+    swap_32_portable(vals + (i << 2), num - i);
+}
+
+static void swap_64_sse2(char *vals, int64_t num)
+{
+    int64_t i = 0;
+    for (; i + 2 <= num; i += 2) {
+        __m128i *p = reinterpret_cast<__m128i*>(vals + (i << 3));
+        __m128i x = _mm_loadu_si128(p);
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+        x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+        _mm_storeu_si128(p, swap_bytes_in_words(x));
+    }
+
+    swap_64_portable(vals + (i << 3), num - i);
+}
+
+// AVX2 has a byte shuffle within each 128-bit lane, which is all we need.
+
+__attribute__((target("avx2")))
+static void swap_avx2(char *vals, int64_t bytes, __m256i mask)
+{
+    int64_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i *p = reinterpret_cast<__m256i*>(vals + i);
+        _mm256_storeu_si256(p, _mm256_shuffle_epi8(_mm256_loadu_si256(p), mask));
+    }
+}
+
+__attribute__((target("avx2")))
+static void swap_16_avx2(char *vals, int64_t num)
+{
+    const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    int64_t n = num & ~static_cast<int64_t>(15);
+    swap_avx2(vals, n << 1, mask);
+    swap_16_portable(vals + (n << 1), num - n);
+}
+
+__attribute__((target("avx2")))
+static void swap_32_avx2(char *vals, int64_t num)
+{
+    const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    int64_t n = num & ~static_cast<int64_t>(7);
+    swap_avx2(vals, n << 2, mask);
+    swap_32_portable(vals + (n << 2), num - n);
+}
+
+__attribute__((target("avx2")))
+static void swap_64_avx2(char *vals, int64_t num)
+{
+    const __m256i mask = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+        7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    int64_t n = num & ~static_cast<int64_t>(3);
+    swap_avx2(vals, n << 3, mask);
+    swap_64_portable(vals + (n << 3), num - n);
+}
+
+#endif // USE_X86_SWAP_KERNELS
+
+/**
+ * The kernels used by swap_vector_elements(). These are chosen once, the
+ * first time they are needed.
+ */
+struct swap_kernels {
+    swap_kernel d_swap_16;
+    swap_kernel d_swap_32;
+    swap_kernel d_swap_64;
+    const char *d_name;
+
+    swap_kernels() :
+        d_swap_16(swap_16_portable), d_swap_32(swap_32_portable), d_swap_64(swap_64_portable), d_name("portable")
+    {
+#if USE_X86_SWAP_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            d_swap_16 = swap_16_avx2;
+            d_swap_32 = swap_32_avx2;
+            d_swap_64 = swap_64_avx2;
+            d_name = "avx2";
+        }
+        else {
+            d_swap_16 = swap_16_sse2;
+            d_swap_32 = swap_32_sse2;
+            d_swap_64 = swap_64_sse2;
+            d_name = "sse2";
+        }
+#endif
+    }
+};
+
+static const swap_kernels &kernels()
+{
+    static swap_kernels k;
+    return k;
+}
+
+void swap_vector_elements(char *vals, int64_t num, int width)
+{
+    switch (width) {
+    case 2:
+        kernels().d_swap_16(vals, num);
+        break;
+    case 4:
+        kernels().d_swap_32(vals, num);
+        break;
+    case 8:
+        kernels().d_swap_64(vals, num);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+void swap_vector_elements_portable(char *vals, int64_t num, int width)
+{
+    switch (width) {
+    case 2:
+        swap_16_portable(vals, num);
+        break;
+    case 4:
+        swap_32_portable(vals, num);
+        break;
+    case 8:
+        swap_64_portable(vals, num);
+        break;
+    default:
+        throw InternalErr(__FILE__, __LINE__, "Unrecognized word size.");
+    }
+}
+
+const char *swap_vector_kernels()
+{
+    return kernels().d_name;
+}
+
+} // namespace libdap
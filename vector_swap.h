@@ -0,0 +1,48 @@
+// -*- mode: c++; c-basic-offset:4 -*-
+
+// This file is part of libdap, A C++ implementation of the OPeNDAP Data
+// Access Protocol.
+
+// Copyright (c) 2026 OPeNDAP, Inc.
+// Author: agent <agent@local>
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License as published by the Free Software Foundation; either
+// version 2.1 of the License, or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+// You can contact OPeNDAP, Inc. at PO Box 112, Saunderstown, RI. 02874-0112.
+
+#ifndef VECTOR_SWAP_H_
+#define VECTOR_SWAP_H_
+
+#include <stdint.h>
+
+namespace libdap {
+
+/**
+ * Reverse the byte order of 'num' elements, each 'width' bytes wide, in
+ * place. Width must be 2, 4 or 8. On x86 hosts this uses SSE2 or AVX2
+ * code, chosen at run time based on what the CPU supports; on other hosts
+ * it uses the portable version.
+ */
+void swap_vector_elements(char *vals, int64_t num, int width);
+
+/// The scalar version of swap_vector_elements(); used for testing
+void swap_vector_elements_portable(char *vals, int64_t num, int width);
+
+/// Which kernels swap_vector_elements() uses: "avx2", "sse2" or "portable"
+const char *swap_vector_kernels();
+
+} // namespace libdap
+
+#endif /* VECTOR_SWAP_H_ */